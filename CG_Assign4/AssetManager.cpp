@@ -1,16 +1,97 @@
 #include "AssetManager.hpp"
+#include "AssetPack.hpp"
 #include "SOIL2/SOIL2.h"
+#include "SOIL2/image_DXT.h"
+#include <vector>
 
 std::map<std::string, GLint> AssetManager::textures;
+std::map<std::string, GLint> AssetManager::normalMaps;
+std::map<GLint, bool> AssetManager::translucentTextures;
+int AssetManager::maxTextureDimension = 0;
+
+// Reads back the alpha of textures that have an alpha channel, done once when the texture is loaded
+static bool hasTranslucentTexels(GLuint textureId) {
+    if (textureId == 0) {
+        return false;
+    }
+    glBindTexture(GL_TEXTURE_2D, textureId);
+    GLint alphaSize = 0, width = 0, height = 0;
+    glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_ALPHA_SIZE, &alphaSize);
+    if (alphaSize == 0) {
+        return false;
+    }
+    glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &width);
+    glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &height);
+
+    // GL_ALPHA isn't a readable format in core profiles, so read the whole texel
+    std::vector<unsigned char> texels(4 * width * height);
+    glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_UNSIGNED_BYTE, &texels[0]);
+    for (size_t i = 3; i < texels.size(); i += 4) {
+        if (texels[i] != 255) {
+            return true;
+        }
+    }
+    return false;
+}
 
 GLint AssetManager::loadTexture(const std::string& filename) {
     if (AssetManager::textures.find(filename) == AssetManager::textures.end()) {
         // Texture has not been loaded already
-        GLint textureId = SOIL_load_OGL_texture(filename.c_str(), SOIL_LOAD_AUTO,
-            SOIL_CREATE_NEW_ID, SOIL_FLAG_INVERT_Y | SOIL_FLAG_TEXTURE_REPEATS);
+        GLint textureId = AssetManager::createTexture(filename, AssetManager::maxTextureDimension);
         AssetManager::textures[filename] = textureId;
+        AssetManager::translucentTextures[textureId] = hasTranslucentTexels(textureId);
         return textureId;
     }
     // Return already loaded texture
     return AssetManager::textures[filename];
+}
+
+GLint AssetManager::loadNormalMap(const std::string& filename) {
+    std::map<std::string, GLint>::const_iterator found = AssetManager::normalMaps.find(filename);
+    if (found != AssetManager::normalMaps.end()) {
+        return found->second;
+    }
+
+    // Normal maps are few and their error shows up in the lighting, so use the slower encoder
+    const int quality = get_DXT_quality();
+    set_DXT_quality(DXT_QUALITY_HIGH);
+    GLint textureId = AssetManager::createTexture(filename, AssetManager::maxTextureDimension,
+        SOIL_FLAG_INVERT_Y | SOIL_FLAG_TEXTURE_REPEATS | SOIL_FLAG_COMPRESS_TO_RGTC);
+    set_DXT_quality(quality);
+    AssetManager::normalMaps[filename] = textureId;
+    return textureId;
+}
+
+void AssetManager::addTexture(const std::string& name, GLint textureId) {
+    AssetManager::textures[name] = textureId;
+    AssetManager::translucentTextures[textureId] = hasTranslucentTexels(textureId);
+}
+
+GLuint AssetManager::createTexture(const std::string& filename, int maxDimension) {
+    return AssetManager::createTexture(filename, maxDimension, SOIL_FLAG_INVERT_Y | SOIL_FLAG_TEXTURE_REPEATS);
+}
+
+GLuint AssetManager::createTexture(const std::string& filename, int maxDimension, unsigned int flags) {
+    AssetFile* file = AssetPack::open(filename);
+    if (file == NULL) {
+        return 0;
+    }
+    GLuint textureId = SOIL_load_OGL_texture_from_memory_max_dimension(
+        reinterpret_cast<const unsigned char*>(file->data()), static_cast<int>(file->size()), SOIL_LOAD_AUTO,
+        SOIL_CREATE_NEW_ID, flags, maxDimension);
+    delete file;
+    return textureId;
+}
+
+void AssetManager::setMaxTextureDimension(int maxDimension) {
+    AssetManager::maxTextureDimension = maxDimension;
+}
+
+int AssetManager::getMaxTextureDimension() {
+    return AssetManager::maxTextureDimension;
+}
+
+bool AssetManager::isTranslucent(GLint textureId) {
+    std::map<GLint, bool>::const_iterator found = AssetManager::translucentTextures.find(textureId);
+    return found != AssetManager::translucentTextures.end() && found->second;
 }
\ No newline at end of file
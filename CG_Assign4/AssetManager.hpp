@@ -13,6 +13,56 @@ public:
     /// <param name="filename">The name of the texture file</param>
     static GLint loadTexture(const std::string& filename);
 
+    /// <summary>
+    /// Load a tangent space normal map returning its OpenGL id. Only X and Y are kept, as BC5 where
+    /// supported, so shaders must rebuild Z
+    /// </summary>
+    ///
+    /// <param name="filename">The name of the normal map file</param>
+    static GLint loadNormalMap(const std::string& filename);
+
+    /// <summary>
+    /// Make a texture created elsewhere, such as a baked atlas, loadable by name with loadTexture
+    /// </summary>
+    ///
+    /// <param name="name">The name to load it by, which shouldn't be a texture file's</param>
+    /// <param name="textureId">The OpenGL id, still owned by the caller</param>
+    static void addTexture(const std::string& name, GLint textureId);
+
+    /// <summary>
+    /// Create a new texture from an image in the asset pack or a loose file, without caching it
+    /// </summary>
+    ///
+    /// <param name="filename">The name of the texture file</param>
+    /// <param name="maxDimension">The largest width or height, 0 for full resolution</param>
+    /// <returns>The OpenGL id, or 0 if the image couldn't be loaded</returns>
+    static GLuint createTexture(const std::string& filename, int maxDimension);
+
+    /// <summary>
+    /// Limit the size of textures loaded from now on, JPEGs are decoded directly
+    /// at the reduced size
+    /// </summary>
+    ///
+    /// <param name="maxDimension">The largest width or height, 0 for full resolution</param>
+    static void setMaxTextureDimension(int maxDimension);
+
+    /// <summary>
+    /// Get the current texture size limit, 0 if textures are loaded at full resolution
+    /// </summary>
+    static int getMaxTextureDimension();
+
+    /// <summary>
+    /// Check whether a texture loaded with loadTexture has any texels that aren't fully opaque
+    /// </summary>
+    ///
+    /// <param name="textureId">The OpenGL id returned by loadTexture</param>
+    static bool isTranslucent(GLint textureId);
+
 private:
+    static GLuint createTexture(const std::string& filename, int maxDimension, unsigned int flags);
+
     static std::map<std::string, GLint> textures;
+    static std::map<std::string, GLint> normalMaps;
+    static std::map<GLint, bool> translucentTextures;
+    static int maxTextureDimension;
 };
\ No newline at end of file
@@ -0,0 +1,425 @@
+#include "AssetPack.hpp"
+#include "MappedFile.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <set>
+#include <sys/stat.h>
+
+// "APCK", also catches files written with the other byte order
+#define ASSET_PACK_MAGIC 0x4B435041u
+
+// Entry flags
+#define ASSET_PACK_COMPRESSED 1u
+
+// Entries start on 16 byte boundaries so they can be handed straight to the loaders
+#define ALIGN16(x) (((x) + 15) & ~(uint64_t)15)
+
+// The shortest match worth encoding, and the furthest back a match can start
+#define LZ_MIN_MATCH 4
+#define LZ_MAX_OFFSET 0xFFFF
+#define LZ_HASH_BITS 14
+
+struct AssetPack::Header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t numEntries;
+    uint32_t stringTableSize;
+    uint64_t fileSize;
+
+    // Byte offsets of each section from the start of the file
+    uint64_t entries;
+    uint64_t strings;
+};
+
+// Entries are sorted by name so they can be binary searched
+struct AssetPack::Entry {
+    // Byte offset of the name in the string table
+    uint32_t name;
+    uint32_t flags;
+    uint64_t modified;
+    uint64_t offset;
+    uint64_t storedSize;
+    uint64_t size;
+};
+
+MappedFile* AssetPack::pack = NULL;
+
+// The assets already reported as newer than their entries, so each is only reported once
+static std::set<std::string> staleEntries;
+
+// --------------------------------------------------
+// LZ compression
+//
+// The data is a series of sequences, each a token byte followed by literals and a match. The high
+// nibble of the token is the number of literals and the low nibble the match length minus
+// LZ_MIN_MATCH, a nibble of 15 is continued by bytes which are added on until one is less than 255.
+// The literals are followed by the match's 16 bit little endian offset. The last sequence has only
+// literals.
+// --------------------------------------------------
+
+static void writeLength(std::vector<char>& out, size_t length) {
+    while (length >= 255) {
+        out.push_back(static_cast<char>(255));
+        length -= 255;
+    }
+    out.push_back(static_cast<char>(length));
+}
+
+static void writeSequence(std::vector<char>& out, const char* literals, size_t numLiterals, size_t offset,
+        size_t matchLength) {
+    const size_t match = matchLength > 0 ? matchLength - LZ_MIN_MATCH : 0;
+    out.push_back(static_cast<char>(((numLiterals < 15 ? numLiterals : 15) << 4) | (match < 15 ? match : 15)));
+    if (numLiterals >= 15) {
+        writeLength(out, numLiterals - 15);
+    }
+    out.insert(out.end(), literals, literals + numLiterals);
+    if (matchLength == 0) {
+        return;
+    }
+    out.push_back(static_cast<char>(offset & 0xFF));
+    out.push_back(static_cast<char>(offset >> 8));
+    if (match >= 15) {
+        writeLength(out, match - 15);
+    }
+}
+
+static inline uint32_t lzHash(const char* p) {
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return (value * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+// Greedy compression using a hash of the last position each 4 bytes were seen at
+static void lzCompress(const char* src, size_t size, std::vector<char>& out) {
+    std::vector<uint32_t> table(1 << LZ_HASH_BITS, 0xFFFFFFFFu);
+    size_t literalStart = 0;
+    size_t i = 0;
+    while (i + LZ_MIN_MATCH <= size) {
+        const uint32_t hash = lzHash(src + i);
+        const uint32_t candidate = table[hash];
+        table[hash] = static_cast<uint32_t>(i);
+
+        if (candidate == 0xFFFFFFFFu || i - candidate > LZ_MAX_OFFSET || memcmp(src + candidate, src + i, LZ_MIN_MATCH) != 0) {
+            i += 1;
+            continue;
+        }
+
+        size_t length = LZ_MIN_MATCH;
+        while (i + length < size && src[candidate + length] == src[i + length]) {
+            ++length;
+        }
+        writeSequence(out, src + literalStart, i - literalStart, i - candidate, length);
+        i += length;
+        literalStart = i;
+    }
+    writeSequence(out, src + literalStart, size - literalStart, 0, 0);
+}
+
+static bool readLength(const unsigned char*& p, const unsigned char* end, size_t& length) {
+    unsigned char byte;
+    do {
+        if (p == end) {
+            return false;
+        }
+        byte = *p++;
+        length += byte;
+    } while (byte == 255);
+    return true;
+}
+
+// Returns false if the data is corrupt or doesn't decompress to exactly 'size' bytes
+static bool lzDecompress(const char* src, size_t srcSize, char* dst, size_t size) {
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(src);
+    const unsigned char* end = p + srcSize;
+    size_t written = 0;
+    while (p < end) {
+        const unsigned char token = *p++;
+
+        size_t numLiterals = token >> 4;
+        if (numLiterals == 15 && !readLength(p, end, numLiterals)) {
+            return false;
+        }
+        if (numLiterals > static_cast<size_t>(end - p) || numLiterals > size - written) {
+            return false;
+        }
+        memcpy(dst + written, p, numLiterals);
+        p += numLiterals;
+        written += numLiterals;
+
+        // The last sequence has no match
+        if (p == end) {
+            break;
+        }
+
+        if (end - p < 2) {
+            return false;
+        }
+        const size_t offset = p[0] | (p[1] << 8);
+        p += 2;
+        size_t length = token & 15;
+        if (length == 15 && !readLength(p, end, length)) {
+            return false;
+        }
+        length += LZ_MIN_MATCH;
+        if (offset == 0 || offset > written || length > size - written) {
+            return false;
+        }
+
+        // Matches may overlap the bytes they produce, so copy forwards a byte at a time
+        const char* match = dst + written - offset;
+        for (size_t i = 0; i < length; ++i) {
+            dst[written + i] = match[i];
+        }
+        written += length;
+    }
+    return written == size;
+}
+
+// --------------------------------------------------
+// Virtual file system
+// --------------------------------------------------
+
+// Names are kept as forward slash paths without a leading "./"
+static std::string normalizeName(const std::string& name) {
+    std::string normalized = name;
+    std::replace(normalized.begin(), normalized.end(), '\\', '/');
+    while (normalized.compare(0, 2, "./") == 0) {
+        normalized.erase(0, 2);
+    }
+    return normalized;
+}
+
+AssetFile::AssetFile(MappedFile* file, const char* contents, size_t size) : file(file), contents(contents),
+    contentsSize(size) {
+}
+
+AssetFile::~AssetFile() {
+    delete file;
+}
+
+const char* AssetFile::data() const {
+    return contentsSize > 0 ? contents : NULL;
+}
+
+size_t AssetFile::size() const {
+    return contentsSize;
+}
+
+bool AssetPack::mount(const std::string& filename) {
+    unmount();
+
+    MappedFile* file = MappedFile::open(filename);
+    if (file == NULL) {
+        return false;
+    }
+
+    // Check the file is complete, and that its sections and entries lie within it
+    const Header* header = reinterpret_cast<const Header*>(file->data());
+    bool valid = file->size() >= sizeof(Header) && header->magic == ASSET_PACK_MAGIC &&
+        header->version == ASSET_PACK_VERSION && header->fileSize == file->size() &&
+        header->entries + header->numEntries * sizeof(Entry) <= file->size() &&
+        header->strings + header->stringTableSize <= file->size() &&
+        header->stringTableSize > 0 && file->data()[header->strings + header->stringTableSize - 1] == '\0';
+    const Entry* entries = valid ? reinterpret_cast<const Entry*>(file->data() + header->entries) : NULL;
+    for (uint32_t i = 0; valid && i < header->numEntries; ++i) {
+        valid = entries[i].name < header->stringTableSize && entries[i].offset <= file->size() &&
+            entries[i].storedSize <= file->size() - entries[i].offset &&
+            ((entries[i].flags & ASSET_PACK_COMPRESSED) != 0 || entries[i].storedSize == entries[i].size);
+    }
+    if (!valid) {
+        delete file;
+        return false;
+    }
+
+    // Everything is read at startup, so ask for the whole pack to be read ahead
+    file->prefetch();
+    pack = file;
+    return true;
+}
+
+void AssetPack::unmount() {
+    delete pack;
+    pack = NULL;
+}
+
+const AssetPack::Entry* AssetPack::find(const std::string& name) {
+    if (pack == NULL) {
+        return NULL;
+    }
+    const Header* header = reinterpret_cast<const Header*>(pack->data());
+    const Entry* entries = reinterpret_cast<const Entry*>(pack->data() + header->entries);
+    const char* strings = pack->data() + header->strings;
+    const std::string normalized = normalizeName(name);
+
+    uint32_t low = 0;
+    uint32_t high = header->numEntries;
+    while (low < high) {
+        const uint32_t middle = low + (high - low) / 2;
+        const int order = strcmp(strings + entries[middle].name, normalized.c_str());
+        if (order == 0) {
+            // A loose file edited since the pack was built wins over its entry
+            struct stat info;
+            if (::stat(name.c_str(), &info) == 0 && static_cast<uint64_t>(info.st_mtime) > entries[middle].modified) {
+                if (staleEntries.insert(normalized).second) {
+                    std::cerr << "Warning: " << name << " is newer than its copy in the asset pack, "
+                        << "run 'make pack' to update it" << std::endl;
+                }
+                return NULL;
+            }
+            return &entries[middle];
+        }
+        if (order < 0) {
+            low = middle + 1;
+        }
+        else {
+            high = middle;
+        }
+    }
+    return NULL;
+}
+
+AssetFile* AssetPack::open(const std::string& name) {
+    const Entry* entry = find(name);
+    if (entry == NULL) {
+        MappedFile* file = MappedFile::open(name);
+        if (file == NULL) {
+            return NULL;
+        }
+        return new AssetFile(file, file->data(), file->size());
+    }
+
+    const char* stored = pack->data() + entry->offset;
+    if ((entry->flags & ASSET_PACK_COMPRESSED) == 0) {
+        return new AssetFile(NULL, stored, entry->size);
+    }
+
+    AssetFile* asset = new AssetFile(NULL, NULL, entry->size);
+    asset->decompressed.resize(entry->size);
+    if (entry->size > 0 && !lzDecompress(stored, entry->storedSize, &asset->decompressed[0], entry->size)) {
+        delete asset;
+        return NULL;
+    }
+    asset->contents = entry->size > 0 ? &asset->decompressed[0] : NULL;
+    return asset;
+}
+
+bool AssetPack::stat(const std::string& name, uint64_t& size, uint64_t& modified) {
+    const Entry* entry = find(name);
+    if (entry != NULL) {
+        size = entry->size;
+        modified = entry->modified;
+        return true;
+    }
+
+    struct stat info;
+    if (::stat(name.c_str(), &info) != 0) {
+        return false;
+    }
+    size = static_cast<uint64_t>(info.st_size);
+    modified = static_cast<uint64_t>(info.st_mtime);
+    return true;
+}
+
+// --------------------------------------------------
+// Writing packs
+// --------------------------------------------------
+
+bool AssetPack::write(const std::string& filename, const std::vector<std::string>& names, std::string& err) {
+    std::vector<std::string> sorted;
+    for (size_t i = 0; i < names.size(); ++i) {
+        sorted.push_back(normalizeName(names[i]));
+    }
+    std::sort(sorted.begin(), sorted.end());
+    sorted.erase(std::unique(sorted.begin(), sorted.end()), sorted.end());
+
+    Header header;
+    memset(static_cast<void*>(&header), 0, sizeof(header));
+    header.magic = ASSET_PACK_MAGIC;
+    header.version = ASSET_PACK_VERSION;
+    header.numEntries = sorted.size();
+
+    std::string strings;
+    std::vector<Entry> entries(sorted.size());
+    for (size_t i = 0; i < sorted.size(); ++i) {
+        entries[i].name = strings.size();
+        strings.append(sorted[i].c_str(), sorted[i].size() + 1);
+    }
+    // The table always ends with a null so mount can check every name is terminated
+    if (strings.empty()) {
+        strings.push_back('\0');
+    }
+    header.stringTableSize = strings.size();
+    header.entries = ALIGN16(sizeof(Header));
+    header.strings = header.entries + entries.size() * sizeof(Entry);
+
+    // Write to a temporary file first so a half written pack is never mounted
+    std::string temporary = filename + ".tmp";
+    FILE* out = fopen(temporary.c_str(), "wb");
+    if (out == NULL) {
+        err = "Unable to write " + temporary;
+        return false;
+    }
+
+    // Entries follow the index, which is written once their offsets are known
+    uint64_t offset = ALIGN16(header.strings + header.stringTableSize);
+    bool written = fseek(out, static_cast<long>(offset), SEEK_SET) == 0;
+    for (size_t i = 0; written && i < sorted.size(); ++i) {
+        // Packs are always built from the loose files, even if one is mounted
+        MappedFile* file = MappedFile::open(sorted[i]);
+        struct stat info;
+        if (file == NULL || ::stat(sorted[i].c_str(), &info) != 0) {
+            delete file;
+            err = "Unable to read " + sorted[i];
+            written = false;
+            break;
+        }
+
+        Entry& entry = entries[i];
+        entry.flags = 0;
+        entry.modified = static_cast<uint64_t>(info.st_mtime);
+        entry.offset = offset;
+        entry.size = file->size();
+
+        // Only keep the compressed copy if it saves at least an eighth
+        const char* stored = file->data();
+        entry.storedSize = file->size();
+        std::vector<char> compressed;
+        if (file->size() > 0 && file->size() <= ASSET_PACK_MAX_COMPRESSED_SIZE) {
+            lzCompress(file->data(), file->size(), compressed);
+            if (compressed.size() < file->size() - file->size() / 8) {
+                entry.flags |= ASSET_PACK_COMPRESSED;
+                stored = &compressed[0];
+                entry.storedSize = compressed.size();
+            }
+        }
+
+        static const char padding[16] = { 0 };
+        const size_t paddingSize = ALIGN16(offset + entry.storedSize) - (offset + entry.storedSize);
+        written = fwrite(stored, 1, entry.storedSize, out) == entry.storedSize &&
+            fwrite(padding, 1, paddingSize, out) == paddingSize;
+        offset += entry.storedSize + paddingSize;
+        delete file;
+    }
+    header.fileSize = offset;
+
+    if (written) {
+        written = fseek(out, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, out) == 1 &&
+            fseek(out, static_cast<long>(header.entries), SEEK_SET) == 0 &&
+            (entries.empty() || fwrite(&entries[0], sizeof(Entry), entries.size(), out) == entries.size()) &&
+            fwrite(strings.data(), 1, strings.size(), out) == strings.size();
+    }
+    written = (fclose(out) == 0) && written;
+#ifdef WIN32
+    remove(filename.c_str());
+#endif
+    if (!written || rename(temporary.c_str(), filename.c_str()) != 0) {
+        remove(temporary.c_str());
+        if (err.empty()) {
+            err = "Unable to write " + filename;
+        }
+        return false;
+    }
+    return true;
+}
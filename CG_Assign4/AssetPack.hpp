@@ -0,0 +1,108 @@
+//! A single file archive of the program's assets, and the virtual file system that reads from it
+#pragma once
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+class MappedFile;
+
+// The pack built by 'make pack', mounted at startup if it exists
+#define ASSET_PACK_FILENAME "assets.pack"
+
+// Bump whenever the layout of the file changes, older packs are then refused
+#define ASSET_PACK_VERSION 1
+
+// Larger entries are never compressed, so they can always be read straight from the mapping
+#define ASSET_PACK_MAX_COMPRESSED_SIZE (16 * 1024 * 1024)
+
+/// <summary>
+/// The contents of an asset, either a view into the mounted pack or a loose file mapped into memory.
+/// </summary>
+class AssetFile {
+    friend class AssetPack;
+
+public:
+    /// <summary>
+    /// Unmaps or frees the contents.
+    /// </summary>
+    ~AssetFile();
+
+    /// <summary>
+    /// The contents of the file, not null terminated. NULL for an empty file.
+    /// </summary>
+    const char* data() const;
+
+    size_t size() const;
+
+private:
+    AssetFile(MappedFile* file, const char* contents, size_t size);
+
+    // The loose file, NULL if the contents are in the pack
+    MappedFile* file;
+    const char* contents;
+    size_t contentsSize;
+
+    // Holds the contents of compressed entries
+    std::vector<char> decompressed;
+};
+
+/// <summary>
+/// Assets are looked up by their path relative to the program, e.g. "shaders/vshader.glsl". While a
+/// pack is mounted its entries are read from a single mapping of the pack file, and anything missing
+/// from the pack falls back to the loose file. So does an asset whose loose file was modified after
+/// it was packed, with a warning that the pack is stale.
+/// </summary>
+class AssetPack {
+public:
+    /// <summary>
+    /// Map a pack file and read everything it contains from it.
+    /// </summary>
+    ///
+    /// <param name="filename">The pack file.</param>
+    /// <returns>false if the file is missing or not a valid pack, assets are then read from loose files.</returns>
+    static bool mount(const std::string& filename);
+
+    /// <summary>
+    /// Unmap the pack, any AssetFiles opened from it must be deleted first.
+    /// </summary>
+    static void unmount();
+
+    /// <summary>
+    /// Open an asset from the pack, or from the loose file if the pack doesn't have it or is older.
+    /// </summary>
+    ///
+    /// <param name="name">The asset's path.</param>
+    /// <returns>The asset, or NULL if it doesn't exist or a compressed entry is corrupt.</returns>
+    static AssetFile* open(const std::string& name);
+
+    /// <summary>
+    /// Find the size and modification time of an asset without reading it.
+    /// </summary>
+    ///
+    /// <param name="name">The asset's path.</param>
+    /// <param name="size">Receives the uncompressed size.</param>
+    /// <param name="modified">Receives the modification time of the file the asset was packed from.</param>
+    /// <returns>false if the asset doesn't exist.</returns>
+    static bool stat(const std::string& name, uint64_t& size, uint64_t& modified);
+
+    /// <summary>
+    /// Write a pack containing the given files. The index is sorted by name, and entries which
+    /// compress well are stored compressed.
+    /// </summary>
+    ///
+    /// <param name="filename">The pack file to write.</param>
+    /// <param name="names">The paths of the files to pack, which are also the names of their entries.</param>
+    /// <param name="err">Receives a description of the error if the pack can't be written.</param>
+    /// <returns>true if the pack was written.</returns>
+    static bool write(const std::string& filename, const std::vector<std::string>& names, std::string& err);
+
+private:
+    struct Header;
+    struct Entry;
+
+    // The entry for a name, NULL if there is no pack mounted, it doesn't have the name or the loose
+    // file is newer
+    static const Entry* find(const std::string& name);
+
+    static MappedFile* pack;
+};
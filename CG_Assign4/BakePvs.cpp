@@ -0,0 +1,377 @@
+//! Bakes the potentially visible sets of the city's tiles
+//
+// usage: bake_pvs [-d render distance] [-e eye height] output
+//
+// The buildings are generated from the same seeds as the program's. Only what every building model
+// is sure to cover is used as an occluder, at the shortest building height, while every tile is
+// tested as a target at the tallest building height. For each road tile of the key, a tile of the
+// city's grid around it is only left out of its set if every segment from the road tile, up to the
+// eye height, to the target passes through an occluder, so the sets hold from anywhere on the tile.
+// The road tile and the target are split in halves until each pair of pieces is in the shadow
+// volume of one occluder, which also joins the shadows of neighbouring buildings.
+#include "CityPvs.hpp"
+#include "CityLayout.hpp"
+#include "BuildingFactory.hpp"
+#include "SOIL2/image_parallel.h"
+#include "glm/common.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+// Matches City, each building is scaled by 1 to 2 in y
+#define MIN_BUILDING_SCALE 1.0f
+#define MAX_BUILDING_SCALE 2.0f
+
+// Matches Main and Renderer::checkCollision, which keeps the camera this far above the ground
+#define DEFAULT_RENDER_DISTANCE 30.0f
+#define DEFAULT_EYE_HEIGHT 2.0f
+#define MIN_EYE_HEIGHT 0.3f
+
+// Streetlights stand on the edge of a road tile, 0.8 high with an arm reaching 0.4 from the pole
+#define ROAD_TARGET_HEIGHT 1.0f
+#define ROAD_TARGET_MARGIN 0.4f
+
+// Cells across a building's footprint when finding what every building covers
+#define CORE_CELLS 16
+
+// The camera's tile and a target are split until they are this small before a target that isn't
+// shown to be hidden is kept
+#define MIN_REGION_SIZE 0.2f
+#define MIN_TARGET_SIZE 0.5f
+
+// A box standing on the ground in a building tile, relative to the tile's centre
+struct Occluder {
+    float minX, maxX;
+    float minZ, maxZ;
+    float top;
+};
+
+// The height every building model reaches over each cell of the footprint, at the shortest scale,
+// merged into boxes of equal height
+static std::vector<Occluder> coreOccluders(const std::vector<std::vector<BoundingBox> >& buildings) {
+    const float half = BUILDING_SCALE / 2.0f;
+    const float cellSize = 2.0f * half / CORE_CELLS;
+    float heights[CORE_CELLS][CORE_CELLS];
+    for (int z = 0; z < CORE_CELLS; ++z) {
+        for (int x = 0; x < CORE_CELLS; ++x) {
+            const float minX = -half + x * cellSize, maxX = minX + cellSize;
+            const float minZ = -half + z * cellSize, maxZ = minZ + cellSize;
+            float height = 1e30f;
+            for (size_t b = 0; b < buildings.size(); ++b) {
+                // Only boxes covering the whole cell count, they all stand on the model's floor at -1
+                float top = 0.0f;
+                for (size_t i = 0; i < buildings[b].size(); ++i) {
+                    const BoundingBox& box = buildings[b][i];
+                    if (box.minVertex.x * half <= minX && box.maxVertex.x * half >= maxX &&
+                            box.minVertex.z * half <= minZ && box.maxVertex.z * half >= maxZ) {
+                        top = std::max(top, MIN_BUILDING_SCALE * (box.maxVertex.y + 1.0f));
+                    }
+                }
+                height = std::min(height, top);
+            }
+            heights[z][x] = buildings.empty() ? 0.0f : height;
+        }
+    }
+
+    // A box for each cell not yet in a box of its height, grown over every cell at least as high along
+    // the row then the column, or the other way round if that covers more. The boxes overlap, as each
+    // shadow volume is only as large as the single box casting it
+    std::vector<Occluder> occluders;
+    bool covered[CORE_CELLS][CORE_CELLS];
+    memset(covered, 0, sizeof(covered));
+    for (int z = 0; z < CORE_CELLS; ++z) {
+        for (int x = 0; x < CORE_CELLS; ++x) {
+            if (covered[z][x] || heights[z][x] <= 0.0f) {
+                continue;
+            }
+            const float top = heights[z][x];
+            int best[2][2] = { { 0, 0 }, { 0, 0 } };
+            for (int first = 0; first < 2; ++first) {
+                // The cells from [axis][0] up to [axis][1] along x, then z
+                int range[2][2] = { { x, x + 1 }, { z, z + 1 } };
+                for (int pass = 0; pass < 2; ++pass) {
+                    const int axis = pass == 0 ? first : 1 - first;
+                    for (int end = 0; end < 2; ++end) {
+                        for (;;) {
+                            const int next = end == 0 ? range[axis][0] - 1 : range[axis][1];
+                            if (next < 0 || next >= CORE_CELLS) {
+                                break;
+                            }
+                            bool high = true;
+                            for (int i = range[1 - axis][0]; i < range[1 - axis][1] && high; ++i) {
+                                high = (axis == 0 ? heights[i][next] : heights[next][i]) >= top;
+                            }
+                            if (!high) {
+                                break;
+                            }
+                            range[axis][end] = next + end;
+                        }
+                    }
+                }
+                if ((range[0][1] - range[0][0]) * (range[1][1] - range[1][0]) >
+                        (best[0][1] - best[0][0]) * (best[1][1] - best[1][0])) {
+                    memcpy(best, range, sizeof(best));
+                }
+            }
+            for (int j = best[1][0]; j < best[1][1]; ++j) {
+                for (int i = best[0][0]; i < best[0][1]; ++i) {
+                    covered[j][i] = covered[j][i] || heights[j][i] == top;
+                }
+            }
+            const Occluder occluder = { -half + best[0][0] * cellSize, -half + best[0][1] * cellSize,
+                -half + best[1][0] * cellSize, -half + best[1][1] * cellSize, top };
+            occluders.push_back(occluder);
+        }
+    }
+    return occluders;
+}
+
+// Whether the segment passes below the top of the occluder
+static bool blockedByOccluder(glm::vec3 from, glm::vec3 to, const Occluder& occluder) {
+    const glm::vec3 delta = to - from;
+    float t0 = 0.0f, t1 = 1.0f;
+    const float minimum[2] = { occluder.minX, occluder.minZ };
+    const float maximum[2] = { occluder.maxX, occluder.maxZ };
+    const float origin[2] = { from.x, from.z };
+    const float direction[2] = { delta.x, delta.z };
+    for (int axis = 0; axis < 2; ++axis) {
+        if (direction[axis] == 0.0f) {
+            if (origin[axis] <= minimum[axis] || origin[axis] >= maximum[axis]) {
+                return false;
+            }
+            continue;
+        }
+        float enter = (minimum[axis] - origin[axis]) / direction[axis];
+        float leave = (maximum[axis] - origin[axis]) / direction[axis];
+        if (enter > leave) {
+            std::swap(enter, leave);
+        }
+        t0 = std::max(t0, enter);
+        t1 = std::min(t1, leave);
+    }
+    return t0 < t1 && std::min(from.y + delta.y * t0, from.y + delta.y * t1) < occluder.top;
+}
+
+// The eight corners of a box
+static void boxCorners(const BoundingBox& box, glm::vec3 corners[8]) {
+    for (int i = 0; i < 8; ++i) {
+        corners[i] = glm::vec3(i & 1 ? box.maxVertex.x : box.minVertex.x, i & 2 ? box.maxVertex.y : box.minVertex.y,
+            i & 4 ? box.maxVertex.z : box.minVertex.z);
+    }
+}
+
+// Whether all of the target is in the occluder's shadow volume from all of the region. With one end
+// of a segment fixed, the other ends for which it passes through the occluder form a convex set, so
+// if the segments between every corner of the region and every corner of the target pass through
+// it, so do all the segments between the two boxes
+static bool shadows(const Occluder& occluder, const glm::vec3 regionCorners[8], const glm::vec3 targetCorners[8]) {
+    for (int i = 0; i < 8; ++i) {
+        for (int j = 0; j < 8; ++j) {
+            if (!blockedByOccluder(regionCorners[i], targetCorners[j], occluder)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// Whether every segment from the region to the target passes through an occluder. Either a single
+// occluder's shadow volume holds all of the target, or the larger box is split in half along its
+// longest side and both halves are hidden: a target is seen from a region if it is seen from either
+// half of it, and is seen if either of its halves is
+static bool hidden(const BoundingBox& region, const BoundingBox& target, const std::vector<Occluder>& occluders) {
+    glm::vec3 regionCorners[8], targetCorners[8];
+    boxCorners(region, regionCorners);
+    boxCorners(target, targetCorners);
+    for (size_t i = 0; i < occluders.size(); ++i) {
+        if (shadows(occluders[i], regionCorners, targetCorners)) {
+            return true;
+        }
+    }
+
+    const glm::vec3 regionSize = region.maxVertex - region.minVertex;
+    const glm::vec3 targetSize = target.maxVertex - target.minVertex;
+    const float regionSplit = std::max(regionSize.x, std::max(regionSize.y, regionSize.z)) / MIN_REGION_SIZE;
+    const float targetSplit = std::max(targetSize.x, std::max(targetSize.y, targetSize.z)) / MIN_TARGET_SIZE;
+    if (regionSplit <= 1.0f && targetSplit <= 1.0f) {
+        return false;
+    }
+
+    // A segment between the centres that nothing blocks proves the target is seen
+    const glm::vec3 from = (region.minVertex + region.maxVertex) / 2.0f;
+    const glm::vec3 to = (target.minVertex + target.maxVertex) / 2.0f;
+    bool blocked = false;
+    for (size_t i = 0; i < occluders.size() && !blocked; ++i) {
+        blocked = blockedByOccluder(from, to, occluders[i]);
+    }
+    if (!blocked) {
+        return false;
+    }
+
+    const bool splitRegion = regionSplit > targetSplit;
+    const BoundingBox& box = splitRegion ? region : target;
+    const glm::vec3 size = splitRegion ? regionSize : targetSize;
+    const int axis = size.x >= size.y && size.x >= size.z ? 0 : (size.y >= size.z ? 1 : 2);
+    BoundingBox low = box, high = box;
+    low.maxVertex[axis] = high.minVertex[axis] = (box.minVertex[axis] + box.maxVertex[axis]) / 2.0f;
+    if (splitRegion) {
+        return hidden(low, target, occluders) && hidden(high, target, occluders);
+    }
+    return hidden(region, low, occluders) && hidden(region, high, occluders);
+}
+
+// What is tested of a tile, the tallest building or a streetlight
+static BoundingBox targetBounds(int x, int y, const std::vector<BoundingBox>& buildingBounds) {
+    BoundingBox bounds;
+    const glm::vec3 center(x * TILE_SIZE, 0.0f, y * TILE_SIZE);
+    if (getTile(x, y) == B) {
+        float top = 0.0f;
+        for (size_t i = 0; i < buildingBounds.size(); ++i) {
+            top = std::max(top, MAX_BUILDING_SCALE * (buildingBounds[i].maxVertex.y + 1.0f));
+        }
+        const float half = BUILDING_SCALE / 2.0f;
+        bounds.minVertex = center - glm::vec3(half, 0.0f, half);
+        bounds.maxVertex = center + glm::vec3(half, top, half);
+    } else {
+        const float half = TILE_SIZE / 2.0f + ROAD_TARGET_MARGIN;
+        bounds.minVertex = center - glm::vec3(half, 0.0f, half);
+        bounds.maxVertex = center + glm::vec3(half, ROAD_TARGET_HEIGHT, half);
+    }
+    return bounds;
+}
+
+// The tiles around one key tile, tested a row at a time on every thread
+struct BakeJob {
+    int cameraX, cameraY;
+    int radius;
+    BoundingBox cameraTile;
+    const std::vector<Occluder>* core;
+    const std::vector<BoundingBox>* buildingBounds;
+    // Whether each tile may be seen, row by row from -radius
+    std::vector<unsigned char> visible;
+};
+
+static void bakeRows(void* data, int first, int last) {
+    BakeJob& job = *static_cast<BakeJob*>(data);
+    const int width = 2 * job.radius + 1;
+    std::vector<Occluder> occluders;
+    for (int row = first; row < last; ++row) {
+        for (int column = 0; column < width; ++column) {
+            const int x = job.cameraX + column - job.radius, y = job.cameraY + row - job.radius;
+            const BoundingBox bounds = targetBounds(x, y, *job.buildingBounds);
+
+            // Only the buildings between the camera's tile and the target's can block a segment between them
+            occluders.clear();
+            for (int j = std::min(y, job.cameraY); j <= std::max(y, job.cameraY); ++j) {
+                for (int i = std::min(x, job.cameraX); i <= std::max(x, job.cameraX); ++i) {
+                    if (getTile(i, j) != B || (i == x && j == y)) {
+                        continue;
+                    }
+                    for (size_t c = 0; c < job.core->size(); ++c) {
+                        Occluder occluder = (*job.core)[c];
+                        occluder.minX += i * TILE_SIZE;
+                        occluder.maxX += i * TILE_SIZE;
+                        occluder.minZ += j * TILE_SIZE;
+                        occluder.maxZ += j * TILE_SIZE;
+                        occluders.push_back(occluder);
+                    }
+                }
+            }
+            job.visible[row * width + column] = !hidden(job.cameraTile, bounds, occluders);
+        }
+    }
+}
+
+// Orders a set's offsets by the ring of tiles around the camera's they are in, as City draws them
+static bool nearerRing(const CityPvs::TileOffset& a, const CityPvs::TileOffset& b) {
+    return std::max(abs(a.x), abs(a.y)) < std::max(abs(b.x), abs(b.y));
+}
+
+int main(int argc, char** argv) {
+    CityPvs::Parameters parameters;
+    parameters.renderDistance = DEFAULT_RENDER_DISTANCE;
+    parameters.eyeHeight = DEFAULT_EYE_HEIGHT;
+    parameters.minBuildingScale = MIN_BUILDING_SCALE;
+    parameters.maxBuildingScale = MAX_BUILDING_SCALE;
+    const char* output = NULL;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+            parameters.renderDistance = static_cast<float>(atof(argv[++i]));
+        }
+        else if (strcmp(argv[i], "-e") == 0 && i + 1 < argc) {
+            parameters.eyeHeight = std::max(MIN_EYE_HEIGHT, static_cast<float>(atof(argv[++i])));
+        }
+        else if (output == NULL && argv[i][0] != '-') {
+            output = argv[i];
+        }
+        else {
+            output = NULL;
+            break;
+        }
+    }
+    if (output == NULL) {
+        fprintf(stderr, "usage: %s [-d render distance] [-e eye height] output\n", argv[0]);
+        return 1;
+    }
+
+    // Only the shapes' positions matter, not their textures
+    BuildingFactory factory(std::vector<std::string>(1, ""), "");
+    std::vector<std::vector<BoundingBox> > buildings;
+    std::vector<BoundingBox> buildingBounds;
+    for (unsigned int seed = 0; seed < NUMBER_OF_BUILDINGS; ++seed) {
+        const RawModelData building = factory.genBuilding(seed);
+        buildings.push_back(building.occluders);
+        buildingBounds.push_back(building.boundingBox);
+    }
+    const std::vector<Occluder> core = coreOccluders(buildings);
+
+    // Every tile of the city's grid, which is placed a tile either way around the camera's. Even the
+    // tiles past the render distance are drawn, fogged, against the sky
+    const int radius = cityGridSize(parameters.renderDistance) / 2 + 1;
+
+    std::vector<std::vector<CityPvs::TileOffset> > sets(KEY_WIDTH * KEY_HEIGHT);
+    size_t totalTiles = 0, totalVisible = 0, numSets = 0;
+    for (int cameraY = 0; cameraY < KEY_HEIGHT; ++cameraY) {
+        for (int cameraX = 0; cameraX < KEY_WIDTH; ++cameraX) {
+            if (getTile(cameraX, cameraY) == B) {
+                continue;
+            }
+
+            BakeJob job;
+            job.cameraX = cameraX;
+            job.cameraY = cameraY;
+            job.radius = radius;
+            job.cameraTile.minVertex = glm::vec3((cameraX - 0.5f) * TILE_SIZE, MIN_EYE_HEIGHT, (cameraY - 0.5f) * TILE_SIZE);
+            job.cameraTile.maxVertex = glm::vec3((cameraX + 0.5f) * TILE_SIZE, parameters.eyeHeight, (cameraY + 0.5f) * TILE_SIZE);
+            job.core = &core;
+            job.buildingBounds = &buildingBounds;
+            job.visible.assign((2 * radius + 1) * (2 * radius + 1), 0);
+            image_parallel_for(2 * radius + 1, 1, bakeRows, &job);
+
+            std::vector<CityPvs::TileOffset>& set = sets[cameraY * KEY_WIDTH + cameraX];
+            for (int dy = -radius; dy <= radius; ++dy) {
+                for (int dx = -radius; dx <= radius; ++dx) {
+                    if (job.visible[(dy + radius) * (2 * radius + 1) + dx + radius]) {
+                        const CityPvs::TileOffset offset = { static_cast<int16_t>(dx), static_cast<int16_t>(dy) };
+                        set.push_back(offset);
+                    }
+                }
+            }
+            std::stable_sort(set.begin(), set.end(), nearerRing);
+            printf("tile %d,%d: %lu of %lu tiles\n", cameraX, cameraY, (unsigned long)set.size(), (unsigned long)job.visible.size());
+            totalTiles += job.visible.size();
+            totalVisible += set.size();
+            numSets += 1;
+        }
+    }
+    printf("%lu occluder boxes, %lu sets, %.1f%% of the tiles kept\n", (unsigned long)core.size(),
+        (unsigned long)numSets, 100.0 * totalVisible / std::max(totalTiles, static_cast<size_t>(1)));
+
+    if (!CityPvs::write(output, CityPvs::key(parameters.renderDistance, buildings), parameters, sets)) {
+        fprintf(stderr, "%s: could not write %s\n", argv[0], output);
+        return 1;
+    }
+    return 0;
+}
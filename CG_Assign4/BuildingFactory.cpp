@@ -1,25 +1,45 @@
 #include "BuildingFactory.hpp"
+#include "glm/common.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
 #include <ctime>
+#include <map>
 
-#define rand_pos_neg ((rand() % 2) * 2 - 1)
+#define RANDOM_MAX 0x7FFF
 
-float randFloat(float min, float max) {
-    return ((float(rand()) / float(RAND_MAX)) * (max - min)) + min;
-}
+// Samples along each side of a face when measuring how far a simplified building is from the full one
+#define LOD_ERROR_SAMPLES 16
+
+// The ground under the blocks, in model space
+#define GROUND_HEIGHT (-1.0f)
+
+// Pieces of faces thinner than this are dropped, and faces closer than it to a plane lie on it
+#define FACE_EPSILON 1e-4f
 
 BuildingFactory::BuildingFactory(std::vector <std::string> windowTexturesName, std::string topTextureName) 
-    : buildingDimension(1.0), buildingHeight(5.0), windowTextures(windowTexturesName), topTexture(topTextureName) {
+    : buildingDimension(1.0), buildingHeight(5.0), windowTextures(windowTexturesName), topTexture(topTextureName),
+    randomState(0) {
+}
+
+unsigned int BuildingFactory::nextRandom() {
+    randomState = randomState * 1103515245u + 12345u;
+    return (randomState >> 16) & RANDOM_MAX;
+}
+
+float BuildingFactory::randFloat(float min, float max) {
+    return ((float(nextRandom()) / float(RANDOM_MAX)) * (max - min)) + min;
+}
+
+int BuildingFactory::randSign() {
+    return (nextRandom() % 2) * 2 - 1;
 }
 
 RawModelData BuildingFactory::genTrianglePrism(float width, float height, float depth, glm::vec3 center) {
     RawModelData data;
     RawModelData::Shape shape;
 
-    // Bottom
-    shape = shapes::quad(glm::vec3(width + center.x, -height + center.y, depth + center.z), glm::vec3(width + center.x, -height + center.y, -depth + center.z),
-        glm::vec3(-width + center.x, -height + center.y, -depth + center.z), glm::vec3(-width + center.x, -height + center.y, depth + center.z));
-    shape.textureName = topTexture;
-    data.shapes.push_back(shape);
+    // The bottom faces down onto the block below it, so it's never drawn
 
     // Left
     shape = shapes::triangle(glm::vec3(-width + center.x, -height + center.y, -depth + center.z), glm::vec3(-width + center.x, -height + center.y, depth + center.z),
@@ -58,11 +78,7 @@ RawModelData BuildingFactory::genCube(std::string texture, float width, float he
     shape.textureName = topTexture;
     data.shapes.push_back(shape);
 
-    // Bottom
-    shape = shapes::quad(glm::vec3(width + center.x, -1, depth + center.z), glm::vec3(width + center.x, -1, -depth + center.z),
-        glm::vec3(-width + center.x, -1, -depth + center.z), glm::vec3(-width + center.x, -1, depth + center.z));
-    shape.textureName = texture;
-    data.shapes.push_back(shape);
+    // The bottom faces down onto the ground, so it's never drawn
 
     // Left
     shape = shapes::quad(glm::vec3(-width + center.x, height, depth + center.z), glm::vec3(-width + center.x, -1, depth + center.z),
@@ -88,6 +104,12 @@ RawModelData BuildingFactory::genCube(std::string texture, float width, float he
     shape.textureName = texture;
     data.shapes.push_back(shape);
 
+    // The cube is solid, so all of it can hide what's behind the building
+    BoundingBox occluder;
+    occluder.minVertex = glm::vec3(-width + center.x, -1, -depth + center.z);
+    occluder.maxVertex = glm::vec3(width + center.x, height, depth + center.z);
+    data.occluders.push_back(occluder);
+
     return data;
 }
 
@@ -96,7 +118,7 @@ RawModelData BuildingFactory::genBlockBuilding() {
     const float zFightOffset = 0.05f;
 
     // Get random building side texture
-    const std::string sideTexture = windowTextures[rand() % windowTextures.size()];
+    const std::string sideTexture = windowTextures[nextRandom() % windowTextures.size()];
 
     // Original square
     RawModelData data;
@@ -108,8 +130,9 @@ RawModelData BuildingFactory::genBlockBuilding() {
         firstBlockSize - zFightOffset,
         buildingHeight,
         firstBlockSize - zFightOffset,
-        glm::vec3(rand_pos_neg * (buildingDimension - firstBlockSize), 0, rand_pos_neg * (buildingDimension - firstBlockSize)));
+        glm::vec3(randSign() * (buildingDimension - firstBlockSize), 0, randSign() * (buildingDimension - firstBlockSize)));
     data.shapes.insert(data.shapes.end(), block.shapes.begin(), block.shapes.end());
+    data.occluders.insert(data.occluders.end(), block.occluders.begin(), block.occluders.end());
 
     // Second block
     block = genCube(sideTexture,
@@ -118,6 +141,7 @@ RawModelData BuildingFactory::genBlockBuilding() {
         buildingDimension - 2 * zFightOffset,
         glm::vec3(0, 0, 0));
     data.shapes.insert(data.shapes.end(), block.shapes.begin(), block.shapes.end());
+    data.occluders.insert(data.occluders.end(), block.occluders.begin(), block.occluders.end());
 
     // Third block
     block = genCube(sideTexture,
@@ -126,13 +150,15 @@ RawModelData BuildingFactory::genBlockBuilding() {
         randFloat(0.3f, 0.8f - zFightOffset),
         glm::vec3(0, 0, 0));
     data.shapes.insert(data.shapes.end(), block.shapes.begin(), block.shapes.end());
+    data.occluders.insert(data.occluders.end(), block.occluders.begin(), block.occluders.end());
 
     BoundingBox boundingBox;
     boundingBox.minVertex = glm::vec3(-buildingDimension, -1, -buildingDimension);
     boundingBox.maxVertex = glm::vec3(buildingDimension, buildingHeight, buildingDimension);
     data.boundingBox = boundingBox;
 
-    return data;
+    // The blocks overlap each other and the base
+    return removeHiddenFaces(data, data.occluders);
 }
 
 RawModelData BuildingFactory::genClassicBuilding() {
@@ -143,7 +169,7 @@ RawModelData BuildingFactory::genClassicBuilding() {
     const float thirdHeight = (buildingHeight - triangleHeight);
 
     // Get random building side texture
-    const std::string sideTexture = windowTextures[rand() % windowTextures.size()];
+    const std::string sideTexture = windowTextures[nextRandom() % windowTextures.size()];
 
     // Base structure
     RawModelData data;
@@ -153,32 +179,414 @@ RawModelData BuildingFactory::genClassicBuilding() {
     RawModelData block;
     block = genCube(sideTexture, buildingDimension * 0.8f, secondHeight, buildingDimension * 0.8f, glm::vec3(0, 0, 0));
     data.shapes.insert(data.shapes.end(), block.shapes.begin(), block.shapes.end());
+    data.occluders.insert(data.occluders.end(), block.occluders.begin(), block.occluders.end());
 
     // Third
     block = genCube(sideTexture, buildingDimension * 0.6f, thirdHeight, buildingDimension * 0.6f, glm::vec3(0, 0, 0));
     data.shapes.insert(data.shapes.end(), block.shapes.begin(), block.shapes.end());
+    data.occluders.insert(data.occluders.end(), block.occluders.begin(), block.occluders.end());
 
     BoundingBox boundingBox;
     boundingBox.minVertex = glm::vec3(-buildingDimension, -1, -buildingDimension);
     boundingBox.maxVertex = glm::vec3(buildingDimension, buildingHeight, buildingDimension);
     data.boundingBox = boundingBox;
 
+    // Each block stands inside the one below it
+    std::vector<BoundingBox> solids = data.occluders;
+
     // Triangle top
     if (triangleHeight > 0.1) {
         block = genTrianglePrism(buildingDimension * 0.6f, triangleHeight, buildingDimension * 0.6f, glm::vec3(0, buildingHeight, 0));
         data.shapes.insert(data.shapes.end(), block.shapes.begin(), block.shapes.end());
         boundingBox.maxVertex = glm::vec3(buildingDimension, buildingHeight + triangleHeight, buildingDimension);
+
+        // The prism's base covers the top block's roof
+        BoundingBox base;
+        base.minVertex = glm::vec3(-buildingDimension * 0.6f, buildingHeight - triangleHeight, -buildingDimension * 0.6f);
+        base.maxVertex = glm::vec3(buildingDimension * 0.6f, buildingHeight - triangleHeight, buildingDimension * 0.6f);
+        solids.push_back(base);
+    }
+
+    return removeHiddenFaces(data, solids);
+
+}
+
+RawModelData BuildingFactory::genBuilding(unsigned int seed) {
+    randomState = seed;
+    if (seed % 2) return genClassicBuilding();
+    else return genBlockBuilding();
+}
+
+// A rectangle on an axis aligned face, in the face's two other axes
+struct FaceRect {
+    float minA, maxA;
+    float minB, maxB;
+};
+
+// Cuts a rectangle out of the pieces of a face
+static void subtractRect(std::vector<FaceRect>& pieces, const FaceRect& cut) {
+    std::vector<FaceRect> remaining;
+    for (size_t i = 0; i < pieces.size(); ++i) {
+        const FaceRect piece = pieces[i];
+        if (cut.minA >= piece.maxA || cut.maxA <= piece.minA || cut.minB >= piece.maxB || cut.maxB <= piece.minB) {
+            remaining.push_back(piece);
+            continue;
+        }
+
+        // Up to four pieces are left around the cut: the full height strips to either side, then
+        // what's above and below it between them
+        const float minA = std::max(piece.minA, cut.minA);
+        const float maxA = std::min(piece.maxA, cut.maxA);
+        const FaceRect around[4] = {
+            { piece.minA, cut.minA, piece.minB, piece.maxB },
+            { cut.maxA, piece.maxA, piece.minB, piece.maxB },
+            { minA, maxA, piece.minB, cut.minB },
+            { minA, maxA, cut.maxB, piece.maxB },
+        };
+        for (int j = 0; j < 4; ++j) {
+            if (around[j].maxA - around[j].minA > FACE_EPSILON && around[j].maxB - around[j].minB > FACE_EPSILON) {
+                remaining.push_back(around[j]);
+            }
+        }
+    }
+    pieces.swap(remaining);
+}
+
+// Joins the pieces of a face into the rectangle around them. What that adds is inside a solid and
+// hidden anyway, so the face is trimmed to the part that can be seen without needing more than its
+// two triangles.
+static void mergeRects(std::vector<FaceRect>& pieces) {
+    if (pieces.size() < 2) {
+        return;
+    }
+    FaceRect& merged = pieces[0];
+    for (size_t i = 1; i < pieces.size(); ++i) {
+        merged.minA = std::min(merged.minA, pieces[i].minA);
+        merged.maxA = std::max(merged.maxA, pieces[i].maxA);
+        merged.minB = std::min(merged.minB, pieces[i].minB);
+        merged.maxB = std::max(merged.maxB, pieces[i].maxB);
+    }
+    pieces.resize(1);
+}
+
+// What tells a building's vertices apart, the tangent follows from the normal and texture
+// coordinates of the face
+struct VertexKey {
+    glm::vec3 position;
+    glm::vec3 normal;
+    glm::vec2 texCoord;
+
+    bool operator<(const VertexKey& other) const {
+        for (int i = 0; i < 3; ++i) {
+            if (position[i] != other.position[i]) {
+                return position[i] < other.position[i];
+            }
+        }
+        for (int i = 0; i < 3; ++i) {
+            if (normal[i] != other.normal[i]) {
+                return normal[i] < other.normal[i];
+            }
+        }
+        if (texCoord.x != other.texCoord.x) {
+            return texCoord.x < other.texCoord.x;
+        }
+        return texCoord.y < other.texCoord.y;
+    }
+};
+
+// Adds a vertex to a shape unless the shape already has the same one
+static unsigned int addVertex(RawModelData::Shape& shape, std::map<VertexKey, unsigned int>& added,
+        const glm::vec3& vertex, const glm::vec3& normal, const glm::vec2& texCoord, const glm::vec3& tangent) {
+    const VertexKey key = { vertex, normal, texCoord };
+    std::map<VertexKey, unsigned int>::const_iterator found = added.find(key);
+    if (found != added.end()) {
+        return found->second;
+    }
+    const unsigned int index = static_cast<unsigned int>(shape.vertices.size());
+    shape.vertices.push_back(vertex);
+    shape.normals.push_back(normal);
+    shape.texCoords.push_back(texCoord);
+    shape.tangents.push_back(tangent);
+    added[key] = index;
+    return index;
+}
+
+RawModelData BuildingFactory::removeHiddenFaces(const RawModelData& building, const std::vector<BoundingBox>& solids) {
+    RawModelData result;
+    result.boundingBox = building.boundingBox;
+    result.occluders = building.occluders;
+
+    // Everything below the ground is solid too
+    std::vector<BoundingBox> hiding(solids);
+    BoundingBox ground;
+    ground.minVertex = glm::vec3(-HUGE_VALF);
+    ground.maxVertex = glm::vec3(HUGE_VALF, GROUND_HEIGHT, HUGE_VALF);
+    hiding.push_back(ground);
+
+    std::vector<std::map<VertexKey, unsigned int> > added;
+    for (size_t i = 0; i < building.shapes.size(); ++i) {
+        const RawModelData::Shape& shape = building.shapes[i];
+
+        // One shape for each texture and material
+        size_t target = 0;
+        while (target < result.shapes.size() && (result.shapes[target].textureName != shape.textureName ||
+                memcmp(&result.shapes[target].material, &shape.material, sizeof(Material)) != 0)) {
+            ++target;
+        }
+        if (target == result.shapes.size()) {
+            RawModelData::Shape empty;
+            empty.material = shape.material;
+            empty.textureName = shape.textureName;
+            empty.normalMap = shape.normalMap;
+            result.shapes.push_back(empty);
+            added.push_back(std::map<VertexKey, unsigned int>());
+        }
+        RawModelData::Shape& out = result.shapes[target];
+
+        // Only quads lying on a plane along the axes can be cut, anything else is kept whole
+        int axis = -1;
+        if (shape.vertices.size() == 4 && shape.indices.size() == 6) {
+            for (int k = 0; k < 3; ++k) {
+                if (fabsf(fabsf(shape.normals[0][k]) - 1.0f) < FACE_EPSILON) {
+                    axis = k;
+                }
+            }
+        }
+        if (axis < 0) {
+            for (size_t k = 0; k < shape.indices.size(); ++k) {
+                const unsigned int index = shape.indices[k];
+                // Triangles have no tangents
+                out.indices.push_back(addVertex(out, added[target], shape.vertices[index], shape.normals[index],
+                    shape.texCoords[index], index < shape.tangents.size() ? shape.tangents[index] : glm::vec3(0.0f)));
+            }
+            continue;
+        }
+
+        const int a = (axis + 1) % 3;
+        const int b = (axis + 2) % 3;
+        const float plane = shape.vertices[0][axis];
+        // The generated faces' normals point into the block, as the shaders light them
+        const bool facesUp = shape.normals[0][axis] < 0.0f;
+        FaceRect face = { shape.vertices[0][a], shape.vertices[0][a], shape.vertices[0][b], shape.vertices[0][b] };
+        for (size_t k = 1; k < 4; ++k) {
+            face.minA = std::min(face.minA, shape.vertices[k][a]);
+            face.maxA = std::max(face.maxA, shape.vertices[k][a]);
+            face.minB = std::min(face.minB, shape.vertices[k][b]);
+            face.maxB = std::max(face.maxB, shape.vertices[k][b]);
+        }
+
+        std::vector<FaceRect> pieces(1, face);
+        for (size_t k = 0; k < hiding.size() && !pieces.empty(); ++k) {
+            const float low = hiding[k].minVertex[axis];
+            const float high = hiding[k].maxVertex[axis];
+            const bool inside = plane > low + FACE_EPSILON && plane < high - FACE_EPSILON;
+            const bool facingIn = facesUp ? fabsf(plane - low) <= FACE_EPSILON : fabsf(plane - high) <= FACE_EPSILON;
+            if (inside || facingIn) {
+                const FaceRect cut = { hiding[k].minVertex[a], hiding[k].maxVertex[a], hiding[k].minVertex[b],
+                    hiding[k].maxVertex[b] };
+                subtractRect(pieces, cut);
+            }
+        }
+
+        mergeRects(pieces);
+
+        // Texture coordinates change linearly across the face, found from its first corner and
+        // the two next to it
+        const glm::vec2 corner(shape.vertices[0][a], shape.vertices[0][b]);
+        const glm::vec2 alongA = glm::vec2(shape.vertices[1][a], shape.vertices[1][b]) - corner;
+        const glm::vec2 alongB = glm::vec2(shape.vertices[3][a], shape.vertices[3][b]) - corner;
+        const float determinant = alongA.x * alongB.y - alongA.y * alongB.x;
+        const glm::vec2 uvA = shape.texCoords[1] - shape.texCoords[0];
+        const glm::vec2 uvB = shape.texCoords[3] - shape.texCoords[0];
+
+        for (size_t k = 0; k < pieces.size(); ++k) {
+            // Each corner of the piece takes the place of the face's corner on the same sides, so
+            // the winding is kept
+            unsigned int indices[4];
+            for (int c = 0; c < 4; ++c) {
+                glm::vec3 vertex = shape.vertices[c];
+                vertex[a] = vertex[a] == face.minA ? pieces[k].minA : pieces[k].maxA;
+                vertex[b] = vertex[b] == face.minB ? pieces[k].minB : pieces[k].maxB;
+
+                const glm::vec2 offset = glm::vec2(vertex[a], vertex[b]) - corner;
+                const float s = (offset.x * alongB.y - offset.y * alongB.x) / determinant;
+                const float t = (alongA.x * offset.y - alongA.y * offset.x) / determinant;
+                indices[c] = addVertex(out, added[target], vertex, shape.normals[c],
+                    shape.texCoords[0] + s * uvA + t * uvB, shape.tangents[c]);
+            }
+            for (size_t c = 0; c < 6; ++c) {
+                out.indices.push_back(indices[shape.indices[c]]);
+            }
+        }
+    }
+
+    // Textures whose faces were all hidden leave an empty shape
+    for (size_t i = result.shapes.size(); i > 0; --i) {
+        if (result.shapes[i - 1].indices.empty()) {
+            result.shapes.erase(result.shapes.begin() + (i - 1));
+        }
+    }
+    return result;
+}
+
+// The distance from a point to a box, 0 inside it
+static float boxDistance(const glm::vec3& point, const BoundingBox& box) {
+    return glm::length(glm::max(glm::max(box.minVertex - point, point - box.maxVertex), glm::vec3(0.0f)));
+}
+
+// Points spread over the top and sides of a box, the bottom stands on the ground
+static std::vector<glm::vec3> boxSurfacePoints(const BoundingBox& box) {
+    std::vector<glm::vec3> points;
+    const glm::vec3 size = box.maxVertex - box.minVertex;
+    for (int i = 0; i <= LOD_ERROR_SAMPLES; ++i) {
+        for (int j = 0; j <= LOD_ERROR_SAMPLES; ++j) {
+            const float u = static_cast<float>(i) / LOD_ERROR_SAMPLES;
+            const float v = static_cast<float>(j) / LOD_ERROR_SAMPLES;
+            points.push_back(box.minVertex + glm::vec3(u * size.x, size.y, v * size.z));
+            points.push_back(box.minVertex + glm::vec3(0.0f, v * size.y, u * size.z));
+            points.push_back(box.minVertex + glm::vec3(size.x, v * size.y, u * size.z));
+            points.push_back(box.minVertex + glm::vec3(u * size.x, v * size.y, 0.0f));
+            points.push_back(box.minVertex + glm::vec3(u * size.x, v * size.y, size.z));
+        }
+    }
+    return points;
+}
+
+RawModelData BuildingFactory::genBox(const BoundingBox& box, const std::string& sideTexture, bool roof) {
+    const glm::vec3 lo = box.minVertex;
+    const glm::vec3 hi = box.maxVertex;
+    RawModelData data;
+    RawModelData::Shape shape;
+
+    if (roof) {
+        shape = shapes::quad(glm::vec3(lo.x, hi.y, hi.z), glm::vec3(lo.x, hi.y, lo.z), glm::vec3(hi.x, hi.y, lo.z),
+            glm::vec3(hi.x, hi.y, hi.z));
+        shape.textureName = topTexture;
+        data.shapes.push_back(shape);
     }
 
+    // Left
+    shape = shapes::quad(glm::vec3(lo.x, hi.y, hi.z), glm::vec3(lo.x, lo.y, hi.z), glm::vec3(lo.x, lo.y, lo.z),
+        glm::vec3(lo.x, hi.y, lo.z));
+    shape.textureName = sideTexture;
+    data.shapes.push_back(shape);
+
+    // Right
+    shape = shapes::quad(glm::vec3(hi.x, hi.y, lo.z), glm::vec3(hi.x, lo.y, lo.z), glm::vec3(hi.x, lo.y, hi.z),
+        glm::vec3(hi.x, hi.y, hi.z));
+    shape.textureName = sideTexture;
+    data.shapes.push_back(shape);
+
+    // Front
+    shape = shapes::quad(glm::vec3(lo.x, hi.y, lo.z), glm::vec3(lo.x, lo.y, lo.z), glm::vec3(hi.x, lo.y, lo.z),
+        glm::vec3(hi.x, hi.y, lo.z));
+    shape.textureName = sideTexture;
+    data.shapes.push_back(shape);
+
+    // Back
+    shape = shapes::quad(glm::vec3(hi.x, hi.y, hi.z), glm::vec3(hi.x, lo.y, hi.z), glm::vec3(lo.x, lo.y, hi.z),
+        glm::vec3(lo.x, hi.y, hi.z));
+    shape.textureName = sideTexture;
+    data.shapes.push_back(shape);
+
+    data.boundingBox = box;
     return data;
+}
+
+std::vector<RawModelLod> BuildingFactory::genLods(const RawModelData& building) {
+    std::vector<RawModelLod> lods;
+    if (building.occluders.empty()) {
+        return lods;
+    }
+
+    // One box around the blocks, the roof is left off
+    BoundingBox box = building.occluders[0];
+    for (size_t i = 1; i < building.occluders.size(); ++i) {
+        box.minVertex = glm::min(box.minVertex, building.occluders[i].minVertex);
+        box.maxVertex = glm::max(box.maxVertex, building.occluders[i].maxVertex);
+    }
+
+    // The error is the farthest the box's surface gets from the blocks...
+    float error = 0.0f;
+    const std::vector<glm::vec3> boxPoints = boxSurfacePoints(box);
+    for (size_t i = 0; i < boxPoints.size(); ++i) {
+        float distance = boxDistance(boxPoints[i], building.occluders[0]);
+        for (size_t j = 1; j < building.occluders.size(); ++j) {
+            distance = std::min(distance, boxDistance(boxPoints[i], building.occluders[j]));
+        }
+        error = std::max(error, distance);
+    }
+
+    // ...or the uncovered surface of a block gets from the box's
+    for (size_t i = 0; i < building.occluders.size(); ++i) {
+        const std::vector<glm::vec3> blockPoints = boxSurfacePoints(building.occluders[i]);
+        for (size_t j = 0; j < blockPoints.size(); ++j) {
+            const glm::vec3 point = blockPoints[j];
+            bool covered = false;
+            for (size_t k = 0; k < building.occluders.size() && !covered; ++k) {
+                const BoundingBox& other = building.occluders[k];
+                covered = k != i && glm::all(glm::greaterThan(point, other.minVertex)) &&
+                    glm::all(glm::lessThan(point, other.maxVertex));
+            }
+            if (!covered) {
+                const float distance = std::min(std::min(std::min(point.x - box.minVertex.x, box.maxVertex.x - point.x),
+                    std::min(point.z - box.minVertex.z, box.maxVertex.z - point.z)), box.maxVertex.y - point.y);
+                error = std::max(error, distance);
+            }
+        }
+    }
 
+    // ...or the roof rises above it
+    for (size_t i = 0; i < building.shapes.size(); ++i) {
+        for (size_t j = 0; j < building.shapes[i].vertices.size(); ++j) {
+            error = std::max(error, building.shapes[i].vertices[j].y - box.maxVertex.y);
+        }
+    }
+
+    // The walls keep the texture of the full building's walls
+    std::string sideTexture = topTexture;
+    for (size_t i = 0; i < building.shapes.size(); ++i) {
+        if (building.shapes[i].textureName != topTexture) {
+            sideTexture = building.shapes[i].textureName;
+            break;
+        }
+    }
+
+    // Both look the same from below the roof, so the roofless box replaces the box whenever it can
+    RawModelLod lod;
+    lod.data = genBox(box, sideTexture, true);
+    lod.error = error;
+    lod.roofless = false;
+    lods.push_back(lod);
+
+    lod.data = genBox(box, sideTexture, false);
+    lod.roofless = true;
+    lods.push_back(lod);
+    return lods;
 }
 
 std::vector <RawModelData> BuildingFactory::genBuildings(int number) {
     std::vector <RawModelData> buildings;
     for (int i = 0; i < number; i++) {
-        if (i % 2) buildings.push_back(genClassicBuilding());
-        else buildings.push_back(genBlockBuilding());
+        buildings.push_back(genBuilding(i));
     }
     return buildings;
 }
+
+uint64_t BuildingFactory::cacheKey(unsigned int seed) const {
+    // FNV-1a over everything that changes the output for a given seed
+    uint64_t hash = 14695981039346656037ull;
+    std::string parameters = topTexture;
+    for (size_t i = 0; i < windowTextures.size(); ++i) {
+        parameters += '\n' + windowTextures[i];
+    }
+    for (size_t i = 0; i < parameters.size(); ++i) {
+        hash = (hash ^ static_cast<unsigned char>(parameters[i])) * 1099511628211ull;
+    }
+    const float dimensions[2] = { buildingDimension, buildingHeight };
+    const unsigned char* bytes = reinterpret_cast<const unsigned char*>(dimensions);
+    for (size_t i = 0; i < sizeof(dimensions); ++i) {
+        hash = (hash ^ bytes[i]) * 1099511628211ull;
+    }
+    return hash ^ (static_cast<uint64_t>(BUILDING_GENERATOR_VERSION) << 32 | seed);
+}
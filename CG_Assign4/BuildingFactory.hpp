@@ -2,6 +2,7 @@
 #pragma once
 
 #include <vector>
+#include <stdint.h>
 #include "Shapes.hpp"
 
 #include "glm/vec3.hpp"
@@ -10,6 +11,9 @@
 #include "glm/gtc/matrix_transform.hpp"
 #include "glm/gtx/rotate_vector.hpp"
 
+// Bump whenever the generated buildings change, so cached buildings are regenerated
+#define BUILDING_GENERATOR_VERSION 4
+
 class BuildingFactory {
 public:
     BuildingFactory(std::vector <std::string> windowTexturesName, std::string topTextureName);
@@ -25,16 +29,51 @@ public:
     RawModelData genClassicBuilding();
 
     /// <summary>
-    /// Returns a number of random generated buildings
+    /// Returns the building generated from a seed, the same seed always gives the same building
+    /// </summary>
+    RawModelData genBuilding(unsigned int seed);
+
+    /// <summary>
+    /// Returns a number of random generated buildings, using the seeds 0 to number - 1
     /// </summary>
     std::vector <RawModelData> genBuildings(int number);
+
+    /// <summary>
+    /// Returns the simplified versions of a generated building: a single box around its blocks,
+    /// then the same box without its roof. Empty if the building has no blocks.
+    /// </summary>
+    std::vector <RawModelLod> genLods(const RawModelData& building);
+
+    /// <summary>
+    /// The mesh cache key of the building generated from a seed by this factory
+    /// </summary>
+    uint64_t cacheKey(unsigned int seed) const;
 private:
     float buildingDimension;
     float buildingHeight;
     std::vector <std::string> windowTextures;
     std::string topTexture;
+    unsigned int randomState;
 
     RawModelData genTrianglePrism(float width, float height, float depth, glm::vec3 center);
     RawModelData genCube(std::string texture, float width, float height, float depth, glm::vec3 center);
+    RawModelData genBox(const BoundingBox& box, const std::string& sideTexture, bool roof);
+
+    /// <summary>
+    /// Cuts away the parts of a building's axis aligned faces that are inside a solid, or lie on
+    /// a solid's surface facing into it, along with everything below the ground. Each face is
+    /// trimmed to the rectangle around what is left of it, so no face gains triangles, and faces
+    /// with nothing left are dropped. The faces are then gathered into one shape for each texture,
+    /// sharing their vertices.
+    /// </summary>
+    ///
+    /// <param name="building">The building, whose shapes are all quads and triangles.</param>
+    /// <param name="solids">The solid parts of the building, normally its blocks.</param>
+    RawModelData removeHiddenFaces(const RawModelData& building, const std::vector<BoundingBox>& solids);
+
+    // A small linear congruential generator, so buildings don't depend on the global rand state
+    unsigned int nextRandom();
+    float randFloat(float min, float max);
+    int randSign();
 
 };
\ No newline at end of file
@@ -0,0 +1,360 @@
+#include "ChunkProxies.hpp"
+#include "AssetManager.hpp"
+#include "glm/glm.hpp"
+#include "glm/gtc/matrix_inverse.hpp"
+#include <algorithm>
+#include <cstring>
+
+#ifdef _WIN32
+    #define WIN32_LEAN_AND_MEAN
+    #include <windows.h>
+#else
+    #include <pthread.h>
+#endif
+
+struct ChunkProxies::Worker {
+#ifdef _WIN32
+    HANDLE thread;
+    CRITICAL_SECTION mutex;
+    CONDITION_VARIABLE condition;
+
+    void lock() { EnterCriticalSection(&mutex); }
+    void unlock() { LeaveCriticalSection(&mutex); }
+    void wait() { SleepConditionVariableCS(&condition, &mutex, INFINITE); }
+    void wake() { WakeConditionVariable(&condition); }
+#else
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t condition;
+
+    void lock() { pthread_mutex_lock(&mutex); }
+    void unlock() { pthread_mutex_unlock(&mutex); }
+    void wait() { pthread_cond_wait(&condition, &mutex); }
+    void wake() { pthread_cond_signal(&condition); }
+#endif
+};
+
+ChunkProxies::ChunkProxies(const std::vector<RawModelData>& models) : models(models), stopping(false) {
+    // Untextured shapes sample a white cell, named by the empty string
+    std::vector<std::string> textureNames;
+    textureNames.push_back("");
+    for (size_t i = 0; i < models.size(); ++i) {
+        for (size_t j = 0; j < models[i].shapes.size(); ++j) {
+            const std::string& name = models[i].shapes[j].textureName;
+            if (std::find(textureNames.begin(), textureNames.end(), name) == textureNames.end()) {
+                textureNames.push_back(name);
+            }
+        }
+    }
+    bakeAtlas(textureNames);
+    AssetManager::addTexture(PROXY_ATLAS_TEXTURE, atlas);
+
+    worker = new Worker;
+#ifdef _WIN32
+    InitializeCriticalSection(&worker->mutex);
+    InitializeConditionVariable(&worker->condition);
+    worker->thread = CreateThread(NULL, 0, workerThread, this, 0, NULL);
+#else
+    pthread_mutex_init(&worker->mutex, NULL);
+    pthread_cond_init(&worker->condition, NULL);
+    pthread_create(&worker->thread, NULL, workerThread, this);
+#endif
+}
+
+ChunkProxies::~ChunkProxies() {
+    worker->lock();
+    stopping = true;
+    worker->wake();
+    worker->unlock();
+#ifdef _WIN32
+    WaitForSingleObject(worker->thread, INFINITE);
+    CloseHandle(worker->thread);
+    DeleteCriticalSection(&worker->mutex);
+#else
+    pthread_join(worker->thread, NULL);
+    pthread_cond_destroy(&worker->condition);
+    pthread_mutex_destroy(&worker->mutex);
+#endif
+    delete worker;
+
+    for (std::map<ChunkKey, ModelData*>::iterator it = proxies.begin(); it != proxies.end(); ++it) {
+        delete it->second;
+    }
+    glDeleteTextures(1, &atlas);
+}
+
+void ChunkProxies::bakeAtlas(const std::vector<std::string>& textureNames) {
+    // A square grid of cells, a power of two on each side
+    int columns = 1;
+    while (columns * columns < static_cast<int>(textureNames.size())) {
+        columns *= 2;
+    }
+    const int size = columns * PROXY_ATLAS_CELL;
+    const int inner = PROXY_ATLAS_CELL - 2 * PROXY_ATLAS_GUTTER;
+    std::vector<unsigned char> texels(4 * size * size, 255);
+
+    std::vector<unsigned char> source;
+    std::vector<unsigned char> shrunk(4 * inner * inner);
+    for (size_t i = 0; i < textureNames.size(); ++i) {
+        const int cellX = static_cast<int>(i) % columns * PROXY_ATLAS_CELL;
+        const int cellY = static_cast<int>(i) / columns * PROXY_ATLAS_CELL;
+        Cell cell;
+        cell.offset = glm::vec2(cellX + PROXY_ATLAS_GUTTER, cellY + PROXY_ATLAS_GUTTER) / static_cast<float>(size);
+        cell.size = glm::vec2(static_cast<float>(inner) / size);
+        cells[textureNames[i]] = cell;
+
+        const GLint textureId = textureNames[i].empty() ? 0 : AssetManager::loadTexture(textureNames[i]);
+        if (textureId <= 0) {
+            continue;
+        }
+
+        // Average the texels covered by each texel of the cell, the textures have no mipmaps to
+        // read a smaller level from
+        GLint width = 0, height = 0;
+        glBindTexture(GL_TEXTURE_2D, textureId);
+        glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &width);
+        glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &height);
+        if (width == 0 || height == 0) {
+            continue;
+        }
+        source.resize(4 * width * height);
+        glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_UNSIGNED_BYTE, &source[0]);
+        for (int y = 0; y < inner; ++y) {
+            const int y0 = y * height / inner;
+            const int y1 = std::max(y0 + 1, (y + 1) * height / inner);
+            for (int x = 0; x < inner; ++x) {
+                const int x0 = x * width / inner;
+                const int x1 = std::max(x0 + 1, (x + 1) * width / inner);
+                unsigned int sum[4] = { 0, 0, 0, 0 };
+                for (int sy = y0; sy < y1; ++sy) {
+                    for (int sx = x0; sx < x1; ++sx) {
+                        for (int c = 0; c < 4; ++c) {
+                            sum[c] += source[4 * (sy * width + sx) + c];
+                        }
+                    }
+                }
+                const unsigned int count = (y1 - y0) * (x1 - x0);
+                for (int c = 0; c < 4; ++c) {
+                    shrunk[4 * (y * inner + x) + c] = static_cast<unsigned char>(sum[c] / count);
+                }
+            }
+        }
+
+        // The gutter repeats the nearest edge texel
+        for (int y = 0; y < PROXY_ATLAS_CELL; ++y) {
+            const int sy = std::min(std::max(y - PROXY_ATLAS_GUTTER, 0), inner - 1);
+            for (int x = 0; x < PROXY_ATLAS_CELL; ++x) {
+                const int sx = std::min(std::max(x - PROXY_ATLAS_GUTTER, 0), inner - 1);
+                memcpy(&texels[4 * ((cellY + y) * size + cellX + x)], &shrunk[4 * (sy * inner + sx)], 4);
+            }
+        }
+    }
+
+    glGenTextures(1, &atlas);
+    glBindTexture(GL_TEXTURE_2D, atlas);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, size, size, 0, GL_RGBA, GL_UNSIGNED_BYTE, &texels[0]);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, PROXY_ATLAS_MAX_LEVEL);
+    glGenerateMipmap(GL_TEXTURE_2D);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+// Faces with no texture stretch have zero tangents, which have to stay that way
+static glm::vec3 safeNormalize(const glm::vec3& vector) {
+    const float length = glm::length(vector);
+    return length > 0.0f ? vector / length : vector;
+}
+
+// Grows a box to hold the corners of another, transformed
+static void addTransformedBox(BoundingBox& box, bool& empty, const BoundingBox& added, const glm::mat4& transformation) {
+    for (int i = 0; i < 8; ++i) {
+        const glm::vec3 corner(i & 1 ? added.maxVertex.x : added.minVertex.x,
+            i & 2 ? added.maxVertex.y : added.minVertex.y,
+            i & 4 ? added.maxVertex.z : added.minVertex.z);
+        const glm::vec3 point = glm::vec3(transformation * glm::vec4(corner, 1.0f));
+        if (empty) {
+            box.minVertex = point;
+            box.maxVertex = point;
+            empty = false;
+        }
+        box.minVertex = glm::min(box.minVertex, point);
+        box.maxVertex = glm::max(box.maxVertex, point);
+    }
+}
+
+RawModelData ChunkProxies::merge(const std::vector<Part>& parts) const {
+    RawModelData merged;
+    merged.boundingBox.minVertex = glm::vec3(0.0f);
+    merged.boundingBox.maxVertex = glm::vec3(0.0f);
+    bool empty = true;
+
+    for (size_t i = 0; i < parts.size(); ++i) {
+        const RawModelData& model = models[parts[i].model];
+        const glm::mat4& transformation = parts[i].transformation;
+        const glm::mat3 normalTransformation = glm::inverseTranspose(glm::mat3(transformation));
+
+        for (size_t j = 0; j < model.shapes.size(); ++j) {
+            const RawModelData::Shape& shape = model.shapes[j];
+
+            // One shape for each material, every texture is in the atlas
+            size_t target = 0;
+            while (target < merged.shapes.size() &&
+                    memcmp(&merged.shapes[target].material, &shape.material, sizeof(Material)) != 0) {
+                ++target;
+            }
+            if (target == merged.shapes.size()) {
+                merged.shapes.push_back(RawModelData::Shape());
+                merged.shapes.back().material = shape.material;
+                merged.shapes.back().textureName = PROXY_ATLAS_TEXTURE;
+            }
+            RawModelData::Shape& out = merged.shapes[target];
+
+            const Cell& cell = cells.find(shape.textureName)->second;
+            const unsigned int base = static_cast<unsigned int>(out.vertices.size());
+            for (size_t k = 0; k < shape.vertices.size(); ++k) {
+                out.vertices.push_back(glm::vec3(transformation * glm::vec4(shape.vertices[k], 1.0f)));
+                out.normals.push_back(k < shape.normals.size() ?
+                    safeNormalize(normalTransformation * shape.normals[k]) : glm::vec3(0, 1, 0));
+                out.tangents.push_back(k < shape.tangents.size() ?
+                    safeNormalize(glm::mat3(transformation) * shape.tangents[k]) : glm::vec3(1, 0, 0));
+                const glm::vec2 texCoord = k < shape.texCoords.size() ?
+                    glm::clamp(shape.texCoords[k], 0.0f, 1.0f) : glm::vec2(0.5f);
+                out.texCoords.push_back(cell.offset + texCoord * cell.size);
+            }
+            for (size_t k = 0; k < shape.indices.size(); ++k) {
+                out.indices.push_back(base + shape.indices[k]);
+            }
+        }
+
+        addTransformedBox(merged.boundingBox, empty, model.boundingBox, transformation);
+        for (size_t j = 0; j < model.occluders.size(); ++j) {
+            BoundingBox occluder;
+            bool emptyOccluder = true;
+            addTransformedBox(occluder, emptyOccluder, model.occluders[j], transformation);
+            merged.occluders.push_back(occluder);
+        }
+    }
+    return merged;
+}
+
+#ifdef _WIN32
+unsigned long __stdcall ChunkProxies::workerThread(void* param) {
+    static_cast<ChunkProxies*>(param)->work();
+    return 0;
+}
+#else
+void* ChunkProxies::workerThread(void* param) {
+    static_cast<ChunkProxies*>(param)->work();
+    return NULL;
+}
+#endif
+
+void ChunkProxies::work() {
+    worker->lock();
+    for (;;) {
+        while (jobs.empty() && !stopping) {
+            worker->wait();
+        }
+        if (stopping) {
+            break;
+        }
+        Job job = jobs.front();
+        jobs.pop_front();
+
+        worker->unlock();
+        Result result;
+        result.chunk = job.chunk;
+        result.data = merge(job.parts);
+        worker->lock();
+
+        results.push_back(result);
+    }
+    worker->unlock();
+}
+
+void ChunkProxies::request(int x, int y, const std::vector<Part>& parts) {
+    const ChunkKey chunk(x, y);
+    if (!pending.insert(chunk).second) {
+        return;
+    }
+    Job job;
+    job.chunk = chunk;
+    job.parts = parts;
+
+    worker->lock();
+    jobs.push_back(job);
+    worker->wake();
+    worker->unlock();
+}
+
+bool ChunkProxies::requested(int x, int y) const {
+    return pending.count(ChunkKey(x, y)) > 0;
+}
+
+void ChunkProxies::update(const Renderer* renderer) {
+    std::vector<Result> finished;
+    worker->lock();
+    finished.swap(results);
+    worker->unlock();
+
+    // Chunks released while they were being merged are dropped
+    for (size_t i = 0; i < finished.size(); ++i) {
+        if (pending.count(finished[i].chunk) > 0 && proxies.count(finished[i].chunk) == 0) {
+            proxies[finished[i].chunk] = new ModelData(finished[i].data, renderer);
+        }
+    }
+}
+
+const ModelData* ChunkProxies::proxy(int x, int y) const {
+    std::map<ChunkKey, ModelData*>::const_iterator found = proxies.find(ChunkKey(x, y));
+    return found == proxies.end() ? NULL : found->second;
+}
+
+// Whether a chunk is outside a range
+struct OutsideRange {
+    int minX, minY, maxX, maxY;
+    bool operator()(int x, int y) const {
+        return x < minX || y < minY || x > maxX || y > maxY;
+    }
+};
+
+void ChunkProxies::release(int minX, int minY, int maxX, int maxY) {
+    const OutsideRange outside = { minX, minY, maxX, maxY };
+
+    for (std::set<ChunkKey>::iterator it = pending.begin(); it != pending.end();) {
+        if (outside(it->first, it->second)) {
+            pending.erase(it++);
+        }
+        else {
+            ++it;
+        }
+    }
+    for (std::map<ChunkKey, ModelData*>::iterator it = proxies.begin(); it != proxies.end();) {
+        if (outside(it->first.first, it->first.second)) {
+            delete it->second;
+            proxies.erase(it++);
+        }
+        else {
+            ++it;
+        }
+    }
+
+    // Don't merge chunks nobody is waiting for
+    worker->lock();
+    for (std::deque<Job>::iterator it = jobs.begin(); it != jobs.end();) {
+        if (outside(it->chunk.first, it->chunk.second)) {
+            it = jobs.erase(it);
+        }
+        else {
+            ++it;
+        }
+    }
+    worker->unlock();
+}
+
+size_t ChunkProxies::numProxies() const {
+    return proxies.size();
+}
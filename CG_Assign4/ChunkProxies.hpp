@@ -0,0 +1,136 @@
+//! Merged meshes standing in for whole chunks of the city, generated in the background
+#pragma once
+#include <deque>
+#include <map>
+#include <set>
+#include <vector>
+#include "ModelData.hpp"
+#include "glm/mat4x4.hpp"
+
+// Texels along each side of a texture's cell in the atlas, and the border around each cell that
+// repeats its edge so the mipmaps up to PROXY_ATLAS_MAX_LEVEL don't bleed into the next cell
+#define PROXY_ATLAS_CELL 128
+#define PROXY_ATLAS_GUTTER 8
+#define PROXY_ATLAS_MAX_LEVEL 3
+
+// The name the atlas is loadable under with AssetManager::loadTexture, while the proxies exist
+#define PROXY_ATLAS_TEXTURE "<chunk proxy atlas>"
+
+class Renderer;
+
+/// <summary>
+/// Merges the models placed in a chunk into a single model, to draw in place of all of them once
+/// the chunk is far away.
+///
+/// Every texture of the source models is shrunk into a cell of one atlas, so the merged model is
+/// a single shape for each material instead of one for each texture. The models are merged by a
+/// worker thread, as chunks are requested, and only uploaded to the GPU by update on the thread
+/// owning the GL context.
+/// </summary>
+class ChunkProxies {
+public:
+    // A source model placed in a chunk
+    struct Part {
+        size_t model;
+        glm::mat4 transformation;
+    };
+
+    /// <summary>
+    /// Bakes the atlas from the models' textures and starts the worker. Needs the GL context.
+    /// </summary>
+    ///
+    /// <param name="models">The models the chunks are made of, normally simplified versions.
+    /// Texture coordinates outside [0, 1] are clamped, as textures don't repeat in the atlas, and
+    /// normal maps are dropped.</param>
+    ChunkProxies(const std::vector<RawModelData>& models);
+
+    /// <summary>
+    /// Stops the worker, waiting for the chunk it is merging, and frees the proxies and the atlas.
+    /// </summary>
+    ~ChunkProxies();
+
+    /// <summary>
+    /// Queue a chunk to be merged, unless it has been already.
+    /// </summary>
+    ///
+    /// <param name="x">The chunk's x, any coordinates that identify it.</param>
+    /// <param name="y">The chunk's y.</param>
+    /// <param name="parts">The models in the chunk, in world space.</param>
+    void request(int x, int y, const std::vector<Part>& parts);
+
+    /// <summary>
+    /// Whether a chunk has been requested since it was last released.
+    /// </summary>
+    bool requested(int x, int y) const;
+
+    /// <summary>
+    /// Uploads the chunks the worker has finished merging. Needs the GL context.
+    /// </summary>
+    ///
+    /// <param name="renderer">The renderer to obtain shader information from.</param>
+    void update(const Renderer* renderer);
+
+    /// <summary>
+    /// The merged model of a chunk, in world space, or NULL if it isn't ready.
+    /// </summary>
+    const ModelData* proxy(int x, int y) const;
+
+    /// <summary>
+    /// Frees the proxies of the chunks outside a range, and forgets their requests.
+    /// </summary>
+    void release(int minX, int minY, int maxX, int maxY);
+
+    size_t numProxies() const;
+
+private:
+    typedef std::pair<int, int> ChunkKey;
+
+    struct Job {
+        ChunkKey chunk;
+        std::vector<Part> parts;
+    };
+
+    struct Result {
+        ChunkKey chunk;
+        RawModelData data;
+    };
+
+    // The rectangle of the atlas a texture's cell samples, in texture coordinates
+    struct Cell {
+        glm::vec2 offset;
+        glm::vec2 size;
+    };
+
+    // Read by the worker, never changed once it starts
+    std::vector<RawModelData> models;
+    std::map<std::string, Cell> cells;
+    GLuint atlas;
+
+    // Guarded by the worker's lock
+    std::deque<Job> jobs;
+    std::vector<Result> results;
+    bool stopping;
+
+    // Only used by the thread owning the GL context
+    std::set<ChunkKey> pending;
+    std::map<ChunkKey, ModelData*> proxies;
+
+    // Platform specific thread, lock and condition, defined in ChunkProxies.cpp
+    struct Worker;
+    Worker* worker;
+
+    // Shrinks each texture into its cell and uploads the atlas
+    void bakeAtlas(const std::vector<std::string>& textureNames);
+
+    // Merges the parts of a chunk into one shape for each material
+    RawModelData merge(const std::vector<Part>& parts) const;
+
+    // The worker's loop, merging jobs until stopping is set
+    void work();
+
+#ifdef _WIN32
+    static unsigned long __stdcall workerThread(void* param);
+#else
+    static void* workerThread(void* param);
+#endif
+};
@@ -1,16 +1,13 @@
 #include "City.hpp"
+#include "CityPvs.hpp"
+#include "ChunkProxies.hpp"
+#include "Terrain.hpp"
 #include <stdlib.h>
 #include <cmath>
 #include <iostream>
 
 #define TAU (6.283185307179586f)
 
-// FIXME: This should be dynamic
-#define BUILDING_SCALE (2.0f)
-// FIXME: This should by dynamic
-#define BUILDING_GAP (1.2f)
-#define TILE_SIZE (BUILDING_SCALE * BUILDING_GAP)
-
 // FIXME: if we want buildings to have a unique street facing facade this value needs to be
 // dynamic
 #define STREET_DIR (glm::vec3(0, 0, 1))
@@ -24,6 +21,15 @@
 #define STREETLIGHT_HEIGHT 0.80f
 #define STREETLIGHT_POS_DIV 2.9f
 
+// Chunks are drawn as proxies once all of them is this far inside the render distance, where the
+// fog starts, FOG_FADE in Renderer.cpp
+#define PROXY_FOG_FADE 10.0f
+
+// The chunk holding a tile coordinate, negative coordinates included
+static int chunkCoordinate(int coordinate) {
+    return coordinate >= 0 ? coordinate / PROXY_CHUNK_TILES : -((-coordinate - 1) / PROXY_CHUNK_TILES) - 1;
+}
+
 float noise(int x, int y) {
     int n = x + y * 57;
     n = (n << 13) ^ n;
@@ -31,25 +37,6 @@ float noise(int x, int y) {
         1073741824.0) + 1.0) / 2.0);
 }
 
-#define KEY_WIDTH 5
-#define KEY_HEIGHT 6
-
-const static TileType TILE_KEY[KEY_HEIGHT][KEY_WIDTH] = {
-        { B, B, V, B, B },
-        { H, H, I, H, H },
-        { B, B, V, B, B },
-        { B, B, V, B, B },
-        { H, H, I, H, H },
-        { B, B, V, B, B },
-};
-
-TileType getTile(int x, int y) {
-    x = x < 0 ? KEY_WIDTH - 1 + ((x + 1) % KEY_WIDTH) : x % KEY_WIDTH;
-    y = y < 0 ? KEY_HEIGHT - 1 + ((y + 1) % KEY_HEIGHT) : y % KEY_HEIGHT;
-
-    return TILE_KEY[y][x];
-}
-
 TileType City::tileForPosition(glm::vec3 position) const {
     const int gridx = static_cast<int>(round(position.x / TILE_SIZE));
     const int gridy = static_cast<int>(round(position.z / TILE_SIZE));
@@ -71,9 +58,16 @@ City::City(const ModelData* base_model, const ModelData* streetlight_model, floa
     streetlight.model = streetlight_model;
     streetlight.scale = glm::vec3(0.001, 0.001, 0.001);
 
-    // Compute a grid size such that the buildings will be rendered so that new buildings
-    // can't be seen appearing as the camera moves.
-    gridSize = static_cast<int>(ceilf(renderDistance * 2 / TILE_SIZE)) + 5;
+    gridSize = cityGridSize(renderDistance);
+    this->renderDistance = renderDistance;
+    pvs = NULL;
+    drawnTiles = 0;
+    proxies = NULL;
+    useProxies = false;
+    proxiedVersion = 0;
+    drawnProxies = 0;
+    drawnRenderer = NULL;
+    staticGroup = 0;
 }
 
 City::City(std::vector <ModelData *> base_models, const ModelData* streetlight_model, float renderDistance) {
@@ -90,9 +84,160 @@ City::City(std::vector <ModelData *> base_models, const ModelData* streetlight_m
     streetlight.model = streetlight_model;
     streetlight.scale = glm::vec3(0.001, 0.001, 0.001);
 
-    // Compute a grid size such that the buildings will be rendered so that new buildings
-    // can't be seen appearing as the camera moves.
-    gridSize = static_cast<int>(ceilf(renderDistance * 2 / TILE_SIZE)) + 5;
+    gridSize = cityGridSize(renderDistance);
+    this->renderDistance = renderDistance;
+    pvs = NULL;
+    drawnTiles = 0;
+    proxies = NULL;
+    useProxies = false;
+    proxiedVersion = 0;
+    drawnProxies = 0;
+    drawnRenderer = NULL;
+    staticGroup = 0;
+}
+
+City::~City() {
+    delete pvs;
+    delete proxies;
+}
+
+bool City::loadVisibleSets(const std::string& filename) {
+    std::vector<std::vector<BoundingBox> > buildingOccluders;
+    for (size_t i = 0; i < buildingTypes.size(); ++i) {
+        buildingOccluders.push_back(buildingTypes[i].model->getOccluders());
+    }
+    CityPvs* loaded = CityPvs::open(filename, CityPvs::key(renderDistance, buildingOccluders));
+    if (loaded == NULL) {
+        return false;
+    }
+
+    // The sets only hold for buildings within the heights they were baked for
+    for (size_t i = 0; i < buildingTypes.size(); ++i) {
+        if (buildingTypes[i].scale.y < loaded->parameters().minBuildingScale ||
+                buildingTypes[i].scale.y > loaded->parameters().maxBuildingScale) {
+            delete loaded;
+            return false;
+        }
+    }
+
+    delete pvs;
+    pvs = loaded;
+    return true;
+}
+
+void City::enableProxies(const std::vector<RawModelData>& buildingProxies) {
+    // The buildings, then the ground of each tile type in TileType's order
+    std::vector<RawModelData> models(buildingProxies);
+    models.push_back(Terrain::tileModel(H));
+    models.push_back(Terrain::tileModel(V));
+    models.push_back(Terrain::tileModel(I));
+    models.push_back(Terrain::tileModel(B));
+
+    delete proxies;
+    proxies = new ChunkProxies(models);
+    useProxies = true;
+}
+
+void City::toggleProxies() {
+    useProxies = !useProxies && proxies != NULL;
+}
+
+bool City::proxiesEnabled() const {
+    return useProxies;
+}
+
+void City::update(const Renderer* renderer, glm::vec3 cameraPosition) {
+    std::set<std::pair<int, int> > previous;
+    previous.swap(proxiedChunks);
+    updateProxies(renderer, cameraPosition);
+    if (proxiedChunks != previous) {
+        proxiedVersion += 1;
+    }
+}
+
+void City::updateProxies(const Renderer* renderer, glm::vec3 cameraPosition) {
+    if (proxies == NULL) {
+        return;
+    }
+    proxies->update(renderer);
+
+    // The chunks overlapping the drawn tiles, the others' proxies won't be needed for a while
+    const int startx = static_cast<int>(cameraPosition.x / TILE_SIZE);
+    const int starty = static_cast<int>(cameraPosition.z / TILE_SIZE);
+    const int minX = chunkCoordinate(startx);
+    const int minY = chunkCoordinate(starty);
+    const int maxX = chunkCoordinate(startx + gridSize - 1);
+    const int maxY = chunkCoordinate(starty + gridSize - 1);
+    proxies->release(minX, minY, maxX, maxY);
+    if (!useProxies) {
+        return;
+    }
+
+    const float proxyDistance = renderDistance - PROXY_FOG_FADE;
+    const glm::vec2 camera = glm::vec2(cameraPosition.x, cameraPosition.z);
+    for (int chunkY = minY; chunkY <= maxY; ++chunkY) {
+        for (int chunkX = minX; chunkX <= maxX; ++chunkX) {
+            // The nearest point of the chunk's ground
+            const glm::vec3 first = tileOffset(chunkX * PROXY_CHUNK_TILES, chunkY * PROXY_CHUNK_TILES);
+            const glm::vec2 low = glm::vec2(first.x, first.z) - TILE_SIZE / 2.0f;
+            const glm::vec2 high = low + static_cast<float>(PROXY_CHUNK_TILES) * TILE_SIZE;
+            if (glm::distance(glm::clamp(camera, low, high), camera) <= proxyDistance) {
+                continue;
+            }
+
+            if (proxies->proxy(chunkX, chunkY) != NULL) {
+                proxiedChunks.insert(std::make_pair(chunkX, chunkY));
+            }
+            else if (!proxies->requested(chunkX, chunkY)) {
+                // The buildings and the ground of every tile, the streetlights are too small to see
+                // from here
+                std::vector<ChunkProxies::Part> parts;
+                for (int y = 0; y < PROXY_CHUNK_TILES; ++y) {
+                    for (int x = 0; x < PROXY_CHUNK_TILES; ++x) {
+                        const int gridx = chunkX * PROXY_CHUNK_TILES + x;
+                        const int gridy = chunkY * PROXY_CHUNK_TILES + y;
+                        ChunkProxies::Part part;
+                        if (getTile(gridx, gridy) == B) {
+                            part.transformation = buildingTransform(gridx, gridy, part.model);
+                            parts.push_back(part);
+                        }
+
+                        const glm::vec3 offset = tileOffset(gridx, gridy);
+                        part.model = buildingTypes.size() + tileForPosition(offset);
+                        part.transformation = glm::scale(glm::translate(glm::mat4(1.0f), offset),
+                            glm::vec3(TILE_SIZE / 2.0f, 1.0f, TILE_SIZE / 2.0f));
+                        parts.push_back(part);
+                    }
+                }
+                proxies->request(chunkX, chunkY, parts);
+            }
+        }
+    }
+}
+
+bool City::drawnByProxy(glm::vec3 position) const {
+    if (proxiedChunks.empty()) {
+        return false;
+    }
+    const glm::vec3 origin = tileOffset(0, 0);
+    const int gridx = static_cast<int>(floorf((position.x - origin.x) / TILE_SIZE + 0.5f));
+    const int gridy = static_cast<int>(floorf((position.z - origin.z) / TILE_SIZE + 0.5f));
+    return proxiedChunks.count(std::make_pair(chunkCoordinate(gridx), chunkCoordinate(gridy))) > 0;
+}
+
+unsigned long City::proxiesVersion() const {
+    return proxiedVersion;
+}
+
+glm::vec3 City::tileOffset(int gridx, int gridy) const {
+    const glm::vec3 baseOffset = glm::vec3(
+        -static_cast<float>(gridSize)* TILE_SIZE / 2.0f,
+        0,
+        -static_cast<float>(gridSize)* TILE_SIZE / 2.0f);
+
+    return glm::vec3(static_cast<float>(gridx)* TILE_SIZE,
+        0,
+        static_cast<float>(gridy)* TILE_SIZE) + baseOffset;
 }
 
 void City::draw(Renderer* renderer, glm::vec3 cameraPosition) const {
@@ -101,74 +246,198 @@ void City::draw(Renderer* renderer, glm::vec3 cameraPosition) const {
         0,
         -static_cast<float>(gridSize)* TILE_SIZE / 2.0f);
 
-    for (int y = 0; y < gridSize; ++y) {
-        for (int x = 0; x < gridSize; ++x) {
-            const int gridx = x + static_cast<int>(cameraPosition.x / TILE_SIZE);
-            const int gridy = y + static_cast<int>(cameraPosition.z / TILE_SIZE);
+    const int startx = static_cast<int>(cameraPosition.x / TILE_SIZE);
+    const int starty = static_cast<int>(cameraPosition.z / TILE_SIZE);
 
-            const glm::vec3 tileOffset = glm::vec3(static_cast<float>(gridx)* TILE_SIZE,
-                0,
-                static_cast<float>(gridy)* TILE_SIZE) + baseOffset;
+    // The tile the camera stands on, tile centres are at baseOffset + grid * TILE_SIZE
+    const int cameraX = static_cast<int>(floorf((cameraPosition.x - baseOffset.x) / TILE_SIZE + 0.5f));
+    const int cameraY = static_cast<int>(floorf((cameraPosition.z - baseOffset.z) / TILE_SIZE + 0.5f));
 
-            switch (getTile(gridx, gridy)) {
-            case B: // Building case
-            {
-                // Get the random building model from the array
-                const int index = (int)(noise(gridx, gridy) * (buildingTypes.size()));
-                const ObjectData building = buildingTypes[index];
+    // Its visible set is used if the camera is low enough
+    DrawnTiles from = { startx, starty, false, cameraX, cameraY, proxiedVersion };
+    if (pvs != NULL && cameraPosition.y <= pvs->parameters().eyeHeight) {
+        from.culled = !pvs->visibleTiles(cameraX, cameraY).empty();
+    }
 
-                const glm::vec3 position = tileOffset + glm::vec3(0, building.scale.y, 0);
+    // The models are kept by the renderer until they change
+    if (renderer != drawnRenderer) {
+        staticGroup = renderer->addStaticGroup();
+    }
+    if (renderer != drawnRenderer || !(from == drawnFrom)) {
+        // Lights are added for every tile in range, as hidden streetlights light what can be seen,
+        // so they only change with the tiles in range
+        std::vector<glm::vec3>* tileLights = NULL;
+        if (renderer != drawnRenderer || from.startx != drawnFrom.startx || from.starty != drawnFrom.starty) {
+            lights.clear();
+            tileLights = &lights;
+        }
+        drawnRenderer = renderer;
+        drawnFrom = from;
 
-                const glm::mat4 transform = Object(position, STREET_DIR, SKY_DIR,
-                    building.scale).transformationMatrix();
+        std::vector<Renderer::StaticInstance> instances;
+        std::set<std::pair<int, int> > seen;
+        drawnTiles = 0;
 
-                renderer->drawModel(building.model, transform);
-            }
-                break;
-
-            case V: // Vertical road segment
-            {
-                if (gridy % 2 == 0) {
-                    const glm::vec3 position = tileOffset + glm::vec3(-TILE_SIZE / 2, 0.01, 0.0);
-                    Object arrangement = Object(position, STREET_DIR, SKY_DIR, streetlight.scale);
-                    arrangement.rotate(glm::vec3(0.0, TAU / 4, 0.0));
-                    const glm::mat4 transform = arrangement.transformationMatrix();
-                    renderer->drawModel(streetlight.model, transform);
-
-                    renderer->addLight(tileOffset + glm::vec3(-TILE_SIZE / STREETLIGHT_POS_DIV, STREETLIGHT_HEIGHT, 0));
-                }
-                else {
-                    const glm::vec3 position = tileOffset + glm::vec3(TILE_SIZE / 2, 0.01, 0.0);
-                    Object arrangement = Object(position, STREET_DIR, SKY_DIR, streetlight.scale);
-                    arrangement.rotate(glm::vec3(0.0, TAU / -4, 0.0));
-                    const glm::mat4 transform = arrangement.transformationMatrix();
-                    renderer->drawModel(streetlight.model, transform);
-
-                    renderer->addLight(tileOffset + glm::vec3(TILE_SIZE / STREETLIGHT_POS_DIV, STREETLIGHT_HEIGHT, 0));
+        // Only the tiles in the visible set of the camera's tile may be seen, its offsets are already
+        // nearest first as the renderer's horizon culler needs
+        if (from.culled) {
+            const std::vector<CityPvs::TileOffset>& tiles = pvs->visibleTiles(from.cameraX, from.cameraY);
+            for (size_t i = 0; i < tiles.size(); ++i) {
+                const int gridx = from.cameraX + tiles[i].x;
+                const int gridy = from.cameraY + tiles[i].y;
+                if (gridx >= startx && gridx < startx + gridSize && gridy >= starty && gridy < starty + gridSize) {
+                    addSeenTile(gridx, gridy, instances, NULL, seen);
                 }
             }
-                break;
-            case H: // Horizontal road segment
-            {
-                if (gridx % 2 == 0) {
-                    const glm::vec3 position = tileOffset + glm::vec3(0.0, 0.01, -TILE_SIZE / 2);
-                    const glm::mat4 transform = Object(position, STREET_DIR, SKY_DIR,
-                        streetlight.scale).transformationMatrix();
-                    renderer->drawModel(streetlight.model, transform);
-
-                    renderer->addLight(tileOffset + glm::vec3(0, STREETLIGHT_HEIGHT, -TILE_SIZE / STREETLIGHT_POS_DIV));
-                }
-                else {
-                    const glm::vec3 position = tileOffset + glm::vec3(0.0, 0.01, TILE_SIZE / 2);
-                    Object arrangement = Object(position, STREET_DIR, SKY_DIR, streetlight.scale);
-                    arrangement.rotate(glm::vec3(0.0, TAU / 2, 0.0));
-                    const glm::mat4 transform = arrangement.transformationMatrix();
-                    renderer->drawModel(streetlight.model, transform);
-
-                    renderer->addLight(tileOffset + glm::vec3(0, STREETLIGHT_HEIGHT, TILE_SIZE / STREETLIGHT_POS_DIV));
+        }
+
+        // Without a set the tiles are added in rings around the camera's tile, so the buildings reach
+        // the renderer nearest first too. With one the rings only add the lights, when they change
+        if (!from.culled || tileLights != NULL) {
+            const int centreX = std::min(std::max(cameraX - startx, 0), gridSize - 1);
+            const int centreY = std::min(std::max(cameraY - starty, 0), gridSize - 1);
+            const int rings = std::max(std::max(centreX, gridSize - 1 - centreX), std::max(centreY, gridSize - 1 - centreY));
+            for (int ring = 0; ring <= rings; ++ring) {
+                for (int y = std::max(centreY - ring, 0); y <= std::min(centreY + ring, gridSize - 1); ++y) {
+                    // Rows crossing the ring only have its two ends
+                    const bool wholeRow = ring == 0 || y == centreY - ring || y == centreY + ring;
+                    for (int x = centreX - ring; x <= centreX + ring; x += wholeRow ? 1 : 2 * ring) {
+                        if (x < 0 || x >= gridSize) {
+                            continue;
+                        }
+                        const int gridx = x + startx;
+                        const int gridy = y + starty;
+                        if (from.culled) {
+                            addTile(gridx, gridy, tileOffset(gridx, gridy), false, instances, tileLights);
+                        }
+                        else {
+                            addSeenTile(gridx, gridy, instances, tileLights, seen);
+                        }
+                    }
                 }
             }
+        }
+        seenProxies.assign(seen.begin(), seen.end());
+        renderer->setStaticInstances(staticGroup, instances);
+    }
+
+    for (size_t i = 0; i < lights.size(); ++i) {
+        renderer->addLight(lights[i]);
+    }
+
+    // Proxies are already in world space
+    for (size_t i = 0; i < seenProxies.size(); ++i) {
+        renderer->drawModel(proxies->proxy(seenProxies[i].first, seenProxies[i].second), glm::mat4(1.0f));
+    }
+    drawnProxies = seenProxies.size();
+}
+
+void City::addSeenTile(int gridx, int gridy, std::vector<Renderer::StaticInstance>& instances,
+    std::vector<glm::vec3>* tileLights, std::set<std::pair<int, int> >& seenChunks) const {
+    // Tiles in a proxied chunk only add their lights, the proxy is drawn instead
+    if (!proxiedChunks.empty()) {
+        const std::pair<int, int> chunk(chunkCoordinate(gridx), chunkCoordinate(gridy));
+        if (proxiedChunks.count(chunk) > 0) {
+            seenChunks.insert(chunk);
+            addTile(gridx, gridy, tileOffset(gridx, gridy), false, instances, tileLights);
+            return;
+        }
+    }
+
+    addTile(gridx, gridy, tileOffset(gridx, gridy), true, instances, tileLights);
+    ++drawnTiles;
+}
+
+size_t City::numDrawnTiles() const {
+    return drawnTiles;
+}
+
+size_t City::numDrawnProxies() const {
+    return drawnProxies;
+}
+
+glm::mat4 City::buildingTransform(int gridx, int gridy, size_t& index) const {
+    // Get the random building model from the array
+    index = (size_t)(noise(gridx, gridy) * (buildingTypes.size()));
+    const ObjectData& building = buildingTypes[index];
+
+    const glm::vec3 position = tileOffset(gridx, gridy) + glm::vec3(0, building.scale.y, 0);
+
+    return Object(position, STREET_DIR, SKY_DIR, building.scale).transformationMatrix();
+}
+
+void City::addTile(int gridx, int gridy, glm::vec3 tileOffset, bool drawModel,
+    std::vector<Renderer::StaticInstance>& instances, std::vector<glm::vec3>* tileLights) const {
+    switch (getTile(gridx, gridy)) {
+    case B: // Building case
+    {
+        if (drawModel) {
+            size_t index;
+            const glm::mat4 transform = buildingTransform(gridx, gridy, index);
+            const Renderer::StaticInstance instance = { buildingTypes[index].model, transform };
+            instances.push_back(instance);
+        }
+    }
+        break;
+
+    case V: // Vertical road segment
+    {
+        if (gridy % 2 == 0) {
+            if (drawModel) {
+                const glm::vec3 position = tileOffset + glm::vec3(-TILE_SIZE / 2, 0.01, 0.0);
+                Object arrangement = Object(position, STREET_DIR, SKY_DIR, streetlight.scale);
+                arrangement.rotate(glm::vec3(0.0, TAU / 4, 0.0));
+                const Renderer::StaticInstance instance = { streetlight.model, arrangement.transformationMatrix() };
+                instances.push_back(instance);
+            }
+
+            if (tileLights != NULL) {
+                tileLights->push_back(tileOffset + glm::vec3(-TILE_SIZE / STREETLIGHT_POS_DIV, STREETLIGHT_HEIGHT, 0));
+            }
+        }
+        else {
+            if (drawModel) {
+                const glm::vec3 position = tileOffset + glm::vec3(TILE_SIZE / 2, 0.01, 0.0);
+                Object arrangement = Object(position, STREET_DIR, SKY_DIR, streetlight.scale);
+                arrangement.rotate(glm::vec3(0.0, TAU / -4, 0.0));
+                const Renderer::StaticInstance instance = { streetlight.model, arrangement.transformationMatrix() };
+                instances.push_back(instance);
+            }
+
+            if (tileLights != NULL) {
+                tileLights->push_back(tileOffset + glm::vec3(TILE_SIZE / STREETLIGHT_POS_DIV, STREETLIGHT_HEIGHT, 0));
             }
         }
     }
+        break;
+    case H: // Horizontal road segment
+    {
+        if (gridx % 2 == 0) {
+            if (drawModel) {
+                const glm::vec3 position = tileOffset + glm::vec3(0.0, 0.01, -TILE_SIZE / 2);
+                const glm::mat4 transform = Object(position, STREET_DIR, SKY_DIR,
+                    streetlight.scale).transformationMatrix();
+                const Renderer::StaticInstance instance = { streetlight.model, transform };
+                instances.push_back(instance);
+            }
+
+            if (tileLights != NULL) {
+                tileLights->push_back(tileOffset + glm::vec3(0, STREETLIGHT_HEIGHT, -TILE_SIZE / STREETLIGHT_POS_DIV));
+            }
+        }
+        else {
+            if (drawModel) {
+                const glm::vec3 position = tileOffset + glm::vec3(0.0, 0.01, TILE_SIZE / 2);
+                Object arrangement = Object(position, STREET_DIR, SKY_DIR, streetlight.scale);
+                arrangement.rotate(glm::vec3(0.0, TAU / 2, 0.0));
+                const Renderer::StaticInstance instance = { streetlight.model, arrangement.transformationMatrix() };
+                instances.push_back(instance);
+            }
+
+            if (tileLights != NULL) {
+                tileLights->push_back(tileOffset + glm::vec3(0, STREETLIGHT_HEIGHT, TILE_SIZE / STREETLIGHT_POS_DIV));
+            }
+        }
+    }
+    }
 }
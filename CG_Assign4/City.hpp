@@ -1,22 +1,23 @@
 //! A basic class for creating, storing and rendering a basic city
 #pragma once
+#include <set>
 #include <vector>
 #include "Renderer.hpp"
 #include "ModelData.hpp"
+#include "CityLayout.hpp"
 #include "glm/vec2.hpp"
 
+class CityPvs;
+class ChunkProxies;
+
+// Tiles along each side of the chunks merged into proxies
+#define PROXY_CHUNK_TILES 4
+
 struct ObjectData {
     glm::vec3 scale;
     const ModelData* model;
 };
 
-enum TileType {
-    H, // Horizontal road
-    V, // Vertical road
-    I, // Intersection road
-    B, // Building
-};
-
 class City {
 public:
     /// <summary>
@@ -29,13 +30,71 @@ public:
     /// </summary>
     City(std::vector <ModelData *> base_models, const ModelData* streetlight_model, float renderDistance);
 
+    ~City();
+
+    /// <summary>
+    /// Load the potentially visible sets baked for this city by bake_pvs. While the camera stands
+    /// low enough on a road, only the tiles in its tile's set are drawn.
+    /// </summary>
+    ///
+    /// <param name="filename">The baked sets.</param>
+    /// <returns>false if the file is missing or was baked for a different city, every tile in range
+    /// is drawn then.</returns>
+    bool loadVisibleSets(const std::string& filename);
+
+    /// <summary>
+    /// Draw chunks of PROXY_CHUNK_TILES x PROXY_CHUNK_TILES tiles as a single merged model, their
+    /// proxy, once all of the chunk is in the fog. Proxies are merged in the background when a
+    /// chunk first needs one, the chunk's tiles are drawn until it is ready. Needs the GL context.
+    /// </summary>
+    ///
+    /// <param name="buildingProxies">A simplified version of each building model, in the same
+    /// order, merged with the ground tiles' models in their place.</param>
+    void enableProxies(const std::vector<RawModelData>& buildingProxies);
+
+    /// <summary>
+    /// Switch between drawing far chunks as proxies and drawing every tile, once proxies are enabled.
+    /// </summary>
+    void toggleProxies();
+
+    bool proxiesEnabled() const;
+
+    /// <summary>
+    /// Uploads the proxies merged since the last frame, requests the ones that are now needed and
+    /// picks the chunks drawn as proxies this frame. Call before drawing the city or its ground.
+    /// </summary>
+    ///
+    /// <param name="renderer">The renderer to obtain shader information from.</param>
+    void update(const Renderer* renderer, glm::vec3 cameraPosition);
+
     /// <summary>
-    /// Draws the city.
+    /// Whether the ground at a position is part of a proxy this frame, and shouldn't be drawn.
+    /// </summary>
+    bool drawnByProxy(glm::vec3 position) const;
+
+    /// <summary>
+    /// Changes whenever the chunks drawn as proxies do, so what depends on drawnByProxy can be kept until then.
+    /// </summary>
+    unsigned long proxiesVersion() const;
+
+    /// <summary>
+    /// Draws the city. The buildings and streetlights are static instances of the renderer, only set
+    /// again when the camera moves to another tile or the tiles drawn change.
     /// </summary>
     ///
     /// <param name="renderer>The renderer to draw to.</renderer>
     void draw(Renderer* renderer, glm::vec3 cameraPosition) const;
 
+    /// <summary>
+    /// The number of tiles whose models the last draw drew.
+    /// </summary>
+    size_t numDrawnTiles() const;
+
+    /// <summary>
+    /// The number of proxies the last draw drew.
+    /// </summary>
+    size_t numDrawnProxies() const;
+
     /// <summary>
     /// Gets the type of tile at specified position
     /// </summary>
@@ -45,5 +104,78 @@ private:
     std::vector<ObjectData> buildingTypes;
     ObjectData streetlight;
     int gridSize;
+    float renderDistance;
+    // NULL until loadVisibleSets succeeds
+    CityPvs* pvs;
+    mutable size_t drawnTiles;
+
+    // NULL until enableProxies is called
+    ChunkProxies* proxies;
+    bool useProxies;
+    // The chunks drawn as proxies this frame
+    std::set<std::pair<int, int> > proxiedChunks;
+    unsigned long proxiedVersion;
+    mutable size_t drawnProxies;
+
+    // What decides the tiles' models and lights
+    struct DrawnTiles {
+        int startx;
+        int starty;
+        // Whether the visible set of the camera's tile was used
+        bool culled;
+        // The camera's tile, which the tiles were ordered around
+        int cameraX;
+        int cameraY;
+        unsigned long proxies;
+
+        bool operator==(const DrawnTiles& other) const {
+            return startx == other.startx && starty == other.starty && culled == other.culled &&
+                cameraX == other.cameraX && cameraY == other.cameraY && proxies == other.proxies;
+        }
+    };
+
+    // The renderer the tiles' models were last set in, the group they were set in and what they
+    // were set from, drawnRenderer is NULL until the first draw
+    mutable Renderer* drawnRenderer;
+    mutable size_t staticGroup;
+    mutable DrawnTiles drawnFrom;
+    // The lights of the tiles and the proxied chunks that may be seen, added every draw
+    mutable std::vector<glm::vec3> lights;
+    mutable std::vector<std::pair<int, int> > seenProxies;
+
+    /// <summary>
+    /// The position of a tile's centre.
+    /// </summary>
+    glm::vec3 tileOffset(int gridx, int gridy) const;
+
+    /// <summary>
+    /// The transformation of a building tile's building.
+    /// </summary>
+    ///
+    /// <param name="index">Set to the building's index in buildingTypes.</param>
+    glm::mat4 buildingTransform(int gridx, int gridy, size_t& index) const;
+
+    /// <summary>
+    /// Picks the chunks drawn as proxies this frame, and requests the proxies they need.
+    /// </summary>
+    void updateProxies(const Renderer* renderer, glm::vec3 cameraPosition);
+
+    /// <summary>
+    /// Adds the building or streetlight of a tile, and the streetlight's light.
+    /// </summary>
+    ///
+    /// <param name="tileOffset">The position of the tile's centre.</param>
+    /// <param name="drawModel">false to only add the light, for tiles that can't be seen.</param>
+    /// <param name="tileLights">Where the light is added, NULL to leave it out.</param>
+    void addTile(int gridx, int gridy, glm::vec3 tileOffset, bool drawModel,
+        std::vector<Renderer::StaticInstance>& instances, std::vector<glm::vec3>* tileLights) const;
+
+    /// <summary>
+    /// Adds a tile that may be seen, or only its light if its chunk is drawn as a proxy this frame.
+    /// </summary>
+    ///
+    /// <param name="seenChunks">Where the proxied chunks of the tiles are added.</param>
+    void addSeenTile(int gridx, int gridy, std::vector<Renderer::StaticInstance>& instances,
+        std::vector<glm::vec3>* tileLights, std::set<std::pair<int, int> >& seenChunks) const;
 };
 
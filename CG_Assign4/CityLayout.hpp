@@ -0,0 +1,58 @@
+//! The city's repeating tile layout, shared by the city and the visible set baking tool
+#pragma once
+#include <cmath>
+
+// FIXME: This should be dynamic
+#define BUILDING_SCALE (2.0f)
+// FIXME: This should by dynamic
+#define BUILDING_GAP (1.2f)
+#define TILE_SIZE (BUILDING_SCALE * BUILDING_GAP)
+
+// The number of building models the city picks from, generated from the seeds 0 to NUMBER_OF_BUILDINGS - 1
+#define NUMBER_OF_BUILDINGS 20
+
+enum TileType {
+    H, // Horizontal road
+    V, // Vertical road
+    I, // Intersection road
+    B, // Building
+};
+
+#define KEY_WIDTH 5
+#define KEY_HEIGHT 6
+
+// Repeated in both directions to fill the city, x along a row and y down the columns
+const static TileType TILE_KEY[KEY_HEIGHT][KEY_WIDTH] = {
+        { B, B, V, B, B },
+        { H, H, I, H, H },
+        { B, B, V, B, B },
+        { B, B, V, B, B },
+        { H, H, I, H, H },
+        { B, B, V, B, B },
+};
+
+/// <summary>
+/// Wraps a tile coordinate into the key, negative coordinates included.
+/// </summary>
+///
+/// <param name="coordinate">The tile's x or y.</param>
+/// <param name="size">KEY_WIDTH for x, KEY_HEIGHT for y.</param>
+inline int keyCoordinate(int coordinate, int size) {
+    const int wrapped = coordinate % size;
+    return wrapped < 0 ? wrapped + size : wrapped;
+}
+
+/// <summary>
+/// Gets the type of the tile at a tile coordinate.
+/// </summary>
+inline TileType getTile(int x, int y) {
+    return TILE_KEY[keyCoordinate(y, KEY_HEIGHT)][keyCoordinate(x, KEY_WIDTH)];
+}
+
+/// <summary>
+/// The number of tiles along each side of the grid the city draws around the camera, enough that new
+/// buildings can't be seen appearing as the camera moves.
+/// </summary>
+inline int cityGridSize(float renderDistance) {
+    return static_cast<int>(ceilf(renderDistance * 2 / TILE_SIZE)) + 5;
+}
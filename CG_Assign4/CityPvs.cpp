@@ -0,0 +1,139 @@
+#include "CityPvs.hpp"
+#include "CityLayout.hpp"
+#include "AssetPack.hpp"
+#include <cstdio>
+#include <cstring>
+
+// "CPVS", also catches files written with the other byte order
+#define CITY_PVS_MAGIC 0x53565043u
+
+// Followed by each key tile's uint32_t set size, row by row, then all of the sets' offsets in the same order
+struct PvsHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t key;
+    CityPvs::Parameters parameters;
+    uint32_t numSets;
+    uint32_t numOffsets;
+};
+
+CityPvs::CityPvs() {
+}
+
+CityPvs* CityPvs::open(const std::string& filename, uint64_t key) {
+    AssetFile* file = AssetPack::open(filename);
+    if (file == NULL) {
+        return NULL;
+    }
+
+    // Check the file is complete and was baked for the same city
+    PvsHeader header;
+    bool valid = file->size() >= sizeof(header);
+    if (valid) {
+        memcpy(&header, file->data(), sizeof(header));
+        valid = header.magic == CITY_PVS_MAGIC && header.version == CITY_PVS_VERSION && header.key == key &&
+            header.numSets == KEY_WIDTH * KEY_HEIGHT &&
+            file->size() == sizeof(header) + header.numSets * sizeof(uint32_t) + header.numOffsets * sizeof(TileOffset);
+    }
+    if (!valid) {
+        delete file;
+        return NULL;
+    }
+
+    CityPvs* pvs = new CityPvs();
+    pvs->params = header.parameters;
+    pvs->sets.resize(header.numSets);
+    const char* sizes = file->data() + sizeof(header);
+    const char* offsets = sizes + header.numSets * sizeof(uint32_t);
+    uint32_t read = 0;
+    for (uint32_t i = 0; i < header.numSets && valid; ++i) {
+        uint32_t size;
+        memcpy(&size, sizes + i * sizeof(uint32_t), sizeof(size));
+        valid = size <= header.numOffsets - read;
+        if (valid && size > 0) {
+            pvs->sets[i].resize(size);
+            memcpy(&pvs->sets[i][0], offsets + read * sizeof(TileOffset), size * sizeof(TileOffset));
+            read += size;
+        }
+    }
+    delete file;
+    if (!valid) {
+        delete pvs;
+        return NULL;
+    }
+    return pvs;
+}
+
+bool CityPvs::write(const std::string& filename, uint64_t key, const Parameters& parameters,
+        const std::vector<std::vector<TileOffset> >& sets) {
+    PvsHeader header;
+    memset(static_cast<void*>(&header), 0, sizeof(header));
+    header.magic = CITY_PVS_MAGIC;
+    header.version = CITY_PVS_VERSION;
+    header.key = key;
+    header.parameters = parameters;
+    header.numSets = sets.size();
+
+    std::vector<uint32_t> sizes;
+    std::vector<TileOffset> offsets;
+    for (size_t i = 0; i < sets.size(); ++i) {
+        sizes.push_back(sets[i].size());
+        offsets.insert(offsets.end(), sets[i].begin(), sets[i].end());
+    }
+    header.numOffsets = offsets.size();
+
+    // Write to a temporary file first so a half written file is never picked up
+    std::string temporary = filename + ".tmp";
+    FILE* out = fopen(temporary.c_str(), "wb");
+    if (out == NULL) {
+        return false;
+    }
+    bool written = fwrite(&header, sizeof(header), 1, out) == 1;
+    if (!sizes.empty()) {
+        written = written && fwrite(&sizes[0], sizeof(uint32_t), sizes.size(), out) == sizes.size();
+    }
+    if (!offsets.empty()) {
+        written = written && fwrite(&offsets[0], sizeof(TileOffset), offsets.size(), out) == offsets.size();
+    }
+    written = (fclose(out) == 0) && written;
+#ifdef WIN32
+    remove(filename.c_str());
+#endif
+    if (!written || rename(temporary.c_str(), filename.c_str()) != 0) {
+        remove(temporary.c_str());
+        return false;
+    }
+    return true;
+}
+
+// FNV-1a over raw bytes
+static uint64_t hashBytes(uint64_t hash, const void* data, size_t size) {
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    for (size_t i = 0; i < size; ++i) {
+        hash = (hash ^ bytes[i]) * 1099511628211ull;
+    }
+    return hash;
+}
+
+uint64_t CityPvs::key(float renderDistance, const std::vector<std::vector<BoundingBox> >& buildingOccluders) {
+    uint64_t hash = 14695981039346656037ull;
+    const float layout[3] = { TILE_SIZE, BUILDING_SCALE, renderDistance };
+    hash = hashBytes(hash, layout, sizeof(layout));
+    hash = hashBytes(hash, TILE_KEY, sizeof(TILE_KEY));
+    for (size_t i = 0; i < buildingOccluders.size(); ++i) {
+        const uint32_t count = buildingOccluders[i].size();
+        hash = hashBytes(hash, &count, sizeof(count));
+        if (count > 0) {
+            hash = hashBytes(hash, &buildingOccluders[i][0], count * sizeof(BoundingBox));
+        }
+    }
+    return hash;
+}
+
+const CityPvs::Parameters& CityPvs::parameters() const {
+    return params;
+}
+
+const std::vector<CityPvs::TileOffset>& CityPvs::visibleTiles(int x, int y) const {
+    return sets[keyCoordinate(y, KEY_HEIGHT) * KEY_WIDTH + keyCoordinate(x, KEY_WIDTH)];
+}
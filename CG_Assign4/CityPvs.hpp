@@ -0,0 +1,79 @@
+//! Potentially visible sets of the city's repeating tile layout, baked by bake_pvs
+#pragma once
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include "ModelData.hpp"
+
+// The sets built by 'make pvs', loaded at startup if they exist
+#define CITY_PVS_FILENAME "city.pvs"
+
+// Bump whenever the layout of the file or the order of the sets changes, older files are then ignored
+#define CITY_PVS_VERSION 2
+
+/// <summary>
+/// For each tile of the city's key that the camera can stand on, the offsets of the tiles that may
+/// be visible from anywhere on it, up to an eye height. As the layout repeats, every tile of the
+/// same key position sees the same offsets, except for how tall its buildings are. The sets are
+/// baked with the shortest buildings as occluders and the tallest as targets, so they hold for any
+/// city whose buildings' heights are in that range.
+/// </summary>
+class CityPvs {
+public:
+    struct TileOffset {
+        int16_t x;
+        int16_t y;
+    };
+
+    // What the sets were baked for
+    struct Parameters {
+        float renderDistance;
+        // The sets only hold while the camera is at most this high
+        float eyeHeight;
+        // The range of the buildings' y scales
+        float minBuildingScale;
+        float maxBuildingScale;
+    };
+
+    /// <summary>
+    /// Read baked sets, from the asset pack or the loose file.
+    /// </summary>
+    ///
+    /// <param name="filename">The file written by write.</param>
+    /// <param name="key">Identifies the city the sets were baked for, see key.</param>
+    /// <returns>The sets, or NULL if the file is missing, from another version or has a different key.</returns>
+    static CityPvs* open(const std::string& filename, uint64_t key);
+
+    /// <summary>
+    /// Write baked sets.
+    /// </summary>
+    ///
+    /// <param name="sets">The set of each key tile, row by row, empty for tiles the camera can't stand on.
+    /// Each set is ordered by the ring of tiles around its key tile the offsets are in, nearest first.</param>
+    /// <returns>true if the file was written.</returns>
+    static bool write(const std::string& filename, uint64_t key, const Parameters& parameters,
+        const std::vector<std::vector<TileOffset> >& sets);
+
+    /// <summary>
+    /// Identifies a city by everything the sets depend on: the tile layout, the render distance and
+    /// the occluders of each building model, unscaled and in the order the city picks them from.
+    /// </summary>
+    static uint64_t key(float renderDistance, const std::vector<std::vector<BoundingBox> >& buildingOccluders);
+
+    const Parameters& parameters() const;
+
+    /// <summary>
+    /// The offsets of the tiles that may be visible from a tile, empty if there's no set for it. They
+    /// are ordered by the ring of tiles around it they are in, nearest first.
+    /// </summary>
+    ///
+    /// <param name="x">The tile's x, wrapped into the key.</param>
+    /// <param name="y">The tile's y, wrapped into the key.</param>
+    const std::vector<TileOffset>& visibleTiles(int x, int y) const;
+
+private:
+    CityPvs();
+
+    Parameters params;
+    std::vector<std::vector<TileOffset> > sets;
+};
@@ -2,25 +2,27 @@
 #pragma once
 
 #include "GLHeaders.hpp"
+#include "AssetPack.hpp"
+#include "MappedFile.hpp"
+#include "MeshCache.hpp"
+#include <cstdio>
+#include <cstring>
 #include <iostream>
-#include <fstream>
 #include <string>
+#include <vector>
+#include <stdint.h>
 
 #define EXIT_SUCCESS 0
 #define EXIT_FAILURE 1
 
-/// <summary>
-/// Compiles a GLSL shader.
-/// </summary>
-///
-/// <param name="src">The shader's source string.</param>
-/// <param name="shaderType">The type of shader (e.g. GL_VERTEX_SHADER).</param>
-GLuint compileShader(const char* src, GLenum shaderType) {
-    GLuint shader = glCreateShader(shaderType);
-    glShaderSource(shader, 1, (const GLchar**)&src, NULL);
-    glCompileShader(shader);
+// "PRGB", program binaries are stored beside the mesh cache in MESH_CACHE_DIRECTORY
+#define PROGRAM_CACHE_MAGIC 0x42475250u
 
-    // Check that the shader successfully compiled
+// Bump whenever the layout of the file changes, older files are then ignored and rewritten
+#define PROGRAM_CACHE_VERSION 1
+
+// Exits with the shader's log if it failed to compile
+inline void checkShaderCompiled(GLuint shader) {
     GLint compiled;
     glGetShaderiv(shader, GL_COMPILE_STATUS, &compiled);
     if (!compiled) {
@@ -37,38 +39,72 @@ GLuint compileShader(const char* src, GLenum shaderType) {
 
         exit(EXIT_FAILURE);
     }
+}
+
+// Exits with the program's log if it failed to link
+inline void checkProgramLinked(GLuint program) {
+    GLint linked;
+    glGetProgramiv(program, GL_LINK_STATUS, &linked);
+    if (linked != (GLint)GL_TRUE) {
+        // Get log length
+        GLint logSize;
+        glGetProgramiv(program, GL_INFO_LOG_LENGTH, &logSize);
+
+        // Get the log message
+        char* logMsg = new char[logSize];
+        glGetProgramInfoLog(program, logSize, NULL, logMsg);
+
+        std::cerr << "Failed to link shader program: " << logMsg << std::endl;
+        delete[] logMsg;
+
+        exit(EXIT_FAILURE);
+    }
+}
+
+/// <summary>
+/// Compiles a GLSL shader.
+/// </summary>
+///
+/// <param name="src">The shader's source string.</param>
+/// <param name="shaderType">The type of shader (e.g. GL_VERTEX_SHADER).</param>
+inline GLuint compileShader(const char* src, GLenum shaderType) {
+    GLuint shader = glCreateShader(shaderType);
+    glShaderSource(shader, 1, (const GLchar**)&src, NULL);
+    glCompileShader(shader);
+
+    // Check that the shader successfully compiled
+    checkShaderCompiled(shader);
 
     return shader;
 }
 
 /// <summary>
-/// Loads and compiles a GLSL shader from a file.
+/// Reads a GLSL shader's source from a file, or from the asset pack if it has the file.
 /// </summary>
 ///
 /// <param name="filename">The shader's filename.</param>
-/// <param name="shaderType">The type of shader (e.g. GL_VERTEX_SHADER).</param>
-GLuint shaderFromFile(const std::string& filename, GLenum shaderType) {
-    std::ifstream file(filename.c_str());
+inline std::string shaderSource(const std::string& filename) {
+    AssetFile* file = AssetPack::open(filename);
 
     // Check that the file was opened
-    if (!file.is_open()) {
+    if (file == NULL) {
         std::cerr << "Failed to read: " << filename << std::endl;
         exit(EXIT_FAILURE);
     }
 
-    // Find the size of the file
-    file.seekg(0, std::ios::end);
-    size_t size = static_cast<size_t>(file.tellg());
-
-    // Read the file into a buffer
-    std::string buffer(size, ' ');
-    file.seekg(0);
-    file.read(&buffer[0], size);
-
-    // Close the file
-    file.close();
+    std::string source(file->data() != NULL ? file->data() : "", file->size());
+    delete file;
+    return source;
+}
 
-    return compileShader(buffer.c_str(), shaderType);
+/// <summary>
+/// Loads and compiles a GLSL shader from a file, or from the asset pack if it has the file.
+/// </summary>
+///
+/// <param name="filename">The shader's filename.</param>
+/// <param name="shaderType">The type of shader (e.g. GL_VERTEX_SHADER).</param>
+inline GLuint shaderFromFile(const std::string& filename, GLenum shaderType) {
+    return compileShader(shaderSource(filename).c_str(), shaderType);
 }
 
 /// <summary>
@@ -77,7 +113,7 @@ GLuint shaderFromFile(const std::string& filename, GLenum shaderType) {
 ///
 /// <param name="vertexShader">The vertex shader to use in the program.</param>
 /// <param name="fragmentShader">The fragment shader to use in the program.</param>
-GLuint initProgram(GLuint vertexShader, GLuint fragmentShader) {
+inline GLuint initProgram(GLuint vertexShader, GLuint fragmentShader) {
     GLuint program = glCreateProgram();
 
     glAttachShader(program, vertexShader);
@@ -86,22 +122,240 @@ GLuint initProgram(GLuint vertexShader, GLuint fragmentShader) {
 
     // Check if the program successfully linked. If the program failed to link, get the error
     // message to show to the user.
+    checkProgramLinked(program);
+    return program;
+}
+
+/// <summary>
+/// The sources of a program for initPrograms.
+/// </summary>
+struct ProgramSource {
+    const char* vertexFile;
+    const char* fragmentFile;
+    // Lines such as "#define SHADOWS 1" inserted after the #version line of both shaders, may be empty
+    const char* defines;
+    // Vertex attribute names bound to locations 0, 1, 2... before linking, NULL terminated. May be
+    // NULL to let the linker choose.
+    const char* const* attributes;
+};
+
+// Inserts the defines after the #version line, which has to stay first
+inline std::string addDefines(const std::string& source, const std::string& defines) {
+    if (defines.empty()) {
+        return source;
+    }
+    size_t start = 0;
+    if (source.compare(0, 8, "#version") == 0) {
+        start = source.find('\n');
+        start = (start == std::string::npos) ? source.size() : start + 1;
+    }
+    return source.substr(0, start) + defines + "\n" + source.substr(start);
+}
+
+// FNV-1a, continuing from 'hash'. The terminating null is included so adjacent strings can't run together.
+inline uint64_t hashString(uint64_t hash, const char* string) {
+    const size_t length = (string != NULL) ? strlen(string) + 1 : 0;
+    for (size_t i = 0; i < length; ++i) {
+        hash = (hash ^ static_cast<unsigned char>(string[i])) * 1099511628211ull;
+    }
+    return hash;
+}
+
+// Identifies a program built from the given sources and attribute locations by the current driver
+inline uint64_t programKey(const std::string& vertexSource, const std::string& fragmentSource,
+        const char* const* attributes) {
+    uint64_t hash = 14695981039346656037ull;
+    hash = hashString(hash, vertexSource.c_str());
+    hash = hashString(hash, fragmentSource.c_str());
+    for (size_t i = 0; attributes != NULL && attributes[i] != NULL; ++i) {
+        hash = hashString(hash, attributes[i]);
+    }
+    hash = hashString(hash, reinterpret_cast<const char*>(glGetString(GL_VENDOR)));
+    hash = hashString(hash, reinterpret_cast<const char*>(glGetString(GL_RENDERER)));
+    hash = hashString(hash, reinterpret_cast<const char*>(glGetString(GL_VERSION)));
+    return hash;
+}
+
+inline std::string programCacheFilename(uint64_t key) {
+    char name[32];
+    sprintf(name, "%08x%08x.program", static_cast<unsigned int>(key >> 32), static_cast<unsigned int>(key));
+    return std::string(MESH_CACHE_DIRECTORY) + name;
+}
+
+struct ProgramCacheHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t key;
+    uint32_t format;
+    uint32_t length;
+};
+
+// Program binaries need GL 4.1 or ARB_get_program_binary, and a driver with at least one format
+inline bool programBinariesSupported() {
+#ifdef GL_NUM_PROGRAM_BINARY_FORMATS
+    GLint numFormats = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &numFormats);
+    // Older contexts don't know the query, so clear the error it leaves behind
+    while (glGetError() != GL_NO_ERROR) {
+    }
+    return numFormats > 0;
+#else
+    return false;
+#endif
+}
+
+// Creates a program from its cached binary, 0 if there is none or the driver rejects it
+inline GLuint programFromCache(uint64_t key) {
+#ifdef GL_NUM_PROGRAM_BINARY_FORMATS
+    MappedFile* file = MappedFile::open(programCacheFilename(key));
+    if (file == NULL) {
+        return 0;
+    }
+    const ProgramCacheHeader* header = reinterpret_cast<const ProgramCacheHeader*>(file->data());
+    if (file->size() < sizeof(ProgramCacheHeader) || header->magic != PROGRAM_CACHE_MAGIC ||
+            header->version != PROGRAM_CACHE_VERSION || header->key != key ||
+            file->size() - sizeof(ProgramCacheHeader) != header->length) {
+        delete file;
+        return 0;
+    }
+
+    GLuint program = glCreateProgram();
+    glProgramBinary(program, header->format, file->data() + sizeof(ProgramCacheHeader), header->length);
+    delete file;
+
+    // Drivers reject binaries after an update even if the version string is unchanged
     GLint linked;
     glGetProgramiv(program, GL_LINK_STATUS, &linked);
     if (linked != (GLint)GL_TRUE) {
-        // Get log length
-        GLint logSize;
-        glGetProgramiv(program, GL_INFO_LOG_LENGTH, &logSize);
-
-        // Get the log message
-        char* logMsg = new char[logSize];
-        glGetProgramInfoLog(program, logSize, NULL, logMsg);
+        glDeleteProgram(program);
+        return 0;
+    }
+    return program;
+#else
+    return 0;
+#endif
+}
 
-        std::cerr << "Failed to link shader program: " << logMsg << std::endl;
-        delete[] logMsg;
+// Writes a linked program's binary to the cache, failing only costs the next start a compile
+inline void saveProgramBinary(GLuint program, uint64_t key) {
+#ifdef GL_NUM_PROGRAM_BINARY_FORMATS
+    GLint length = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0) {
+        return;
+    }
+    std::vector<char> contents(sizeof(ProgramCacheHeader) + length);
+    ProgramCacheHeader header;
+    GLenum format;
+    GLsizei written = 0;
+    glGetProgramBinary(program, length, &written, &format, &contents[sizeof(ProgramCacheHeader)]);
+    if (written <= 0) {
+        return;
+    }
+    header.magic = PROGRAM_CACHE_MAGIC;
+    header.version = PROGRAM_CACHE_VERSION;
+    header.key = key;
+    header.format = format;
+    header.length = written;
+    memcpy(&contents[0], &header, sizeof(header));
+    contents.resize(sizeof(ProgramCacheHeader) + written);
 
-        exit(EXIT_FAILURE);
+    // Write to a temporary file first so a half written binary is never picked up
+    MeshCache::createDirectory();
+    const std::string filename = programCacheFilename(key);
+    const std::string temporary = filename + ".tmp";
+    FILE* out = fopen(temporary.c_str(), "wb");
+    if (out == NULL) {
+        return;
     }
-    return program;
+    bool saved = fwrite(&contents[0], 1, contents.size(), out) == contents.size();
+    saved = (fclose(out) == 0) && saved;
+#ifdef WIN32
+    remove(filename.c_str());
+#endif
+    if (!saved || rename(temporary.c_str(), filename.c_str()) != 0) {
+        remove(temporary.c_str());
+    }
+#endif
 }
 
+/// <summary>
+/// Create several GLSL programs at once. Each program is loaded from its cached binary if the
+/// sources, defines and driver are unchanged, and otherwise compiled from source and its binary
+/// cached for next time. Every compile and link is started before any is checked, so drivers with
+/// KHR_parallel_shader_compile build the programs in parallel.
+/// </summary>
+///
+/// <param name="sources">The sources of each program.</param>
+/// <param name="programs">Receives the id of each program.</param>
+/// <param name="count">The number of programs.</param>
+inline void initPrograms(const ProgramSource* sources, GLuint* programs, size_t count) {
+    const bool useBinaries = programBinariesSupported();
+#ifdef GLEW_KHR_parallel_shader_compile
+    if (GLEW_KHR_parallel_shader_compile) {
+        glMaxShaderCompilerThreadsKHR(0xFFFFFFFFu);
+    }
+#endif
+
+    std::vector<uint64_t> keys(count);
+    std::vector<GLuint> vertexShaders(count, 0);
+    std::vector<GLuint> fragmentShaders(count, 0);
+    for (size_t i = 0; i < count; ++i) {
+        const std::string defines = (sources[i].defines != NULL) ? sources[i].defines : "";
+        const std::string vertexSource = addDefines(shaderSource(sources[i].vertexFile), defines);
+        const std::string fragmentSource = addDefines(shaderSource(sources[i].fragmentFile), defines);
+        keys[i] = programKey(vertexSource, fragmentSource, sources[i].attributes);
+
+        programs[i] = useBinaries ? programFromCache(keys[i]) : 0;
+        if (programs[i] != 0) {
+            continue;
+        }
+
+        // Start compiling, the results are checked once everything has been started
+        const char* vertexString = vertexSource.c_str();
+        const char* fragmentString = fragmentSource.c_str();
+        vertexShaders[i] = glCreateShader(GL_VERTEX_SHADER);
+        glShaderSource(vertexShaders[i], 1, (const GLchar**)&vertexString, NULL);
+        glCompileShader(vertexShaders[i]);
+        fragmentShaders[i] = glCreateShader(GL_FRAGMENT_SHADER);
+        glShaderSource(fragmentShaders[i], 1, (const GLchar**)&fragmentString, NULL);
+        glCompileShader(fragmentShaders[i]);
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        if (vertexShaders[i] == 0) {
+            continue;
+        }
+        programs[i] = glCreateProgram();
+        glAttachShader(programs[i], vertexShaders[i]);
+        glAttachShader(programs[i], fragmentShaders[i]);
+        for (GLuint location = 0; sources[i].attributes != NULL && sources[i].attributes[location] != NULL; ++location) {
+            glBindAttribLocation(programs[i], location, sources[i].attributes[location]);
+        }
+#ifdef GL_NUM_PROGRAM_BINARY_FORMATS
+        if (useBinaries) {
+            glProgramParameteri(programs[i], GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+        }
+#endif
+        glLinkProgram(programs[i]);
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        if (vertexShaders[i] == 0) {
+            continue;
+        }
+        checkShaderCompiled(vertexShaders[i]);
+        checkShaderCompiled(fragmentShaders[i]);
+        checkProgramLinked(programs[i]);
+
+        // The program keeps what it needs, so the shaders can go
+        glDetachShader(programs[i], vertexShaders[i]);
+        glDetachShader(programs[i], fragmentShaders[i]);
+        glDeleteShader(vertexShaders[i]);
+        glDeleteShader(fragmentShaders[i]);
+
+        if (useBinaries) {
+            saveProgramBinary(programs[i], keys[i]);
+        }
+    }
+}
@@ -0,0 +1,370 @@
+//! Benchmark and check for the compute shader culler, on a headless OpenGL 4.3 context
+//
+// usage: gpu_cull_bench [-n iterations]
+//
+// Grids of city blocks of growing size are generated, with a building on each block and a
+// streetlight on each street tile, and culled from street level with the renderer's projection,
+// render distance, levels of detail and a sun above. Buildings have a coarser level and
+// streetlights are dropped when far. The time the same tests take on the CPU is compared with the
+// time the instances take to add, once for each grid, with the time the CPU spends in each frame's
+// cull, which doesn't visit instances and should stay flat as the grid grows, and with the time
+// until the GPU has culled them. The context is made with EGL without a window, so this runs on
+// Mesa's llvmpipe, where the "GPU" time is spent on the CPU too, and in the cull call as llvmpipe
+// runs the dispatch there.
+//
+// Each grid replaces the last one's instances, so removed slots are reused. The results of the
+// largest grid are read back and checked against the same tests on the CPU: an instance with a
+// corner inside a view must never be culled unless its level draws nothing, every draw command of
+// a batch must have the batch's instance count, and each instance should be drawn with the level
+// the renderer would choose.
+#include "GpuCuller.hpp"
+#include "glm/gtc/matrix_transform.hpp"
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <set>
+#include <utility>
+#include <time.h>
+
+#define TILE_SIZE 2.0f
+#define NUM_BUILDINGS 4
+#define RENDER_DISTANCE 30.0f
+#define SCREEN_HEIGHT 1080.0f
+#define PIXEL_ERROR 2.0f
+#define HYSTERESIS 0.1f
+#define FOG_FADE 10.0f
+// The largest distance of the buildings' coarser level, and the streetlights' empty one, from the full model
+#define BUILDING_ERROR 0.04f
+#define STREETLIGHT_ERROR 0.02f
+
+// Wall clock time in seconds
+static double now() {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec * 1e-9;
+}
+
+// Makes a core 4.3 context current without a window, returns false if there is none
+static bool createContext() {
+    EGLDisplay display = EGL_NO_DISPLAY;
+    PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+        (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+    if (getPlatformDisplay != NULL) {
+        display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+    }
+    if (display == EGL_NO_DISPLAY) {
+        display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    }
+    EGLint major, minor;
+    if (!eglInitialize(display, &major, &minor) || !eglBindAPI(EGL_OPENGL_API)) {
+        return false;
+    }
+    const EGLint attributes[] = {
+        EGL_CONTEXT_MAJOR_VERSION, 4,
+        EGL_CONTEXT_MINOR_VERSION, 3,
+        EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+        EGL_NONE
+    };
+    EGLContext context = eglCreateContext(display, (EGLConfig)0, EGL_NO_CONTEXT, attributes);
+    return context != EGL_NO_CONTEXT && eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context);
+}
+
+struct Scene {
+    BoundingBox bounds[NUM_BUILDINGS + 1];
+    std::vector<size_t> models;
+    std::vector<glm::mat4> transformations;
+};
+
+// Each building's batches are its full model and its coarser level, the streetlights' batch is last
+static size_t levelBatch(size_t model, size_t level) {
+    if (model == NUM_BUILDINGS) {
+        return level == 0 ? 2 * NUM_BUILDINGS : GpuCuller::NO_BATCH;
+    }
+    return 2 * model + level;
+}
+
+// Every third row and column of tiles is a street with a streetlight, the rest are buildings
+// turned by multiples of 90 degrees
+static void buildCity(int gridSize, Scene& scene) {
+    for (int i = 0; i < NUM_BUILDINGS; ++i) {
+        scene.bounds[i].minVertex = glm::vec3(-0.9f, 0.0f, -0.6f);
+        scene.bounds[i].maxVertex = glm::vec3(0.9f, 2.0f + 2.0f * i, 0.6f);
+    }
+    scene.bounds[NUM_BUILDINGS].minVertex = glm::vec3(-0.05f, 0.0f, -0.05f);
+    scene.bounds[NUM_BUILDINGS].maxVertex = glm::vec3(0.05f, 1.0f, 0.05f);
+
+    for (int z = -gridSize; z <= gridSize; ++z) {
+        for (int x = -gridSize; x <= gridSize; ++x) {
+            const glm::vec3 center(x * TILE_SIZE, 0.0f, z * TILE_SIZE);
+            const int hash = (x * 7919 + z * 104729) & 0xffff;
+            if (x % 3 != 0 && z % 3 != 0) {
+                scene.models.push_back(hash % NUM_BUILDINGS);
+                scene.transformations.push_back(glm::rotate(glm::translate(glm::mat4(1.0f), center),
+                    (hash % 4) * 1.5707963f, glm::vec3(0.0f, 1.0f, 0.0f)));
+            }
+            else {
+                scene.models.push_back(NUM_BUILDINGS);
+                scene.transformations.push_back(glm::translate(glm::mat4(1.0f), center + glm::vec3(0.8f, 0.0f, 0.8f)));
+            }
+        }
+    }
+}
+
+// Two camera ranges and three shadow ranges for each batch, they are never drawn here
+static void addModels(GpuCuller& culler, const Scene& scene) {
+    std::vector<GpuCuller::DrawRange> cameraRanges, shadowRanges;
+    for (GLuint i = 0; i < 3; ++i) {
+        const GpuCuller::DrawRange range = { i * 36, 36 };
+        if (i < 2) {
+            cameraRanges.push_back(range);
+        }
+        shadowRanges.push_back(range);
+    }
+    for (int i = 0; i <= 2 * NUM_BUILDINGS; ++i) {
+        culler.addBatch(cameraRanges, shadowRanges);
+    }
+
+    GpuCuller::Impostor noImpostor;
+    noImpostor.radius = 0.0f;
+    noImpostor.sphere = glm::mat4(1.0f);
+    noImpostor.layer = 0.0f;
+    noImpostor.shadowBatch = GpuCuller::NO_BATCH;
+    for (size_t i = 0; i <= NUM_BUILDINGS; ++i) {
+        std::vector<GpuCuller::Level> levels;
+        for (size_t level = 0; level < 2; ++level) {
+            const GpuCuller::Level added = { static_cast<GLuint>(levelBatch(i, level)),
+                level == 0 ? 0.0f : (i == NUM_BUILDINGS ? STREETLIGHT_ERROR : BUILDING_ERROR) };
+            levels.push_back(added);
+        }
+        culler.addModel(scene.bounds[i], levels, noImpostor);
+    }
+}
+
+// The distance past which an error is too small to see, as Renderer::lodDistance
+static float lodDistance(const GpuCuller::Falloff& falloff, float error) {
+    const float pixels = error * falloff.pixelsPerUnit;
+    const float clear = pixels / falloff.pixelError;
+    if (clear <= falloff.fogStart) {
+        return clear;
+    }
+    return pixels * (falloff.fogStart + falloff.fogLength) / (falloff.pixelError * falloff.fogLength + pixels);
+}
+
+// The box around the transformed bounds, as the shader computes it
+static void worldBox(const BoundingBox& bounds, const glm::mat4& m, glm::vec3& center, glm::vec3& extent) {
+    const glm::vec3 localCenter = 0.5f * (bounds.minVertex + bounds.maxVertex);
+    const glm::vec3 localExtent = 0.5f * (bounds.maxVertex - bounds.minVertex);
+    center = glm::vec3(m * glm::vec4(localCenter, 1.0f));
+    extent = glm::abs(glm::vec3(m[0])) * localExtent.x + glm::abs(glm::vec3(m[1])) * localExtent.y +
+        glm::abs(glm::vec3(m[2])) * localExtent.z;
+}
+
+static bool insidePlanes(const glm::vec4 planes[6], glm::vec3 center, glm::vec3 extent) {
+    for (int i = 0; i < 6; ++i) {
+        const glm::vec3 normal(planes[i]);
+        if (glm::dot(normal, center) + glm::dot(glm::abs(normal), extent) + planes[i].w < 0.0f) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static float boxDistance(glm::vec3 point, glm::vec3 center, glm::vec3 extent) {
+    return glm::length(glm::clamp(point, center - extent, center + extent) - point);
+}
+
+// Whether any corner of the bounds is inside the clip volume
+static bool cornerInView(const BoundingBox& bounds, const glm::mat4& mvp) {
+    for (int i = 0; i < 8; ++i) {
+        const glm::vec4 corner(
+            (i & 1) ? bounds.maxVertex.x : bounds.minVertex.x,
+            (i & 2) ? bounds.maxVertex.y : bounds.minVertex.y,
+            (i & 4) ? bounds.maxVertex.z : bounds.minVertex.z,
+            1.0f);
+        const glm::vec4 clip = mvp * corner;
+        if (glm::abs(clip.x) <= clip.w && glm::abs(clip.y) <= clip.w && glm::abs(clip.z) <= clip.w) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Instances are identified by their tile
+static std::pair<int, int> tileOf(const glm::mat4& m) {
+    return std::make_pair(static_cast<int>(std::floor(m[3].x / TILE_SIZE + 0.5f)),
+        static_cast<int>(std::floor(m[3].z / TILE_SIZE + 0.5f)));
+}
+
+int main(int argc, char** argv) {
+    int iterations = 20;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            iterations = atoi(argv[++i]);
+            if (iterations < 1) iterations = 1;
+        }
+        else {
+            fprintf(stderr, "usage: %s [-n iterations]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if (!createContext()) {
+        fprintf(stderr, "No OpenGL 4.3 context\n");
+        return 1;
+    }
+#ifndef __APPLE__
+    // Reports that there is no GLX display, but the GL functions are loaded
+    glewInit();
+#endif
+    if (!GpuCuller::supported()) {
+        fprintf(stderr, "Compute shaders aren't supported by %s\n", glGetString(GL_RENDERER));
+        return 1;
+    }
+    printf("%s, %s\n", glGetString(GL_RENDERER), glGetString(GL_VERSION));
+
+    // Standing in an avenue looking along it, with the renderer's projection and the sun in the afternoon
+    const glm::vec3 camera(0.0f, 1.5f, 1.0f);
+    const glm::mat4 view = glm::lookAt(camera, camera + glm::vec3(0.3f, -0.05f, 1.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    const glm::mat4 proj = glm::perspective(60.0f / 360.0f * 6.283185307179586f, 16.0f / 9.0f, 0.1f, 200.0f);
+    const glm::mat4 cameraViewProjection = proj * view;
+    const glm::mat4 sunViewProjection = glm::ortho(-40.0f, 40.0f, -40.0f, 40.0f, 1.0f, 400.0f) *
+        glm::lookAt(camera + glm::vec3(100.0f, 150.0f, 50.0f), camera, glm::vec3(0.0f, 1.0f, 0.0f));
+    const float maxDistance = RENDER_DISTANCE + 1.0f;
+    GpuCuller::Falloff falloff;
+    falloff.pixelsPerUnit = SCREEN_HEIGHT / (2.0f * tanf(60.0f / 720.0f * 6.283185307179586f));
+    falloff.pixelError = PIXEL_ERROR;
+    falloff.hysteresis = HYSTERESIS;
+    falloff.fogStart = RENDER_DISTANCE - FOG_FADE;
+    falloff.fogLength = FOG_FADE + 1.0f;
+    falloff.impostorPixels = 0.0f;
+
+    glm::vec4 cameraPlanes[6], shadowPlanes[6];
+    GpuCuller::frustumPlanes(cameraViewProjection, cameraPlanes);
+    GpuCuller::frustumPlanes(sunViewProjection, shadowPlanes);
+
+    GpuCuller culler("shaders/cull.c.glsl");
+    printf("%10s %12s %12s %12s %12s %12s %12s\n", "instances", "camera", "shadow", "cpu cull", "add once",
+        "cull call", "gpu cull");
+    const int gridSizes[] = { 30, 60, 120, 240 };
+    Scene scene;
+    buildCity(0, scene);
+    addModels(culler, scene);
+    std::vector<size_t> added;
+    for (size_t size = 0; size < sizeof(gridSizes) / sizeof(gridSizes[0]); ++size) {
+        scene = Scene();
+        buildCity(gridSizes[size], scene);
+
+        // The same tests on the CPU, as the renderer would otherwise do them
+        size_t cameraCount = 0, shadowCount = 0;
+        double start = now();
+        for (int i = 0; i < iterations; ++i) {
+            cameraCount = shadowCount = 0;
+            for (size_t j = 0; j < scene.transformations.size(); ++j) {
+                glm::vec3 center, extent;
+                worldBox(scene.bounds[scene.models[j]], scene.transformations[j], center, extent);
+                if (boxDistance(camera, center, extent) <= maxDistance && insidePlanes(cameraPlanes, center, extent)) {
+                    cameraCount += 1;
+                }
+                if (insidePlanes(shadowPlanes, center, extent)) {
+                    shadowCount += 1;
+                }
+            }
+        }
+        const double cpuTime = now() - start;
+
+        // Replace the last grid, then cull once so the instances are uploaded, the buffers have
+        // grown and the shader is compiled by the driver
+        start = now();
+        for (size_t j = 0; j < added.size(); ++j) {
+            culler.removeInstance(added[j]);
+        }
+        added.clear();
+        for (size_t j = 0; j < scene.transformations.size(); ++j) {
+            added.push_back(culler.addInstance(scene.models[j], scene.transformations[j]));
+        }
+        culler.cull(cameraViewProjection, camera, maxDistance, sunViewProjection, falloff);
+        glFinish();
+        const double addTime = now() - start;
+
+        double callTime = 0.0, gpuTime = 0.0;
+        for (int i = 0; i < iterations; ++i) {
+            start = now();
+            culler.cull(cameraViewProjection, camera, maxDistance, sunViewProjection, falloff);
+            callTime += now() - start;
+            glFinish();
+            gpuTime += now() - start;
+        }
+
+        printf("%10lu %12lu %12lu %9.3f ms %9.3f ms %9.3f ms %9.3f ms\n", (unsigned long)scene.transformations.size(),
+            (unsigned long)cameraCount, (unsigned long)shadowCount, 1000.0 * cpuTime / iterations,
+            1000.0 * addTime, 1000.0 * callTime / iterations, 1000.0 * gpuTime / iterations);
+    }
+
+    // Check the last grid's results against the CPU
+    int failed = 0;
+    std::set<std::pair<int, int> > cameraTiles[2 * NUM_BUILDINGS + 1], shadowTiles[2 * NUM_BUILDINGS + 1];
+    for (size_t batch = 0; batch <= 2 * NUM_BUILDINGS; ++batch) {
+        std::vector<glm::mat4> cameraResults, shadowResults;
+        if (!culler.readBatch(batch, cameraResults, shadowResults)) {
+            printf("batch %lu: draw commands don't have the batch's instance count\n", (unsigned long)batch);
+            failed = 1;
+        }
+        for (size_t i = 0; i < cameraResults.size(); ++i) {
+            cameraTiles[batch].insert(tileOf(cameraResults[i]));
+        }
+        for (size_t i = 0; i < shadowResults.size(); ++i) {
+            shadowTiles[batch].insert(tileOf(shadowResults[i]));
+        }
+        if (cameraTiles[batch].size() != cameraResults.size() || shadowTiles[batch].size() != shadowResults.size()) {
+            printf("batch %lu: an instance was written twice\n", (unsigned long)batch);
+            failed = 1;
+        }
+    }
+
+    size_t wronglyCulled = 0, differences = 0, coarser = 0;
+    for (size_t j = 0; j < scene.transformations.size(); ++j) {
+        const size_t model = scene.models[j];
+        const BoundingBox& bounds = scene.bounds[model];
+        const glm::mat4& m = scene.transformations[j];
+        glm::vec3 center, extent;
+        worldBox(bounds, m, center, extent);
+        const float distance = boxDistance(camera, center, extent);
+        const bool near = distance <= maxDistance;
+
+        // The camera hasn't moved, so every instance has gone up from the full model as far as it will
+        const float error = model == NUM_BUILDINGS ? STREETLIGHT_ERROR : BUILDING_ERROR;
+        const size_t level = distance > lodDistance(falloff, error) * (1.0f + falloff.hysteresis) ? 1 : 0;
+        coarser += level;
+
+        // Which level's batches the instance was found in, if any
+        bool inCamera = false, inShadow = false, otherLevel = false;
+        for (size_t i = 0; i < 2; ++i) {
+            const size_t batch = levelBatch(model, i);
+            if (batch == GpuCuller::NO_BATCH) {
+                continue;
+            }
+            const bool cameraFound = cameraTiles[batch].count(tileOf(m)) != 0;
+            const bool shadowFound = shadowTiles[batch].count(tileOf(m)) != 0;
+            inCamera = inCamera || cameraFound;
+            inShadow = inShadow || shadowFound;
+            otherLevel = otherLevel || ((cameraFound || shadowFound) && i != level);
+        }
+
+        const bool drawn = levelBatch(model, level) != GpuCuller::NO_BATCH;
+        if (drawn && ((near && cornerInView(bounds, cameraViewProjection * m) && !inCamera) ||
+                (cornerInView(bounds, sunViewProjection * m) && !inShadow))) {
+            wronglyCulled += 1;
+        }
+        if (otherLevel || inCamera != (drawn && near && insidePlanes(cameraPlanes, center, extent)) ||
+                inShadow != (drawn && insidePlanes(shadowPlanes, center, extent))) {
+            differences += 1;
+        }
+    }
+    printf("coarser level %lu, wrongly culled %lu, different from the CPU %lu\n", (unsigned long)coarser,
+        (unsigned long)wronglyCulled, (unsigned long)differences);
+    return failed || wronglyCulled > 0;
+}
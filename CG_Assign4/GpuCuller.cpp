@@ -0,0 +1,466 @@
+#include "GpuCuller.hpp"
+#include "GLShaderLoader.hpp"
+#include "glm/gtc/type_ptr.hpp"
+#include <algorithm>
+
+// Compute shaders, storage buffers and indirect multi-draws are core from 4.3, which some
+// platforms' headers don't have
+#if defined(GL_COMPUTE_SHADER) && defined(GL_SHADER_STORAGE_BUFFER)
+#define GPU_CULLING_AVAILABLE
+#endif
+
+// Invocations in each work group, must match local_size_x in cull.c.glsl
+#define CULL_GROUP_SIZE 64
+
+// Floats in each impostor written by the shader, the transformation of its sphere and its layer
+#define IMPOSTOR_FLOATS 17
+
+const GLuint GpuCuller::NO_BATCH;
+const GLuint GpuCuller::NO_MODEL;
+
+GpuCuller::GpuCuller(const std::string& computeShader) : program(0), instanceCapacity(0), layoutChanged(true),
+    culledCapacity(1), impostorCapacity(1) {
+#ifdef GPU_CULLING_AVAILABLE
+    const GLuint shader = shaderFromFile(computeShader, GL_COMPUTE_SHADER);
+    program = glCreateProgram();
+    glAttachShader(program, shader);
+    glLinkProgram(program);
+    checkProgramLinked(program);
+    glDetachShader(program, shader);
+    glDeleteShader(shader);
+
+    uniform_numInstances = glGetUniformLocation(program, "numInstances");
+    uniform_cameraPlanes = glGetUniformLocation(program, "cameraPlanes");
+    uniform_shadowPlanes = glGetUniformLocation(program, "shadowPlanes");
+    uniform_cameraPosition = glGetUniformLocation(program, "cameraPosition");
+    uniform_maxDistance = glGetUniformLocation(program, "maxDistance");
+    uniform_pixelsPerUnit = glGetUniformLocation(program, "pixelsPerUnit");
+    uniform_pixelError = glGetUniformLocation(program, "pixelError");
+    uniform_hysteresis = glGetUniformLocation(program, "hysteresis");
+    uniform_fogStart = glGetUniformLocation(program, "fogStart");
+    uniform_fogLength = glGetUniformLocation(program, "fogLength");
+    uniform_impostorPixels = glGetUniformLocation(program, "impostorPixels");
+#endif
+
+    glGenBuffers(1, &instanceBuffer);
+    glGenBuffers(1, &modelBuffer);
+    glGenBuffers(1, &levelBuffer);
+    glGenBuffers(1, &batchTemplate);
+    glGenBuffers(1, &commandTemplate);
+    glGenBuffers(1, &batchBuffer);
+    glGenBuffers(1, &commandBuffer);
+
+    // Vertex arrays keep reading the first transformation when they aren't drawn instanced, so
+    // the buffers are never empty
+    glGenBuffers(1, &culledBuffer);
+    glBindBuffer(GL_ARRAY_BUFFER, culledBuffer);
+    glBufferData(GL_ARRAY_BUFFER, culledCapacity * sizeof(glm::mat4), NULL, GL_DYNAMIC_COPY);
+    glGenBuffers(1, &impostorBuffer);
+    glBindBuffer(GL_ARRAY_BUFFER, impostorBuffer);
+    glBufferData(GL_ARRAY_BUFFER, impostorCapacity * IMPOSTOR_FLOATS * sizeof(GLfloat), NULL, GL_DYNAMIC_COPY);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+GpuCuller::~GpuCuller() {
+    glDeleteBuffers(1, &instanceBuffer);
+    glDeleteBuffers(1, &modelBuffer);
+    glDeleteBuffers(1, &levelBuffer);
+    glDeleteBuffers(1, &batchTemplate);
+    glDeleteBuffers(1, &commandTemplate);
+    glDeleteBuffers(1, &batchBuffer);
+    glDeleteBuffers(1, &commandBuffer);
+    glDeleteBuffers(1, &culledBuffer);
+    glDeleteBuffers(1, &impostorBuffer);
+    if (program != 0) {
+        glDeleteProgram(program);
+    }
+}
+
+bool GpuCuller::supported() {
+#ifdef GPU_CULLING_AVAILABLE
+    GLint majorVersion = 0, minorVersion = 0;
+    glGetIntegerv(GL_MAJOR_VERSION, &majorVersion);
+    glGetIntegerv(GL_MINOR_VERSION, &minorVersion);
+    return majorVersion * 10 + minorVersion >= 43;
+#else
+    return false;
+#endif
+}
+
+void GpuCuller::clear() {
+    instances.clear();
+    spareSlots.clear();
+    changedSlots.clear();
+    models.clear();
+    levels.clear();
+    modelInstances.clear();
+    batches.clear();
+    cameraCommands.clear();
+    shadowCommands.clear();
+    commands.clear();
+    layoutChanged = true;
+}
+
+size_t GpuCuller::addBatch(const std::vector<DrawRange>& cameraRanges, const std::vector<DrawRange>& shadowRanges) {
+    Batch batch;
+    batch.firstCameraCommand = static_cast<GLuint>(cameraCommands.size());
+    batch.numCameraCommands = static_cast<GLuint>(cameraRanges.size());
+    batch.firstShadowCommand = static_cast<GLuint>(shadowCommands.size());
+    batch.numShadowCommands = static_cast<GLuint>(shadowRanges.size());
+    batch.cameraBase = 0;
+    batch.shadowBase = 0;
+    batch.cameraCount = 0;
+    batch.shadowCount = 0;
+    batches.push_back(batch);
+
+    for (size_t i = 0; i < cameraRanges.size(); ++i) {
+        const DrawCommand command = { cameraRanges[i].count, 0, cameraRanges[i].firstIndex, 0, 0 };
+        cameraCommands.push_back(command);
+    }
+    for (size_t i = 0; i < shadowRanges.size(); ++i) {
+        const DrawCommand command = { shadowRanges[i].count, 0, shadowRanges[i].firstIndex, 0, 0 };
+        shadowCommands.push_back(command);
+    }
+    layoutChanged = true;
+    return batches.size() - 1;
+}
+
+size_t GpuCuller::addModel(const BoundingBox& bounds, const std::vector<Level>& modelLevels,
+        const Impostor& impostor) {
+    Model model;
+    model.minVertex = glm::vec4(bounds.minVertex, 1.0f);
+    model.maxVertex = glm::vec4(bounds.maxVertex, 1.0f);
+    model.impostorSphere = impostor.sphere;
+    model.firstLevel = static_cast<GLuint>(levels.size());
+    model.numLevels = static_cast<GLuint>(modelLevels.size());
+    model.impostorRadius = impostor.radius;
+    model.impostorLayer = impostor.layer;
+    model.impostorShadowBatch = impostor.radius > 0.0f ? impostor.shadowBatch : NO_BATCH;
+    model.padding[0] = model.padding[1] = model.padding[2] = 0;
+    models.push_back(model);
+    modelInstances.push_back(0);
+
+    for (size_t i = 0; i < modelLevels.size(); ++i) {
+        const GpuLevel level = { modelLevels[i].batch, modelLevels[i].error };
+        levels.push_back(level);
+    }
+    layoutChanged = true;
+    return models.size() - 1;
+}
+
+size_t GpuCuller::addInstance(size_t model, const glm::mat4& transformation) {
+    Instance instance;
+    instance.transformation = transformation;
+    instance.model = static_cast<GLuint>(model);
+    instance.level = 0;
+    instance.padding[0] = instance.padding[1] = 0;
+
+    size_t slot = instances.size();
+    if (!spareSlots.empty()) {
+        slot = spareSlots.back();
+        spareSlots.pop_back();
+        instances[slot] = instance;
+    }
+    else {
+        instances.push_back(instance);
+    }
+    changedSlots.push_back(slot);
+    modelInstances[model] += 1;
+    layoutChanged = true;
+    return slot;
+}
+
+void GpuCuller::removeInstance(size_t instance) {
+    modelInstances[instances[instance].model] -= 1;
+    instances[instance].model = NO_MODEL;
+    spareSlots.push_back(instance);
+    changedSlots.push_back(instance);
+    layoutChanged = true;
+}
+
+void GpuCuller::frustumPlanes(const glm::mat4& viewProjection, glm::vec4 planes[6]) {
+    // Sums and differences of the rows of the matrix, see Gribb and Hartmann
+    const glm::vec4 x(viewProjection[0][0], viewProjection[1][0], viewProjection[2][0], viewProjection[3][0]);
+    const glm::vec4 y(viewProjection[0][1], viewProjection[1][1], viewProjection[2][1], viewProjection[3][1]);
+    const glm::vec4 z(viewProjection[0][2], viewProjection[1][2], viewProjection[2][2], viewProjection[3][2]);
+    const glm::vec4 w(viewProjection[0][3], viewProjection[1][3], viewProjection[2][3], viewProjection[3][3]);
+    planes[0] = w + x;
+    planes[1] = w - x;
+    planes[2] = w + y;
+    planes[3] = w - y;
+    planes[4] = w + z;
+    planes[5] = w - z;
+    for (int i = 0; i < 6; ++i) {
+        planes[i] /= glm::length(glm::vec3(planes[i]));
+    }
+}
+
+void GpuCuller::uploadLayout() {
+    // Every batch a model may draw, at any level or for its impostor's shadow, needs room for all
+    // of the model's instances
+    std::vector<GLuint> batchSizes(batches.size(), 0);
+    for (size_t i = 0; i < models.size(); ++i) {
+        std::vector<GLuint> drawn;
+        for (GLuint j = 0; j < models[i].numLevels; ++j) {
+            drawn.push_back(levels[models[i].firstLevel + j].batch);
+        }
+        drawn.push_back(models[i].impostorShadowBatch);
+        std::sort(drawn.begin(), drawn.end());
+        drawn.erase(std::unique(drawn.begin(), drawn.end()), drawn.end());
+        for (size_t j = 0; j < drawn.size(); ++j) {
+            if (drawn[j] != NO_BATCH) {
+                batchSizes[drawn[j]] += static_cast<GLuint>(modelInstances[i]);
+            }
+        }
+    }
+    GLuint total = 0;
+    for (size_t i = 0; i < batchSizes.size(); ++i) {
+        total += batchSizes[i];
+    }
+
+    // The camera's ranges first and then the sun's. The uploaded batches index the shadow commands
+    // from the start of all the commands.
+    std::vector<DrawCommand> shadows(shadowCommands);
+    std::vector<Batch> layout(batches.size());
+    commands = cameraCommands;
+    GLuint cameraBase = 0;
+    GLuint shadowBase = total;
+    for (size_t i = 0; i < batches.size(); ++i) {
+        Batch& batch = batches[i];
+        batch.cameraBase = cameraBase;
+        batch.shadowBase = shadowBase;
+        cameraBase += batchSizes[i];
+        shadowBase += batchSizes[i];
+
+        for (GLuint j = 0; j < batch.numCameraCommands; ++j) {
+            commands[batch.firstCameraCommand + j].baseInstance = batch.cameraBase;
+        }
+        for (GLuint j = 0; j < batch.numShadowCommands; ++j) {
+            shadows[batch.firstShadowCommand + j].baseInstance = batch.shadowBase;
+        }
+        layout[i] = batch;
+        layout[i].firstShadowCommand += static_cast<GLuint>(cameraCommands.size());
+    }
+    commands.insert(commands.end(), shadows.begin(), shadows.end());
+    // glDrawArraysIndirect reads the count, instance count, first vertex and base instance
+    const DrawCommand impostors = { 4, 0, 0, 0, 0 };
+    commands.push_back(impostors);
+
+#ifdef GPU_CULLING_AVAILABLE
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, modelBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, models.size() * sizeof(Model), models.empty() ? NULL : &models[0],
+        GL_STATIC_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, levelBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, levels.size() * sizeof(GpuLevel), levels.empty() ? NULL : &levels[0],
+        GL_STATIC_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, batchTemplate);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, layout.size() * sizeof(Batch), layout.empty() ? NULL : &layout[0],
+        GL_STATIC_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, batchBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, layout.size() * sizeof(Batch), NULL, GL_DYNAMIC_COPY);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, commandTemplate);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, commands.size() * sizeof(DrawCommand), &commands[0], GL_STATIC_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, commandBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, commands.size() * sizeof(DrawCommand), NULL, GL_DYNAMIC_COPY);
+    if (culledCapacity < 2 * total) {
+        culledCapacity = 2 * total;
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, culledBuffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, culledCapacity * sizeof(glm::mat4), NULL, GL_DYNAMIC_COPY);
+    }
+    if (impostorCapacity < instances.size()) {
+        impostorCapacity = instances.size();
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, impostorBuffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, impostorCapacity * IMPOSTOR_FLOATS * sizeof(GLfloat), NULL,
+            GL_DYNAMIC_COPY);
+    }
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+#endif
+    layoutChanged = false;
+}
+
+void GpuCuller::uploadInstances() {
+#ifdef GPU_CULLING_AVAILABLE
+    // The shader writes each instance's level, so the buffer grows by copying it rather than by
+    // uploading the instances again
+    if (instanceCapacity < instances.size()) {
+        const size_t capacity = std::max(instances.size(), 2 * instanceCapacity);
+        GLuint grown;
+        glGenBuffers(1, &grown);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, grown);
+        glBufferData(GL_COPY_WRITE_BUFFER, capacity * sizeof(Instance), NULL, GL_DYNAMIC_DRAW);
+        if (instanceCapacity > 0) {
+            glBindBuffer(GL_COPY_READ_BUFFER, instanceBuffer);
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, instanceCapacity * sizeof(Instance));
+        }
+        glBindBuffer(GL_COPY_READ_BUFFER, 0);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        glDeleteBuffers(1, &instanceBuffer);
+        instanceBuffer = grown;
+        instanceCapacity = capacity;
+    }
+
+    // Only the slots that changed, so the others keep their levels
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, instanceBuffer);
+    for (size_t i = 0; i < changedSlots.size(); ++i) {
+        const size_t slot = changedSlots[i];
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, slot * sizeof(Instance), sizeof(Instance), &instances[slot]);
+    }
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+#endif
+    changedSlots.clear();
+}
+
+void GpuCuller::cull(const glm::mat4& cameraViewProjection, glm::vec3 cameraPosition, float maxDistance,
+        const glm::mat4& shadowViewProjection, const Falloff& falloff) {
+    if (numInstances() == 0) {
+        return;
+    }
+    if (layoutChanged) {
+        uploadLayout();
+    }
+    if (!changedSlots.empty()) {
+        uploadInstances();
+    }
+
+#ifdef GPU_CULLING_AVAILABLE
+    // Start from no instances in any batch or command, without the CPU touching them
+    glBindBuffer(GL_COPY_READ_BUFFER, batchTemplate);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, batchBuffer);
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, batches.size() * sizeof(Batch));
+    glBindBuffer(GL_COPY_READ_BUFFER, commandTemplate);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, commandBuffer);
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, commands.size() * sizeof(DrawCommand));
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, instanceBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, modelBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, levelBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, batchBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, commandBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, culledBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, impostorBuffer);
+
+    glm::vec4 cameraPlanes[6], shadowPlanes[6];
+    frustumPlanes(cameraViewProjection, cameraPlanes);
+    frustumPlanes(shadowViewProjection, shadowPlanes);
+
+    glUseProgram(program);
+    glUniform1ui(uniform_numInstances, static_cast<GLuint>(instances.size()));
+    glUniform4fv(uniform_cameraPlanes, 6, glm::value_ptr(cameraPlanes[0]));
+    glUniform4fv(uniform_shadowPlanes, 6, glm::value_ptr(shadowPlanes[0]));
+    glUniform3fv(uniform_cameraPosition, 1, glm::value_ptr(cameraPosition));
+    glUniform1f(uniform_maxDistance, maxDistance);
+    glUniform1f(uniform_pixelsPerUnit, falloff.pixelsPerUnit);
+    glUniform1f(uniform_pixelError, falloff.pixelError);
+    glUniform1f(uniform_hysteresis, falloff.hysteresis);
+    glUniform1f(uniform_fogStart, falloff.fogStart);
+    glUniform1f(uniform_fogLength, falloff.fogLength);
+    glUniform1f(uniform_impostorPixels, falloff.impostorPixels);
+    glDispatchCompute(static_cast<GLuint>((instances.size() + CULL_GROUP_SIZE - 1) / CULL_GROUP_SIZE), 1, 1);
+    glUseProgram(0);
+
+    // The draws read the commands and transformations the shader wrote
+    glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+#endif
+}
+
+void GpuCuller::bindInstanceAttributes(GLuint location) const {
+    glBindBuffer(GL_ARRAY_BUFFER, culledBuffer);
+    for (GLuint column = 0; column < 4; ++column) {
+        glEnableVertexAttribArray(location + column);
+        glVertexAttribPointer(location + column, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4),
+            (GLvoid*)(column * sizeof(glm::vec4)));
+        glVertexAttribDivisor(location + column, 1);
+    }
+}
+
+void GpuCuller::bindImpostorAttributes(GLuint transformLocation, GLuint layerLocation) const {
+    const GLsizei stride = IMPOSTOR_FLOATS * sizeof(GLfloat);
+    glBindBuffer(GL_ARRAY_BUFFER, impostorBuffer);
+    for (GLuint column = 0; column < 4; ++column) {
+        glEnableVertexAttribArray(transformLocation + column);
+        glVertexAttribPointer(transformLocation + column, 4, GL_FLOAT, GL_FALSE, stride,
+            (GLvoid*)(column * sizeof(glm::vec4)));
+        glVertexAttribDivisor(transformLocation + column, 1);
+    }
+    glEnableVertexAttribArray(layerLocation);
+    glVertexAttribPointer(layerLocation, 1, GL_FLOAT, GL_FALSE, stride, (GLvoid*)(sizeof(glm::mat4)));
+    glVertexAttribDivisor(layerLocation, 1);
+}
+
+void GpuCuller::drawCamera(size_t batch, size_t range) const {
+#ifdef GPU_CULLING_AVAILABLE
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+    glDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT,
+        (GLvoid*)((batches[batch].firstCameraCommand + range) * sizeof(DrawCommand)));
+#endif
+}
+
+void GpuCuller::drawShadows(size_t batch) const {
+#ifdef GPU_CULLING_AVAILABLE
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+    glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT,
+        (GLvoid*)((cameraCommands.size() + batches[batch].firstShadowCommand) * sizeof(DrawCommand)),
+        batches[batch].numShadowCommands, 0);
+#endif
+}
+
+void GpuCuller::drawImpostors() const {
+#ifdef GPU_CULLING_AVAILABLE
+    if (commands.empty()) {
+        return;
+    }
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+    glDrawArraysIndirect(GL_TRIANGLE_STRIP, (GLvoid*)((commands.size() - 1) * sizeof(DrawCommand)));
+#endif
+}
+
+size_t GpuCuller::numBatches() const {
+    return batches.size();
+}
+
+size_t GpuCuller::numInstances() const {
+    return instances.size() - spareSlots.size();
+}
+
+bool GpuCuller::readBatch(size_t batch, std::vector<glm::mat4>& camera, std::vector<glm::mat4>& shadow) const {
+    camera.clear();
+    shadow.clear();
+#ifdef GPU_CULLING_AVAILABLE
+    if (numInstances() == 0) {
+        return true;
+    }
+
+    Batch result;
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, batchBuffer);
+    glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, batch * sizeof(Batch), sizeof(Batch), &result);
+
+    std::vector<DrawCommand> results(commands.size());
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, commandBuffer);
+    glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, results.size() * sizeof(DrawCommand), &results[0]);
+    bool counted = true;
+    for (GLuint i = 0; i < result.numCameraCommands; ++i) {
+        counted = counted && results[result.firstCameraCommand + i].instanceCount == result.cameraCount;
+    }
+    for (GLuint i = 0; i < result.numShadowCommands; ++i) {
+        counted = counted && results[result.firstShadowCommand + i].instanceCount == result.shadowCount;
+    }
+
+    camera.resize(result.cameraCount);
+    shadow.resize(result.shadowCount);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, culledBuffer);
+    if (!camera.empty()) {
+        glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, result.cameraBase * sizeof(glm::mat4),
+            camera.size() * sizeof(glm::mat4), &camera[0]);
+    }
+    if (!shadow.empty()) {
+        glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, result.shadowBase * sizeof(glm::mat4),
+            shadow.size() * sizeof(glm::mat4), &shadow[0]);
+    }
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    return counted;
+#else
+    return false;
+#endif
+}
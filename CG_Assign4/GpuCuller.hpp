@@ -0,0 +1,288 @@
+//! Frustum and distance culling of model instances in a compute shader, feeding indirect draws
+#pragma once
+#include <string>
+#include <vector>
+#include "ModelData.hpp"
+#include "glm/mat4x4.hpp"
+#include "glm/vec4.hpp"
+
+/// <summary>
+/// Culls instances of models on the GPU. Each batch is a mesh with the ranges of its element
+/// buffer to draw, and each model is a list of batches, one per level of detail. Instances are kept
+/// on the GPU from frame to frame and only uploaded when they are added or removed. Every frame a
+/// compute shader chooses each instance's level, or its impostor, from its distance and tests it
+/// against the camera's frustum and distance and against the sun's frustum. Those that pass are
+/// packed into a buffer of transformations, and the instance counts of indirect draw commands are
+/// written, so the CPU never visits an instance.
+///
+/// Needs OpenGL 4.3 for compute shaders and shader storage buffers, see supported.
+/// </summary>
+class GpuCuller {
+public:
+    /// <summary>
+    /// A range of a model's element buffer, in elements.
+    /// </summary>
+    struct DrawRange {
+        GLuint firstIndex;
+        GLuint count;
+    };
+
+    /// <summary>
+    /// A level of detail of a model. Level i is used past the switch distance of its error, and
+    /// the first level is the full model with no error.
+    /// </summary>
+    struct Level {
+        // NO_BATCH to draw nothing at this level
+        GLuint batch;
+        // The largest distance from the full model, in model units
+        float error;
+    };
+
+    /// <summary>
+    /// What far instances of a model are drawn as instead, if radius isn't 0. Its camera instances
+    /// are written for ImpostorAtlas::draw, the transformation of its sphere and its layer.
+    /// </summary>
+    struct Impostor {
+        // The radius of the sphere its views were taken of, in model units
+        float radius;
+        // Of a unit sphere onto the views' sphere, in model space
+        glm::mat4 sphere;
+        float layer;
+        // The batch drawn into the shadow map instead
+        GLuint shadowBatch;
+    };
+
+    /// <summary>
+    /// Where instances switch between levels and to their impostors, as Renderer::lodDistance and
+    /// Renderer::impostorDistance choose.
+    /// </summary>
+    struct Falloff {
+        // Pixels covered by a length of one at a distance of one
+        float pixelsPerUnit;
+        // Levels are switched to once their error covers fewer pixels than this
+        float pixelError;
+        // The fraction past the switch distance levels only become coarser at
+        float hysteresis;
+        // Where the fog starts and how far it is until models are hidden by it
+        float fogStart;
+        float fogLength;
+        // Pixels each texel of an impostor's views covers, 0 to draw no impostors
+        float impostorPixels;
+    };
+
+    static const GLuint NO_BATCH = 0xffffffffu;
+
+    /// <summary>
+    /// Build the culling program.
+    /// </summary>
+    ///
+    /// <param name="computeShader">The compute shader's filename.</param>
+    GpuCuller(const std::string& computeShader);
+    ~GpuCuller();
+
+    /// <summary>
+    /// Whether the current context can run the culler.
+    /// </summary>
+    static bool supported();
+
+    /// <summary>
+    /// Remove every batch, model and instance.
+    /// </summary>
+    void clear();
+
+    /// <summary>
+    /// Add a mesh to draw instances with.
+    /// </summary>
+    ///
+    /// <param name="cameraRanges">The ranges drawn for the camera, one draw command each.</param>
+    /// <param name="shadowRanges">The ranges drawn into the shadow map.</param>
+    /// <returns>The batch's index.</returns>
+    size_t addBatch(const std::vector<DrawRange>& cameraRanges, const std::vector<DrawRange>& shadowRanges);
+
+    /// <summary>
+    /// Add a model to add instances of.
+    /// </summary>
+    ///
+    /// <param name="bounds">The full model's bounds in model space, which every level is tested with.</param>
+    /// <param name="levels">The model's levels from the full model on, at least one.</param>
+    /// <param name="impostor">What to draw past the levels, or a radius of 0 for nothing.</param>
+    /// <returns>The model's index.</returns>
+    size_t addModel(const BoundingBox& bounds, const std::vector<Level>& levels, const Impostor& impostor);
+
+    /// <summary>
+    /// Add an instance of a model, which stays until it is removed. It is uploaded by the next cull.
+    /// </summary>
+    ///
+    /// <returns>The instance's index, for removing it.</returns>
+    size_t addInstance(size_t model, const glm::mat4& transformation);
+
+    void removeInstance(size_t instance);
+
+    /// <summary>
+    /// Upload the instances added or removed since the last cull, then choose their levels and cull
+    /// them. The results stay on the GPU for the draws.
+    /// </summary>
+    ///
+    /// <param name="cameraViewProjection">The camera's projection times its view.</param>
+    /// <param name="cameraPosition">The camera's position.</param>
+    /// <param name="maxDistance">Instances entirely farther than this from the camera are culled.</param>
+    /// <param name="shadowViewProjection">The sun's projection times its view.</param>
+    void cull(const glm::mat4& cameraViewProjection, glm::vec3 cameraPosition, float maxDistance,
+        const glm::mat4& shadowViewProjection, const Falloff& falloff);
+
+    /// <summary>
+    /// Point four attributes of the bound vertex array, from 'location' on, at the culled
+    /// transformations, one mat4 per instance. Needed once for each vertex array.
+    /// </summary>
+    void bindInstanceAttributes(GLuint location) const;
+
+    /// <summary>
+    /// Point the bound vertex array's instance attributes at the culled impostors, the
+    /// transformation of each one's sphere from 'transformLocation' on and its layer at
+    /// 'layerLocation'. Needed once for each vertex array.
+    /// </summary>
+    void bindImpostorAttributes(GLuint transformLocation, GLuint layerLocation) const;
+
+    /// <summary>
+    /// Draw one of a batch's camera ranges for every instance in the camera's view, with its
+    /// vertex array bound.
+    /// </summary>
+    void drawCamera(size_t batch, size_t range) const;
+
+    /// <summary>
+    /// Draw all of a batch's shadow ranges for every instance in the sun's view, with one multi-draw.
+    /// </summary>
+    void drawShadows(size_t batch) const;
+
+    /// <summary>
+    /// Draw a quad, as a triangle strip of four vertices, for every impostor in the camera's view.
+    /// </summary>
+    void drawImpostors() const;
+
+    size_t numBatches() const;
+
+    /// <summary>
+    /// The number of instances added and not removed.
+    /// </summary>
+    size_t numInstances() const;
+
+    /// <summary>
+    /// Read back the transformations of a batch's instances that passed each test, waiting for the
+    /// GPU. For checking the culler, returns false if any of the batch's draw commands doesn't
+    /// have the batch's number of instances.
+    /// </summary>
+    bool readBatch(size_t batch, std::vector<glm::mat4>& camera, std::vector<glm::mat4>& shadow) const;
+
+    /// <summary>
+    /// The planes of a view projection's frustum, as (normal, distance) with the normals pointing
+    /// inward, so a point p is inside when dot(normal, p) + distance >= 0 for every plane.
+    /// </summary>
+    static void frustumPlanes(const glm::mat4& viewProjection, glm::vec4 planes[6]);
+
+private:
+    // Match the structs in cull.c.glsl
+    struct Instance {
+        glm::mat4 transformation;
+        // NO_MODEL for a removed instance's slot
+        GLuint model;
+        // The level chosen last frame, written by the shader
+        GLuint level;
+        GLuint padding[2];
+    };
+
+    struct Model {
+        glm::vec4 minVertex;
+        glm::vec4 maxVertex;
+        glm::mat4 impostorSphere;
+        GLuint firstLevel;
+        GLuint numLevels;
+        float impostorRadius;
+        float impostorLayer;
+        GLuint impostorShadowBatch;
+        GLuint padding[3];
+    };
+
+    struct GpuLevel {
+        GLuint batch;
+        float error;
+    };
+
+    struct Batch {
+        GLuint firstCameraCommand;
+        GLuint numCameraCommands;
+        GLuint firstShadowCommand;
+        GLuint numShadowCommands;
+        GLuint cameraBase;
+        GLuint shadowBase;
+        GLuint cameraCount;
+        GLuint shadowCount;
+    };
+
+    struct DrawCommand {
+        GLuint count;
+        GLuint instanceCount;
+        GLuint firstIndex;
+        GLuint baseVertex;
+        GLuint baseInstance;
+    };
+
+    static const GLuint NO_MODEL = 0xffffffffu;
+
+    GLuint program;
+    GLint uniform_numInstances;
+    GLint uniform_cameraPlanes;
+    GLint uniform_shadowPlanes;
+    GLint uniform_cameraPosition;
+    GLint uniform_maxDistance;
+    GLint uniform_pixelsPerUnit;
+    GLint uniform_pixelError;
+    GLint uniform_hysteresis;
+    GLint uniform_fogStart;
+    GLint uniform_fogLength;
+    GLint uniform_impostorPixels;
+
+    // The instances' slots, removed ones are reused by the next instance added
+    std::vector<Instance> instances;
+    std::vector<size_t> spareSlots;
+    // Slots changed since they were last uploaded
+    std::vector<size_t> changedSlots;
+    size_t instanceCapacity;
+
+    std::vector<Model> models;
+    std::vector<GpuLevel> levels;
+    std::vector<size_t> modelInstances;
+    // The shadow commands are stored after the camera commands, each batch's firstShadowCommand is
+    // relative to them
+    std::vector<Batch> batches;
+    std::vector<DrawCommand> cameraCommands;
+    std::vector<DrawCommand> shadowCommands;
+    // The commands as uploaded, the impostors' command last
+    std::vector<DrawCommand> commands;
+    // Whether the models, or how many instances each has, changed since the layout was uploaded
+    bool layoutChanged;
+
+    GLuint instanceBuffer;
+    GLuint modelBuffer;
+    GLuint levelBuffer;
+    // The batches and commands with no instances, copied over the ones the shader counts in every frame
+    GLuint batchTemplate;
+    GLuint commandTemplate;
+    GLuint batchBuffer;
+    GLuint commandBuffer;
+    // The camera's instances of every batch, then the sun's
+    GLuint culledBuffer;
+    size_t culledCapacity;
+    GLuint impostorBuffer;
+    size_t impostorCapacity;
+
+    /// <summary>
+    /// Give each batch ranges of the culled buffer big enough for all the instances of the models
+    /// drawing it, and upload the models and the batches and commands with no instances.
+    /// </summary>
+    void uploadLayout();
+
+    /// <summary>
+    /// Upload the changed slots, growing the buffer if it is full.
+    /// </summary>
+    void uploadInstances();
+};
@@ -0,0 +1,112 @@
+#include "HorizonCuller.hpp"
+#include "glm/common.hpp"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+// Orders points by x, for building the upper hull
+static bool leftOf(const glm::vec3& p1, const glm::vec3& p2) {
+    return p1.x < p2.x || (p1.x == p2.x && p1.y < p2.y);
+}
+
+// Height of the upper hull at x, which must be within the hull
+static float hullHeight(const glm::vec3* hull, int hullSize, float x) {
+    for (int i = 1; i < hullSize; ++i) {
+        if (x <= hull[i].x) {
+            const float width = hull[i].x - hull[i - 1].x;
+            const float t = width > 0.0f ? (x - hull[i - 1].x) / width : 1.0f;
+            return hull[i - 1].y + t * (hull[i].y - hull[i - 1].y);
+        }
+    }
+    return hull[hullSize - 1].y;
+}
+
+HorizonCuller::HorizonCuller() : viewProjection(1.0f) {
+}
+
+void HorizonCuller::begin(const glm::mat4& viewProjection) {
+    this->viewProjection = viewProjection;
+    horizon.assign(HORIZON_BUFFER_WIDTH, -FLT_MAX);
+    horizonDepth.assign(HORIZON_BUFFER_WIDTH, FLT_MAX);
+}
+
+bool HorizonCuller::project(const BoundingBox& box, const glm::mat4& transformation, glm::vec3 corners[8]) const {
+    const glm::mat4 mvp = viewProjection * transformation;
+    for (int i = 0; i < 8; ++i) {
+        const glm::vec4 corner(
+            (i & 1) ? box.maxVertex.x : box.minVertex.x,
+            (i & 2) ? box.maxVertex.y : box.minVertex.y,
+            (i & 4) ? box.maxVertex.z : box.minVertex.z,
+            1.0f);
+        const glm::vec4 clip = mvp * corner;
+        if (clip.w <= 0.0f || clip.z < -clip.w) {
+            return false;
+        }
+        corners[i] = glm::vec3((clip.x / clip.w * 0.5f + 0.5f) * HORIZON_BUFFER_WIDTH, clip.y / clip.w, clip.w);
+    }
+    return true;
+}
+
+void HorizonCuller::addOccluder(const BoundingBox& box, const glm::mat4& transformation) {
+    glm::vec3 corners[8];
+    if (!project(box, transformation, corners)) {
+        return;
+    }
+    float farthest = corners[0].z;
+    for (int i = 1; i < 8; ++i) {
+        farthest = std::max(farthest, corners[i].z);
+    }
+
+    // The top of the silhouette is the upper hull of the corners
+    std::sort(corners, corners + 8, leftOf);
+    glm::vec3 hull[8];
+    int hullSize = 0;
+    for (int i = 0; i < 8; ++i) {
+        while (hullSize >= 2 && (hull[hullSize - 1].x - hull[hullSize - 2].x) * (corners[i].y - hull[hullSize - 2].y) -
+                (hull[hullSize - 1].y - hull[hullSize - 2].y) * (corners[i].x - hull[hullSize - 2].x) >= 0.0f) {
+            hullSize -= 1;
+        }
+        hull[hullSize++] = corners[i];
+    }
+
+    // Only columns entirely under the silhouette are raised, to the lowest point of the hull over
+    // the column, which is at one of its edges as the hull is convex
+    const int firstColumn = std::max(static_cast<int>(std::ceil(std::max(hull[0].x, -1.0f))), 0);
+    const int lastColumn = std::min(static_cast<int>(std::floor(std::min(hull[hullSize - 1].x,
+        static_cast<float>(HORIZON_BUFFER_WIDTH + 1)))) - 1, HORIZON_BUFFER_WIDTH - 1);
+    for (int column = firstColumn; column <= lastColumn; ++column) {
+        const float height = std::min(hullHeight(hull, hullSize, static_cast<float>(column)),
+            hullHeight(hull, hullSize, static_cast<float>(column + 1)));
+        if (height > horizon[column]) {
+            horizon[column] = height;
+            horizonDepth[column] = farthest;
+        }
+    }
+}
+
+bool HorizonCuller::isVisible(const BoundingBox& bounds, const glm::mat4& transformation) const {
+    glm::vec3 corners[8];
+    if (!project(bounds, transformation, corners)) {
+        return true;
+    }
+
+    glm::vec3 minCorner = corners[0], maxCorner = corners[0];
+    for (int i = 1; i < 8; ++i) {
+        minCorner = glm::min(minCorner, corners[i]);
+        maxCorner = glm::max(maxCorner, corners[i]);
+    }
+    if (maxCorner.x < 0.0f || minCorner.x > HORIZON_BUFFER_WIDTH || maxCorner.y < -1.0f || minCorner.y > 1.0f) {
+        return false;
+    }
+
+    // Hidden if it's below the horizon and behind the occluder that set it in every column it touches
+    const int firstColumn = static_cast<int>(std::floor(std::max(minCorner.x, 0.0f)));
+    const int lastColumn = std::min(static_cast<int>(std::floor(std::min(maxCorner.x,
+        static_cast<float>(HORIZON_BUFFER_WIDTH)))), HORIZON_BUFFER_WIDTH - 1);
+    for (int column = firstColumn; column <= lastColumn; ++column) {
+        if (maxCorner.y >= horizon[column] || minCorner.z < horizonDepth[column]) {
+            return true;
+        }
+    }
+    return false;
+}
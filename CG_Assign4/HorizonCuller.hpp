@@ -0,0 +1,58 @@
+//! Occlusion culling against a per column skyline, for scenes of boxes standing on flat ground
+#pragma once
+#include <vector>
+#include "ModelData.hpp"
+#include "glm/mat4x4.hpp"
+
+// Number of screen columns the horizon is kept for
+#define HORIZON_BUFFER_WIDTH 512
+
+/// <summary>
+/// Hides objects that are below the skyline of nearer buildings. For each column of the screen the
+/// horizon is the highest point reached by an occluder's silhouette, so adding an occluder and
+/// testing an object only touch the columns they cover.
+///
+/// This relies on the scene being 2.5D: occluders and objects stand on flat ground at y = 0 or
+/// extend below it, the camera is above the ground and the view isn't rolled. An object which is
+/// entirely behind the occluder that set the horizon in a column, and lower than the horizon, is
+/// then covered by that occluder in the column, since its base projects higher than the
+/// occluder's. Each column remembers the depth of the occluder that set it, so objects in front of
+/// it are never hidden. Objects should be tested and added nearest first.
+/// </summary>
+class HorizonCuller {
+public:
+    HorizonCuller();
+
+    /// <summary>
+    /// Start a new frame with an empty horizon.
+    /// </summary>
+    ///
+    /// <param name="viewProjection">The camera's projection times its view.</param>
+    void begin(const glm::mat4& viewProjection);
+
+    /// <summary>
+    /// Raise the horizon to the silhouette of a solid box.
+    /// </summary>
+    ///
+    /// <param name="box">The box in model space.</param>
+    /// <param name="transformation">The model's transformation.</param>
+    void addOccluder(const BoundingBox& box, const glm::mat4& transformation);
+
+    /// <summary>
+    /// Whether an object may be seen over the horizon. Objects entirely off the screen are not visible.
+    /// </summary>
+    ///
+    /// <param name="bounds">The object's bounds in model space.</param>
+    /// <param name="transformation">The model's transformation.</param>
+    bool isVisible(const BoundingBox& bounds, const glm::mat4& transformation) const;
+
+private:
+    // Projects the corners of a box to x in columns, y in normalized device coordinates and the
+    // view depth, returns false if any corner is behind the near plane
+    bool project(const BoundingBox& box, const glm::mat4& transformation, glm::vec3 corners[8]) const;
+
+    glm::mat4 viewProjection;
+    // Height of the horizon in each column, and the farthest depth of the occluder that set it
+    std::vector<float> horizon;
+    std::vector<float> horizonDepth;
+};
@@ -0,0 +1,278 @@
+#include "ImpostorAtlas.hpp"
+#include "Renderer.hpp"
+#include "GLShaderLoader.hpp"
+#include "GpuCuller.hpp"
+#include "glm/gtc/matrix_transform.hpp"
+#include "glm/gtc/type_ptr.hpp"
+#include <stdint.h>
+
+#define IMPOSTOR_BAKE_VERTEX_SHADER "shaders/impostorbake.v.glsl"
+#define IMPOSTOR_BAKE_FRAGMENT_SHADER "shaders/impostorbake.f.glsl"
+
+// Mipmaps below this are smaller than a texel per view and would blend neighbouring views
+#define IMPOSTOR_MAX_LEVEL 3
+
+// Corners of the quads, as a triangle strip wound clockwise
+static const GLfloat quadCorners[] = { -1, -1, -1, 1, 1, -1, 1, 1 };
+
+// Attribute names of the bake shaders, at the same locations as the models' so their vertex arrays can be drawn
+static const char* const bakeAttributes[] = { "v_coord", "v_normal", "v_texcoord", NULL };
+
+// The direction of the view at a point of the grid, from the model to the camera. Must match
+// frameDirection in impostor.v.glsl.
+static glm::vec3 frameDirection(int x, int y) {
+    const glm::vec2 grid = glm::vec2(static_cast<float>(x), static_cast<float>(y)) /
+        static_cast<float>(IMPOSTOR_FRAMES - 1) * 2.0f - 1.0f;
+    const float a = (grid.x + grid.y) / 2.0f;
+    const float b = (grid.x - grid.y) / 2.0f;
+    return glm::normalize(glm::vec3(a, 1.0f - glm::abs(a) - glm::abs(b), b));
+}
+
+// The directions of a view's right and up, must match frameBasis in impostor.v.glsl
+static void frameBasis(const glm::vec3& direction, glm::vec3& right, glm::vec3& up) {
+    right = glm::abs(direction.y) > 0.999f ? glm::vec3(1.0f, 0.0f, 0.0f) :
+        glm::normalize(glm::cross(glm::vec3(0.0f, 1.0f, 0.0f), direction));
+    up = glm::cross(direction, right);
+}
+
+ImpostorAtlas::ImpostorAtlas(const std::vector<const ModelData*>& models) : impostorMaterial(DEFAULT_MATERIAL) {
+    for (size_t i = 0; i < models.size(); ++i) {
+        const BoundingBox& bounds = models[i]->boundingBox;
+        if (bounds.minVertex == bounds.maxVertex || layers.count(models[i]) != 0) {
+            continue;
+        }
+        const Layer layer = { static_cast<GLfloat>(layers.size()), (bounds.minVertex + bounds.maxVertex) / 2.0f,
+            glm::length(bounds.maxVertex - bounds.minVertex) / 2.0f };
+        layers[models[i]] = layer;
+    }
+    if (!models.empty() && !models[0]->shapes.empty()) {
+        impostorMaterial = models[0]->shapes[0].material;
+    }
+
+    // Both arrays hold a layer per model, which has a view in each cell of the grid
+    const GLsizei size = IMPOSTOR_FRAMES * IMPOSTOR_FRAME_SIZE;
+    const GLsizei numLayers = layers.empty() ? 1 : static_cast<GLsizei>(layers.size());
+    GLuint textures[2];
+    glGenTextures(2, textures);
+    colourTexture = textures[0];
+    normalDepthTexture = textures[1];
+    for (int i = 0; i < 2; ++i) {
+        glBindTexture(GL_TEXTURE_2D_ARRAY, textures[i]);
+        glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA8, size, size, numLayers, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, IMPOSTOR_MAX_LEVEL);
+    }
+
+    // The colour pass and the normal and depth pass
+    const ProgramSource sources[] = {
+        { IMPOSTOR_BAKE_VERTEX_SHADER, IMPOSTOR_BAKE_FRAGMENT_SHADER, "", bakeAttributes },
+        { IMPOSTOR_BAKE_VERTEX_SHADER, IMPOSTOR_BAKE_FRAGMENT_SHADER, "#define NORMAL_DEPTH\n", bakeAttributes }
+    };
+    GLuint programs[2];
+    initPrograms(sources, programs, 2);
+
+    GLuint framebuffer, depthBuffer;
+    glGenFramebuffers(1, &framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glGenRenderbuffers(1, &depthBuffer);
+    glBindRenderbuffer(GL_RENDERBUFFER, depthBuffer);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, size, size);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthBuffer);
+
+    // Baking happens between frames, so the state it changes is put back afterwards
+    GLint viewport[4];
+    GLfloat clearColour[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    glGetFloatv(GL_COLOR_CLEAR_VALUE, clearColour);
+    const GLboolean blend = glIsEnabled(GL_BLEND);
+    glDisable(GL_BLEND);
+    glEnable(GL_DEPTH_TEST);
+    glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+
+    for (std::map<const ModelData*, Layer>::const_iterator i = layers.begin(); i != layers.end(); ++i) {
+        bake(i->first, i->second, framebuffer, programs);
+    }
+
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+    glClearColor(clearColour[0], clearColour[1], clearColour[2], clearColour[3]);
+    if (blend) {
+        glEnable(GL_BLEND);
+    }
+    glBindVertexArray(0);
+    glUseProgram(0);
+    glDeleteRenderbuffers(1, &depthBuffer);
+    glDeleteFramebuffers(1, &framebuffer);
+    glDeleteProgram(programs[0]);
+    glDeleteProgram(programs[1]);
+
+    for (int i = 0; i < 2; ++i) {
+        glBindTexture(GL_TEXTURE_2D_ARRAY, textures[i]);
+        glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+    }
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+    // Every instance draws the same corners, facing its quad to the camera in the vertex shader
+    glGenVertexArrays(1, &vao);
+    glBindVertexArray(vao);
+    glGenBuffers(1, &cornerBuffer);
+    glBindBuffer(GL_ARRAY_BUFFER, cornerBuffer);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(quadCorners), quadCorners, GL_STATIC_DRAW);
+    glEnableVertexAttribArray(ATTRIBUTE_COORD);
+    glVertexAttribPointer(ATTRIBUTE_COORD, 2, GL_FLOAT, GL_FALSE, 0, NULL);
+    glGenBuffers(1, &instanceBuffer);
+    glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+    for (GLuint column = 0; column < 4; ++column) {
+        glEnableVertexAttribArray(ATTRIBUTE_INSTANCE_TRANSFORM + column);
+        glVertexAttribPointer(ATTRIBUTE_INSTANCE_TRANSFORM + column, 4, GL_FLOAT, GL_FALSE, sizeof(Instance),
+            (GLvoid*)(column * sizeof(glm::vec4)));
+        glVertexAttribDivisor(ATTRIBUTE_INSTANCE_TRANSFORM + column, 1);
+    }
+    glEnableVertexAttribArray(ATTRIBUTE_TEXCOORD);
+    glVertexAttribPointer(ATTRIBUTE_TEXCOORD, 1, GL_FLOAT, GL_FALSE, sizeof(Instance),
+        (GLvoid*)(sizeof(glm::mat4)));
+    glVertexAttribDivisor(ATTRIBUTE_TEXCOORD, 1);
+
+    // Its instances are bound the first time a culler's impostors are drawn
+    glGenVertexArrays(1, &culledVao);
+    glBindVertexArray(culledVao);
+    glBindBuffer(GL_ARRAY_BUFFER, cornerBuffer);
+    glEnableVertexAttribArray(ATTRIBUTE_COORD);
+    glVertexAttribPointer(ATTRIBUTE_COORD, 2, GL_FLOAT, GL_FALSE, 0, NULL);
+    culledBy = NULL;
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+ImpostorAtlas::~ImpostorAtlas() {
+    glDeleteTextures(1, &colourTexture);
+    glDeleteTextures(1, &normalDepthTexture);
+    glDeleteBuffers(1, &cornerBuffer);
+    glDeleteBuffers(1, &instanceBuffer);
+    glDeleteVertexArrays(1, &vao);
+    glDeleteVertexArrays(1, &culledVao);
+}
+
+bool ImpostorAtlas::supported() {
+    GLint majorVersion = 0, minorVersion = 0;
+    glGetIntegerv(GL_MAJOR_VERSION, &majorVersion);
+    glGetIntegerv(GL_MINOR_VERSION, &minorVersion);
+    return majorVersion * 10 + minorVersion >= 33;
+}
+
+void ImpostorAtlas::bake(const ModelData* model, const Layer& layer, GLuint framebuffer, const GLuint programs[2]) {
+    const GLuint targets[2] = { colourTexture, normalDepthTexture };
+    const float r = layer.radius;
+    glBindVertexArray(model->vao);
+    for (int pass = 0; pass < 2; ++pass) {
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, targets[pass], 0,
+            static_cast<GLint>(layer.layer));
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+            std::cerr << "Impostor framebuffer is incomplete" << std::endl;
+            exit(EXIT_FAILURE);
+        }
+
+        // Texels no view covers stay transparent
+        glViewport(0, 0, IMPOSTOR_FRAMES * IMPOSTOR_FRAME_SIZE, IMPOSTOR_FRAMES * IMPOSTOR_FRAME_SIZE);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+        const GLuint program = programs[pass];
+        glUseProgram(program);
+        glUniform3fv(glGetUniformLocation(program, "center"), 1, glm::value_ptr(layer.center));
+        glUniform1f(glGetUniformLocation(program, "radius"), r);
+        glUniform1i(glGetUniformLocation(program, "modelTexture"), 0);
+        const GLint uniform_viewProj = glGetUniformLocation(program, "viewProj");
+        const GLint uniform_viewDirection = glGetUniformLocation(program, "viewDirection");
+
+        // Each view looks at the bounding sphere from twice its radius, with the sphere filling it
+        const glm::mat4 projection = glm::ortho(-r, r, -r, r, r, 3.0f * r);
+        for (int y = 0; y < IMPOSTOR_FRAMES; ++y) {
+            for (int x = 0; x < IMPOSTOR_FRAMES; ++x) {
+                const glm::vec3 direction = frameDirection(x, y);
+                glm::vec3 right, up;
+                frameBasis(direction, right, up);
+                const glm::mat4 viewProj = projection *
+                    glm::lookAt(layer.center + direction * 2.0f * r, layer.center, up);
+                glUniformMatrix4fv(uniform_viewProj, 1, GL_FALSE, glm::value_ptr(viewProj));
+                glUniform3fv(uniform_viewDirection, 1, glm::value_ptr(direction));
+                glViewport(x * IMPOSTOR_FRAME_SIZE, y * IMPOSTOR_FRAME_SIZE, IMPOSTOR_FRAME_SIZE, IMPOSTOR_FRAME_SIZE);
+
+                for (size_t i = 0; i < model->shapes.size(); ++i) {
+                    const ModelData::Shape& shape = model->shapes[i];
+                    if (pass == 0) {
+                        glActiveTexture(GL_TEXTURE0);
+                        glBindTexture(GL_TEXTURE_2D, shape.textureId);
+                    }
+                    glDrawElements(GL_TRIANGLES, shape.numElements, GL_UNSIGNED_INT, (GLvoid*)(uintptr_t)shape.elementOffset);
+                }
+            }
+        }
+    }
+}
+
+float ImpostorAtlas::radius(const ModelData* model) const {
+    std::map<const ModelData*, Layer>::const_iterator found = layers.find(model);
+    return found == layers.end() ? 0.0f : found->second.radius;
+}
+
+glm::mat4 ImpostorAtlas::sphere(const ModelData* model) const {
+    const Layer& layer = layers.find(model)->second;
+    return glm::translate(glm::mat4(1.0f), layer.center) * glm::scale(glm::mat4(1.0f), glm::vec3(layer.radius));
+}
+
+float ImpostorAtlas::layer(const ModelData* model) const {
+    return layers.find(model)->second.layer;
+}
+
+const Material& ImpostorAtlas::material() const {
+    return impostorMaterial;
+}
+
+void ImpostorAtlas::begin() {
+    instances.clear();
+}
+
+void ImpostorAtlas::addInstance(const ModelData* model, const glm::mat4& transformation) {
+    Instance instance;
+    instance.transformation = transformation * sphere(model);
+    instance.layer = layer(model);
+    instances.push_back(instance);
+}
+
+size_t ImpostorAtlas::numInstances() const {
+    return instances.size();
+}
+
+void ImpostorAtlas::bindTextures(GLenum colourUnit, GLenum normalDepthUnit) const {
+    glActiveTexture(colourUnit);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, colourTexture);
+    glActiveTexture(normalDepthUnit);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, normalDepthTexture);
+}
+
+void ImpostorAtlas::draw() const {
+    if (instances.empty()) {
+        return;
+    }
+    glBindVertexArray(vao);
+    glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+    glBufferData(GL_ARRAY_BUFFER, instances.size() * sizeof(Instance), &instances[0], GL_STREAM_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, static_cast<GLsizei>(instances.size()));
+    glBindVertexArray(0);
+}
+
+void ImpostorAtlas::draw(const GpuCuller& culler) {
+    glBindVertexArray(culledVao);
+    if (culledBy != &culler) {
+        culler.bindImpostorAttributes(ATTRIBUTE_INSTANCE_TRANSFORM, ATTRIBUTE_TEXCOORD);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        culledBy = &culler;
+    }
+    culler.drawImpostors();
+    glBindVertexArray(0);
+}
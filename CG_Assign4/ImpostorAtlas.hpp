@@ -0,0 +1,123 @@
+//! Octahedral impostors, pictures of models drawn in place of far instances
+#pragma once
+#include <map>
+#include <vector>
+#include "GLHeaders.hpp"
+#include "ModelData.hpp"
+#include "glm/mat4x4.hpp"
+
+class GpuCuller;
+
+// Views of each model along each side of its hemi-octahedral grid, and the size of each view
+#define IMPOSTOR_FRAMES 8
+#define IMPOSTOR_FRAME_SIZE 64
+
+/// <summary>
+/// Renders models from every direction above the ground into a texture array, one layer per
+/// model, and draws far instances of them as camera facing quads sampling those views.
+///
+/// The views are taken from the directions of a hemi-octahedron, which maps the upper hemisphere
+/// onto a square, in an IMPOSTOR_FRAMES x IMPOSTOR_FRAMES grid. Each view is an orthographic
+/// picture of the model's bounding sphere. One array holds the colour of the model's textures and
+/// how much of each texel it covers, the other its model space normal and its depth along the
+/// view, so the impostors can be lit and fogged like the models and write their real depth. Both
+/// are multiplied by the coverage, so their mipmaps don't darken the edges.
+///
+/// Every instance of every model is drawn with a single instanced draw. Needs OpenGL 3.3 for
+/// instanced attributes, see supported.
+/// </summary>
+class ImpostorAtlas {
+public:
+    /// <summary>
+    /// Renders the models' views. The models are drawn with their first shape's material, so
+    /// they should all share it, as generated buildings do.
+    /// </summary>
+    ///
+    /// <param name="models">The models to make impostors of, each with bounds.</param>
+    ImpostorAtlas(const std::vector<const ModelData*>& models);
+    ~ImpostorAtlas();
+
+    /// <summary>
+    /// Whether the current context can draw impostors.
+    /// </summary>
+    static bool supported();
+
+    /// <summary>
+    /// The radius of the sphere a model's views were taken of, in model space, or 0 if the model
+    /// has no impostor.
+    /// </summary>
+    float radius(const ModelData* model) const;
+
+    /// <summary>
+    /// The transformation of a unit sphere onto the sphere a model's views were taken of, in model
+    /// space, and the model's layer, which draw reads for each instance. The model must have an impostor.
+    /// </summary>
+    glm::mat4 sphere(const ModelData* model) const;
+
+    float layer(const ModelData* model) const;
+
+    /// <summary>
+    /// The material to light the impostors with.
+    /// </summary>
+    const Material& material() const;
+
+    /// <summary>
+    /// Start a new frame, removing the previous frame's instances.
+    /// </summary>
+    void begin();
+
+    /// <summary>
+    /// Draw an instance of a model, which must have an impostor, in this frame's draw.
+    /// </summary>
+    void addInstance(const ModelData* model, const glm::mat4& transformation);
+
+    size_t numInstances() const;
+
+    /// <summary>
+    /// Bind the colour array to one texture unit and the normal and depth array to another.
+    /// </summary>
+    void bindTextures(GLenum colourUnit, GLenum normalDepthUnit) const;
+
+    /// <summary>
+    /// Upload the instances and draw them, with a program built from impostor.v.glsl bound. The
+    /// quad's corners are read from ATTRIBUTE_COORD, each instance's transformation of its model's
+    /// bounding sphere, as a unit sphere, from ATTRIBUTE_INSTANCE_TRANSFORM and its layer from
+    /// ATTRIBUTE_TEXCOORD.
+    /// </summary>
+    void draw() const;
+
+    /// <summary>
+    /// Draw the impostors a GPU culler chose this frame, as draw draws the instances added.
+    /// </summary>
+    void draw(const GpuCuller& culler);
+
+private:
+    // The transformation of a unit sphere onto the instance's bounds, and its layer
+    struct Instance {
+        glm::mat4 transformation;
+        GLfloat layer;
+    };
+
+    // A model's layer and bounding sphere in model space
+    struct Layer {
+        GLfloat layer;
+        glm::vec3 center;
+        float radius;
+    };
+
+    std::map<const ModelData*, Layer> layers;
+    Material impostorMaterial;
+    GLuint colourTexture;
+    GLuint normalDepthTexture;
+
+    std::vector<Instance> instances;
+    GLuint vao;
+    GLuint cornerBuffer;
+    GLuint instanceBuffer;
+    // Draws the same corners with the culled impostors of culledBy
+    GLuint culledVao;
+    const GpuCuller* culledBy;
+
+    // Renders each view of a model into a layer of both arrays
+    void bake(const ModelData* model, const Layer& layer, GLuint framebuffer, const GLuint programs[2]);
+};
@@ -2,13 +2,18 @@
 #include "GLShaderLoader.hpp"
 #include "Camera.hpp"
 #include "ModelData.hpp"
+#include "MeshCache.hpp"
+#include "MeshSimplifier.hpp"
 #include "Shapes.hpp"
 #include "Renderer.hpp"
 #include "City.hpp"
+#include "CityPvs.hpp"
 #include "Sun.hpp"
 #include "Skybox.hpp"
 #include "BuildingFactory.hpp"
 #include "Terrain.hpp"
+#include "AssetManager.hpp"
+#include "AssetPack.hpp"
 
 #include "glm/vec3.hpp"
 #include "glm/vec4.hpp"
@@ -16,6 +21,8 @@
 #include "glm/gtc/matrix_transform.hpp"
 #include "glm/gtx/rotate_vector.hpp"
 
+#include <sstream>
+
 #define TAU (6.283185307179586f)
 #define DEG2RAD(x) ((x) / 360.0f * TAU)
 
@@ -23,7 +30,15 @@
 #define FORWARD_DIR (glm::vec3(0, 0, 1))
 #define ORIGIN  (glm::vec3(0))
 
-#define NUMBER_OF_BUILDINGS 20
+#define STREETLIGHT_FILENAME "data/streetlight/lamppost_01.obj"
+// The height of lamppost_01.obj in its own units, its arm reaches about half as far
+#define STREETLIGHT_MODEL_SIZE 800.0f
+// Simplified levels of the streetlight, each keeping this fraction of the last one's triangles
+#define STREETLIGHT_LEVELS 3
+#define STREETLIGHT_LEVEL_RATIO 0.5f
+
+// Largest texture width/height, 0 for full resolution (e.g. 256 for a low quality preset)
+#define MAX_TEXTURE_DIMENSION 0
 
 static ModelData* streetlightModel;
 static City* city;
@@ -41,6 +56,9 @@ static GLsizei screenHeight = 600;
 
 static long prevTime = 0;
 
+// Printed with the FPS, in the order of OcclusionMode
+static const char* const occlusionModeNames[NUM_OCCLUSION_MODES] = { "off", "depth buffer", "horizon", "GPU queries" };
+
 // A simple structure for storing relevant information required for keyboard control
 struct KeyState {
     bool up;
@@ -62,17 +80,31 @@ static struct MouseHandler {
 
 // Initialise the program resources
 void initResources() {
-    GLuint shadowMapProgram = initProgram(shaderFromFile("shaders/shadowmap.v.glsl", GL_VERTEX_SHADER),
-        shaderFromFile("shaders/shadowmap.f.glsl", GL_FRAGMENT_SHADER));
-    GLuint modelProgram = initProgram(shaderFromFile("shaders/vshader.glsl", GL_VERTEX_SHADER),
-        shaderFromFile("shaders/fshader.glsl", GL_FRAGMENT_SHADER));
-
-    GLuint skyboxProgram = initProgram(shaderFromFile("shaders/skybox.v.glsl", GL_VERTEX_SHADER),
-        shaderFromFile("shaders/skybox.f.glsl", GL_FRAGMENT_SHADER));
+    // Shadow map, depth pre-pass and skybox programs, built together so they can be compiled in
+    // parallel. The shadow map and depth positions use the same location as the models' so they can
+    // draw their vertex arrays, and the instanced shadow map reads the transformations from the
+    // same location as the instanced models.
+    static const char* const shadowMapAttributes[] = { "v_position", NULL };
+    static const char* const instancedShadowMapAttributes[] = { "v_position", "v_normal", "v_texcoord", "v_tangent",
+        "m_instance", NULL };
+    static const char* const depthAttributes[] = { "v_coord", NULL };
+    const ProgramSource programSources[] = {
+        { "shaders/shadowmap.v.glsl", "shaders/shadowmap.f.glsl", "", shadowMapAttributes },
+        { "shaders/shadowmap.v.glsl", "shaders/shadowmap.f.glsl", "#define INSTANCED\n", instancedShadowMapAttributes },
+        { "shaders/depth.v.glsl", "shaders/shadowmap.f.glsl", "", depthAttributes },
+        { "shaders/skybox.v.glsl", "shaders/skybox.f.glsl", "", NULL }
+    };
+    GLuint programs[4];
+    initPrograms(programSources, programs, 4);
+    GLuint shadowMapProgram = programs[0];
+    GLuint instancedShadowMapProgram = programs[1];
+    GLuint depthProgram = programs[2];
+    GLuint skyboxProgram = programs[3];
 
     cam1 = new Camera(glm::vec3(0.0f, 10.0f, 10.0f), glm::vec3(0.0f, 10.0f, 1.0f));
     sun = new Sun(-TAU / 24.0f, TAU / 12.0f);
-    renderer = new Renderer(screenWidth, screenHeight, 30.0f, cam1, sun, modelProgram, shadowMapProgram, skyboxProgram);
+    renderer = new Renderer(screenWidth, screenHeight, 30.0f, cam1, sun, "shaders/vshader.glsl", "shaders/fshader.glsl",
+        shadowMapProgram, instancedShadowMapProgram, depthProgram, skyboxProgram);
 
     ground = new Terrain(renderer);
 
@@ -86,18 +118,69 @@ void initResources() {
     std::string topTextureName = "data/building/roof.jpg";
     buildingFactory = new BuildingFactory(sideTextureNames, topTextureName);
 
-    // Generate city
+    // Generate city, buildings already in the mesh cache are uploaded from it instead of regenerated
     std::vector<ModelData*> modelBuildings;
-    std::vector<RawModelData> buildings;
-    buildings = buildingFactory->genBuildings(NUMBER_OF_BUILDINGS);
-    for (size_t i = 0; i < buildings.size(); ++i) {
-        ModelData *buildingModel = new ModelData(buildings[i], renderer);
+    std::vector<RawModelData> buildingProxies;
+    for (unsigned int seed = 0; seed < NUMBER_OF_BUILDINGS; ++seed) {
+        std::ostringstream name;
+        name << "building_" << seed;
+        const std::string cacheFilename = MeshCache::cacheFilename(name.str());
+        const uint64_t key = buildingFactory->cacheKey(seed);
+
+        ModelData *buildingModel;
+        RawModelData building;
+        MeshCache* cache = MeshCache::open(cacheFilename, key);
+        if (cache != NULL) {
+            buildingModel = new ModelData(*cache, renderer);
+            building = cache->toRawModelData();
+            delete cache;
+        }
+        else {
+            building = buildingFactory->genBuilding(seed);
+            MeshCache::write(cacheFilename, building, key);
+            buildingModel = new ModelData(building, renderer);
+        }
+        // The simplified levels are a few boxes around the building's blocks, quicker to generate
+        // than to cache
+        const std::vector<RawModelLod> lods = buildingFactory->genLods(building);
         buildingModel->reduce();
+
+        for (size_t i = 0; i < lods.size(); ++i) {
+            buildingModel->addLod(lods[i], renderer);
+        }
         modelBuildings.push_back(buildingModel);
+
+        // Far chunks are merged from the box with a roof, or the whole building if it has no blocks
+        // to make one from
+        buildingProxies.push_back(lods.empty() ? building : lods.front().data);
     }
-    streetlightModel = new ModelData(loadModelData("data/streetlight/lamppost_01.obj", true), renderer);
+    // Far buildings are drawn as pictures of themselves
+    renderer->bakeImpostors(std::vector<const ModelData*>(modelBuildings.begin(), modelBuildings.end()));
+
+    // Far streetlights are drawn with a chain of simplified levels, then left out once they're too
+    // small to see
+    const RawModelData streetlight = loadModelData(STREETLIGHT_FILENAME, true);
+    streetlightModel = new ModelData(streetlight, renderer);
     streetlightModel->reduce();
+    MeshSimplifier streetlightSimplifier(streetlight);
+    for (int level = 0; level < STREETLIGHT_LEVELS; ++level) {
+        const size_t before = streetlightSimplifier.numTriangles();
+        RawModelLod lod;
+        lod.data = streetlightSimplifier.simplify(static_cast<size_t>(before * STREETLIGHT_LEVEL_RATIO));
+        if (streetlightSimplifier.numTriangles() == before) {
+            break;
+        }
+        lod.error = surfaceDistance(streetlight, lod.data);
+        lod.roofless = false;
+        flatShade(lod.data);
+        streetlightModel->addLod(lod, renderer);
+    }
+    streetlightModel->addEmptyLod(STREETLIGHT_MODEL_SIZE);
     city = new City(modelBuildings, streetlightModel, 30.0f);
+    if (!city->loadVisibleSets(CITY_PVS_FILENAME)) {
+        std::cout << "No visible sets for this city, run 'make pvs' to bake them" << std::endl;
+    }
+    city->enableProxies(buildingProxies);
 
     //day filenames
     std::vector<std::string> day_files;
@@ -139,6 +222,7 @@ void initResources() {
 void onDisplay() {
     renderer->clear();
 
+    city->update(renderer, cam1->getPosition());
     ground->draw(renderer, city, cam1->getPosition(), 15);
     city->draw(renderer, cam1->getPosition());
     renderer->renderScene();
@@ -162,7 +246,22 @@ void onIdle() {
     // FPS counter
     frames += 1;
     if (static_cast<float>(time - past) / 1000.0f >= 1.0f) {
-        std::cout << "FPS: " << frames << std::endl;
+        std::cout << "FPS: " << frames << ", shaded samples: " << renderer->shadedSamples()
+            << (renderer->depthPrePassEnabled() ? " (depth pre-pass)" : "") << ", occluded: "
+            << renderer->numOccluded() << " (" << occlusionModeNames[renderer->getOcclusionMode()] << ")"
+            << (renderer->gpuCullingEnabled() ? " (GPU culling)" : "") << ", tiles drawn: " << city->numDrawnTiles()
+            << ", simplified: " << renderer->numSimplified() << ", dropped: " << renderer->numDropped();
+        if (renderer->impostorsEnabled()) {
+            std::cout << ", impostors: " << renderer->numImpostors();
+        }
+        if (city->proxiesEnabled()) {
+            std::cout << ", proxies: " << city->numDrawnProxies();
+        }
+        if (renderer->getOcclusionMode() == OCCLUSION_QUERIES) {
+            std::cout << ", query hits: " << renderer->occlusionQueryHits() << ", misses: "
+                << renderer->occlusionQueryMisses();
+        }
+        std::cout << std::endl;
         frames = 0;
         past = time;
     }
@@ -215,6 +314,11 @@ void keyboard(unsigned char key, int x, int y) {
     case 'i': sun->increaseSpeed(); break;
     case 'o': sun->decreaseSpeed(); break;
     case 'p': sun->togglePause(); break;
+    case 'z': renderer->toggleDepthPrePass(); break;
+    case 'c': renderer->nextOcclusionMode(); break;
+    case 'g': renderer->toggleGpuCulling(); break;
+    case 'b': renderer->toggleImpostors(); break;
+    case 'h': city->toggleProxies(); break;
     }
 }
 
@@ -311,10 +415,9 @@ int main(int argc, char* argv[]) {
     glewInit();
 #endif
 
-    // Enable GL properties
+    // Enable GL properties, the renderer turns blending on only for what needs it
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
     glEnable(GL_DEPTH_TEST);
-    glEnable(GL_BLEND);
     glEnable(GL_TEXTURE_2D);
     glCullFace(GL_BACK);
     glFrontFace(GL_CW);
@@ -330,6 +433,10 @@ int main(int argc, char* argv[]) {
     glutMotionFunc(onMotion);
     initGlutMenu();
 
+    // Read assets from the pack built by 'make pack' if there is one, otherwise from the loose files
+    AssetPack::mount(ASSET_PACK_FILENAME);
+
+    AssetManager::setMaxTextureDimension(MAX_TEXTURE_DIMENSION);
     initResources();
 
     glutMainLoop();
@@ -0,0 +1,84 @@
+#include "MappedFile.hpp"
+
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile* MappedFile::open(const std::string& filename) {
+    void* mapping = NULL;
+    size_t size = 0;
+
+#ifdef WIN32
+    HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+        FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        return NULL;
+    }
+    size = GetFileSize(file, NULL);
+    if (size > 0) {
+        HANDLE fileMapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (fileMapping != NULL) {
+            mapping = MapViewOfFile(fileMapping, FILE_MAP_READ, 0, 0, 0);
+            CloseHandle(fileMapping);
+        }
+    }
+    CloseHandle(file);
+#else
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+    struct stat info;
+    if (fstat(fd, &info) == 0) {
+        size = info.st_size;
+    }
+    if (size > 0) {
+        mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapping == MAP_FAILED) {
+            mapping = NULL;
+        }
+    }
+    close(fd);
+#endif
+
+    // Empty files can't be mapped, but are still valid
+    if (mapping == NULL && size > 0) {
+        return NULL;
+    }
+    return new MappedFile(mapping, size);
+}
+
+MappedFile::MappedFile(void* mapping, size_t size) : mapping(mapping), mappingSize(size) {
+}
+
+MappedFile::~MappedFile() {
+    if (mapping == NULL) {
+        return;
+    }
+#ifdef WIN32
+    UnmapViewOfFile(mapping);
+#else
+    munmap(mapping, mappingSize);
+#endif
+}
+
+const char* MappedFile::data() const {
+    return static_cast<const char*>(mapping);
+}
+
+size_t MappedFile::size() const {
+    return mappingSize;
+}
+
+void MappedFile::prefetch() const {
+#ifndef WIN32
+    if (mapping != NULL) {
+        madvise(mapping, mappingSize, MADV_WILLNEED);
+    }
+#endif
+}
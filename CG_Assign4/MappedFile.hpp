@@ -0,0 +1,38 @@
+//! A read only file mapped into memory
+#pragma once
+#include <string>
+#include <cstddef>
+
+class MappedFile {
+public:
+    /// <summary>
+    /// Map a whole file into memory.
+    /// </summary>
+    ///
+    /// <param name="filename">The file to map.</param>
+    /// <returns>The mapped file, or NULL if it could not be opened or mapped.</returns>
+    static MappedFile* open(const std::string& filename);
+
+    /// <summary>
+    /// Unmaps the file.
+    /// </summary>
+    ~MappedFile();
+
+    /// <summary>
+    /// The contents of the file, not null terminated. NULL for an empty file.
+    /// </summary>
+    const char* data() const;
+
+    size_t size() const;
+
+    /// <summary>
+    /// Hint that the whole file will be read soon, so it can be read ahead in large sequential reads.
+    /// </summary>
+    void prefetch() const;
+
+private:
+    MappedFile(void* mapping, size_t size);
+
+    void* mapping;
+    size_t mappingSize;
+};
@@ -0,0 +1,316 @@
+#include "MeshCache.hpp"
+#include "MappedFile.hpp"
+#include <cstdio>
+#include <cstring>
+
+#ifdef WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+
+// "MSHC", also catches files written with the other byte order
+#define MESH_CACHE_MAGIC 0x4348534Du
+
+// Streams start on 16 byte boundaries so they can be handed straight to the driver
+#define ALIGN16(x) (((x) + 15) & ~(uint64_t)15)
+
+struct MeshCache::Header {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t key;
+    uint64_t fileSize;
+
+    uint32_t numShapes;
+    uint32_t numVertices;
+    uint32_t numIndices;
+    uint32_t stringTableSize;
+    uint32_t numOccluders;
+    BoundingBox boundingBox;
+
+    // Byte offsets of each section from the start of the file
+    uint64_t shapes;
+    uint64_t vertices;
+    uint64_t normals;
+    uint64_t texCoords;
+    uint64_t tangents;
+    uint64_t indices;
+    uint64_t occluders;
+    uint64_t strings;
+};
+
+// Whether count items of stride bytes starting at offset lie within a file of the given size
+static bool sectionFits(uint64_t offset, uint64_t count, uint64_t stride, uint64_t size) {
+    return offset <= size && count * stride <= size - offset;
+}
+
+MeshCache* MeshCache::open(const std::string& filename, uint64_t key) {
+    MappedFile* file = MappedFile::open(filename);
+    if (file == NULL) {
+        return NULL;
+    }
+
+    // Check the file is complete and was built from the same source
+    const Header* header = reinterpret_cast<const Header*>(file->data());
+    if (file->size() < sizeof(Header) || header->magic != MESH_CACHE_MAGIC || header->version != MESH_CACHE_VERSION ||
+            header->key != key || header->fileSize != file->size()) {
+        delete file;
+        return NULL;
+    }
+
+    // A damaged file is rejected so the model is loaded from its source instead
+    MeshCache* cache = new MeshCache(file);
+    if (!cache->valid()) {
+        delete cache;
+        return NULL;
+    }
+    return cache;
+}
+
+bool MeshCache::write(const std::string& filename, const RawModelData& data, uint64_t key) {
+    Header header;
+    memset(static_cast<void*>(&header), 0, sizeof(header));
+    header.magic = MESH_CACHE_MAGIC;
+    header.version = MESH_CACHE_VERSION;
+    header.key = key;
+    header.boundingBox = data.boundingBox;
+    header.numShapes = data.shapes.size();
+    header.numOccluders = data.occluders.size();
+
+    // Lay out the shapes and strings, rebasing each shape's indices onto the combined vertex stream
+    std::vector<Shape> shapes;
+    std::vector<uint32_t> indices;
+    std::string strings;
+    for (size_t i = 0; i < data.shapes.size(); ++i) {
+        const RawModelData::Shape& source = data.shapes[i];
+        Shape shape;
+        shape.material = source.material;
+        shape.vertexOffset = header.numVertices;
+        shape.numVertices = source.vertices.size();
+        shape.indexOffset = header.numIndices;
+        shape.numIndices = source.indices.size();
+        shape.textureName = NO_STRING;
+        shape.normalMap = NO_STRING;
+        if (!source.textureName.empty()) {
+            shape.textureName = strings.size();
+            strings.append(source.textureName.c_str(), source.textureName.size() + 1);
+        }
+        if (!source.normalMap.empty()) {
+            shape.normalMap = strings.size();
+            strings.append(source.normalMap.c_str(), source.normalMap.size() + 1);
+        }
+        shapes.push_back(shape);
+
+        for (size_t j = 0; j < source.indices.size(); ++j) {
+            indices.push_back(source.indices[j] + header.numVertices);
+        }
+        header.numVertices += shape.numVertices;
+        header.numIndices += shape.numIndices;
+    }
+    header.stringTableSize = strings.size();
+
+    header.shapes = ALIGN16(sizeof(Header));
+    header.vertices = ALIGN16(header.shapes + header.numShapes * sizeof(Shape));
+    header.normals = ALIGN16(header.vertices + header.numVertices * sizeof(glm::vec3));
+    header.texCoords = ALIGN16(header.normals + header.numVertices * sizeof(glm::vec3));
+    header.tangents = ALIGN16(header.texCoords + header.numVertices * sizeof(glm::vec2));
+    header.indices = ALIGN16(header.tangents + header.numVertices * sizeof(glm::vec3));
+    header.occluders = ALIGN16(header.indices + header.numIndices * sizeof(uint32_t));
+    header.strings = ALIGN16(header.occluders + header.numOccluders * sizeof(BoundingBox));
+    header.fileSize = header.strings + header.stringTableSize;
+
+    // Build the whole file in memory, shapes without texture coordinates or tangents get zeros
+    std::vector<char> contents(header.fileSize, 0);
+    memcpy(&contents[0], &header, sizeof(header));
+    if (!shapes.empty()) {
+        memcpy(&contents[header.shapes], &shapes[0], shapes.size() * sizeof(Shape));
+    }
+    for (size_t i = 0; i < data.shapes.size(); ++i) {
+        const RawModelData::Shape& source = data.shapes[i];
+        const uint32_t offset = shapes[i].vertexOffset;
+        const size_t count = source.vertices.size();
+        if (count == 0) {
+            continue;
+        }
+        memcpy(&contents[header.vertices + offset * sizeof(glm::vec3)], &source.vertices[0], count * sizeof(glm::vec3));
+        if (source.normals.size() == count) {
+            memcpy(&contents[header.normals + offset * sizeof(glm::vec3)], &source.normals[0], count * sizeof(glm::vec3));
+        }
+        if (source.texCoords.size() == count) {
+            memcpy(&contents[header.texCoords + offset * sizeof(glm::vec2)], &source.texCoords[0], count * sizeof(glm::vec2));
+        }
+        if (source.tangents.size() == count) {
+            memcpy(&contents[header.tangents + offset * sizeof(glm::vec3)], &source.tangents[0], count * sizeof(glm::vec3));
+        }
+    }
+    if (!indices.empty()) {
+        memcpy(&contents[header.indices], &indices[0], indices.size() * sizeof(uint32_t));
+    }
+    if (!data.occluders.empty()) {
+        memcpy(&contents[header.occluders], &data.occluders[0], data.occluders.size() * sizeof(BoundingBox));
+    }
+    if (!strings.empty()) {
+        memcpy(&contents[header.strings], strings.data(), strings.size());
+    }
+
+    createDirectory();
+
+    // Write to a temporary file first so a half written cache is never picked up
+    std::string temporary = filename + ".tmp";
+    FILE* out = fopen(temporary.c_str(), "wb");
+    if (out == NULL) {
+        return false;
+    }
+    bool written = fwrite(&contents[0], 1, contents.size(), out) == contents.size();
+    written = (fclose(out) == 0) && written;
+#ifdef WIN32
+    remove(filename.c_str());
+#endif
+    if (!written || rename(temporary.c_str(), filename.c_str()) != 0) {
+        remove(temporary.c_str());
+        return false;
+    }
+    return true;
+}
+
+void MeshCache::createDirectory() {
+#ifdef WIN32
+    _mkdir(MESH_CACHE_DIRECTORY);
+#else
+    mkdir(MESH_CACHE_DIRECTORY, 0755);
+#endif
+}
+
+std::string MeshCache::cacheFilename(const std::string& name) {
+    std::string flattened = name;
+    for (size_t i = 0; i < flattened.size(); ++i) {
+        if (flattened[i] == '/' || flattened[i] == '\\' || flattened[i] == ':') {
+            flattened[i] = '_';
+        }
+    }
+    return MESH_CACHE_DIRECTORY + flattened + ".mesh";
+}
+
+MeshCache::MeshCache(MappedFile* file) : file(file) {
+}
+
+MeshCache::~MeshCache() {
+    delete file;
+}
+
+RawModelData MeshCache::toRawModelData() const {
+    RawModelData data;
+    data.boundingBox = boundingBox();
+    data.occluders.assign(occluders(), occluders() + numOccluders());
+    for (uint32_t i = 0; i < numShapes(); ++i) {
+        const Shape& source = shape(i);
+        RawModelData::Shape shape;
+        const uint32_t first = source.vertexOffset;
+        const uint32_t last = source.vertexOffset + source.numVertices;
+        shape.vertices.assign(vertices() + first, vertices() + last);
+        shape.normals.assign(normals() + first, normals() + last);
+        shape.texCoords.assign(texCoords() + first, texCoords() + last);
+        shape.tangents.assign(tangents() + first, tangents() + last);
+        shape.indices.reserve(source.numIndices);
+        for (uint32_t j = 0; j < source.numIndices; ++j) {
+            shape.indices.push_back(indices()[source.indexOffset + j] - first);
+        }
+        shape.material = source.material;
+        shape.textureName = string(source.textureName);
+        shape.normalMap = string(source.normalMap);
+        data.shapes.push_back(shape);
+    }
+    return data;
+}
+
+uint32_t MeshCache::numShapes() const {
+    return header()->numShapes;
+}
+
+uint32_t MeshCache::numVertices() const {
+    return header()->numVertices;
+}
+
+uint32_t MeshCache::numIndices() const {
+    return header()->numIndices;
+}
+
+BoundingBox MeshCache::boundingBox() const {
+    return header()->boundingBox;
+}
+
+uint32_t MeshCache::numOccluders() const {
+    return header()->numOccluders;
+}
+
+const BoundingBox* MeshCache::occluders() const {
+    return static_cast<const BoundingBox*>(at(header()->occluders));
+}
+
+const MeshCache::Shape& MeshCache::shape(uint32_t i) const {
+    return static_cast<const Shape*>(at(header()->shapes))[i];
+}
+
+std::string MeshCache::string(uint32_t offset) const {
+    if (offset == NO_STRING || offset >= header()->stringTableSize) {
+        return std::string();
+    }
+    return std::string(static_cast<const char*>(at(header()->strings)) + offset);
+}
+
+const glm::vec3* MeshCache::vertices() const {
+    return static_cast<const glm::vec3*>(at(header()->vertices));
+}
+
+const glm::vec3* MeshCache::normals() const {
+    return static_cast<const glm::vec3*>(at(header()->normals));
+}
+
+const glm::vec2* MeshCache::texCoords() const {
+    return static_cast<const glm::vec2*>(at(header()->texCoords));
+}
+
+const glm::vec3* MeshCache::tangents() const {
+    return static_cast<const glm::vec3*>(at(header()->tangents));
+}
+
+const uint32_t* MeshCache::indices() const {
+    return static_cast<const uint32_t*>(at(header()->indices));
+}
+
+bool MeshCache::valid() const {
+    const Header* h = header();
+    const uint64_t size = file->size();
+    if (!sectionFits(h->shapes, h->numShapes, sizeof(Shape), size) ||
+            !sectionFits(h->vertices, h->numVertices, sizeof(glm::vec3), size) ||
+            !sectionFits(h->normals, h->numVertices, sizeof(glm::vec3), size) ||
+            !sectionFits(h->texCoords, h->numVertices, sizeof(glm::vec2), size) ||
+            !sectionFits(h->tangents, h->numVertices, sizeof(glm::vec3), size) ||
+            !sectionFits(h->indices, h->numIndices, sizeof(uint32_t), size) ||
+            !sectionFits(h->occluders, h->numOccluders, sizeof(BoundingBox), size) ||
+            !sectionFits(h->strings, h->stringTableSize, 1, size)) {
+        return false;
+    }
+
+    // Strings are read up to their terminator, so the table must end with one
+    if (h->stringTableSize > 0 && static_cast<const char*>(at(h->strings))[h->stringTableSize - 1] != '\0') {
+        return false;
+    }
+
+    for (uint32_t i = 0; i < h->numShapes; ++i) {
+        const Shape& s = shape(i);
+        if ((uint64_t)s.vertexOffset + s.numVertices > h->numVertices ||
+                (uint64_t)s.indexOffset + s.numIndices > h->numIndices) {
+            return false;
+        }
+    }
+    return true;
+}
+
+const MeshCache::Header* MeshCache::header() const {
+    return reinterpret_cast<const Header*>(file->data());
+}
+
+const void* MeshCache::at(uint64_t offset) const {
+    return file->data() + offset;
+}
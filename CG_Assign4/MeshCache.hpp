@@ -0,0 +1,111 @@
+//! A memory mappable binary format for model data, ready to be uploaded to the GPU
+#pragma once
+#include <string>
+#include <stdint.h>
+#include "ModelData.hpp"
+#include "glm/vec2.hpp"
+#include "glm/vec3.hpp"
+
+class MappedFile;
+
+// Directory the cache files are written to
+#define MESH_CACHE_DIRECTORY "cache/"
+
+// Bump whenever the layout of the file or how models are prepared for it changes, older files are
+// then ignored and rewritten
+#define MESH_CACHE_VERSION 4
+
+class MeshCache {
+public:
+    // On disk description of a shape, all offsets are counts into the file's streams
+    struct Shape {
+        Material material;
+        uint32_t vertexOffset;
+        uint32_t numVertices;
+        uint32_t indexOffset;
+        uint32_t numIndices;
+        // Byte offsets into the string table, NO_STRING if the shape has no texture
+        uint32_t textureName;
+        uint32_t normalMap;
+    };
+
+    static const uint32_t NO_STRING = 0xFFFFFFFFu;
+
+    /// <summary>
+    /// Map a cache file into memory.
+    /// </summary>
+    ///
+    /// <param name="filename">The cache file.</param>
+    /// <param name="key">Identifies what the cache was built from, e.g. a source file's size and
+    /// modification time, or a building's seed.</param>
+    /// <returns>The mapped cache, or NULL if the file is missing, from another version, has a
+    /// different key or is damaged.</returns>
+    static MeshCache* open(const std::string& filename, uint64_t key);
+
+    /// <summary>
+    /// Write model data to a cache file, creating the cache directory if needed.
+    /// </summary>
+    ///
+    /// <param name="filename">The cache file.</param>
+    /// <param name="data">The model data to store.</param>
+    /// <param name="key">The key that open must be given to accept this file.</param>
+    /// <returns>true if the file was written.</returns>
+    static bool write(const std::string& filename, const RawModelData& data, uint64_t key);
+
+    /// <summary>
+    /// Create MESH_CACHE_DIRECTORY if it doesn't exist yet.
+    /// </summary>
+    static void createDirectory();
+
+    /// <summary>
+    /// The cache file name for a file or procedural model name, inside MESH_CACHE_DIRECTORY.
+    /// </summary>
+    static std::string cacheFilename(const std::string& name);
+
+    /// <summary>
+    /// Unmaps the file.
+    /// </summary>
+    ~MeshCache();
+
+    /// <summary>
+    /// Copy the mapped data back into a RawModelData, for code that modifies the model.
+    /// </summary>
+    RawModelData toRawModelData() const;
+
+    uint32_t numShapes() const;
+    uint32_t numVertices() const;
+    uint32_t numIndices() const;
+    BoundingBox boundingBox() const;
+    const Shape& shape(uint32_t i) const;
+
+    uint32_t numOccluders() const;
+    const BoundingBox* occluders() const;
+
+    /// <summary>
+    /// Returns a string from the string table, or an empty string for NO_STRING.
+    /// </summary>
+    std::string string(uint32_t offset) const;
+
+    // The streams, each numVertices long. Indices are relative to the whole vertex stream.
+    const glm::vec3* vertices() const;
+    const glm::vec3* normals() const;
+    const glm::vec2* texCoords() const;
+    const glm::vec3* tangents() const;
+    const uint32_t* indices() const;
+
+private:
+    struct Header;
+
+    MeshCache(MappedFile* file);
+
+    /// <summary>
+    /// Check every section and shape lies within the file, so a truncated or corrupt file is never
+    /// read past its end.
+    /// </summary>
+    bool valid() const;
+
+    const Header* header() const;
+    const void* at(uint64_t offset) const;
+
+    MappedFile* file;
+};
@@ -0,0 +1,505 @@
+#include "MeshSimplifier.hpp"
+#include "glm/geometric.hpp"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <map>
+
+// How much the planes along borders, seams and material boundaries count, relative to the
+// triangles' own planes, per unit of squared edge length
+#define BOUNDARY_WEIGHT 10.0
+
+// A collapse is refused if it turns a triangle's normal by more than about 75 degrees
+#define MIN_NORMAL_COSINE 0.25f
+
+namespace {
+    struct PositionLess {
+        bool operator()(const glm::vec3& a, const glm::vec3& b) const {
+            if (a.x != b.x) return a.x < b.x;
+            if (a.y != b.y) return a.y < b.y;
+            return a.z < b.z;
+        }
+    };
+
+    struct WedgeKey {
+        uint32_t vertex;
+        uint32_t shape;
+        float u;
+        float v;
+
+        bool operator<(const WedgeKey& other) const {
+            if (vertex != other.vertex) return vertex < other.vertex;
+            if (shape != other.shape) return shape < other.shape;
+            if (u != other.u) return u < other.u;
+            return v < other.v;
+        }
+    };
+
+    // Finds the corner of a triangle at a vertex, or -1
+    int cornerOf(const uint32_t* vertices, uint32_t vertex) {
+        for (int i = 0; i < 3; ++i) {
+            if (vertices[i] == vertex) {
+                return i;
+            }
+        }
+        return -1;
+    }
+
+    void removeTriangle(std::vector<uint32_t>& list, uint32_t triangle) {
+        std::vector<uint32_t>::iterator found = std::find(list.begin(), list.end(), triangle);
+        if (found != list.end()) {
+            *found = list.back();
+            list.pop_back();
+        }
+    }
+
+    // The closest point on a triangle, from Ericson's Real-Time Collision Detection
+    glm::vec3 closestPointOnTriangle(const glm::vec3& p, const glm::vec3& a, const glm::vec3& b, const glm::vec3& c) {
+        const glm::vec3 ab = b - a;
+        const glm::vec3 ac = c - a;
+        const glm::vec3 ap = p - a;
+        const float d1 = glm::dot(ab, ap);
+        const float d2 = glm::dot(ac, ap);
+        if (d1 <= 0.0f && d2 <= 0.0f) {
+            return a;
+        }
+
+        const glm::vec3 bp = p - b;
+        const float d3 = glm::dot(ab, bp);
+        const float d4 = glm::dot(ac, bp);
+        if (d3 >= 0.0f && d4 <= d3) {
+            return b;
+        }
+
+        const float vc = d1 * d4 - d3 * d2;
+        if (vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f) {
+            return a + ab * (d1 / (d1 - d3));
+        }
+
+        const glm::vec3 cp = p - c;
+        const float d5 = glm::dot(ab, cp);
+        const float d6 = glm::dot(ac, cp);
+        if (d6 >= 0.0f && d5 <= d6) {
+            return c;
+        }
+
+        const float vb = d5 * d2 - d1 * d6;
+        if (vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f) {
+            return a + ac * (d2 / (d2 - d6));
+        }
+
+        const float va = d3 * d6 - d5 * d4;
+        if (va <= 0.0f && (d4 - d3) >= 0.0f && (d5 - d6) >= 0.0f) {
+            return b + (c - b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)));
+        }
+
+        const float denominator = 1.0f / (va + vb + vc);
+        return a + ab * (vb * denominator) + ac * (vc * denominator);
+    }
+
+    // Three corners per triangle
+    std::vector<glm::vec3> triangleCorners(const RawModelData& data) {
+        std::vector<glm::vec3> corners;
+        for (size_t i = 0; i < data.shapes.size(); ++i) {
+            const RawModelData::Shape& shape = data.shapes[i];
+            for (size_t j = 0; j + 2 < shape.indices.size(); j += 3) {
+                corners.push_back(shape.vertices[shape.indices[j]]);
+                corners.push_back(shape.vertices[shape.indices[j + 1]]);
+                corners.push_back(shape.vertices[shape.indices[j + 2]]);
+            }
+        }
+        return corners;
+    }
+
+    // The squared distance from a point to the nearest of a set of triangles, stopping early once
+    // it's known to be under a bound
+    float nearestSquared(const glm::vec3& point, const std::vector<glm::vec3>& corners, float bound) {
+        float nearest = std::numeric_limits<float>::max();
+        for (size_t i = 0; i < corners.size() && nearest > bound; i += 3) {
+            const glm::vec3 offset = point - closestPointOnTriangle(point, corners[i], corners[i + 1], corners[i + 2]);
+            nearest = std::min(nearest, glm::dot(offset, offset));
+        }
+        return nearest;
+    }
+
+    // The largest distance from the corners and centres of one set of triangles to another
+    float oneSidedDistance(const std::vector<glm::vec3>& from, const std::vector<glm::vec3>& to) {
+        float largest = 0.0f;
+        for (size_t i = 0; i < from.size(); i += 3) {
+            for (int j = 0; j < 3; ++j) {
+                largest = std::max(largest, nearestSquared(from[i + j], to, largest));
+            }
+            const glm::vec3 centre = (from[i] + from[i + 1] + from[i + 2]) / 3.0f;
+            largest = std::max(largest, nearestSquared(centre, to, largest));
+        }
+        return std::sqrt(largest);
+    }
+}
+
+static void addPlane(double* q, const glm::vec3& normal, float distance, double weight) {
+    const double a = normal.x, b = normal.y, c = normal.z, d = distance;
+    q[0] += weight * a * a; q[1] += weight * a * b; q[2] += weight * a * c; q[3] += weight * a * d;
+    q[4] += weight * b * b; q[5] += weight * b * c; q[6] += weight * b * d;
+    q[7] += weight * c * c; q[8] += weight * c * d;
+    q[9] += weight * d * d;
+}
+
+MeshSimplifier::MeshSimplifier(const RawModelData& data) : source(data), remaining(0) {
+    // Weld positions across shapes, and find each corner's wedge
+    std::map<glm::vec3, uint32_t, PositionLess> positionIndices;
+    std::map<WedgeKey, uint32_t> wedgeIndices;
+    for (size_t s = 0; s < data.shapes.size(); ++s) {
+        const RawModelData::Shape& shape = data.shapes[s];
+        std::vector<uint32_t> shapeWedges(shape.vertices.size());
+        for (size_t i = 0; i < shape.vertices.size(); ++i) {
+            std::map<glm::vec3, uint32_t, PositionLess>::iterator position = positionIndices.find(shape.vertices[i]);
+            if (position == positionIndices.end()) {
+                position = positionIndices.insert(std::make_pair(shape.vertices[i], (uint32_t)positions.size())).first;
+                positions.push_back(shape.vertices[i]);
+            }
+
+            // Texture coordinates only make a seam if there's a texture to tear
+            const glm::vec2 texCoord = i < shape.texCoords.size() && !shape.textureName.empty() ?
+                shape.texCoords[i] : glm::vec2(0.0f);
+            WedgeKey key = { position->second, (uint32_t)s, texCoord.x, texCoord.y };
+            std::map<WedgeKey, uint32_t>::iterator wedge = wedgeIndices.find(key);
+            if (wedge == wedgeIndices.end()) {
+                Wedge newWedge = { position->second, (uint32_t)s, texCoord };
+                wedge = wedgeIndices.insert(std::make_pair(key, (uint32_t)wedges.size())).first;
+                wedges.push_back(newWedge);
+            }
+            shapeWedges[i] = wedge->second;
+        }
+
+        for (size_t i = 0; i + 2 < shape.indices.size(); i += 3) {
+            Triangle triangle;
+            for (int j = 0; j < 3; ++j) {
+                triangle.wedges[j] = shapeWedges[shape.indices[i + j]];
+                triangle.vertices[j] = wedges[triangle.wedges[j]].vertex;
+            }
+            triangle.shape = s;
+            triangle.removed = false;
+            // Triangles with a repeated corner have no area and only get in the way
+            if (triangle.vertices[0] != triangle.vertices[1] && triangle.vertices[1] != triangle.vertices[2] &&
+                    triangle.vertices[0] != triangle.vertices[2]) {
+                triangles.push_back(triangle);
+            }
+        }
+    }
+    remaining = triangles.size();
+
+    vertexTriangles.resize(positions.size());
+    for (size_t i = 0; i < triangles.size(); ++i) {
+        for (int j = 0; j < 3; ++j) {
+            vertexTriangles[triangles[i].vertices[j]].push_back(i);
+        }
+    }
+
+    // Each triangle's plane, weighted by its area
+    Quadric zero;
+    std::fill(zero.a, zero.a + 10, 0.0);
+    quadrics.resize(positions.size(), zero);
+    for (size_t i = 0; i < triangles.size(); ++i) {
+        const uint32_t* v = triangles[i].vertices;
+        const glm::vec3 cross = glm::cross(positions[v[1]] - positions[v[0]], positions[v[2]] - positions[v[0]]);
+        const float length = glm::length(cross);
+        if (length == 0.0f) {
+            continue;
+        }
+        const glm::vec3 normal = cross / length;
+        for (int j = 0; j < 3; ++j) {
+            addPlane(quadrics[v[j]].a, normal, -glm::dot(normal, positions[v[0]]), 0.5 * length);
+        }
+
+        // Planes at right angles to the triangle along edges where the surface or its texture ends,
+        // which hold those edges in place
+        for (int j = 0; j < 3; ++j) {
+            const uint32_t a = v[j];
+            const uint32_t b = v[(j + 1) % 3];
+            bool boundary = true;
+            for (size_t k = 0; k < vertexTriangles[a].size(); ++k) {
+                const Triangle& other = triangles[vertexTriangles[a][k]];
+                const int otherB = cornerOf(other.vertices, b);
+                if (vertexTriangles[a][k] != i && otherB >= 0) {
+                    boundary = other.wedges[cornerOf(other.vertices, a)] != triangles[i].wedges[j] ||
+                        other.wedges[otherB] != triangles[i].wedges[(j + 1) % 3];
+                    break;
+                }
+            }
+            if (boundary) {
+                const glm::vec3 edge = positions[b] - positions[a];
+                const glm::vec3 edgeNormal = glm::normalize(glm::cross(edge, normal));
+                const double weight = BOUNDARY_WEIGHT * glm::dot(edge, edge);
+                addPlane(quadrics[a].a, edgeNormal, -glm::dot(edgeNormal, positions[a]), weight);
+                addPlane(quadrics[b].a, edgeNormal, -glm::dot(edgeNormal, positions[a]), weight);
+            }
+        }
+    }
+
+    versions.resize(positions.size(), 0);
+    removedVertices.resize(positions.size(), false);
+    for (size_t i = 0; i < positions.size(); ++i) {
+        const std::vector<uint32_t>& around = vertexTriangles[i];
+        for (size_t j = 0; j < around.size(); ++j) {
+            for (int k = 0; k < 3; ++k) {
+                const uint32_t neighbour = triangles[around[j]].vertices[k];
+                if (neighbour != i) {
+                    Collapse c = { collapseCost(i, neighbour), (uint32_t)i, neighbour, 0, 0 };
+                    queue.push_back(c);
+                }
+            }
+        }
+    }
+    std::make_heap(queue.begin(), queue.end());
+}
+
+size_t MeshSimplifier::numTriangles() const {
+    return remaining;
+}
+
+size_t MeshSimplifier::edgeTriangles(uint32_t a, uint32_t b) const {
+    size_t count = 0;
+    for (size_t i = 0; i < vertexTriangles[a].size(); ++i) {
+        if (cornerOf(triangles[vertexTriangles[a][i]].vertices, b) >= 0) {
+            ++count;
+        }
+    }
+    return count;
+}
+
+float MeshSimplifier::collapseCost(uint32_t from, uint32_t to) const {
+    double q[10];
+    for (int i = 0; i < 10; ++i) {
+        q[i] = quadrics[from].a[i] + quadrics[to].a[i];
+    }
+    const double x = positions[to].x, y = positions[to].y, z = positions[to].z;
+    const double cost = q[0] * x * x + 2.0 * q[1] * x * y + 2.0 * q[2] * x * z + 2.0 * q[3] * x +
+        q[4] * y * y + 2.0 * q[5] * y * z + 2.0 * q[6] * y +
+        q[7] * z * z + 2.0 * q[8] * z + q[9];
+    return (float)std::max(cost, 0.0);
+}
+
+void MeshSimplifier::queueCollapses(uint32_t vertex) {
+    const std::vector<uint32_t>& around = vertexTriangles[vertex];
+    for (size_t i = 0; i < around.size(); ++i) {
+        for (int j = 0; j < 3; ++j) {
+            const uint32_t neighbour = triangles[around[i]].vertices[j];
+            if (neighbour == vertex) {
+                continue;
+            }
+            Collapse out = { collapseCost(vertex, neighbour), vertex, neighbour, versions[vertex], versions[neighbour] };
+            queue.push_back(out);
+            std::push_heap(queue.begin(), queue.end());
+            Collapse in = { collapseCost(neighbour, vertex), neighbour, vertex, versions[neighbour], versions[vertex] };
+            queue.push_back(in);
+            std::push_heap(queue.begin(), queue.end());
+        }
+    }
+}
+
+bool MeshSimplifier::canCollapse(uint32_t from, uint32_t to,
+        std::vector<std::pair<uint32_t, uint32_t> >& wedgeMap) const {
+    const std::vector<uint32_t>& around = vertexTriangles[from];
+    const size_t shared = edgeTriangles(from, to);
+    if (shared == 0 || shared > 2) {
+        return false;
+    }
+
+    // Vertices on a border may only slide along it, and never if more than one border meets there
+    // or an edge is shared by more than two triangles
+    std::vector<uint32_t> fromNeighbours;
+    size_t borderEdges = 0;
+    for (size_t i = 0; i < around.size(); ++i) {
+        for (int j = 0; j < 3; ++j) {
+            const uint32_t neighbour = triangles[around[i]].vertices[j];
+            if (neighbour != from && std::find(fromNeighbours.begin(), fromNeighbours.end(), neighbour) == fromNeighbours.end()) {
+                fromNeighbours.push_back(neighbour);
+                const size_t count = edgeTriangles(from, neighbour);
+                if (count > 2) {
+                    return false;
+                }
+                borderEdges += count == 1 ? 1 : 0;
+            }
+        }
+    }
+    if (borderEdges > 2 || (borderEdges > 0 && shared != 1)) {
+        return false;
+    }
+
+    // The vertices next to both ends must only be the far corners of the triangles on the edge,
+    // otherwise the collapse would fold the surface onto itself
+    size_t common = 0;
+    for (size_t i = 0; i < fromNeighbours.size(); ++i) {
+        if (fromNeighbours[i] != to && edgeTriangles(to, fromNeighbours[i]) > 0) {
+            ++common;
+        }
+    }
+    if (common != shared) {
+        return false;
+    }
+
+    // Keep the last triangles of a part, or it would disappear however far it is from the rest
+    if (vertexTriangles[to].size() == shared) {
+        return false;
+    }
+
+    // Each wedge at the moved vertex must become a wedge of the same shape at the other end, on a
+    // triangle along the edge. A vertex on a seam or boundary then has to move along it.
+    wedgeMap.clear();
+    for (size_t i = 0; i < around.size(); ++i) {
+        const Triangle& triangle = triangles[around[i]];
+        const int toCorner = cornerOf(triangle.vertices, to);
+        if (toCorner < 0) {
+            continue;
+        }
+        const uint32_t fromWedge = triangle.wedges[cornerOf(triangle.vertices, from)];
+        const uint32_t toWedge = triangle.wedges[toCorner];
+        for (size_t j = 0; j < wedgeMap.size(); ++j) {
+            if (wedgeMap[j].first == fromWedge && wedgeMap[j].second != toWedge) {
+                return false;
+            }
+        }
+        wedgeMap.push_back(std::make_pair(fromWedge, toWedge));
+    }
+
+    for (size_t i = 0; i < around.size(); ++i) {
+        const Triangle& triangle = triangles[around[i]];
+        if (cornerOf(triangle.vertices, to) >= 0) {
+            continue;
+        }
+        const int fromCorner = cornerOf(triangle.vertices, from);
+        bool mapped = false;
+        for (size_t j = 0; j < wedgeMap.size() && !mapped; ++j) {
+            mapped = wedgeMap[j].first == triangle.wedges[fromCorner];
+        }
+        if (!mapped) {
+            return false;
+        }
+
+        // A closed part can't get smaller than a tetrahedron, past that the collapse would put a
+        // triangle back to back with one that's already there
+        const uint32_t a = triangle.vertices[(fromCorner + 1) % 3];
+        const uint32_t b = triangle.vertices[(fromCorner + 2) % 3];
+        for (size_t j = 0; j < vertexTriangles[to].size(); ++j) {
+            const uint32_t* vertices = triangles[vertexTriangles[to][j]].vertices;
+            if (cornerOf(vertices, a) >= 0 && cornerOf(vertices, b) >= 0) {
+                return false;
+            }
+        }
+
+        // Refuse to flip or flatten the triangles that are left
+        glm::vec3 corners[3];
+        for (int j = 0; j < 3; ++j) {
+            corners[j] = positions[triangle.vertices[j]];
+        }
+        const glm::vec3 before = glm::cross(corners[1] - corners[0], corners[2] - corners[0]);
+        corners[fromCorner] = positions[to];
+        const glm::vec3 after = glm::cross(corners[1] - corners[0], corners[2] - corners[0]);
+        const float beforeLength = glm::length(before);
+        const float afterLength = glm::length(after);
+        if (afterLength <= beforeLength * 1e-4f ||
+                (beforeLength > 0.0f && glm::dot(before, after) < MIN_NORMAL_COSINE * beforeLength * afterLength)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void MeshSimplifier::collapse(uint32_t from, uint32_t to,
+        const std::vector<std::pair<uint32_t, uint32_t> >& wedgeMap) {
+    const std::vector<uint32_t> around = vertexTriangles[from];
+    for (size_t i = 0; i < around.size(); ++i) {
+        Triangle& triangle = triangles[around[i]];
+        const int fromCorner = cornerOf(triangle.vertices, from);
+        if (cornerOf(triangle.vertices, to) >= 0) {
+            triangle.removed = true;
+            --remaining;
+            for (int j = 0; j < 3; ++j) {
+                if (triangle.vertices[j] != from) {
+                    removeTriangle(vertexTriangles[triangle.vertices[j]], around[i]);
+                }
+            }
+            continue;
+        }
+
+        triangle.vertices[fromCorner] = to;
+        for (size_t j = 0; j < wedgeMap.size(); ++j) {
+            if (wedgeMap[j].first == triangle.wedges[fromCorner]) {
+                triangle.wedges[fromCorner] = wedgeMap[j].second;
+                break;
+            }
+        }
+        vertexTriangles[to].push_back(around[i]);
+    }
+
+    vertexTriangles[from].clear();
+    removedVertices[from] = true;
+    for (int i = 0; i < 10; ++i) {
+        quadrics[to].a[i] += quadrics[from].a[i];
+    }
+    ++versions[to];
+    queueCollapses(to);
+}
+
+RawModelData MeshSimplifier::simplify(size_t targetTriangles) {
+    std::vector<std::pair<uint32_t, uint32_t> > wedgeMap;
+    while (remaining > targetTriangles && !queue.empty()) {
+        std::pop_heap(queue.begin(), queue.end());
+        const Collapse next = queue.back();
+        queue.pop_back();
+        if (removedVertices[next.from] || removedVertices[next.to] ||
+                versions[next.from] != next.fromVersion || versions[next.to] != next.toVersion) {
+            continue;
+        }
+        if (canCollapse(next.from, next.to, wedgeMap)) {
+            collapse(next.from, next.to, wedgeMap);
+        }
+    }
+
+    RawModelData data;
+    data.boundingBox.minVertex = glm::vec3(std::numeric_limits<float>::max());
+    data.boundingBox.maxVertex = glm::vec3(-std::numeric_limits<float>::max());
+    std::vector<int> vertexIndices(wedges.size(), -1);
+    for (size_t s = 0; s < source.shapes.size(); ++s) {
+        const RawModelData::Shape& sourceShape = source.shapes[s];
+        RawModelData::Shape shape;
+        shape.material = sourceShape.material;
+        shape.textureName = sourceShape.textureName;
+        shape.normalMap = sourceShape.normalMap;
+        for (size_t i = 0; i < triangles.size(); ++i) {
+            if (triangles[i].removed || triangles[i].shape != s) {
+                continue;
+            }
+            for (int j = 0; j < 3; ++j) {
+                const uint32_t wedge = triangles[i].wedges[j];
+                if (vertexIndices[wedge] < 0) {
+                    vertexIndices[wedge] = shape.vertices.size();
+                    shape.vertices.push_back(positions[wedges[wedge].vertex]);
+                    if (!sourceShape.texCoords.empty() && !sourceShape.textureName.empty()) {
+                        shape.texCoords.push_back(wedges[wedge].texCoord);
+                    }
+                    data.boundingBox.minVertex = glm::min(data.boundingBox.minVertex, shape.vertices.back());
+                    data.boundingBox.maxVertex = glm::max(data.boundingBox.maxVertex, shape.vertices.back());
+                }
+                shape.indices.push_back(vertexIndices[wedge]);
+            }
+        }
+        if (!shape.indices.empty()) {
+            data.shapes.push_back(shape);
+        }
+        std::fill(vertexIndices.begin(), vertexIndices.end(), -1);
+    }
+    if (data.shapes.empty()) {
+        data.boundingBox.minVertex = data.boundingBox.maxVertex = glm::vec3(0.0f);
+    }
+    return data;
+}
+
+float surfaceDistance(const RawModelData& a, const RawModelData& b) {
+    const std::vector<glm::vec3> aCorners = triangleCorners(a);
+    const std::vector<glm::vec3> bCorners = triangleCorners(b);
+    if (aCorners.empty() || bCorners.empty()) {
+        return aCorners.empty() && bCorners.empty() ? 0.0f : std::numeric_limits<float>::infinity();
+    }
+    return std::max(oneSidedDistance(aCorners, bCorners), oneSidedDistance(bCorners, aCorners));
+}
@@ -0,0 +1,102 @@
+//! Quadric error mesh simplification of imported models
+#pragma once
+#include <vector>
+#include <stdint.h>
+#include "ModelData.hpp"
+
+/// <summary>
+/// Simplifies a model by collapsing edges, cheapest first, where the cost of moving a vertex is its
+/// summed squared distance from the planes of the triangles it was part of (Garland and Heckbert's
+/// quadric error metric). A vertex is always collapsed onto a neighbour, so every remaining vertex
+/// keeps its position and texture coordinates exactly. Shapes without a texture drop theirs.
+///
+/// Vertices are welded by position across shapes. A corner of a triangle is identified by its
+/// vertex, shape and texture coordinate, so a vertex on a texture seam or between two materials
+/// has several, and may only slide along that seam or boundary. Open borders are kept the same
+/// way, and vertices on edges shared by more than two triangles are never moved.
+/// </summary>
+class MeshSimplifier {
+public:
+    /// <summary>
+    /// Prepares a model for simplification.
+    /// </summary>
+    ///
+    /// <param name="data">Indexed shapes, as loaded by loadObj or loadModelData.</param>
+    MeshSimplifier(const RawModelData& data);
+
+    /// <summary>
+    /// Collapses edges until at most a number of triangles are left, or no more can be collapsed.
+    /// Each call continues from the last, so a chain of levels is made with decreasing targets.
+    /// </summary>
+    ///
+    /// <param name="targetTriangles">The number of triangles to stop at.</param>
+    /// <returns>The simplified shapes, indexed, with the input's materials and textures. Normals are
+    /// left out, as they no longer match the surface.</returns>
+    RawModelData simplify(size_t targetTriangles);
+
+    size_t numTriangles() const;
+
+private:
+    struct Quadric {
+        double a[10];
+    };
+
+    // A corner's vertex, shape and texture coordinate
+    struct Wedge {
+        uint32_t vertex;
+        uint32_t shape;
+        glm::vec2 texCoord;
+    };
+
+    struct Triangle {
+        uint32_t vertices[3];
+        uint32_t wedges[3];
+        uint32_t shape;
+        bool removed;
+    };
+
+    // A collapse of one vertex onto another, and the versions of both when its cost was computed
+    struct Collapse {
+        float cost;
+        uint32_t from;
+        uint32_t to;
+        uint32_t fromVersion;
+        uint32_t toVersion;
+
+        bool operator<(const Collapse& other) const {
+            return cost > other.cost;
+        }
+    };
+
+    RawModelData source;
+    std::vector<glm::vec3> positions;
+    std::vector<Quadric> quadrics;
+    // Bumped whenever a vertex's quadric or neighbours change, older collapses are then skipped
+    std::vector<uint32_t> versions;
+    std::vector<bool> removedVertices;
+    std::vector<std::vector<uint32_t> > vertexTriangles;
+    std::vector<Wedge> wedges;
+    std::vector<Triangle> triangles;
+    std::vector<Collapse> queue;
+    size_t remaining;
+
+    // The number of triangles sharing an edge
+    size_t edgeTriangles(uint32_t a, uint32_t b) const;
+
+    // Pushes the collapses of a vertex onto each neighbour and of each neighbour onto it
+    void queueCollapses(uint32_t vertex);
+
+    float collapseCost(uint32_t from, uint32_t to) const;
+
+    // Checks the collapse keeps the mesh's topology, borders, seams and orientation, and finds the
+    // wedge each of the moved vertex's wedges becomes
+    bool canCollapse(uint32_t from, uint32_t to, std::vector<std::pair<uint32_t, uint32_t> >& wedgeMap) const;
+
+    void collapse(uint32_t from, uint32_t to, const std::vector<std::pair<uint32_t, uint32_t> >& wedgeMap);
+};
+
+/// <summary>
+/// The largest distance between the surfaces of two models, measured from the vertices and
+/// triangle centres of each to the nearest triangle of the other.
+/// </summary>
+float surfaceDistance(const RawModelData& a, const RawModelData& b);
@@ -1,12 +1,12 @@
 #include "ModelData.hpp"
-#include "tiny_obj_loader/tiny_obj_loader.h"
+#include "AssetPack.hpp"
+#include "MeshCache.hpp"
+#include "ObjLoader.hpp"
 #include "AssetManager.hpp"
 #include "glm/gtc/matrix_transform.hpp"
+#include <cstring>
 #include <iostream>
-
-// Reads a glm::vec3 from an array of floats
-#define READ_VEC3(v) (glm::vec3((v)[0], (v)[1], (v)[2]))
-#define READ_VEC2(v) (glm::vec2((v)[0], (v)[1]))
+#include <limits>
 
 // Gets the address of the elements of a vector
 template<class T>
@@ -14,14 +14,152 @@ static GLvoid** dataPtr(const std::vector<T>& vec) {
     return (GLvoid**)(&vec[0]);
 }
 
+// The cache key of an .obj file, changes whenever the file is modified
+static uint64_t objCacheKey(const std::string& filename, bool opposite_winding) {
+    uint64_t size, modified;
+    if (!AssetPack::stat(filename, size, modified)) {
+        return 0;
+    }
+    uint64_t key = modified * 1000003u ^ size;
+    return (key << 1) | (opposite_winding ? 1 : 0);
+}
+
+// The flat shaded normal of a triangle
+static glm::vec3 faceNormal(const glm::vec3& a, const glm::vec3& b, const glm::vec3& c, bool opposite_winding) {
+    if (!opposite_winding) {
+        return glm::normalize(glm::cross(b - a, c - a));
+    }
+    return glm::normalize(glm::cross(c - a, b - a));
+}
+
+static uint64_t fileSize(const std::string& filename) {
+    uint64_t size, modified;
+    if (!AssetPack::stat(filename, size, modified)) {
+        return 0;
+    }
+    return size;
+}
+
+// Whether two shapes are drawn with the same state, and so can be drawn as one
+static bool sameRenderState(const RawModelData::Shape& a, const RawModelData::Shape& b) {
+    return a.textureName == b.textureName && a.normalMap == b.normalMap &&
+        memcmp(&a.material, &b.material, sizeof(Material)) == 0;
+}
+
+// Appends a stream of a shape to the merged stream, or zeros if the shape doesn't have it
+template<class T>
+static void appendStream(std::vector<T>& merged, const std::vector<T>& stream, size_t numVertices) {
+    if (stream.empty()) {
+        merged.resize(merged.size() + numVertices, T(0.0f));
+    }
+    else {
+        merged.insert(merged.end(), stream.begin(), stream.end());
+    }
+}
+
+void coalesceShapes(RawModelData& data) {
+    // The shapes of each render state, in order of first appearance
+    std::vector<std::vector<size_t> > groups;
+    for (size_t i = 0; i < data.shapes.size(); ++i) {
+        size_t group = 0;
+        while (group < groups.size() && !sameRenderState(data.shapes[groups[group][0]], data.shapes[i])) {
+            ++group;
+        }
+        if (group == groups.size()) {
+            groups.push_back(std::vector<size_t>());
+        }
+        groups[group].push_back(i);
+    }
+    if (groups.size() == data.shapes.size()) {
+        return;
+    }
+
+    std::vector<RawModelData::Shape> merged(groups.size());
+    for (size_t i = 0; i < groups.size(); ++i) {
+        const std::vector<size_t>& group = groups[i];
+        RawModelData::Shape& shape = merged[i];
+        shape.material = data.shapes[group[0]].material;
+        shape.textureName = data.shapes[group[0]].textureName;
+        shape.normalMap = data.shapes[group[0]].normalMap;
+
+        // A stream is only kept if any of the shapes has it
+        bool texCoords = false;
+        bool tangents = false;
+        for (size_t j = 0; j < group.size(); ++j) {
+            texCoords = texCoords || !data.shapes[group[j]].texCoords.empty();
+            tangents = tangents || !data.shapes[group[j]].tangents.empty();
+        }
+
+        for (size_t j = 0; j < group.size(); ++j) {
+            const RawModelData::Shape& source = data.shapes[group[j]];
+            const unsigned int offset = static_cast<unsigned int>(shape.vertices.size());
+            for (size_t k = 0; k < source.indices.size(); ++k) {
+                shape.indices.push_back(source.indices[k] + offset);
+            }
+
+            const size_t numVertices = source.vertices.size();
+            shape.vertices.insert(shape.vertices.end(), source.vertices.begin(), source.vertices.end());
+            appendStream(shape.normals, source.normals, numVertices);
+            if (texCoords) {
+                appendStream(shape.texCoords, source.texCoords, numVertices);
+            }
+            if (tangents) {
+                appendStream(shape.tangents, source.tangents, numVertices);
+            }
+        }
+    }
+    data.shapes.swap(merged);
+}
+
+void flatShade(RawModelData& data) {
+    for (size_t i = 0; i < data.shapes.size(); ++i) {
+        RawModelData::Shape& shape = data.shapes[i];
+        RawModelData::Shape flat;
+        flat.vertices.reserve(shape.indices.size());
+        flat.normals.reserve(shape.indices.size());
+        flat.texCoords.reserve(shape.texCoords.empty() ? 0 : shape.indices.size());
+        for (size_t j = 0; j + 2 < shape.indices.size(); j += 3) {
+            const glm::vec3 normal = faceNormal(shape.vertices[shape.indices[j]],
+                shape.vertices[shape.indices[j + 1]], shape.vertices[shape.indices[j + 2]], false);
+            for (int k = 0; k < 3; ++k) {
+                const unsigned int index = shape.indices[j + k];
+                flat.vertices.push_back(shape.vertices[index]);
+                flat.normals.push_back(normal);
+                if (!shape.texCoords.empty()) {
+                    flat.texCoords.push_back(shape.texCoords[index]);
+                }
+                flat.indices.push_back(static_cast<unsigned int>(j + k));
+            }
+        }
+        shape.vertices.swap(flat.vertices);
+        shape.normals.swap(flat.normals);
+        shape.texCoords.swap(flat.texCoords);
+        shape.indices.swap(flat.indices);
+        shape.tangents.clear();
+    }
+}
+
 RawModelData loadModelData(const std::string& filename, bool opposite_winding) {
     // --------------------------------------------------
-    // Load the base model using the tinyobjreader library
+    // Use the cached copy of the model if it is up to date
+    // --------------------------------------------------
+
+    const std::string cacheFilename = MeshCache::cacheFilename(filename);
+    const uint64_t key = objCacheKey(filename, opposite_winding);
+    MeshCache* cache = MeshCache::open(cacheFilename, key);
+    if (cache != NULL) {
+        RawModelData data = cache->toRawModelData();
+        delete cache;
+        return data;
+    }
+
+    // --------------------------------------------------
+    // Load the base model
     // --------------------------------------------------
 
-    std::vector<tinyobj::shape_t> baseShapes;
+    RawModelData baseData;
     std::string subdir = filename.substr(0, filename.find_last_of('/') + 1);
-    std::string err = tinyobj::LoadObj(baseShapes, filename.c_str(), subdir.c_str());
+    std::string err = loadObj(baseData, filename, subdir);
 
     // Check the model loaded correctly
     if (!err.empty()) {
@@ -34,40 +172,35 @@ RawModelData loadModelData(const std::string& filename, bool opposite_winding) {
     // --------------------------------------------------------------
 
     RawModelData data;
-    for (size_t i = 0; i < baseShapes.size(); ++i) {
+    for (size_t i = 0; i < baseData.shapes.size(); ++i) {
+        const RawModelData::Shape& baseShape = baseData.shapes[i];
         RawModelData::Shape shape;
-        shape.vertices.reserve(baseShapes[i].mesh.indices.size());
-        shape.normals.reserve(baseShapes[i].mesh.indices.size());
-        shape.texCoords.reserve(baseShapes[i].mesh.indices.size());
+        shape.vertices.reserve(baseShape.indices.size());
+        shape.normals.reserve(baseShape.indices.size());
+        shape.texCoords.reserve(baseShape.indices.size());
 
-        for (size_t j = 0; j < baseShapes[i].mesh.indices.size(); j += 3) {
-            const unsigned int i1 = baseShapes[i].mesh.indices[j + 0];
-            const unsigned int i2 = baseShapes[i].mesh.indices[j + 1];
-            const unsigned int i3 = baseShapes[i].mesh.indices[j + 2];
+        for (size_t j = 0; j < baseShape.indices.size(); j += 3) {
+            const unsigned int i1 = baseShape.indices[j + 0];
+            const unsigned int i2 = baseShape.indices[j + 1];
+            const unsigned int i3 = baseShape.indices[j + 2];
 
-            const glm::vec3 a = READ_VEC3(&baseShapes[i].mesh.positions[i1 * 3]);
-            const glm::vec3 b = READ_VEC3(&baseShapes[i].mesh.positions[i2 * 3]);
-            const glm::vec3 c = READ_VEC3(&baseShapes[i].mesh.positions[i3 * 3]);
+            const glm::vec3 a = baseShape.vertices[i1];
+            const glm::vec3 b = baseShape.vertices[i2];
+            const glm::vec3 c = baseShape.vertices[i3];
 
             shape.vertices.push_back(a);
             shape.vertices.push_back(b);
             shape.vertices.push_back(c);
 
-            glm::vec3 normal;
-            if (!opposite_winding) {
-                normal = glm::normalize(glm::cross(b - a, c - a));
-            }
-            else {
-                normal = glm::normalize(glm::cross(c - a, b - a));
-            }
+            const glm::vec3 normal = faceNormal(a, b, c, opposite_winding);
             for (int n = 0; n < 3; ++n) {
                 shape.normals.push_back(normal);
             }
 
-            if (baseShapes[i].mesh.texcoords.size() > 0) {
-                shape.texCoords.push_back(READ_VEC2(&(baseShapes[i].mesh.texcoords[i1 * 2])));
-                shape.texCoords.push_back(READ_VEC2(&(baseShapes[i].mesh.texcoords[i2 * 2])));
-                shape.texCoords.push_back(READ_VEC2(&(baseShapes[i].mesh.texcoords[i3 * 2])));
+            if (baseShape.texCoords.size() > 0) {
+                shape.texCoords.push_back(baseShape.texCoords[i1]);
+                shape.texCoords.push_back(baseShape.texCoords[i2]);
+                shape.texCoords.push_back(baseShape.texCoords[i3]);
             }
             if (!opposite_winding) {
                 shape.indices.push_back(static_cast<unsigned int>(j + 0));
@@ -81,27 +214,53 @@ RawModelData loadModelData(const std::string& filename, bool opposite_winding) {
             }
         }
 
-        // Read the material properties
-        shape.material.ambient = READ_VEC3(baseShapes[i].material.ambient);
-        shape.material.diffuse = READ_VEC3(baseShapes[i].material.diffuse);
-        shape.material.specular = READ_VEC3(baseShapes[i].material.specular);
-        shape.material.shininess = baseShapes[i].material.shininess;
-        shape.material.dissolve = baseShapes[i].material.dissolve;
-
-        if (!baseShapes[i].material.diffuse_texname.empty()) {
-            shape.textureName = subdir + baseShapes[i].material.diffuse_texname;
-            // The filename from tiny_obj_loader does not trim trailing whitespace. This causes issues
-            // when using SOIL to load textures on Linux. So we need to manually trim whitespace 
-            // It is unfortunate that C++ does not have a nice way for trimming strings, so we need
-            // to use this complicated expression.
-            shape.textureName.erase(shape.textureName.find_last_not_of(" \n\r\t") + 1);
+        shape.material = baseShape.material;
+        if (!baseShape.textureName.empty()) {
+            shape.textureName = subdir + baseShape.textureName;
         }
 
         data.shapes.push_back(shape);
     }
+    coalesceShapes(data);
+
+    // Failing to write the cache only costs the next load a parse
+    if (!MeshCache::write(cacheFilename, data, key)) {
+        std::cerr << "Unable to write mesh cache: " << cacheFilename << std::endl;
+    }
     return data;
 }
 
+ModelData* loadModel(const std::string& filename, const Renderer* renderer, bool opposite_winding) {
+    MeshCache* cache = MeshCache::open(MeshCache::cacheFilename(filename), objCacheKey(filename, opposite_winding));
+    if (cache == NULL) {
+        // Very large models would not fit in memory as RawModelData, so they skip the mesh cache
+        if (fileSize(filename) > MODEL_STREAMING_THRESHOLD) {
+            return streamModel(filename, renderer, opposite_winding);
+        }
+        return new ModelData(loadModelData(filename, opposite_winding), renderer);
+    }
+    ModelData* model = new ModelData(*cache, renderer);
+    delete cache;
+    return model;
+}
+
+ModelData* streamModel(const std::string& filename, const Renderer* renderer, bool opposite_winding,
+        size_t memoryLimit) {
+    std::string subdir = filename.substr(0, filename.find_last_of('/') + 1);
+    std::string err;
+    // Half the limit buffers the parse, the rest holds the batches uploaded
+    const size_t parseBufferSize = memoryLimit / 2;
+    ObjStream* stream = ObjStream::open(filename, subdir, parseBufferSize, err);
+    if (stream == NULL) {
+        std::cerr << err << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    ModelData* model = new ModelData(*stream, renderer, subdir, opposite_winding, memoryLimit - parseBufferSize);
+    delete stream;
+    return model;
+}
+
 ModelData::ModelData(const RawModelData& data, const Renderer* renderer) {
     unsigned int totalAttributes = 0;
     unsigned int totalElements = 0;
@@ -117,34 +276,7 @@ ModelData::ModelData(const RawModelData& data, const Renderer* renderer) {
         totalElements += data.shapes[i].indices.size();
     }
 
-    glGenVertexArrays(1, &vao);
-    glBindVertexArray(vao);
-
-    glGenBuffers(5, buffers);
-
-    // Allocate memory for buffers
-    glBindBuffer(GL_ARRAY_BUFFER, buffers[0]);
-    glBufferData(GL_ARRAY_BUFFER, totalAttributes * sizeof(glm::vec3), NULL, GL_STATIC_DRAW);
-    glEnableVertexAttribArray(renderer->shader.in_coord);
-    glVertexAttribPointer(renderer->shader.in_coord, 3, GL_FLOAT, GL_FALSE, 0, NULL);
-
-    glBindBuffer(GL_ARRAY_BUFFER, buffers[1]);
-    glBufferData(GL_ARRAY_BUFFER, totalAttributes * sizeof(glm::vec3), NULL, GL_STATIC_DRAW);
-    glEnableVertexAttribArray(renderer->shader.in_normal);
-    glVertexAttribPointer(renderer->shader.in_normal, 3, GL_FLOAT, GL_FALSE, 0, NULL);
-
-    glBindBuffer(GL_ARRAY_BUFFER, buffers[2]);
-    glBufferData(GL_ARRAY_BUFFER, totalAttributes * sizeof(glm::vec2), NULL, GL_STATIC_DRAW);
-    glEnableVertexAttribArray(renderer->shader.in_texcoord);
-    glVertexAttribPointer(renderer->shader.in_texcoord, 2, GL_FLOAT, GL_FALSE, 0, NULL);
-
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffers[3]);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, totalElements * sizeof(unsigned int), dataPtr(indices), GL_STATIC_DRAW);
-
-    glBindBuffer(GL_ARRAY_BUFFER, buffers[4]);
-    glBufferData(GL_ARRAY_BUFFER, totalAttributes * sizeof(glm::vec3), NULL, GL_STATIC_DRAW);
-    glEnableVertexAttribArray(renderer->shader.in_tangent);
-    glVertexAttribPointer(renderer->shader.in_tangent, 3, GL_FLOAT, GL_FALSE, 0, NULL);
+    createBuffers(renderer, totalAttributes, totalElements, NULL, NULL, NULL, NULL, dataPtr(indices));
 
     unsigned int attributeArrayOffset = 0;
     unsigned int elementArrayOffset = 0;
@@ -175,10 +307,13 @@ ModelData::ModelData(const RawModelData& data, const Renderer* renderer) {
         if (!data.shapes[i].textureName.empty()) {
             shape.textureId = AssetManager::loadTexture(data.shapes[i].textureName);
         }
+        else {
+            shape.textureId = 0;
+        }
 
         // Load the normal map texture using SOIL
         if (!data.shapes[i].normalMap.empty()) {
-            shape.normalMapId = AssetManager::loadTexture(data.shapes[i].normalMap);
+            shape.normalMapId = AssetManager::loadNormalMap(data.shapes[i].normalMap);
         }
         else {
             shape.normalMapId = -1;
@@ -194,6 +329,7 @@ ModelData::ModelData(const RawModelData& data, const Renderer* renderer) {
         shape.elementOffset = elementArrayOffset * sizeof(unsigned int);
         shape.numElements = data.shapes[i].indices.size();
         shape.material = data.shapes[i].material;
+        shape.transparent = shape.material.dissolve < 1.0f || AssetManager::isTranslucent(shape.textureId);
         shapes.push_back(shape);
 
         attributeArrayOffset += attributeArraySize;
@@ -202,11 +338,164 @@ ModelData::ModelData(const RawModelData& data, const Renderer* renderer) {
 
     boundingBox.minVertex = data.boundingBox.minVertex;
     boundingBox.maxVertex = data.boundingBox.maxVertex;
+    occluders = data.occluders;
+}
+
+ModelData::ModelData(const MeshCache& cache, const Renderer* renderer) {
+    // The streams are already laid out as the buffers expect, so each is a single upload
+    createBuffers(renderer, cache.numVertices(), cache.numIndices(), cache.vertices(), cache.normals(),
+        cache.texCoords(), cache.tangents(), cache.indices());
+
+    for (uint32_t i = 0; i < cache.numShapes(); ++i) {
+        const MeshCache::Shape& cached = cache.shape(i);
+        Shape shape;
+
+        // Load the texture using SOIL
+        if (cached.textureName != MeshCache::NO_STRING) {
+            shape.textureId = AssetManager::loadTexture(cache.string(cached.textureName));
+        }
+        else {
+            shape.textureId = 0;
+        }
+
+        // Load the normal map texture using SOIL
+        if (cached.normalMap != MeshCache::NO_STRING) {
+            shape.normalMapId = AssetManager::loadNormalMap(cache.string(cached.normalMap));
+        }
+        else {
+            shape.normalMapId = -1;
+        }
+
+        shape.elementOffset = cached.indexOffset * sizeof(unsigned int);
+        shape.numElements = cached.numIndices;
+        shape.material = cached.material;
+        shape.transparent = shape.material.dissolve < 1.0f || AssetManager::isTranslucent(shape.textureId);
+        shapes.push_back(shape);
+    }
+
+    boundingBox = cache.boundingBox();
+    occluders.assign(cache.occluders(), cache.occluders() + cache.numOccluders());
+}
+
+ModelData::ModelData(ObjStream& stream, const Renderer* renderer, const std::string& texturePath,
+        bool opposite_winding, size_t memoryLimit) {
+    const unsigned int numVertices = stream.numTriangles() * 3;
+    createBuffers(renderer, numVertices, numVertices, NULL, NULL, NULL, NULL, NULL);
+
+    const std::vector<ObjStream::Shape>& streamShapes = stream.shapes();
+    unsigned int elementArrayOffset = 0;
+    for (size_t i = 0; i < streamShapes.size(); ++i) {
+        Shape shape;
+
+        // Load the texture using SOIL
+        if (!streamShapes[i].textureName.empty()) {
+            shape.textureId = AssetManager::loadTexture(texturePath + streamShapes[i].textureName);
+        }
+        else {
+            shape.textureId = 0;
+        }
+        shape.normalMapId = -1;
+
+        shape.elementOffset = elementArrayOffset * sizeof(unsigned int);
+        shape.numElements = streamShapes[i].numTriangles * 3;
+        shape.material = streamShapes[i].material;
+        shape.transparent = shape.material.dissolve < 1.0f || AssetManager::isTranslucent(shape.textureId);
+        shapes.push_back(shape);
+
+        elementArrayOffset += shape.numElements;
+    }
+
+    // --------------------------------------------------
+    // Upload the triangles a batch at a time
+    // --------------------------------------------------
+
+    const size_t bytesPerTriangle = 3 * (2 * sizeof(glm::vec3) + sizeof(glm::vec2) + sizeof(unsigned int));
+    const size_t batchSize = memoryLimit / bytesPerTriangle > 0 ? memoryLimit / bytesPerTriangle : 1;
+    std::vector<glm::vec3> vertices(batchSize * 3);
+    std::vector<glm::vec3> normals(batchSize * 3);
+    std::vector<glm::vec2> texCoords(batchSize * 3);
+    std::vector<unsigned int> indices(batchSize * 3);
+
+    boundingBox.minVertex = glm::vec3(std::numeric_limits<float>::max());
+    boundingBox.maxVertex = glm::vec3(-std::numeric_limits<float>::max());
+
+    std::string err;
+    unsigned int offset = 0;
+    size_t count;
+    while ((count = stream.read(&vertices[0], &texCoords[0], batchSize, err)) > 0) {
+        for (size_t j = 0; j < count * 3; j += 3) {
+            const glm::vec3 normal = faceNormal(vertices[j], vertices[j + 1], vertices[j + 2], opposite_winding);
+            for (int n = 0; n < 3; ++n) {
+                normals[j + n] = normal;
+                boundingBox.minVertex = glm::min(boundingBox.minVertex, vertices[j + n]);
+                boundingBox.maxVertex = glm::max(boundingBox.maxVertex, vertices[j + n]);
+            }
+
+            indices[j + 0] = offset + j + 0;
+            indices[j + 1] = offset + j + (opposite_winding ? 2 : 1);
+            indices[j + 2] = offset + j + (opposite_winding ? 1 : 2);
+        }
+
+        glBindBuffer(GL_ARRAY_BUFFER, buffers[0]);
+        glBufferSubData(GL_ARRAY_BUFFER, offset * sizeof(glm::vec3), count * 3 * sizeof(glm::vec3), dataPtr(vertices));
+
+        glBindBuffer(GL_ARRAY_BUFFER, buffers[1]);
+        glBufferSubData(GL_ARRAY_BUFFER, offset * sizeof(glm::vec3), count * 3 * sizeof(glm::vec3), dataPtr(normals));
+
+        glBindBuffer(GL_ARRAY_BUFFER, buffers[2]);
+        glBufferSubData(GL_ARRAY_BUFFER, offset * sizeof(glm::vec2), count * 3 * sizeof(glm::vec2), dataPtr(texCoords));
+
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffers[3]);
+        glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, offset * sizeof(unsigned int), count * 3 * sizeof(unsigned int),
+            dataPtr(indices));
+
+        offset += count * 3;
+    }
+
+    if (!err.empty()) {
+        std::cerr << err << std::endl;
+        exit(EXIT_FAILURE);
+    }
+}
+
+void ModelData::createBuffers(const Renderer* renderer, unsigned int numVertices, unsigned int numIndices,
+        const GLvoid* vertices, const GLvoid* normals, const GLvoid* texCoords, const GLvoid* tangents,
+        const GLvoid* indices) {
+    glGenVertexArrays(1, &vao);
+    glBindVertexArray(vao);
+
+    glGenBuffers(5, buffers);
+
+    glBindBuffer(GL_ARRAY_BUFFER, buffers[0]);
+    glBufferData(GL_ARRAY_BUFFER, numVertices * sizeof(glm::vec3), vertices, GL_STATIC_DRAW);
+    glEnableVertexAttribArray(renderer->shader.in_coord);
+    glVertexAttribPointer(renderer->shader.in_coord, 3, GL_FLOAT, GL_FALSE, 0, NULL);
+
+    glBindBuffer(GL_ARRAY_BUFFER, buffers[1]);
+    glBufferData(GL_ARRAY_BUFFER, numVertices * sizeof(glm::vec3), normals, GL_STATIC_DRAW);
+    glEnableVertexAttribArray(renderer->shader.in_normal);
+    glVertexAttribPointer(renderer->shader.in_normal, 3, GL_FLOAT, GL_FALSE, 0, NULL);
+
+    glBindBuffer(GL_ARRAY_BUFFER, buffers[2]);
+    glBufferData(GL_ARRAY_BUFFER, numVertices * sizeof(glm::vec2), texCoords, GL_STATIC_DRAW);
+    glEnableVertexAttribArray(renderer->shader.in_texcoord);
+    glVertexAttribPointer(renderer->shader.in_texcoord, 2, GL_FLOAT, GL_FALSE, 0, NULL);
+
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffers[3]);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, numIndices * sizeof(unsigned int), indices, GL_STATIC_DRAW);
+
+    glBindBuffer(GL_ARRAY_BUFFER, buffers[4]);
+    glBufferData(GL_ARRAY_BUFFER, numVertices * sizeof(glm::vec3), tangents, GL_STATIC_DRAW);
+    glEnableVertexAttribArray(renderer->shader.in_tangent);
+    glVertexAttribPointer(renderer->shader.in_tangent, 3, GL_FLOAT, GL_FALSE, 0, NULL);
 }
 
 ModelData::~ModelData() {
-    glDeleteBuffers(4, buffers);
+    glDeleteBuffers(5, buffers);
     glDeleteVertexArrays(1, &vao);
+    for (size_t i = 0; i < lods.size(); ++i) {
+        delete lods[i].model;
+    }
 }
 
 void ModelData::unify() {
@@ -220,6 +509,24 @@ void ModelData::unify() {
     }
 }
 
+const std::vector<BoundingBox>& ModelData::getOccluders() const {
+    return occluders;
+}
+
+void ModelData::addLod(const RawModelLod& lod, const Renderer* renderer) {
+    // Levels are generated a face at a time, so their shapes are merged first
+    RawModelData data = lod.data;
+    coalesceShapes(data);
+    ModelData* model = new ModelData(data, renderer);
+    const Lod level = { model, lod.error, lod.roofless };
+    lods.push_back(level);
+}
+
+void ModelData::addEmptyLod(float size) {
+    const Lod level = { NULL, size, false };
+    lods.push_back(level);
+}
+
 void ModelData::reduce() {
     std::vector<Shape> newShapes;
     unsigned int offset = 0;
@@ -228,7 +535,9 @@ void ModelData::reduce() {
     while (i < shapes.size()) {
         unsigned int numElements = 0;
         size_t j = i + 1;
-        while (j < shapes.size() && shapes[j].textureId == shapes[i].textureId) {
+        while (j < shapes.size() && shapes[j].textureId == shapes[i].textureId &&
+            shapes[j].normalMapId == shapes[i].normalMapId && shapes[j].transparent == shapes[i].transparent &&
+            memcmp(&shapes[j].material, &shapes[i].material, sizeof(Material)) == 0) {
             numElements += shapes[j].numElements;
             j += 1;
         }
@@ -4,9 +4,18 @@
 #include <vector>
 #include "Object.hpp"
 #include "GLHeaders.hpp"
+#include "glm/vec2.hpp"
 #include "Renderer.hpp"
 
 class Renderer;
+class MeshCache;
+class ObjStream;
+
+// .obj files larger than this are streamed to the GPU instead of being loaded into memory
+#define MODEL_STREAMING_THRESHOLD (64 * 1024 * 1024)
+
+// Bytes of model data kept in memory at once while a model is streamed
+#define MODEL_STREAMING_MEMORY_LIMIT (16 * 1024 * 1024)
 
 struct Material {
     glm::vec3 ambient;
@@ -21,7 +30,7 @@ const Material DEFAULT_MATERIAL = {
     glm::vec3(1.0f),
     glm::vec3(0.1f),
     0.0f,
-    0.0f
+    1.0f
 };
 
 struct BoundingBox {
@@ -43,17 +52,74 @@ struct RawModelData {
         std::string normalMap;
     };
     std::vector<Shape> shapes;
+
+    // Solid boxes inside the model, which hide whatever is behind them from the occlusion culler.
+    // Empty for models whose shape isn't known to be solid.
+    std::vector<BoundingBox> occluders;
+};
+
+// A simplified version of a model, drawn in its place once the camera is far enough away
+struct RawModelLod {
+    RawModelData data;
+    // The largest distance between the simplified surface and the full model's, in model units
+    float error;
+    // Without the faces on top, which can't be seen while the camera is below them. The faces
+    // are still needed for shadows, so these are never drawn to the shadow map.
+    bool roofless;
 };
 
 /// <summary>
-/// Load a model from an .obj file.
+/// Load a model from an .obj file. The parsed model is stored in the mesh cache, and later loads
+/// read the cache instead while the .obj file is unchanged.
 /// </summary>
 ///
 /// <param name="filename">The filename of the model.</param>
 RawModelData loadModelData(const std::string& filename, bool opposite_winding = false);
 
+/// <summary>
+/// Merge the shapes drawn with the same texture, normal map and material into one, wherever they
+/// are in the model, so the model is drawn with as few ranges as it can be. The merged shapes keep
+/// the order in which their first shape appeared.
+/// </summary>
+///
+/// <param name="data">The model to merge the shapes of.</param>
+void coalesceShapes(RawModelData& data);
+
+/// <summary>
+/// Give every triangle its own vertices with the triangle's normal, as loadModelData does for
+/// loaded models, for indexed shapes without normals such as MeshSimplifier's levels.
+/// </summary>
+///
+/// <param name="data">The model to shade, its triangles are kept in order.</param>
+void flatShade(RawModelData& data);
+
+class ModelData;
+
+/// <summary>
+/// Load a model from an .obj file onto the GPU. If the mesh cache is up to date the model is
+/// uploaded directly from the mapped cache file without being parsed.
+/// </summary>
+///
+/// <param name="filename">The filename of the model.</param>
+/// <param name="renderer">The renderer to obtain shader information from.</param>
+ModelData* loadModel(const std::string& filename, const Renderer* renderer, bool opposite_winding = false);
+
+/// <summary>
+/// Stream a model from an .obj file onto the GPU, for files too large to load into memory. The
+/// triangles are read and uploaded in batches. The limit is split between the buffers the file is
+/// parsed through and the batches, so the model data held at once stays within it whatever the
+/// size of the file. Streamed models are not stored in the mesh cache.
+/// </summary>
+///
+/// <param name="filename">The filename of the model.</param>
+/// <param name="renderer">The renderer to obtain shader information from.</param>
+/// <param name="memoryLimit">Bytes of model data to keep in memory at once, parse buffers and batches together.</param>
+ModelData* streamModel(const std::string& filename, const Renderer* renderer, bool opposite_winding = false,
+    size_t memoryLimit = MODEL_STREAMING_MEMORY_LIMIT);
+
 class ModelData {
     friend class Renderer;
+    friend class ImpostorAtlas;
 
 public:
     /// <summary>
@@ -64,6 +130,25 @@ public:
     /// <param name="renderer">The renderer to obtain shader information from.</param>
     ModelData(const RawModelData& data, const Renderer* renderer);
 
+    /// <summary>
+    /// Setup a model on the GPU straight from a mapped cache file.
+    /// </summary>
+    ///
+    /// <param name="cache">The mapped model data, it can be closed once the model is created.</param>
+    /// <param name="renderer">The renderer to obtain shader information from.</param>
+    ModelData(const MeshCache& cache, const Renderer* renderer);
+
+    /// <summary>
+    /// Setup a model on the GPU from an .obj stream, uploading it in batches of triangles.
+    /// </summary>
+    ///
+    /// <param name="stream">The opened .obj file.</param>
+    /// <param name="renderer">The renderer to obtain shader information from.</param>
+    /// <param name="texturePath">Prefix for the texture names of the stream's shapes.</param>
+    /// <param name="memoryLimit">Bytes of each batch of triangles, with their normals and indices.</param>
+    ModelData(ObjStream& stream, const Renderer* renderer, const std::string& texturePath, bool opposite_winding,
+        size_t memoryLimit);
+
     /// <summary>
     /// Model destructor, ensures that all the buffers generated by the model are cleared.
     /// </summary>
@@ -75,10 +160,33 @@ public:
     void unify();
 
     /// <summary>
-    /// Reduces shapes as much as it can without losing any texture data.
+    /// Merges runs of shapes drawn with the same texture, normal map and material, without losing
+    /// any of them. Shapes of the same state elsewhere in the model are only merged by coalesceShapes.
     /// </summary>
     void reduce();
 
+    /// <summary>
+    /// The solid boxes inside the model, in model space.
+    /// </summary>
+    const std::vector<BoundingBox>& getOccluders() const;
+
+    /// <summary>
+    /// Adds a simplified version of the model. The renderer draws it instead once its error covers
+    /// less than LOD_PIXEL_ERROR pixels on the screen. Levels are added from the finest to the coarsest.
+    /// </summary>
+    ///
+    /// <param name="lod">The simplified model, its error must be no smaller than the previous level's.</param>
+    /// <param name="renderer">The renderer to obtain shader information from.</param>
+    void addLod(const RawModelLod& lod, const Renderer* renderer);
+
+    /// <summary>
+    /// Stops drawing the model once it covers less than LOD_PIXEL_ERROR pixels on the screen, as
+    /// the coarsest level.
+    /// </summary>
+    ///
+    /// <param name="size">The model's largest dimension, in model units.</param>
+    void addEmptyLod(float size);
+
 
 private:
     GLuint vao;
@@ -87,10 +195,27 @@ private:
         Material material;
         GLuint textureId;
         GLint normalMapId;
+        // Drawn blended after the opaque shapes, set from the material's dissolve and the texture's alpha
+        bool transparent;
         unsigned int elementOffset;
         unsigned int numElements;
     };
     std::vector<Shape> shapes;
 
     BoundingBox boundingBox;
+    std::vector<BoundingBox> occluders;
+
+    struct Lod {
+        // NULL for the empty level
+        ModelData* model;
+        float error;
+        bool roofless;
+    };
+    // Finest first, owned by the model
+    std::vector<Lod> lods;
+
+    // Creates the vao and buffers, any of the data pointers can be NULL to leave the buffer unfilled
+    void createBuffers(const Renderer* renderer, unsigned int numVertices, unsigned int numIndices,
+        const GLvoid* vertices, const GLvoid* normals, const GLvoid* texCoords, const GLvoid* tangents,
+        const GLvoid* indices);
 };
@@ -0,0 +1,187 @@
+//! Benchmark comparing the .obj loader with tiny_obj_loader
+//
+// usage: obj_bench [-n iterations] [-g grid size] files...
+//
+// Each file is loaded repeatedly with tiny_obj_loader, with loadObj on a single thread and with
+// loadObj on every thread, and the throughput of each is printed. A generated grid with positions,
+// texture coordinates and normals is benchmarked as well so there is always a large file to test,
+// -g 0 turns it off.
+#include "ObjLoader.hpp"
+#include "tiny_obj_loader/tiny_obj_loader.h"
+#include "SOIL2/image_parallel.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sys/stat.h>
+
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+#define GRID_FILENAME "obj_bench_grid.obj"
+
+// Writes a size x size grid of quads split into a few groups
+static bool writeGrid(const char* filename, int size) {
+    FILE* out = fopen(filename, "w");
+    if (out == NULL) {
+        return false;
+    }
+    fprintf(out, "# obj_bench grid\n");
+    for (int y = 0; y <= size; ++y) {
+        for (int x = 0; x <= size; ++x) {
+            fprintf(out, "v %f %f %f\n", x * 0.1f, 0.05f * ((x * 7 + y * 13) % 11), y * 0.1f);
+            fprintf(out, "vt %f %f\n", x / float(size), y / float(size));
+        }
+    }
+    fprintf(out, "vn 0.000000 1.000000 0.000000\n");
+    for (int y = 0; y < size; ++y) {
+        if (y % (size / 4 + 1) == 0) {
+            fprintf(out, "g grid_%d\n", y);
+        }
+        for (int x = 0; x < size; ++x) {
+            const int a = y * (size + 1) + x + 1;
+            const int b = a + 1;
+            const int c = a + size + 2;
+            const int d = a + size + 1;
+            fprintf(out, "f %d/%d/1 %d/%d/1 %d/%d/1 %d/%d/1\n", a, a, b, b, c, c, d, d);
+        }
+    }
+    return fclose(out) == 0;
+}
+
+static double fileSize(const char* filename) {
+    struct stat info;
+    if (stat(filename, &info) != 0) {
+        return 0.0;
+    }
+    return static_cast<double>(info.st_size);
+}
+
+// Wall clock time in seconds, CPU time would add up the time of every thread
+static double now() {
+#ifdef WIN32
+    LARGE_INTEGER counter, frequency;
+    QueryPerformanceCounter(&counter);
+    QueryPerformanceFrequency(&frequency);
+    return static_cast<double>(counter.QuadPart) / frequency.QuadPart;
+#else
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec * 1e-9;
+#endif
+}
+
+// Loads the file 'iterations' times with tiny_obj_loader, returns the seconds taken or -1 on error
+static double timeTinyObj(const char* filename, int iterations, size_t& vertices, size_t& indices) {
+    const std::string filenameString(filename);
+    const std::string subdir = filenameString.substr(0, filenameString.find_last_of('/') + 1);
+    const double start = now();
+    for (int i = 0; i < iterations; ++i) {
+        std::vector<tinyobj::shape_t> shapes;
+        if (!tinyobj::LoadObj(shapes, filename, subdir.c_str()).empty()) {
+            return -1.0;
+        }
+        vertices = 0;
+        indices = 0;
+        for (size_t s = 0; s < shapes.size(); ++s) {
+            vertices += shapes[s].mesh.positions.size() / 3;
+            indices += shapes[s].mesh.indices.size();
+        }
+    }
+    return now() - start;
+}
+
+// Loads the file 'iterations' times with loadObj, returns the seconds taken or -1 on error
+static double timeLoadObj(const char* filename, int iterations, int threads, size_t& vertices, size_t& indices) {
+    const std::string filenameString(filename);
+    const std::string subdir = filenameString.substr(0, filenameString.find_last_of('/') + 1);
+    image_parallel_set_thread_count(threads);
+    const double start = now();
+    for (int i = 0; i < iterations; ++i) {
+        RawModelData data;
+        if (!loadObj(data, filenameString, subdir).empty()) {
+            return -1.0;
+        }
+        vertices = 0;
+        indices = 0;
+        for (size_t s = 0; s < data.shapes.size(); ++s) {
+            vertices += data.shapes[s].vertices.size();
+            indices += data.shapes[s].indices.size();
+        }
+    }
+    return now() - start;
+}
+
+int main(int argc, char** argv) {
+    int iterations = 5;
+    int gridSize = 400;
+    std::vector<const char*> files;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            iterations = atoi(argv[++i]);
+            if (iterations < 1) iterations = 1;
+        }
+        else if (strcmp(argv[i], "-g") == 0 && i + 1 < argc) {
+            gridSize = atoi(argv[++i]);
+        }
+        else {
+            files.push_back(argv[i]);
+        }
+    }
+
+    if (gridSize > 0) {
+        if (!writeGrid(GRID_FILENAME, gridSize)) {
+            fprintf(stderr, "Unable to write %s\n", GRID_FILENAME);
+            return 1;
+        }
+        files.push_back(GRID_FILENAME);
+    }
+    if (files.empty()) {
+        fprintf(stderr, "usage: %s [-n iterations] [-g grid size] files...\n", argv[0]);
+        return 1;
+    }
+
+    const int threads = image_parallel_thread_count();
+    printf("%-40s %10s %12s %12s %12s %8s\n", "file", "size (KB)", "tinyobj MB/s", "1 thread", "threads", "speedup");
+
+    int failed = 0;
+    double totalBytes = 0.0, totalTinyObj = 0.0, totalSingle = 0.0, totalThreaded = 0.0;
+    for (size_t i = 0; i < files.size(); ++i) {
+        const double bytes = fileSize(files[i]) * iterations;
+        size_t tinyVertices = 0, tinyIndices = 0, vertices = 0, indices = 0;
+        const double tinyObj = timeTinyObj(files[i], iterations, tinyVertices, tinyIndices);
+        const double single = timeLoadObj(files[i], iterations, 1, vertices, indices);
+        const double threaded = timeLoadObj(files[i], iterations, threads, vertices, indices);
+        if (tinyObj < 0.0 || single < 0.0 || threaded < 0.0) {
+            printf("%-40s failed to load\n", files[i]);
+            failed = 1;
+            continue;
+        }
+        if (vertices != tinyVertices || indices != tinyIndices) {
+            printf("%-40s MISMATCH: %lu/%lu vertices, %lu/%lu indices\n", files[i],
+                (unsigned long)vertices, (unsigned long)tinyVertices, (unsigned long)indices, (unsigned long)tinyIndices);
+            failed = 1;
+        }
+
+        printf("%-40s %10.1f %12.1f %12.1f %12.1f %7.2fx\n", files[i], fileSize(files[i]) / 1024.0,
+            bytes / 1e6 / tinyObj, bytes / 1e6 / single, bytes / 1e6 / threaded, tinyObj / threaded);
+        totalBytes += bytes;
+        totalTinyObj += tinyObj;
+        totalSingle += single;
+        totalThreaded += threaded;
+    }
+
+    if (totalTinyObj > 0.0 && totalSingle > 0.0 && totalThreaded > 0.0) {
+        printf("%-40s %10.1f %12.1f %12.1f %12.1f %7.2fx\n", "total", totalBytes / iterations / 1024.0,
+            totalBytes / 1e6 / totalTinyObj, totalBytes / 1e6 / totalSingle, totalBytes / 1e6 / totalThreaded,
+            totalTinyObj / totalThreaded);
+    }
+    printf("%d thread(s)\n", threads);
+
+    if (gridSize > 0) {
+        remove(GRID_FILENAME);
+    }
+    return failed;
+}
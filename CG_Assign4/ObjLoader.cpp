@@ -0,0 +1,1004 @@
+#include "ObjLoader.hpp"
+#include "AssetPack.hpp"
+#include "MappedFile.hpp"
+#include "MeshCache.hpp"
+#include "SOIL2/image_parallel.h"
+#include "glm/vec2.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdint.h>
+#include <map>
+#include <sstream>
+
+// Files are split into chunks of roughly this many bytes, each chunk is parsed by a single task
+#define OBJ_CHUNK_SIZE (256 * 1024)
+
+// Vertex indices that were not given in a face
+#define OBJ_NO_INDEX (-1)
+
+// Flags for the optional indices of a face corner
+#define OBJ_HAS_TEXCOORD 1
+#define OBJ_HAS_NORMAL 2
+
+namespace {
+
+struct ObjMaterial {
+    Material material;
+    std::string textureName;
+};
+
+// A line that changes which shape or material the following faces belong to
+struct ObjCommand {
+    enum Type { GROUP, OBJECT, USE_MATERIAL, MATERIAL_LIBRARY };
+
+    Type type;
+    // The number of faces in the chunk before this command
+    size_t face;
+    std::string name;
+};
+
+// Everything parsed from one chunk of the file
+struct ObjChunk {
+    const char* begin;
+    const char* end;
+
+    std::vector<float> positions;
+    std::vector<float> normals;
+    std::vector<float> texCoords;
+
+    // Three indices (position, texture coordinate, normal) per face corner, faceStarts[i] is the
+    // first corner of face i and the last entry is the total number of corners
+    std::vector<int> corners;
+    std::vector<size_t> faceStarts;
+
+    // Entries of corners holding negative (relative) indices, resolved against the chunk's own
+    // counts. They still need the number of elements before the chunk added.
+    std::vector<size_t> relative;
+
+    std::vector<ObjCommand> commands;
+};
+
+// A run of faces from one chunk
+struct ObjSegment {
+    const ObjChunk* chunk;
+    size_t firstFace;
+    size_t lastFace;
+};
+
+// The faces and material of one output shape
+struct ObjGroup {
+    std::vector<ObjSegment> segments;
+    ObjMaterial material;
+};
+
+// The materials loaded so far and the one in use
+struct ObjMaterialState {
+    std::map<std::string, ObjMaterial> materials;
+    ObjMaterial material;
+    bool isMaterialSet;
+};
+
+// Floats on their way to one of a stream's temporary files
+struct ObjSpill {
+    FILE* file;
+    std::vector<float> buffer;
+    size_t count;
+    bool failed;
+};
+
+// Shared state for exporting the groups in parallel
+struct ObjExport {
+    const std::vector<ObjGroup>* groups;
+    const std::vector<float>* positions;
+    const std::vector<float>* normals;
+    const std::vector<float>* texCoords;
+    std::vector<RawModelData::Shape>* shapes;
+    std::vector<std::string>* errors;
+};
+
+}
+
+// Exact powers of ten, larger ones can't be represented exactly in a double
+static const double POWERS_OF_TEN[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+static inline bool isSpace(char c) {
+    return c == ' ' || c == '\t';
+}
+
+static inline bool isDigit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+// Ends a token, '\r' is included so that files with Windows line endings work
+static inline bool isSeparator(char c) {
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+static inline const char* skipSpace(const char* p, const char* end) {
+    while (p < end && isSpace(*p)) {
+        ++p;
+    }
+    return p;
+}
+
+static inline const char* skipToken(const char* p, const char* end) {
+    while (p < end && !isSeparator(*p)) {
+        ++p;
+    }
+    return p;
+}
+
+// Tests whether a line starts with a keyword followed by whitespace
+static inline bool isKeyword(const char* p, const char* end, const char* keyword, size_t length) {
+    return static_cast<size_t>(end - p) > length && memcmp(p, keyword, length) == 0 && isSpace(p[length]);
+}
+
+// Parses a float the same way as atof. Common decimal forms are converted directly, anything else
+// (very long mantissas, large exponents, inf, nan) is handed to strtod.
+static float parseFloat(const char*& p, const char* end) {
+    p = skipSpace(p, end);
+    const char* start = p;
+    const char* tokenEnd = skipToken(p, end);
+
+    bool negative = false;
+    if (p < tokenEnd && (*p == '-' || *p == '+')) {
+        negative = (*p == '-');
+        ++p;
+    }
+
+    uint64_t mantissa = 0;
+    int significantDigits = 0;
+    int digits = 0;
+    int exponent = 0;
+    for (; p < tokenEnd && isDigit(*p); ++p, ++digits) {
+        mantissa = mantissa * 10 + (*p - '0');
+        significantDigits += (mantissa != 0);
+    }
+    if (p < tokenEnd && *p == '.') {
+        for (++p; p < tokenEnd && isDigit(*p); ++p, ++digits) {
+            mantissa = mantissa * 10 + (*p - '0');
+            significantDigits += (mantissa != 0);
+            --exponent;
+        }
+    }
+    if (digits > 0 && p < tokenEnd && (*p == 'e' || *p == 'E')) {
+        const char* e = p + 1;
+        bool negativeExponent = false;
+        if (e < tokenEnd && (*e == '-' || *e == '+')) {
+            negativeExponent = (*e == '-');
+            ++e;
+        }
+        if (e < tokenEnd && isDigit(*e)) {
+            int value = 0;
+            for (; e < tokenEnd && isDigit(*e); ++e) {
+                if (value < 10000) {
+                    value = value * 10 + (*e - '0');
+                }
+            }
+            exponent += negativeExponent ? -value : value;
+            p = e;
+        }
+    }
+
+    double value;
+    if (p == tokenEnd && digits > 0 && significantDigits <= 15 && exponent >= -22 && exponent <= 22) {
+        // Both the mantissa and the power of ten are exact, so a single operation rounds correctly
+        value = static_cast<double>(mantissa);
+        value = exponent < 0 ? value / POWERS_OF_TEN[-exponent] : value * POWERS_OF_TEN[exponent];
+        if (negative) {
+            value = -value;
+        }
+    }
+    else {
+        char buffer[64];
+        size_t length = tokenEnd - start;
+        if (length >= sizeof(buffer)) {
+            length = sizeof(buffer) - 1;
+        }
+        memcpy(buffer, start, length);
+        buffer[length] = '\0';
+        value = strtod(buffer, NULL);
+    }
+
+    p = tokenEnd;
+    return static_cast<float>(value);
+}
+
+// Parses an int the same way as atoi, stopping at the first character that is not a digit
+static int parseInt(const char*& p, const char* end) {
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+')) {
+        negative = (*p == '-');
+        ++p;
+    }
+    int value = 0;
+    for (; p < end && isDigit(*p); ++p) {
+        value = value * 10 + (*p - '0');
+    }
+    return negative ? -value : value;
+}
+
+// Reads the first whitespace separated word after a keyword
+static std::string parseName(const char* p, const char* end) {
+    p = skipSpace(p, end);
+    return std::string(p, skipToken(p, end));
+}
+
+// Converts a 1 based .obj index to 0 based. Negative indices count back from the current element,
+// these are resolved against the chunk's count and marked to be fixed up once the chunks are joined.
+static inline int fixIndex(int index, size_t count, ObjChunk& chunk, size_t slot) {
+    if (index > 0) {
+        return index - 1;
+    }
+    if (index == 0) {
+        return 0;
+    }
+    chunk.relative.push_back(slot);
+    return static_cast<int>(count) + index;
+}
+
+static inline const char* skipIndex(const char* p, const char* end) {
+    while (p < end && !isSeparator(*p) && *p != '/') {
+        ++p;
+    }
+    return p;
+}
+
+// Reads the 1 based indices of a face corner: i, i/j, i//k or i/j/k. Returns which of the
+// texture coordinate and normal indices were given, as OBJ_HAS_TEXCOORD | OBJ_HAS_NORMAL.
+static int parseCornerIndices(const char*& p, const char* end, int indices[3]) {
+    int given = 0;
+    indices[0] = parseInt(p, end);
+    indices[1] = 0;
+    indices[2] = 0;
+    p = skipIndex(p, end);
+    if (p < end && *p == '/') {
+        ++p;
+        if (p < end && *p == '/') {
+            // i//k
+            ++p;
+            indices[2] = parseInt(p, end);
+            given |= OBJ_HAS_NORMAL;
+        }
+        else {
+            // i/j or i/j/k
+            indices[1] = parseInt(p, end);
+            given |= OBJ_HAS_TEXCOORD;
+            p = skipIndex(p, end);
+            if (p < end && *p == '/') {
+                ++p;
+                indices[2] = parseInt(p, end);
+                given |= OBJ_HAS_NORMAL;
+            }
+        }
+    }
+    p = skipToken(p, end);
+    return given;
+}
+
+static void parseCorner(const char*& p, const char* end, ObjChunk& chunk) {
+    int indices[3];
+    const int given = parseCornerIndices(p, end, indices);
+
+    const size_t slot = chunk.corners.size();
+    chunk.corners.push_back(fixIndex(indices[0], chunk.positions.size() / 3, chunk, slot));
+    chunk.corners.push_back((given & OBJ_HAS_TEXCOORD) ?
+        fixIndex(indices[1], chunk.texCoords.size() / 2, chunk, slot + 1) : OBJ_NO_INDEX);
+    chunk.corners.push_back((given & OBJ_HAS_NORMAL) ?
+        fixIndex(indices[2], chunk.normals.size() / 3, chunk, slot + 2) : OBJ_NO_INDEX);
+}
+
+// Parses a line that changes the current shape or material, returns false for any other line
+static bool parseCommand(const char* p, const char* end, ObjCommand& command) {
+    command.face = 0;
+    if (isKeyword(p, end, "usemtl", 6)) {
+        command.type = ObjCommand::USE_MATERIAL;
+        command.name = parseName(p + 7, end);
+    }
+    else if (isKeyword(p, end, "mtllib", 6)) {
+        command.type = ObjCommand::MATERIAL_LIBRARY;
+        command.name = parseName(p + 7, end);
+    }
+    else if (isKeyword(p, end, "g", 1)) {
+        command.type = ObjCommand::GROUP;
+    }
+    else if (isKeyword(p, end, "o", 1)) {
+        command.type = ObjCommand::OBJECT;
+    }
+    else {
+        // Ignore unknown commands
+        return false;
+    }
+    return true;
+}
+
+static void parseLine(const char* p, const char* end, ObjChunk& chunk) {
+    p = skipSpace(p, end);
+    if (p == end || *p == '#') {
+        return;
+    }
+
+    // vertex
+    if (isKeyword(p, end, "v", 1)) {
+        p += 2;
+        chunk.positions.push_back(parseFloat(p, end));
+        chunk.positions.push_back(parseFloat(p, end));
+        chunk.positions.push_back(parseFloat(p, end));
+        return;
+    }
+
+    // normal
+    if (isKeyword(p, end, "vn", 2)) {
+        p += 3;
+        chunk.normals.push_back(parseFloat(p, end));
+        chunk.normals.push_back(parseFloat(p, end));
+        chunk.normals.push_back(parseFloat(p, end));
+        return;
+    }
+
+    // texcoord
+    if (isKeyword(p, end, "vt", 2)) {
+        p += 3;
+        chunk.texCoords.push_back(parseFloat(p, end));
+        chunk.texCoords.push_back(parseFloat(p, end));
+        return;
+    }
+
+    // face
+    if (isKeyword(p, end, "f", 1)) {
+        p = skipSpace(p + 2, end);
+        while (p < end && *p != '\r') {
+            parseCorner(p, end, chunk);
+            while (p < end && isSeparator(*p)) {
+                ++p;
+            }
+        }
+        chunk.faceStarts.push_back(chunk.corners.size() / 3);
+        return;
+    }
+
+    ObjCommand command;
+    if (parseCommand(p, end, command)) {
+        command.face = chunk.faceStarts.size() - 1;
+        chunk.commands.push_back(command);
+    }
+}
+
+static void parseChunks(void* user, int first, int last) {
+    ObjChunk* chunks = static_cast<ObjChunk*>(user);
+    for (int i = first; i < last; ++i) {
+        ObjChunk& chunk = chunks[i];
+        chunk.faceStarts.push_back(0);
+
+        const char* p = chunk.begin;
+        while (p < chunk.end) {
+            const char* lineEnd = static_cast<const char*>(memchr(p, '\n', chunk.end - p));
+            if (lineEnd == NULL) {
+                lineEnd = chunk.end;
+            }
+            parseLine(p, lineEnd, chunk);
+            p = lineEnd + 1;
+        }
+    }
+}
+
+// The material tiny_obj_loader gives to material names it can't find
+static ObjMaterial initMaterial() {
+    ObjMaterial material;
+    material.material.ambient = glm::vec3(0.0f);
+    material.material.diffuse = glm::vec3(0.0f);
+    material.material.specular = glm::vec3(0.0f);
+    material.material.shininess = 1.0f;
+    material.material.dissolve = 1.0f;
+    return material;
+}
+
+static void loadMtl(std::map<std::string, ObjMaterial>& materials, const std::string& filename) {
+    materials.clear();
+
+    // A missing material library is not an error, the shapes just keep their default materials
+    AssetFile* file = AssetPack::open(filename);
+    if (file == NULL) {
+        return;
+    }
+
+    ObjMaterial material = initMaterial();
+    std::string name;
+    bool hasMaterial = false;
+
+    const char* p = file->data();
+    const char* end = p + file->size();
+    while (p < end) {
+        const char* lineEnd = static_cast<const char*>(memchr(p, '\n', end - p));
+        if (lineEnd == NULL) {
+            lineEnd = end;
+        }
+        const char* token = skipSpace(p, lineEnd);
+        p = lineEnd + 1;
+
+        if (isKeyword(token, lineEnd, "newmtl", 6)) {
+            if (hasMaterial) {
+                materials.insert(std::make_pair(name, material));
+            }
+            material = initMaterial();
+            name = parseName(token + 7, lineEnd);
+            hasMaterial = true;
+        }
+        else if (isKeyword(token, lineEnd, "Ka", 2)) {
+            token += 2;
+            material.material.ambient.x = parseFloat(token, lineEnd);
+            material.material.ambient.y = parseFloat(token, lineEnd);
+            material.material.ambient.z = parseFloat(token, lineEnd);
+        }
+        else if (isKeyword(token, lineEnd, "Kd", 2)) {
+            token += 2;
+            material.material.diffuse.x = parseFloat(token, lineEnd);
+            material.material.diffuse.y = parseFloat(token, lineEnd);
+            material.material.diffuse.z = parseFloat(token, lineEnd);
+        }
+        else if (isKeyword(token, lineEnd, "Ks", 2)) {
+            token += 2;
+            material.material.specular.x = parseFloat(token, lineEnd);
+            material.material.specular.y = parseFloat(token, lineEnd);
+            material.material.specular.z = parseFloat(token, lineEnd);
+        }
+        else if (isKeyword(token, lineEnd, "Ns", 2)) {
+            token += 2;
+            material.material.shininess = parseFloat(token, lineEnd);
+        }
+        else if (isKeyword(token, lineEnd, "d", 1) || isKeyword(token, lineEnd, "Tr", 2)) {
+            token += (token[0] == 'd') ? 1 : 2;
+            material.material.dissolve = parseFloat(token, lineEnd);
+        }
+        else if (isKeyword(token, lineEnd, "map_Kd", 6)) {
+            // The texture name is the rest of the line, which may contain spaces
+            const char* nameStart = skipSpace(token + 7, lineEnd);
+            const char* nameEnd = lineEnd;
+            while (nameEnd > nameStart && isSeparator(nameEnd[-1])) {
+                --nameEnd;
+            }
+            material.textureName.assign(nameStart, nameEnd);
+        }
+    }
+    if (hasMaterial) {
+        materials.insert(std::make_pair(name, material));
+    }
+
+    delete file;
+}
+
+// Applies a command to the current material. Starting a new shape clears the material, like
+// tiny_obj_loader, so the shape will be white unless it has a usemtl of its own.
+static void applyCommand(ObjMaterialState& state, const ObjCommand& command, const std::string& mtlBasePath) {
+    if (command.type == ObjCommand::GROUP || command.type == ObjCommand::OBJECT) {
+        state.isMaterialSet = false;
+    }
+    else if (command.type == ObjCommand::USE_MATERIAL) {
+        std::map<std::string, ObjMaterial>::const_iterator found = state.materials.find(command.name);
+        if (found != state.materials.end()) {
+            state.material = found->second;
+            state.isMaterialSet = true;
+        }
+        else {
+            state.material = initMaterial();
+        }
+    }
+    else {
+        loadMtl(state.materials, mtlBasePath + command.name);
+    }
+}
+
+// The material for the shape that is being ended
+static ObjMaterial shapeMaterial(const ObjMaterialState& state) {
+    if (state.isMaterialSet) {
+        return state.material;
+    }
+    ObjMaterial defaultMaterial = initMaterial();
+    defaultMaterial.material.diffuse = glm::vec3(1.0f);
+    return defaultMaterial;
+}
+
+static inline bool inRange(int index, size_t count) {
+    return index >= 0 && static_cast<size_t>(index) < count;
+}
+
+// Finds or adds the vertex for a corner in a flat open addressed hash table
+static unsigned int findVertex(const int* corner, std::vector<int>& table, std::vector<int>& keys,
+        RawModelData::Shape& shape, const ObjExport& state, bool& valid) {
+    const unsigned int hash = static_cast<unsigned int>(corner[0]) * 73856093u ^
+        static_cast<unsigned int>(corner[1]) * 19349663u ^ static_cast<unsigned int>(corner[2]) * 83492791u;
+    const size_t mask = table.size() - 1;
+    for (size_t slot = hash & mask; ; slot = (slot + 1) & mask) {
+        const int existing = table[slot];
+        if (existing < 0) {
+            const int index = keys.size() / 3;
+            table[slot] = index;
+            keys.insert(keys.end(), corner, corner + 3);
+
+            const std::vector<float>& positions = *state.positions;
+            const std::vector<float>& normals = *state.normals;
+            const std::vector<float>& texCoords = *state.texCoords;
+            if (!inRange(corner[0], positions.size() / 3) ||
+                    (corner[1] != OBJ_NO_INDEX && !inRange(corner[1], texCoords.size() / 2)) ||
+                    (corner[2] != OBJ_NO_INDEX && !inRange(corner[2], normals.size() / 3))) {
+                valid = false;
+                shape.vertices.push_back(glm::vec3(0.0f));
+                shape.normals.push_back(glm::vec3(0.0f));
+                shape.texCoords.push_back(glm::vec2(0.0f));
+                return index;
+            }
+
+            shape.vertices.push_back(glm::vec3(positions[corner[0] * 3], positions[corner[0] * 3 + 1],
+                positions[corner[0] * 3 + 2]));
+            if (corner[2] != OBJ_NO_INDEX) {
+                shape.normals.push_back(glm::vec3(normals[corner[2] * 3], normals[corner[2] * 3 + 1],
+                    normals[corner[2] * 3 + 2]));
+            }
+            else {
+                shape.normals.push_back(glm::vec3(0.0f));
+            }
+            if (corner[1] != OBJ_NO_INDEX) {
+                shape.texCoords.push_back(glm::vec2(texCoords[corner[1] * 2], texCoords[corner[1] * 2 + 1]));
+            }
+            else {
+                shape.texCoords.push_back(glm::vec2(0.0f));
+            }
+            return index;
+        }
+        const int* key = &keys[existing * 3];
+        if (key[0] == corner[0] && key[1] == corner[1] && key[2] == corner[2]) {
+            return existing;
+        }
+    }
+}
+
+static void exportGroups(void* user, int first, int last) {
+    const ObjExport& state = *static_cast<ObjExport*>(user);
+    for (int i = first; i < last; ++i) {
+        const ObjGroup& group = (*state.groups)[i];
+        RawModelData::Shape& shape = (*state.shapes)[i];
+
+        size_t numCorners = 0;
+        size_t numTriangles = 0;
+        for (size_t s = 0; s < group.segments.size(); ++s) {
+            const ObjSegment& segment = group.segments[s];
+            const std::vector<size_t>& faceStarts = segment.chunk->faceStarts;
+            numCorners += faceStarts[segment.lastFace] - faceStarts[segment.firstFace];
+            for (size_t f = segment.firstFace; f < segment.lastFace; ++f) {
+                const size_t size = faceStarts[f + 1] - faceStarts[f];
+                numTriangles += (size >= 3) ? size - 2 : 0;
+            }
+        }
+
+        size_t tableSize = 16;
+        while (tableSize < numCorners * 2) {
+            tableSize *= 2;
+        }
+        std::vector<int> table(tableSize, -1);
+        std::vector<int> keys;
+        keys.reserve(numCorners * 3);
+        shape.vertices.reserve(numCorners);
+        shape.normals.reserve(numCorners);
+        shape.texCoords.reserve(numCorners);
+        shape.indices.reserve(numTriangles * 3);
+
+        bool valid = true;
+        bool hasNormals = false;
+        bool hasTexCoords = false;
+        for (size_t s = 0; s < group.segments.size(); ++s) {
+            const ObjSegment& segment = group.segments[s];
+            const std::vector<size_t>& faceStarts = segment.chunk->faceStarts;
+            for (size_t f = segment.firstFace; f < segment.lastFace; ++f) {
+                const int* face = &segment.chunk->corners[faceStarts[f] * 3];
+                const size_t size = faceStarts[f + 1] - faceStarts[f];
+                if (size < 3) {
+                    continue;
+                }
+
+                // Polygon -> triangle fan conversion
+                unsigned int v0 = findVertex(face, table, keys, shape, state, valid);
+                unsigned int v2 = findVertex(face + 3, table, keys, shape, state, valid);
+                for (size_t k = 2; k < size; ++k) {
+                    const unsigned int v1 = v2;
+                    v2 = findVertex(face + k * 3, table, keys, shape, state, valid);
+                    shape.indices.push_back(v0);
+                    shape.indices.push_back(v1);
+                    shape.indices.push_back(v2);
+                }
+                for (size_t k = 0; k < size; ++k) {
+                    hasTexCoords = hasTexCoords || face[k * 3 + 1] != OBJ_NO_INDEX;
+                    hasNormals = hasNormals || face[k * 3 + 2] != OBJ_NO_INDEX;
+                }
+            }
+        }
+
+        if (!valid) {
+            (*state.errors)[i] = "Face refers to a vertex that does not exist";
+        }
+        if (!hasNormals) {
+            shape.normals.clear();
+        }
+        if (!hasTexCoords) {
+            shape.texCoords.clear();
+        }
+        shape.material = group.material.material;
+        shape.textureName = group.material.textureName;
+    }
+}
+
+std::string loadObj(RawModelData& data, const std::string& filename, const std::string& mtlBasePath) {
+    AssetFile* file = AssetPack::open(filename);
+    if (file == NULL) {
+        std::stringstream err;
+        err << "Cannot open file [" << filename << "]" << std::endl;
+        return err.str();
+    }
+
+    // --------------------------------------------------
+    // Split the file at line breaks and parse the chunks in parallel
+    // --------------------------------------------------
+
+    const char* begin = file->data();
+    const char* end = begin + file->size();
+    const size_t numChunks = file->size() / OBJ_CHUNK_SIZE + 1;
+    std::vector<ObjChunk> chunks(numChunks);
+    const char* chunkBegin = begin;
+    for (size_t i = 0; i < numChunks; ++i) {
+        const char* chunkEnd = end;
+        if (i + 1 < numChunks) {
+            chunkEnd = begin + file->size() / numChunks * (i + 1);
+            if (chunkEnd < chunkBegin) {
+                chunkEnd = chunkBegin;
+            }
+            const char* lineEnd = static_cast<const char*>(memchr(chunkEnd, '\n', end - chunkEnd));
+            chunkEnd = (lineEnd == NULL) ? end : lineEnd + 1;
+        }
+        chunks[i].begin = chunkBegin;
+        chunks[i].end = chunkEnd;
+        chunkBegin = chunkEnd;
+    }
+    image_parallel_for(numChunks, 1, parseChunks, &chunks[0]);
+
+    // --------------------------------------------------
+    // Join the chunks' attributes and resolve relative indices
+    // --------------------------------------------------
+
+    std::vector<float> positions;
+    std::vector<float> normals;
+    std::vector<float> texCoords;
+    for (size_t i = 0; i < numChunks; ++i) {
+        ObjChunk& chunk = chunks[i];
+        const int bases[3] = {
+            static_cast<int>(positions.size() / 3),
+            static_cast<int>(texCoords.size() / 2),
+            static_cast<int>(normals.size() / 3)
+        };
+        for (size_t j = 0; j < chunk.relative.size(); ++j) {
+            chunk.corners[chunk.relative[j]] += bases[chunk.relative[j] % 3];
+        }
+        positions.insert(positions.end(), chunk.positions.begin(), chunk.positions.end());
+        normals.insert(normals.end(), chunk.normals.begin(), chunk.normals.end());
+        texCoords.insert(texCoords.end(), chunk.texCoords.begin(), chunk.texCoords.end());
+    }
+
+    // --------------------------------------------------
+    // Replay the commands in order to find the faces and material of each shape
+    // --------------------------------------------------
+
+    ObjMaterialState materialState;
+    materialState.material = initMaterial();
+    materialState.isMaterialSet = false;
+
+    std::vector<ObjGroup> groups;
+    ObjGroup group;
+    for (size_t i = 0; i < numChunks; ++i) {
+        const ObjChunk& chunk = chunks[i];
+        const size_t numFaces = chunk.faceStarts.size() - 1;
+        size_t face = 0;
+        for (size_t c = 0; c <= chunk.commands.size(); ++c) {
+            const size_t nextFace = (c < chunk.commands.size()) ? chunk.commands[c].face : numFaces;
+            if (nextFace > face) {
+                ObjSegment segment = { &chunk, face, nextFace };
+                group.segments.push_back(segment);
+                face = nextFace;
+            }
+            if (c == chunk.commands.size()) {
+                break;
+            }
+
+            const ObjCommand& command = chunk.commands[c];
+            if ((command.type == ObjCommand::GROUP || command.type == ObjCommand::OBJECT) && !group.segments.empty()) {
+                group.material = shapeMaterial(materialState);
+                groups.push_back(group);
+                group.segments.clear();
+            }
+            applyCommand(materialState, command, mtlBasePath);
+        }
+    }
+    if (!group.segments.empty()) {
+        group.material = shapeMaterial(materialState);
+        groups.push_back(group);
+    }
+
+    // --------------------------------------------------
+    // Build each shape's indexed vertices in parallel
+    // --------------------------------------------------
+
+    std::vector<RawModelData::Shape> shapes(groups.size());
+    std::vector<std::string> errors(groups.size());
+    ObjExport state = { &groups, &positions, &normals, &texCoords, &shapes, &errors };
+    image_parallel_for(groups.size(), 1, exportGroups, &state);
+
+    delete file;
+
+    for (size_t i = 0; i < errors.size(); ++i) {
+        if (!errors[i].empty()) {
+            return errors[i] + " in [" + filename + "]";
+        }
+    }
+    data.shapes.insert(data.shapes.end(), shapes.begin(), shapes.end());
+    return "";
+}
+
+static void flushSpill(ObjSpill& spill) {
+    if (spill.count > 0 && fwrite(&spill.buffer[0], sizeof(float), spill.count, spill.file) != spill.count) {
+        spill.failed = true;
+    }
+    spill.count = 0;
+}
+
+static inline void spillFloat(ObjSpill& spill, float value) {
+    if (spill.count == spill.buffer.size()) {
+        flushSpill(spill);
+    }
+    spill.buffer[spill.count++] = value;
+}
+
+// Opens a temporary file, returns false if it can't be created
+static bool openSpill(ObjSpill& spill, const std::string& filename, size_t bufferSize) {
+    spill.file = fopen(filename.c_str(), "wb");
+    spill.buffer.resize(bufferSize / sizeof(float) > 0 ? bufferSize / sizeof(float) : 1);
+    spill.count = 0;
+    spill.failed = false;
+    return spill.file != NULL;
+}
+
+// Writes out what is left in the buffer and closes the file, returns false if anything failed
+static bool closeSpill(ObjSpill& spill) {
+    if (spill.file == NULL) {
+        return false;
+    }
+    flushSpill(spill);
+    if (fclose(spill.file) != 0) {
+        spill.failed = true;
+    }
+    spill.file = NULL;
+    std::vector<float>().swap(spill.buffer);
+    return !spill.failed;
+}
+
+// Converts a 1 based, possibly relative, index to 0 based
+static inline int resolveIndex(int index, size_t count) {
+    if (index > 0) {
+        return index - 1;
+    }
+    if (index == 0) {
+        return 0;
+    }
+    return static_cast<int>(count) + index;
+}
+
+ObjStream* ObjStream::open(const std::string& filename, const std::string& mtlBasePath, size_t bufferSize,
+        std::string& err) {
+    AssetFile* file = AssetPack::open(filename);
+    if (file == NULL) {
+        std::stringstream message;
+        message << "Cannot open file [" << filename << "]" << std::endl;
+        err = message.str();
+        return NULL;
+    }
+
+    ObjStream* stream = new ObjStream();
+    stream->file = file;
+    MeshCache::createDirectory();
+    stream->positionFilename = MeshCache::cacheFilename(filename) + ".positions.tmp";
+    stream->texCoordFilename = MeshCache::cacheFilename(filename) + ".texcoords.tmp";
+
+    ObjSpill positions;
+    ObjSpill texCoords;
+    bool opened = openSpill(positions, stream->positionFilename, bufferSize / 2);
+    opened = openSpill(texCoords, stream->texCoordFilename, bufferSize / 2) && opened;
+    if (!opened) {
+        closeSpill(positions);
+        closeSpill(texCoords);
+        delete stream;
+        err = "Unable to create temporary files for [" + filename + "]";
+        return NULL;
+    }
+
+    // --------------------------------------------------
+    // Write out the attributes and count the triangles in each shape
+    // --------------------------------------------------
+
+    ObjMaterialState materialState;
+    materialState.material = initMaterial();
+    materialState.isMaterialSet = false;
+
+    Shape shape;
+    shape.numTriangles = 0;
+    size_t numFaces = 0;
+
+    const char* p = file->data();
+    const char* end = p + file->size();
+    while (p < end) {
+        const char* lineEnd = static_cast<const char*>(memchr(p, '\n', end - p));
+        if (lineEnd == NULL) {
+            lineEnd = end;
+        }
+        const char* token = skipSpace(p, lineEnd);
+        p = lineEnd + 1;
+
+        if (isKeyword(token, lineEnd, "v", 1)) {
+            token += 2;
+            spillFloat(positions, parseFloat(token, lineEnd));
+            spillFloat(positions, parseFloat(token, lineEnd));
+            spillFloat(positions, parseFloat(token, lineEnd));
+            stream->numPositions += 1;
+        }
+        else if (isKeyword(token, lineEnd, "vt", 2)) {
+            token += 3;
+            spillFloat(texCoords, parseFloat(token, lineEnd));
+            spillFloat(texCoords, parseFloat(token, lineEnd));
+            stream->numTexCoords += 1;
+        }
+        else if (isKeyword(token, lineEnd, "f", 1)) {
+            token = skipSpace(token + 2, lineEnd);
+            size_t numCorners = 0;
+            int indices[3];
+            while (token < lineEnd && *token != '\r') {
+                parseCornerIndices(token, lineEnd, indices);
+                numCorners += 1;
+                while (token < lineEnd && isSeparator(*token)) {
+                    ++token;
+                }
+            }
+            shape.numTriangles += (numCorners >= 3) ? numCorners - 2 : 0;
+            numFaces += 1;
+        }
+        else {
+            ObjCommand command;
+            if (parseCommand(token, lineEnd, command)) {
+                if ((command.type == ObjCommand::GROUP || command.type == ObjCommand::OBJECT) && numFaces > 0) {
+                    const ObjMaterial material = shapeMaterial(materialState);
+                    shape.material = material.material;
+                    shape.textureName = material.textureName;
+                    stream->streamShapes.push_back(shape);
+                    stream->totalTriangles += shape.numTriangles;
+                    shape.numTriangles = 0;
+                    numFaces = 0;
+                }
+                applyCommand(materialState, command, mtlBasePath);
+            }
+        }
+    }
+    if (numFaces > 0) {
+        const ObjMaterial material = shapeMaterial(materialState);
+        shape.material = material.material;
+        shape.textureName = material.textureName;
+        stream->streamShapes.push_back(shape);
+        stream->totalTriangles += shape.numTriangles;
+    }
+
+    bool written = closeSpill(positions);
+    written = closeSpill(texCoords) && written;
+    if (written) {
+        stream->positionFile = MappedFile::open(stream->positionFilename);
+        stream->texCoordFile = MappedFile::open(stream->texCoordFilename);
+    }
+    if (stream->positionFile == NULL || stream->texCoordFile == NULL) {
+        delete stream;
+        err = "Unable to write temporary files for [" + filename + "]";
+        return NULL;
+    }
+
+    stream->cursor = file->data();
+    return stream;
+}
+
+ObjStream::ObjStream() : file(NULL), positionFile(NULL), texCoordFile(NULL), totalTriangles(0), numPositions(0),
+    numTexCoords(0), cursor(NULL), positionCount(0), texCoordCount(0), nextCorner(0) {
+}
+
+ObjStream::~ObjStream() {
+    delete file;
+    delete positionFile;
+    delete texCoordFile;
+    remove(positionFilename.c_str());
+    remove(texCoordFilename.c_str());
+}
+
+const std::vector<ObjStream::Shape>& ObjStream::shapes() const {
+    return streamShapes;
+}
+
+size_t ObjStream::numTriangles() const {
+    return totalTriangles;
+}
+
+bool ObjStream::nextFace(std::string& err) {
+    const char* end = file->data() + file->size();
+    while (cursor < end) {
+        const char* lineEnd = static_cast<const char*>(memchr(cursor, '\n', end - cursor));
+        if (lineEnd == NULL) {
+            lineEnd = end;
+        }
+        const char* token = skipSpace(cursor, lineEnd);
+        cursor = lineEnd + 1;
+
+        // Only the counts are needed for relative indices, the values were written out by open
+        if (isKeyword(token, lineEnd, "v", 1)) {
+            positionCount += 1;
+        }
+        else if (isKeyword(token, lineEnd, "vt", 2)) {
+            texCoordCount += 1;
+        }
+        else if (isKeyword(token, lineEnd, "f", 1)) {
+            token = skipSpace(token + 2, lineEnd);
+            face.clear();
+            int indices[3];
+            while (token < lineEnd && *token != '\r') {
+                const int given = parseCornerIndices(token, lineEnd, indices);
+                const int position = resolveIndex(indices[0], positionCount);
+                const int texCoord = (given & OBJ_HAS_TEXCOORD) ? resolveIndex(indices[1], texCoordCount) : OBJ_NO_INDEX;
+                if (!inRange(position, numPositions) || (texCoord != OBJ_NO_INDEX && !inRange(texCoord, numTexCoords))) {
+                    err = "Face refers to a vertex that does not exist";
+                    return false;
+                }
+                face.push_back(position);
+                face.push_back(texCoord);
+                while (token < lineEnd && isSeparator(*token)) {
+                    ++token;
+                }
+            }
+            if (face.size() >= 6) {
+                nextCorner = 2;
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+size_t ObjStream::read(glm::vec3* positions, glm::vec2* texCoords, size_t maxTriangles, std::string& err) {
+    const float* positionData = reinterpret_cast<const float*>(positionFile->data());
+    const float* texCoordData = reinterpret_cast<const float*>(texCoordFile->data());
+
+    size_t count = 0;
+    while (count < maxTriangles) {
+        if (nextCorner * 2 >= face.size() && !nextFace(err)) {
+            break;
+        }
+
+        // Polygon -> triangle fan conversion
+        const size_t corners[3] = { 0, nextCorner - 1, nextCorner };
+        for (int i = 0; i < 3; ++i) {
+            const float* position = positionData + face[corners[i] * 2] * 3;
+            positions[count * 3 + i] = glm::vec3(position[0], position[1], position[2]);
+
+            const int texCoord = face[corners[i] * 2 + 1];
+            if (texCoord != OBJ_NO_INDEX) {
+                texCoords[count * 3 + i] = glm::vec2(texCoordData[texCoord * 2], texCoordData[texCoord * 2 + 1]);
+            }
+            else {
+                texCoords[count * 3 + i] = glm::vec2(0.0f);
+            }
+        }
+        nextCorner += 1;
+        count += 1;
+    }
+    return err.empty() ? count : 0;
+}
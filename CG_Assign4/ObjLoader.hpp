@@ -0,0 +1,103 @@
+//! Loader for Wavefront .obj and .mtl files
+#pragma once
+#include <string>
+#include "ModelData.hpp"
+
+class AssetFile;
+class MappedFile;
+
+/// <summary>
+/// Load an .obj file, and the .mtl files it references, into indexed shapes. The file is read from
+/// the asset pack or mapped into memory, and split into chunks which are parsed in parallel.
+///
+/// Shapes follow tiny_obj_loader: a new shape starts at each 'g' or 'o' line, polygons are
+/// triangulated as fans, and vertices sharing the same position, texture coordinate and normal
+/// indices within a shape are merged. A shape takes the last material used within it, or a white
+/// material if it has none. Texture names are left relative to the .mtl file. Normals and texture
+/// coordinates are only filled in if the file has them.
+/// </summary>
+///
+/// <param name="data">Receives the shapes, the bounding box is not set.</param>
+/// <param name="filename">The .obj file.</param>
+/// <param name="mtlBasePath">Prefix for the names of .mtl files referenced by the .obj file.</param>
+/// <returns>An empty string on success, otherwise a description of the error.</returns>
+std::string loadObj(RawModelData& data, const std::string& filename, const std::string& mtlBasePath);
+
+/// <summary>
+/// Reads an .obj file as a stream of triangles, for models too large to load into memory.
+///
+/// Opening the stream makes one pass over the file. It writes the positions and texture
+/// coordinates to temporary files in MESH_CACHE_DIRECTORY and counts the triangles of each shape.
+/// The shapes and materials are the same as loadObj's. read then walks the file again and returns
+/// the triangles in order, so memory use depends on the buffer sizes and not on the file size.
+/// </summary>
+class ObjStream {
+public:
+    struct Shape {
+        Material material;
+        std::string textureName;
+        size_t numTriangles;
+    };
+
+    /// <summary>
+    /// Open an .obj file for streaming.
+    /// </summary>
+    ///
+    /// <param name="filename">The .obj file.</param>
+    /// <param name="mtlBasePath">Prefix for the names of .mtl files referenced by the .obj file.</param>
+    /// <param name="bufferSize">Bytes used to buffer the temporary files while they are written.</param>
+    /// <param name="err">Receives a description of the error if the file can't be streamed.</param>
+    /// <returns>The stream, or NULL on error.</returns>
+    static ObjStream* open(const std::string& filename, const std::string& mtlBasePath, size_t bufferSize,
+        std::string& err);
+
+    /// <summary>
+    /// Closes the file and deletes the temporary files.
+    /// </summary>
+    ~ObjStream();
+
+    /// <summary>
+    /// The shapes in the order their triangles are read.
+    /// </summary>
+    const std::vector<Shape>& shapes() const;
+
+    size_t numTriangles() const;
+
+    /// <summary>
+    /// Read the next triangles. Texture coordinates that are not given in the file are zero.
+    /// </summary>
+    ///
+    /// <param name="positions">Receives three positions per triangle.</param>
+    /// <param name="texCoords">Receives three texture coordinates per triangle.</param>
+    /// <param name="maxTriangles">The most triangles to read.</param>
+    /// <param name="err">Receives a description of the error if a face is invalid.</param>
+    /// <returns>The number of triangles read, 0 at the end of the file or on error.</returns>
+    size_t read(glm::vec3* positions, glm::vec2* texCoords, size_t maxTriangles, std::string& err);
+
+private:
+    ObjStream();
+
+    // Moves to the next face with at least one triangle, false at the end of the file or on error
+    bool nextFace(std::string& err);
+
+    AssetFile* file;
+    MappedFile* positionFile;
+    MappedFile* texCoordFile;
+    std::string positionFilename;
+    std::string texCoordFilename;
+
+    std::vector<Shape> streamShapes;
+    size_t totalTriangles;
+    size_t numPositions;
+    size_t numTexCoords;
+
+    // Read position in the file, and the number of positions and texture coordinates before it
+    const char* cursor;
+    size_t positionCount;
+    size_t texCoordCount;
+
+    // Position and texture coordinate index of each corner of the current face, and the corner
+    // that ends the next triangle of its fan
+    std::vector<int> face;
+    size_t nextCorner;
+};
@@ -0,0 +1,299 @@
+//! Benchmark and check for the software occlusion cullers, which run without a GPU
+//
+// usage: occlusion_bench [-n iterations] [-g grid size]
+//
+// A grid of city blocks is generated, with a box building on each block and small boxes along the
+// streets, and viewed from street level looking down an avenue. The nearest buildings are used as
+// occluders, as the renderer does, and every box is culled with one thread and with every thread.
+// The horizon culler is run on the same boxes as the renderer runs it: every building is an
+// occluder, taken in the order the city draws them, ring by ring out from the camera's tile, and
+// the small boxes are tested against the finished horizon. Each box a culler hides is checked by casting rays from the camera to points on its
+// faces, a box with any unblocked point inside the view is reported as wrongly hidden. Rays that
+// coarse miss slivers, so a box showing less than a pixel above an occluder is checked on its own.
+#include "OcclusionCuller.hpp"
+#include "HorizonCuller.hpp"
+#include "SOIL2/image_parallel.h"
+#include "glm/common.hpp"
+#include "glm/gtc/matrix_transform.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+#define TILE_SIZE 2.0f
+#define MAX_OCCLUDING_MODELS 48
+
+// Wall clock time in seconds, CPU time would add up the time of every thread
+static double now() {
+#ifdef WIN32
+    LARGE_INTEGER counter, frequency;
+    QueryPerformanceCounter(&counter);
+    QueryPerformanceFrequency(&frequency);
+    return static_cast<double>(counter.QuadPart) / frequency.QuadPart;
+#else
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec * 1e-9;
+#endif
+}
+
+static BoundingBox makeBox(glm::vec3 minVertex, glm::vec3 maxVertex) {
+    BoundingBox box;
+    box.minVertex = minVertex;
+    box.maxVertex = maxVertex;
+    return box;
+}
+
+// Every third row and column of tiles is a street, the rest are buildings of varying height. The
+// buildings come first, in rings around the tile at the centre as City::draw adds them.
+static void buildCity(int gridSize, std::vector<BoundingBox>& boxes, size_t& numBuildings) {
+    for (int ring = 0; ring <= gridSize; ++ring) {
+        for (int z = -ring; z <= ring; ++z) {
+            const bool wholeRow = ring == 0 || z == -ring || z == ring;
+            for (int x = -ring; x <= ring; x += wholeRow ? 1 : 2 * ring) {
+                const glm::vec3 center(x * TILE_SIZE, 0.0f, z * TILE_SIZE);
+                if (x % 3 != 0 && z % 3 != 0) {
+                    const float height = 2.0f + static_cast<float>((x * 7919 + z * 104729) & 7);
+                    boxes.push_back(makeBox(center - glm::vec3(0.9f, 0.0f, 0.9f), center + glm::vec3(0.9f, height, 0.9f)));
+                }
+            }
+        }
+    }
+    numBuildings = boxes.size();
+    for (int z = -gridSize; z <= gridSize; ++z) {
+        for (int x = -gridSize; x <= gridSize; ++x) {
+            const glm::vec3 center(x * TILE_SIZE + 0.8f, 0.0f, z * TILE_SIZE + 0.8f);
+            if (x % 3 == 0 || z % 3 == 0) {
+                boxes.push_back(makeBox(center - glm::vec3(0.05f, 0.0f, 0.05f), center + glm::vec3(0.05f, 1.0f, 0.05f)));
+            }
+        }
+    }
+}
+
+// Distance along the ray to where it enters the box, or a negative number if it misses
+static float rayBox(glm::vec3 origin, glm::vec3 direction, const BoundingBox& box) {
+    float nearest = 0.0f, farthest = 1e30f;
+    for (int axis = 0; axis < 3; ++axis) {
+        if (direction[axis] == 0.0f) {
+            if (origin[axis] < box.minVertex[axis] || origin[axis] > box.maxVertex[axis]) {
+                return -1.0f;
+            }
+            continue;
+        }
+        float t1 = (box.minVertex[axis] - origin[axis]) / direction[axis];
+        float t2 = (box.maxVertex[axis] - origin[axis]) / direction[axis];
+        nearest = std::max(nearest, std::min(t1, t2));
+        farthest = std::min(farthest, std::max(t1, t2));
+    }
+    return nearest <= farthest ? nearest : -1.0f;
+}
+
+// Whether any point on the box's faces can be seen from the camera
+static bool raysReach(const std::vector<BoundingBox>& boxes, size_t target, glm::vec3 camera,
+        const glm::mat4& viewProjection) {
+    const BoundingBox& box = boxes[target];
+    const int samples = 6;
+    for (int face = 0; face < 6; ++face) {
+        const int axis = face / 2;
+        for (int i = 0; i < samples; ++i) {
+            for (int j = 0; j < samples; ++j) {
+                glm::vec3 t;
+                t[axis] = (face & 1) ? 1.0f : 0.0f;
+                t[(axis + 1) % 3] = (i + 0.5f) / samples;
+                t[(axis + 2) % 3] = (j + 0.5f) / samples;
+                const glm::vec3 point = box.minVertex + t * (box.maxVertex - box.minVertex);
+
+                const glm::vec4 clip = viewProjection * glm::vec4(point, 1.0f);
+                if (clip.w <= 0.0f || glm::abs(clip.x) > clip.w || glm::abs(clip.y) > clip.w || glm::abs(clip.z) > clip.w) {
+                    continue;
+                }
+
+                const glm::vec3 direction = point - camera;
+                bool blocked = false;
+                for (size_t k = 0; k < boxes.size() && !blocked; ++k) {
+                    if (k != target) {
+                        const float hit = rayBox(camera, direction, boxes[k]);
+                        blocked = hit >= 0.0f && hit < 0.999f;
+                    }
+                }
+                if (!blocked) {
+                    return true;
+                }
+            }
+        }
+    }
+    return false;
+}
+
+// Whether a box poking out above an occluder by less than a pixel of the culler's buffer is kept.
+// The wall's top edge is placed just above a pixel's centre and the box's top between that and the
+// pixel's top, so only the pixel the wall partly covers shows the box.
+static bool sliverKept(const glm::mat4& proj) {
+    const glm::vec3 camera(0.0f);
+    const glm::mat4 viewProjection = proj * glm::lookAt(camera, glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    const float wallDistance = 10.0f;
+    const float boxDistance = 20.0f;
+    const float pixel = 2.0f / OCCLUSION_BUFFER_HEIGHT;
+
+    // Heights whose projections land a given number of pixels up the buffer
+    const float wallRow = OCCLUSION_BUFFER_HEIGHT * 0.625f + 0.6f;
+    const float wallTop = (wallRow * pixel - 1.0f) * wallDistance / proj[1][1];
+    const float boxTop = ((wallRow + 0.3f) * pixel - 1.0f) * boxDistance / proj[1][1];
+
+    std::vector<BoundingBox> boxes;
+    boxes.push_back(makeBox(glm::vec3(-5.0f, -5.0f, wallDistance), glm::vec3(5.0f, wallTop, wallDistance + 1.0f)));
+    boxes.push_back(makeBox(glm::vec3(-1.0f, -5.0f, boxDistance), glm::vec3(1.0f, boxTop, boxDistance + 1.0f)));
+
+    // Make sure the top of the box really can be seen over the wall
+    const glm::vec3 point(0.0f, boxTop - (boxTop - wallTop * boxDistance / wallDistance) * 0.5f, boxDistance);
+    const float hit = rayBox(camera, point - camera, boxes[0]);
+    if (hit >= 0.0f && hit < 0.999f) {
+        printf("sliver: the test box is hidden by the wall\n");
+        return false;
+    }
+
+    OcclusionCuller culler;
+    const glm::mat4 identity(1.0f);
+    culler.begin(viewProjection);
+    culler.addOccluder(boxes[0], identity);
+    const size_t object = culler.addObject(boxes[1], identity);
+    culler.cull();
+    return culler.isVisible(object);
+}
+
+// Distance from the camera to a box's centre
+struct NearerBox {
+    const std::vector<BoundingBox>* boxes;
+    glm::vec3 camera;
+
+    bool operator()(size_t b1, size_t b2) const {
+        const BoundingBox& box1 = (*boxes)[b1];
+        const BoundingBox& box2 = (*boxes)[b2];
+        return glm::length((box1.minVertex + box1.maxVertex) * 0.5f - camera) <
+            glm::length((box2.minVertex + box2.maxVertex) * 0.5f - camera);
+    }
+};
+
+// Culls every box 'iterations' times, returns the seconds taken
+static double timeCull(OcclusionCuller& culler, const std::vector<BoundingBox>& boxes,
+        const std::vector<size_t>& occluders, const glm::mat4& viewProjection, int iterations, int threads) {
+    image_parallel_set_thread_count(threads);
+    const glm::mat4 identity(1.0f);
+    const double start = now();
+    for (int i = 0; i < iterations; ++i) {
+        culler.begin(viewProjection);
+        for (size_t j = 0; j < occluders.size(); ++j) {
+            culler.addOccluder(boxes[occluders[j]], identity);
+        }
+        for (size_t j = 0; j < boxes.size(); ++j) {
+            culler.addObject(boxes[j], identity);
+        }
+        culler.cull();
+    }
+    return now() - start;
+}
+
+// Culls every box 'iterations' times against the horizon, the buildings in the order they were
+// built, returns the seconds taken
+static double timeHorizon(const std::vector<BoundingBox>& boxes, size_t numBuildings,
+        const glm::mat4& viewProjection, int iterations, std::vector<unsigned char>& visible) {
+    HorizonCuller culler;
+    const glm::mat4 identity(1.0f);
+    const double start = now();
+    for (int i = 0; i < iterations; ++i) {
+        culler.begin(viewProjection);
+        visible.assign(boxes.size(), 0);
+        for (size_t j = 0; j < boxes.size(); ++j) {
+            visible[j] = culler.isVisible(boxes[j], identity);
+            if (visible[j] && j < numBuildings) {
+                culler.addOccluder(boxes[j], identity);
+            }
+        }
+    }
+    return now() - start;
+}
+
+int main(int argc, char** argv) {
+    int iterations = 200;
+    int gridSize = 30;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            iterations = atoi(argv[++i]);
+            if (iterations < 1) iterations = 1;
+        }
+        else if (strcmp(argv[i], "-g") == 0 && i + 1 < argc) {
+            gridSize = atoi(argv[++i]);
+            if (gridSize < 1) gridSize = 1;
+        }
+        else {
+            fprintf(stderr, "usage: %s [-n iterations] [-g grid size]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    std::vector<BoundingBox> boxes;
+    size_t numBuildings = 0;
+    buildCity(gridSize, boxes, numBuildings);
+
+    // Standing in an avenue looking along it, with the renderer's projection
+    const glm::vec3 camera(0.0f, 1.5f, 1.0f);
+    const glm::mat4 view = glm::lookAt(camera, camera + glm::vec3(0.3f, -0.05f, 1.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    const glm::mat4 proj = glm::perspective(60.0f / 360.0f * 6.283185307179586f, 16.0f / 9.0f, 0.1f, 200.0f);
+    const glm::mat4 viewProjection = proj * view;
+
+    std::vector<size_t> occluders;
+    for (size_t i = 0; i < numBuildings; ++i) {
+        occluders.push_back(i);
+    }
+    NearerBox nearer = { &boxes, camera };
+    const size_t numOccluders = std::min(occluders.size(), static_cast<size_t>(MAX_OCCLUDING_MODELS));
+    std::partial_sort(occluders.begin(), occluders.begin() + numOccluders, occluders.end(), nearer);
+    occluders.resize(numOccluders);
+
+    OcclusionCuller single, threaded;
+    const int threads = image_parallel_thread_count();
+    const double singleTime = timeCull(single, boxes, occluders, viewProjection, iterations, 1);
+    const double threadedTime = timeCull(threaded, boxes, occluders, viewProjection, iterations, threads);
+
+    std::vector<unsigned char> horizonVisible;
+    const double horizonTime = timeHorizon(boxes, numBuildings, viewProjection, iterations, horizonVisible);
+
+    int failed = 0;
+    size_t wronglyHidden = 0, horizonHidden = 0, horizonWronglyHidden = 0;
+    for (size_t i = 0; i < boxes.size(); ++i) {
+        if (single.isVisible(i) != threaded.isVisible(i)) {
+            failed = 1;
+        }
+        if (!threaded.isVisible(i) && raysReach(boxes, i, camera, viewProjection)) {
+            wronglyHidden += 1;
+        }
+        if (!horizonVisible[i]) {
+            horizonHidden += 1;
+            if (raysReach(boxes, i, camera, viewProjection)) {
+                horizonWronglyHidden += 1;
+            }
+        }
+    }
+
+    printf("%lu boxes, %lu occluders, %dx%d buffer\n", (unsigned long)boxes.size(), (unsigned long)occluders.size(),
+        OCCLUSION_BUFFER_WIDTH, OCCLUSION_BUFFER_HEIGHT);
+    printf("hidden %lu (%.1f%%), wrongly hidden %lu\n", (unsigned long)threaded.numHidden(),
+        100.0 * threaded.numHidden() / boxes.size(), (unsigned long)wronglyHidden);
+    printf("%-10s %10.3f ms per cull\n", "1 thread", 1000.0 * singleTime / iterations);
+    printf("%-10s %10.3f ms per cull (%d threads)\n", "threads", 1000.0 * threadedTime / iterations, threads);
+    printf("horizon: hidden %lu (%.1f%%), wrongly hidden %lu\n", (unsigned long)horizonHidden,
+        100.0 * horizonHidden / boxes.size(), (unsigned long)horizonWronglyHidden);
+    printf("%-10s %10.3f ms per cull\n", "horizon", 1000.0 * horizonTime / iterations);
+    const bool sliver = sliverKept(proj);
+    printf("box less than a pixel above an occluder: %s\n", sliver ? "kept" : "WRONGLY HIDDEN");
+    if (failed) {
+        printf("MISMATCH between single and multithreaded results\n");
+    }
+    return failed || wronglyHidden > 0 || horizonWronglyHidden > 0 || !sliver;
+}
@@ -0,0 +1,249 @@
+#include "OcclusionCuller.hpp"
+#include "SOIL2/image_parallel.h"
+#include "glm/common.hpp"
+#include <algorithm>
+#include <cmath>
+
+// SSE2 is always there on x64, and on x86 when the compiler targets it
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#define OCCLUSION_SSE2
+#include <emmintrin.h>
+#endif
+
+// The corners of each face of a box, corner i has bit 0 set for max x, bit 1 for max y and bit 2 for max z
+static const int boxFaces[6][4] = {
+    { 0, 2, 6, 4 }, { 1, 3, 7, 5 },
+    { 0, 1, 5, 4 }, { 2, 3, 7, 6 },
+    { 0, 1, 3, 2 }, { 4, 5, 7, 6 }
+};
+
+// Rounds down and clamps to a pixel range, without overflowing for points projected far off the screen
+static int pixelFloor(float value, int min, int max) {
+    return static_cast<int>(std::floor(std::min(std::max(value, static_cast<float>(min)), static_cast<float>(max))));
+}
+
+// Rounds up and clamps to a pixel range
+static int pixelCeil(float value, int min, int max) {
+    return static_cast<int>(std::ceil(std::min(std::max(value, static_cast<float>(min)), static_cast<float>(max))));
+}
+
+OcclusionCuller::OcclusionCuller() : viewProjection(1.0f), hidden(0) {
+}
+
+void OcclusionCuller::begin(const glm::mat4& viewProjection) {
+    this->viewProjection = viewProjection;
+    faces.clear();
+    objects.clear();
+    visible.clear();
+    hidden = 0;
+}
+
+bool OcclusionCuller::project(const BoundingBox& box, const glm::mat4& transformation, glm::vec3 corners[8]) const {
+    const glm::mat4 mvp = viewProjection * transformation;
+    for (int i = 0; i < 8; ++i) {
+        const glm::vec4 corner(
+            (i & 1) ? box.maxVertex.x : box.minVertex.x,
+            (i & 2) ? box.maxVertex.y : box.minVertex.y,
+            (i & 4) ? box.maxVertex.z : box.minVertex.z,
+            1.0f);
+        const glm::vec4 clip = mvp * corner;
+        if (clip.w <= 0.0f || clip.z < -clip.w) {
+            return false;
+        }
+        corners[i] = glm::vec3(
+            (clip.x / clip.w * 0.5f + 0.5f) * OCCLUSION_BUFFER_WIDTH,
+            (clip.y / clip.w * 0.5f + 0.5f) * OCCLUSION_BUFFER_HEIGHT,
+            clip.z / clip.w);
+    }
+    return true;
+}
+
+void OcclusionCuller::addOccluder(const BoundingBox& box, const glm::mat4& transformation) {
+    glm::vec3 corners[8];
+    if (!project(box, transformation, corners)) {
+        return;
+    }
+
+    // Both sides of every face are drawn, the buffer keeps the nearest so the winding doesn't matter
+    for (int i = 0; i < 6; ++i) {
+        const Face face = { { corners[boxFaces[i][0]], corners[boxFaces[i][1]], corners[boxFaces[i][2]],
+            corners[boxFaces[i][3]] } };
+        faces.push_back(face);
+    }
+}
+
+size_t OcclusionCuller::addObject(const BoundingBox& bounds, const glm::mat4& transformation) {
+    const Object object = { bounds, transformation };
+    objects.push_back(object);
+    return objects.size() - 1;
+}
+
+void OcclusionCuller::rasterizeBands(void* user, int first, int last) {
+    OcclusionCuller* culler = static_cast<OcclusionCuller*>(user);
+    for (int band = first; band < last; ++band) {
+        const int firstRow = band * OCCLUSION_BAND_HEIGHT;
+        const int lastRow = std::min(firstRow + OCCLUSION_BAND_HEIGHT, OCCLUSION_BUFFER_HEIGHT);
+        std::fill(culler->depth.begin() + firstRow * OCCLUSION_BUFFER_WIDTH,
+            culler->depth.begin() + lastRow * OCCLUSION_BUFFER_WIDTH, 1.0f);
+        for (size_t i = 0; i < culler->faces.size(); ++i) {
+            culler->rasterize(culler->faces[i], firstRow, lastRow);
+        }
+    }
+}
+
+void OcclusionCuller::testObjects(void* user, int first, int last) {
+    OcclusionCuller* culler = static_cast<OcclusionCuller*>(user);
+    for (int i = first; i < last; ++i) {
+        culler->visible[i] = culler->isVisible(culler->objects[i]);
+    }
+}
+
+void OcclusionCuller::cull() {
+    // Each thread rasterises every triangle into its own rows of the buffer, so no writes are shared
+    depth.resize(OCCLUSION_BUFFER_WIDTH * OCCLUSION_BUFFER_HEIGHT);
+    const int numBands = (OCCLUSION_BUFFER_HEIGHT + OCCLUSION_BAND_HEIGHT - 1) / OCCLUSION_BAND_HEIGHT;
+    image_parallel_for(numBands, 1, rasterizeBands, this);
+
+    visible.assign(objects.size(), 1);
+    if (!objects.empty()) {
+        image_parallel_for(static_cast<int>(objects.size()), 64, testObjects, this);
+    }
+    hidden = std::count(visible.begin(), visible.end(), 0);
+}
+
+void OcclusionCuller::rasterize(const Face& face, int firstRow, int lastRow) {
+    // A box's faces stay convex and planar once projected, as no corner is behind the camera
+    glm::vec3 v[4] = { face.vertices[0], face.vertices[1], face.vertices[2], face.vertices[3] };
+
+    // Make the winding counter clockwise so the inside of every edge is positive
+    float area = 0.0f;
+    for (int i = 0; i < 4; ++i) {
+        area += v[i].x * v[(i + 1) % 4].y - v[(i + 1) % 4].x * v[i].y;
+    }
+    if (area < 0.0f) {
+        std::swap(v[1], v[3]);
+        area = -area;
+    }
+    if (area < 1e-6f) {
+        return;
+    }
+
+    // Pixels whose centres may be inside the face, starting on a multiple of 4
+    const float lowX = std::min(std::min(v[0].x, v[1].x), std::min(v[2].x, v[3].x));
+    const float highX = std::max(std::max(v[0].x, v[1].x), std::max(v[2].x, v[3].x));
+    const float lowY = std::min(std::min(v[0].y, v[1].y), std::min(v[2].y, v[3].y));
+    const float highY = std::max(std::max(v[0].y, v[1].y), std::max(v[2].y, v[3].y));
+    const int minX = pixelFloor(lowX, 0, OCCLUSION_BUFFER_WIDTH) & ~3;
+    const int maxX = pixelCeil(highX, -1, OCCLUSION_BUFFER_WIDTH - 1);
+    const int minY = pixelFloor(lowY, firstRow, lastRow);
+    const int maxY = pixelCeil(highY, firstRow - 1, lastRow - 1);
+    if (minX > maxX || minY > maxY) {
+        return;
+    }
+
+    // Edge functions a*x + b*y + c for the edges v0-v1, v1-v2, v2-v3 and v3-v0. Each is moved inwards
+    // by half a pixel along both axes, so testing a pixel's centre tests its innermost corner and only
+    // pixels the face covers entirely are written.
+    float a[4], b[4], c[4];
+    for (int i = 0; i < 4; ++i) {
+        const glm::vec3& from = v[i];
+        const glm::vec3& to = v[(i + 1) % 4];
+        a[i] = from.y - to.y;
+        b[i] = to.x - from.x;
+        c[i] = -(a[i] * from.x + b[i] * from.y) - 0.5f * (std::fabs(a[i]) + std::fabs(b[i]));
+    }
+
+    // Depth is linear in screen space over the face's plane, taken from its larger half so a face
+    // with two corners on the same point still has a plane
+    const glm::vec3 p0 = v[0];
+    const float area012 = (v[1].x - v[0].x) * (v[2].y - v[0].y) - (v[2].x - v[0].x) * (v[1].y - v[0].y);
+    const float area023 = (v[2].x - v[0].x) * (v[3].y - v[0].y) - (v[3].x - v[0].x) * (v[2].y - v[0].y);
+    const glm::vec3 p1 = area012 >= area023 ? v[1] : v[2];
+    const glm::vec3 p2 = area012 >= area023 ? v[2] : v[3];
+    const float planeArea = std::max(area012, area023);
+    const float dzdx = ((p1.z - p0.z) * (p2.y - p0.y) - (p2.z - p0.z) * (p1.y - p0.y)) / planeArea;
+    const float dzdy = ((p2.z - p0.z) * (p1.x - p0.x) - (p1.z - p0.z) * (p2.x - p0.x)) / planeArea;
+
+    // The farthest depth over a pixel is at one of its corners
+    const float dzc = p0.z - dzdx * p0.x - dzdy * p0.y + 0.5f * (std::fabs(dzdx) + std::fabs(dzdy));
+
+    for (int y = minY; y <= maxY; ++y) {
+        const float py = y + 0.5f;
+        float* row = &depth[y * OCCLUSION_BUFFER_WIDTH];
+#ifdef OCCLUSION_SSE2
+        const __m128 offsets = _mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f);
+        const __m128 zero = _mm_setzero_ps();
+        for (int x = minX; x <= maxX; x += 4) {
+            const __m128 px = _mm_add_ps(_mm_set1_ps(static_cast<float>(x)), offsets);
+            __m128 inside = _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(a[0]), px), _mm_set1_ps(b[0] * py + c[0])), zero);
+            for (int i = 1; i < 4; ++i) {
+                inside = _mm_and_ps(inside,
+                    _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(a[i]), px), _mm_set1_ps(b[i] * py + c[i])), zero));
+            }
+            if (_mm_movemask_ps(inside) == 0) {
+                continue;
+            }
+            const __m128 z = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(dzdx), px), _mm_set1_ps(dzdy * py + dzc));
+            const __m128 current = _mm_loadu_ps(row + x);
+            const __m128 nearest = _mm_min_ps(current, z);
+            _mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, nearest), _mm_andnot_ps(inside, current)));
+        }
+#else
+        for (int x = minX; x <= maxX; ++x) {
+            const float px = x + 0.5f;
+            if (a[0] * px + b[0] * py + c[0] >= 0.0f && a[1] * px + b[1] * py + c[1] >= 0.0f &&
+                    a[2] * px + b[2] * py + c[2] >= 0.0f && a[3] * px + b[3] * py + c[3] >= 0.0f) {
+                row[x] = std::min(row[x], dzdx * px + dzdy * py + dzc);
+            }
+        }
+#endif
+    }
+}
+
+bool OcclusionCuller::isVisible(const Object& object) const {
+    glm::vec3 corners[8];
+    if (!project(object.bounds, object.transformation, corners)) {
+        return true;
+    }
+
+    glm::vec3 minCorner = corners[0], maxCorner = corners[0];
+    for (int i = 1; i < 8; ++i) {
+        minCorner = glm::min(minCorner, corners[i]);
+        maxCorner = glm::max(maxCorner, corners[i]);
+    }
+    if (maxCorner.x < 0.0f || minCorner.x > OCCLUSION_BUFFER_WIDTH || maxCorner.y < 0.0f ||
+            minCorner.y > OCCLUSION_BUFFER_HEIGHT || minCorner.z > 1.0f) {
+        return false;
+    }
+
+    // Every pixel the bounds touch has to have an occluder in front of their nearest point
+    const int minX = pixelFloor(minCorner.x, 0, OCCLUSION_BUFFER_WIDTH - 1);
+    const int maxX = pixelFloor(maxCorner.x, 0, OCCLUSION_BUFFER_WIDTH - 1);
+    const int minY = pixelFloor(minCorner.y, 0, OCCLUSION_BUFFER_HEIGHT - 1);
+    const int maxY = pixelFloor(maxCorner.y, 0, OCCLUSION_BUFFER_HEIGHT - 1);
+    for (int y = minY; y <= maxY; ++y) {
+        const float* row = &depth[y * OCCLUSION_BUFFER_WIDTH];
+        for (int x = minX; x <= maxX; ++x) {
+            if (row[x] >= minCorner.z) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+bool OcclusionCuller::isVisible(size_t object) const {
+    return visible[object] != 0;
+}
+
+size_t OcclusionCuller::numObjects() const {
+    return objects.size();
+}
+
+size_t OcclusionCuller::numHidden() const {
+    return hidden;
+}
+
+const float* OcclusionCuller::depthBuffer() const {
+    return depth.empty() ? NULL : &depth[0];
+}
@@ -0,0 +1,101 @@
+//! Software occlusion culling against a small depth buffer rasterised on the CPU
+#pragma once
+#include <vector>
+#include "ModelData.hpp"
+#include "glm/mat4x4.hpp"
+#include "glm/vec4.hpp"
+
+// Resolution of the depth buffer, the width must be a multiple of 4
+#define OCCLUSION_BUFFER_WIDTH 256
+#define OCCLUSION_BUFFER_HEIGHT 128
+
+// Rows in each band of the buffer, bands are rasterised on separate threads
+#define OCCLUSION_BAND_HEIGHT 16
+
+/// <summary>
+/// Hides objects that are entirely behind occluders. The occluders are solid boxes which are drawn
+/// into a low resolution depth buffer, then the screen space bounds of each object are tested
+/// against it. Everything runs on the CPU, rasterising with SSE2 where it is available, and the
+/// work is split across threads with image_parallel_for.
+///
+/// An object is only hidden if, over every pixel its bounds cover, the nearest point of its bounds
+/// is behind the occluders. Occluders only fill the pixels they cover entirely, with the farthest
+/// depth they have over the pixel. They have to lie inside the geometry they stand for, and
+/// occluders crossing the near plane are skipped, so visible objects aren't hidden.
+/// </summary>
+class OcclusionCuller {
+public:
+    OcclusionCuller();
+
+    /// <summary>
+    /// Start a new frame, removing the previous frame's occluders and objects.
+    /// </summary>
+    ///
+    /// <param name="viewProjection">The camera's projection times its view.</param>
+    void begin(const glm::mat4& viewProjection);
+
+    /// <summary>
+    /// Add a solid box which hides what is behind it.
+    /// </summary>
+    ///
+    /// <param name="box">The box in model space.</param>
+    /// <param name="transformation">The model's transformation.</param>
+    void addOccluder(const BoundingBox& box, const glm::mat4& transformation);
+
+    /// <summary>
+    /// Add an object to be tested.
+    /// </summary>
+    ///
+    /// <param name="bounds">The object's bounds in model space.</param>
+    /// <param name="transformation">The model's transformation.</param>
+    /// <returns>The object's index, for isVisible.</returns>
+    size_t addObject(const BoundingBox& bounds, const glm::mat4& transformation);
+
+    /// <summary>
+    /// Rasterise the occluders and test every object against them.
+    /// </summary>
+    void cull();
+
+    /// <summary>
+    /// Whether an object may be seen, valid after cull. Objects entirely off the screen are not visible.
+    /// </summary>
+    bool isVisible(size_t object) const;
+
+    size_t numObjects() const;
+
+    size_t numHidden() const;
+
+    /// <summary>
+    /// The depth buffer after cull, rows from the bottom of the screen up. Pixels with no occluder
+    /// hold 1, the far plane.
+    /// </summary>
+    const float* depthBuffer() const;
+
+private:
+    // A face of an occluder in screen space, x and y in pixels and z the normalized device depth.
+    // Faces are drawn whole, so no pixel is left half covered along a diagonal inside them.
+    struct Face {
+        glm::vec3 vertices[4];
+    };
+
+    struct Object {
+        BoundingBox bounds;
+        glm::mat4 transformation;
+    };
+
+    static void rasterizeBands(void* user, int first, int last);
+    static void testObjects(void* user, int first, int last);
+
+    void rasterize(const Face& face, int firstRow, int lastRow);
+    bool isVisible(const Object& object) const;
+
+    // Projects the corners of a box, returns false if any corner is behind the near plane
+    bool project(const BoundingBox& box, const glm::mat4& transformation, glm::vec3 corners[8]) const;
+
+    glm::mat4 viewProjection;
+    std::vector<Face> faces;
+    std::vector<Object> objects;
+    std::vector<unsigned char> visible;
+    std::vector<float> depth;
+    size_t hidden;
+};
@@ -0,0 +1,95 @@
+//! Builds the asset pack from loose files
+//
+// usage: pack_assets pack paths...
+//
+// Each path is a file or a directory, directories are packed recursively. Entries are named by
+// their path, so run it from the directory the program is run from.
+#include "AssetPack.hpp"
+#include <cstdio>
+#include <cstring>
+#include <sys/stat.h>
+
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <dirent.h>
+#endif
+
+// Adds a file, or every file below a directory, returns false if the path doesn't exist
+static bool addPath(const std::string& path, std::vector<std::string>& files) {
+    struct stat info;
+    if (stat(path.c_str(), &info) != 0) {
+        return false;
+    }
+    if (!S_ISDIR(info.st_mode)) {
+        files.push_back(path);
+        return true;
+    }
+
+    std::vector<std::string> children;
+#ifdef WIN32
+    WIN32_FIND_DATAA found;
+    HANDLE search = FindFirstFileA((path + "/*").c_str(), &found);
+    if (search == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    do {
+        children.push_back(found.cFileName);
+    } while (FindNextFileA(search, &found));
+    FindClose(search);
+#else
+    DIR* dir = opendir(path.c_str());
+    if (dir == NULL) {
+        return false;
+    }
+    for (struct dirent* child = readdir(dir); child != NULL; child = readdir(dir)) {
+        children.push_back(child->d_name);
+    }
+    closedir(dir);
+#endif
+
+    for (size_t i = 0; i < children.size(); ++i) {
+        if (children[i] != "." && children[i] != ".." && !addPath(path + "/" + children[i], files)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 3) {
+        fprintf(stderr, "usage: %s pack paths...\n", argv[0]);
+        return 1;
+    }
+
+    std::vector<std::string> files;
+    double looseSize = 0.0;
+    for (int i = 2; i < argc; ++i) {
+        std::string path = argv[i];
+        while (path.size() > 1 && (path[path.size() - 1] == '/' || path[path.size() - 1] == '\\')) {
+            path.erase(path.size() - 1);
+        }
+        if (!addPath(path, files)) {
+            fprintf(stderr, "Unable to read %s\n", argv[i]);
+            return 1;
+        }
+    }
+    for (size_t i = 0; i < files.size(); ++i) {
+        struct stat info;
+        if (stat(files[i].c_str(), &info) == 0) {
+            looseSize += info.st_size;
+        }
+    }
+
+    std::string err;
+    if (!AssetPack::write(argv[1], files, err)) {
+        fprintf(stderr, "%s\n", err.c_str());
+        return 1;
+    }
+
+    struct stat info;
+    const double packSize = stat(argv[1], &info) == 0 ? static_cast<double>(info.st_size) : 0.0;
+    printf("%s: %lu files, %.1f KB packed into %.1f KB\n", argv[1], (unsigned long)files.size(),
+        looseSize / 1024.0, packSize / 1024.0);
+    return 0;
+}
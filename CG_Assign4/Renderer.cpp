@@ -3,53 +3,92 @@
 #include "glm/gtc/type_ptr.hpp"
 #include "glm/gtc/matrix_transform.hpp"
 #include "GLMUtil.hpp"
+#include "GLShaderLoader.hpp"
+#include "OcclusionCuller.hpp"
+#include "HorizonCuller.hpp"
+#include "GpuCuller.hpp"
+#include "ImpostorAtlas.hpp"
 #include <iostream>
 #include <algorithm>
 #include <sstream>
+#include <stdint.h>
 
 #define TAU (6.283185307179586f)
 #define DEG2RAD(x) ((x) / 360.0f * TAU)
 
 #define FOV 45.0f
+// Vertical field of view of the camera's projection
+#define PROJECTION_FOV 60.0f
 #define SHADOW_QUALITY 4
 
+// Distance over which the fog fades in before the render distance, must match fogFade in fshader.glsl
+#define FOG_FADE 10.0f
+
+// The number of nearest models whose occluders are drawn for occlusion culling
+#define MAX_OCCLUDING_MODELS 48
+
+#define GPU_CULL_SHADER "shaders/cull.c.glsl"
+// gpuModel's result for models the culler can't draw
+#define NOT_GPU_CULLED ((size_t)-1)
+#define IMPOSTOR_VERTEX_SHADER "shaders/impostor.v.glsl"
+#define IMPOSTOR_FRAGMENT_SHADER "shaders/impostor.f.glsl"
+
+// Query targets newer than the headers on some systems
+#ifndef GL_ANY_SAMPLES_PASSED
+#define GL_ANY_SAMPLES_PASSED 0x8C2F
+#endif
+#ifndef GL_ANY_SAMPLES_PASSED_CONSERVATIVE
+#define GL_ANY_SAMPLES_PASSED_CONSERVATIVE 0x8D6A
+#endif
+
+// Corners and triangles of the unit cube drawn for building bounds
+static const GLfloat proxyVertices[] = {
+    0, 0, 0, 1, 0, 0, 0, 1, 0, 1, 1, 0,
+    0, 0, 1, 1, 0, 1, 0, 1, 1, 1, 1, 1
+};
+static const GLuint proxyIndices[] = {
+    0, 2, 6, 0, 6, 4, 1, 5, 7, 1, 7, 3,
+    0, 4, 5, 0, 5, 1, 2, 3, 7, 2, 7, 6,
+    0, 1, 3, 0, 3, 2, 4, 6, 7, 4, 7, 5
+};
+
+// Attribute names bound to the ATTRIBUTE locations in every model variant
+static const char* const modelAttributes[] = { "v_coord", "v_normal", "v_texcoord", "v_tangent", "m_instance", NULL };
+
+// Maps the sun's clip space to shadow map texture coordinates and depths
+static const glm::mat4 biasMatrix(
+    0.5, 0.0, 0.0, 0.0,
+    0.0, 0.5, 0.0, 0.0,
+    0.0, 0.0, 0.5, 0.0,
+    0.5, 0.5, 0.5, 1.0
+    );
+
 Renderer::Renderer(GLsizei screenWidth, GLsizei screenHeight, float renderDistance, const Camera* camera, const Sun* sun,
-    GLuint modelProgram, GLuint shadowMapProgram, GLuint skyboxProgram) : screenWidth(screenWidth),
+    const std::string& modelVertexShader, const std::string& modelFragmentShader, GLuint shadowMapProgram,
+    GLuint instancedShadowMapProgram, GLuint depthProgram, GLuint skyboxProgram) : screenWidth(screenWidth),
     screenHeight(screenHeight), renderDistance(renderDistance), activeCamera(camera), sun(sun),
-    modelProgram(modelProgram), shadowMapProgram(shadowMapProgram), skyboxProgram(skyboxProgram) {
-
-    // Configure shaders
-    shader.in_coord = glGetAttribLocation(modelProgram, "v_coord");
-    shader.in_normal = glGetAttribLocation(modelProgram, "v_normal");
-    shader.in_texcoord = glGetAttribLocation(modelProgram, "v_texcoord");
-    shader.in_tangent = glGetAttribLocation(modelProgram, "v_tangent");
-
-    shader.uniform_m = glGetUniformLocation(modelProgram, "m");
-    shader.uniform_v = glGetUniformLocation(modelProgram, "v");
-    shader.uniform_proj = glGetUniformLocation(modelProgram, "proj");
-    shader.uniform_depthBiasMVP = glGetUniformLocation(modelProgram, "depthBiasMVP");
-    shader.uniform_normalMatrix = glGetUniformLocation(modelProgram, "normalMatrix");
-    shader.uniform_bumpMapFlag = glGetUniformLocation(modelProgram, "bumpMapFlag");
-
-    shader.uniform_materialAmbient = glGetUniformLocation(modelProgram, "material.ambient");
-    shader.uniform_materialDiffuse = glGetUniformLocation(modelProgram, "material.diffuse");
-    shader.uniform_materialSpecular = glGetUniformLocation(modelProgram, "material.specular");
-    shader.uniform_materialShine = glGetUniformLocation(modelProgram, "material.shine");
-    shader.uniform_materialOpacity = glGetUniformLocation(modelProgram, "material.opacity");
-
-    shader.uniform_sunPos = glGetUniformLocation(modelProgram, "sunPos");
-    shader.uniform_sunAmbient = glGetUniformLocation(modelProgram, "sunAmbient");
-    shader.uniform_sunDiffuse = glGetUniformLocation(modelProgram, "sunDiffuse");
-    shader.uniform_isDay = glGetUniformLocation(modelProgram, "isDay");
-
-    shader.uniform_normalMap = glGetUniformLocation(modelProgram, "normalMap");
-    shader.uniform_modelTexture = glGetUniformLocation(modelProgram, "modelTexture");
-    shader.uniform_shadowMap = glGetUniformLocation(modelProgram, "shadowMap");
-    shader.uniform_depthMVP = glGetUniformLocation(shadowMapProgram, "depthMVP");
+    modelVertexShader(modelVertexShader), modelFragmentShader(modelFragmentShader), shadowMapProgram(shadowMapProgram),
+    instancedShadowMapProgram(instancedShadowMapProgram), depthProgram(depthProgram), skyboxProgram(skyboxProgram),
+    depthPrePass(false), occlusionMode(OCCLUSION_HORIZON), occluded(0), frameNumber(0), queryHits(0),
+    queryMisses(0), gpuCuller(NULL), gpuCulling(false), simplified(0), dropped(0), impostorAtlas(NULL),
+    impostors(false), shadedSamplesPending(false),
+    lastShadedSamples(0) {
+
+    // Configure shaders, the model variants are built when they are first drawn with
+    for (int i = 0; i < NUM_MODEL_VARIANTS; ++i) {
+        modelPrograms[i].program = 0;
+    }
+    shader.in_coord = ATTRIBUTE_COORD;
+    shader.in_normal = ATTRIBUTE_NORMAL;
+    shader.in_texcoord = ATTRIBUTE_TEXCOORD;
+    shader.in_tangent = ATTRIBUTE_TANGENT;
 
-    shader.uniform_fogColor = glGetUniformLocation(modelProgram, "fogColor");
+    shader.uniform_depthMVP = glGetUniformLocation(shadowMapProgram, "depthMVP");
+    shader.uniform_instanced_depthVP = glGetUniformLocation(instancedShadowMapProgram, "depthVP");
 
-    shader.uniform_renderDistance = glGetUniformLocation(modelProgram, "renderDistance");
+    shader.uniform_depth_m = glGetUniformLocation(depthProgram, "m");
+    shader.uniform_depth_v = glGetUniformLocation(depthProgram, "v");
+    shader.uniform_depth_proj = glGetUniformLocation(depthProgram, "proj");
 
     shader.in_sb_coord = glGetAttribLocation(skyboxProgram, "v_coord");
     shader.in_sb_texcoord = glGetAttribLocation(skyboxProgram, "texcoord");
@@ -61,18 +100,7 @@ Renderer::Renderer(GLsizei screenWidth, GLsizei screenHeight, float renderDistan
     shader.uniform_sb_sunset_texture = glGetUniformLocation(skyboxProgram, "sunset_texture");
     shader.uniform_sb_sun_pos = glGetUniformLocation(skyboxProgram, "sun_position");
 
-    // Configure lights uniform
-    shader.uniform_numLights = glGetUniformLocation(modelProgram, "numLights");
-    shader.uniform_lampLight.direction = glGetUniformLocation(modelProgram, "lampLight.direction");
-    shader.uniform_lampLight.maxAngle = glGetUniformLocation(modelProgram, "lampLight.maxAngle");
-    shader.uniform_lampLight.ambient = glGetUniformLocation(modelProgram, "lampLight.ambient");
-    shader.uniform_lampLight.diffuse = glGetUniformLocation(modelProgram, "lampLight.diffuse");
-    for (int i = 0; i < MAX_LIGHTS; ++i) {
-        std::ostringstream light_ind;
-        light_ind << i;
-        const std::string shaderName = "lightPositions[" + light_ind.str() + "]";
-        shader.uniform_lightPositions[i] = glGetUniformLocation(modelProgram, (shaderName).c_str());
-    }
+    // Configure lights
     lampLight.direction = glm::vec3(0, -1, 0);
     lampLight.maxAngle = 1.4f;
     lampLight.ambient = glm::vec3(0.0);
@@ -110,12 +138,59 @@ Renderer::Renderer(GLsizei screenWidth, GLsizei screenHeight, float renderDistan
 
     // Initialize skybox to empty
     active_skybox = NULL;
+
+    glGenQueries(1, &shadedSamplesQuery);
+
+    // Queries that only report whether any sample passed can stop counting early, the conservative
+    // one (4.3) may also test at a coarser resolution
+    GLint majorVersion = 0, minorVersion = 0;
+    glGetIntegerv(GL_MAJOR_VERSION, &majorVersion);
+    glGetIntegerv(GL_MINOR_VERSION, &minorVersion);
+    const int version = majorVersion * 10 + minorVersion;
+    if (version >= 43) {
+        occlusionQueryTarget = GL_ANY_SAMPLES_PASSED_CONSERVATIVE;
+    } else if (version >= 33) {
+        occlusionQueryTarget = GL_ANY_SAMPLES_PASSED;
+    } else {
+        occlusionQueryTarget = GL_SAMPLES_PASSED;
+    }
+
+    // Configure the cube for building bounds, drawn with the depth program
+    glGenVertexArrays(1, &proxyVao);
+    glBindVertexArray(proxyVao);
+    glGenBuffers(2, proxyBuffers);
+    glBindBuffer(GL_ARRAY_BUFFER, proxyBuffers[0]);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(proxyVertices), proxyVertices, GL_STATIC_DRAW);
+    glEnableVertexAttribArray(ATTRIBUTE_COORD);
+    glVertexAttribPointer(ATTRIBUTE_COORD, 3, GL_FLOAT, GL_FALSE, 0, NULL);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, proxyBuffers[1]);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(proxyIndices), proxyIndices, GL_STATIC_DRAW);
+    glBindVertexArray(0);
+
+    occlusionCuller = new OcclusionCuller();
+    horizonCuller = new HorizonCuller();
+    if (GpuCuller::supported()) {
+        gpuCuller = new GpuCuller(GPU_CULL_SHADER);
+    }
 }
 
 Renderer::~Renderer() {
     // Free the framebuffer and texture
     glDeleteFramebuffers(1, &shadowMapFramebuffer);
     glDeleteTextures(1, &shadowMapTexture);
+    glDeleteQueries(1, &shadedSamplesQuery);
+    releaseOcclusionQueries();
+    glDeleteVertexArrays(1, &proxyVao);
+    glDeleteBuffers(2, proxyBuffers);
+    delete occlusionCuller;
+    delete horizonCuller;
+    delete gpuCuller;
+    delete impostorAtlas;
+    for (int i = 0; i < NUM_MODEL_VARIANTS; ++i) {
+        if (modelPrograms[i].program != 0) {
+            glDeleteProgram(modelPrograms[i].program);
+        }
+    }
 }
 
 void Renderer::resize(GLsizei width, GLsizei height) {
@@ -123,9 +198,195 @@ void Renderer::resize(GLsizei width, GLsizei height) {
     screenHeight = height;
 }
 
+// Transforms the corners of a bounding box
+static void boxCorners(const BoundingBox& box, const glm::mat4& transformation, glm::vec4 corners[8]) {
+    for (int i = 0; i < 8; ++i) {
+        const glm::vec4 corner(
+            (i & 1) ? box.maxVertex.x : box.minVertex.x,
+            (i & 2) ? box.maxVertex.y : box.minVertex.y,
+            (i & 4) ? box.maxVertex.z : box.minVertex.z,
+            1.0f);
+        corners[i] = transformation * corner;
+    }
+}
+
+float Renderer::lodDistance(float error) const {
+    // Pixels covered by the error at a distance of one
+    const float pixels = error * static_cast<float>(screenHeight) / (2.0f * tanf(DEG2RAD(PROJECTION_FOV) / 2.0f));
+    const float clear = pixels / LOD_PIXEL_ERROR;
+    const float fogStart = renderDistance - FOG_FADE;
+    if (clear <= fogStart) {
+        return clear;
+    }
+
+    // Past the start of the fog the error also fades by 1 - (distance - fogStart) / (FOG_FADE + 1),
+    // as in fshader.glsl. Outlines against the sky don't fade, but they only change near the
+    // render distance, and the GPU culler leaves out everything a unit past it anyway.
+    const float fogLength = FOG_FADE + 1.0f;
+    return pixels * (fogStart + fogLength) / (LOD_PIXEL_ERROR * fogLength + pixels);
+}
+
+float Renderer::boundsDistance(const ModelData* model, const glm::mat4& transformation) const {
+    glm::vec4 corners[8];
+    boxCorners(model->boundingBox, transformation, corners);
+    glm::vec3 minimum(corners[0]), maximum(corners[0]);
+    for (int i = 1; i < 8; ++i) {
+        minimum = glm::min(minimum, glm::vec3(corners[i]));
+        maximum = glm::max(maximum, glm::vec3(corners[i]));
+    }
+    const glm::vec3 camera = activeCamera->getPosition();
+    return glm::length(camera - glm::clamp(camera, minimum, maximum));
+}
+
+float Renderer::largestScale(const glm::mat4& transformation) {
+    return glm::max(glm::max(glm::length(glm::vec3(transformation[0])),
+        glm::length(glm::vec3(transformation[1]))), glm::length(glm::vec3(transformation[2])));
+}
+
+float Renderer::impostorDistance(const ModelData* model, const glm::mat4& transformation) const {
+    const float radius = impostorAtlas->radius(model);
+    if (radius == 0.0f) {
+        return -1.0f;
+    }
+    // The views are IMPOSTOR_FRAME_SIZE texels across the bounding sphere, which covers this many
+    // pixels at a distance of one
+    const float pixels = 2.0f * radius * largestScale(transformation) * static_cast<float>(screenHeight) /
+        (2.0f * tanf(DEG2RAD(PROJECTION_FOV) / 2.0f));
+    return pixels / (IMPOSTOR_FRAME_SIZE * IMPOSTOR_PIXELS_PER_TEXEL);
+}
+
+void Renderer::selectLod(const ModelData* model, const glm::mat4& transformation, const ModelData*& mesh,
+    const ModelData*& shadowMesh) {
+    // The nearest point of the model's bounds, and the largest scale, give its largest error on screen
+    const glm::vec3 camera = activeCamera->getPosition();
+    const float distance = boundsDistance(model, transformation);
+    const float scale = largestScale(transformation);
+
+    const InstanceKey key = { model, glm::vec3(transformation[3]) };
+    std::map<InstanceKey, LodState>::iterator found = lodStates.find(key);
+    if (found == lodStates.end()) {
+        const LodState state = { 0, 0 };
+        found = lodStates.insert(std::make_pair(key, state)).first;
+    }
+
+    // Level i is used past the switch distance of model->lods[i - 1]
+    size_t level = found->second.level;
+    while (level < model->lods.size() &&
+        distance > lodDistance(model->lods[level].error * scale) * (1.0f + LOD_HYSTERESIS)) {
+        level += 1;
+    }
+    while (level > 0 && distance < lodDistance(model->lods[level - 1].error * scale)) {
+        level -= 1;
+    }
+    found->second.level = level;
+    found->second.lastFrame = frameNumber;
+
+    // A roofless level is only drawn to the screen from below its top, and never to the shadow map
+    size_t cameraLevel = level;
+    while (cameraLevel > 0 && model->lods[cameraLevel - 1].roofless) {
+        const BoundingBox& bounds = model->lods[cameraLevel - 1].model->boundingBox;
+        if (camera.y < glm::vec3(transformation * glm::vec4(0.0f, bounds.maxVertex.y, 0.0f, 1.0f)).y) {
+            break;
+        }
+        cameraLevel -= 1;
+    }
+    size_t shadowLevel = cameraLevel;
+    while (shadowLevel > 0 && model->lods[shadowLevel - 1].roofless) {
+        shadowLevel -= 1;
+    }
+    mesh = cameraLevel == 0 ? model : model->lods[cameraLevel - 1].model;
+    shadowMesh = shadowLevel == 0 ? model : model->lods[shadowLevel - 1].model;
+}
+
 void Renderer::drawModel(const ModelData* model, glm::mat4 transformation) {
-    RenderData data = { model, transformation };
+    // Choose the variant features that depend on the whole model. Models without a bounding box
+    // (min == max) keep shadows and fog, as it's unknown where they are.
+    int variant = 0;
+    const bool hasBounds = model->boundingBox.minVertex != model->boundingBox.maxVertex;
+
+    // Models far enough for their impostor are only drawn as models to the shadow map, with their
+    // coarsest level that has a roof
+    if (impostors && hasBounds) {
+        const float switchDistance = impostorDistance(model, transformation);
+        if (switchDistance >= 0.0f && boundsDistance(model, transformation) > switchDistance) {
+            const ModelData* shadowMesh = model;
+            for (size_t i = model->lods.size(); i > 0; --i) {
+                if (model->lods[i - 1].model != NULL && !model->lods[i - 1].roofless) {
+                    shadowMesh = model->lods[i - 1].model;
+                    break;
+                }
+            }
+            const BoundingBox& bounds = model->boundingBox;
+            const glm::vec4 center = activeCamera->view() * transformation *
+                glm::vec4((bounds.minVertex + bounds.maxVertex) / 2.0f, 1.0f);
+            RenderData data = { model, NULL, shadowMesh, transformation, glm::length(glm::vec3(center)), true, 0,
+                true };
+            renderData.push_back(data);
+            return;
+        }
+    }
+
+    // Far models are drawn with their simplified levels, if they have any
+    const ModelData* mesh = model;
+    const ModelData* shadowMesh = model;
+    if (!model->lods.empty()) {
+        selectLod(model, transformation, mesh, shadowMesh);
+        if (mesh == NULL) {
+            dropped += 1;
+            return;
+        }
+        if (mesh != model) {
+            simplified += 1;
+        }
+    }
+
+    RenderData data = { model, mesh, shadowMesh, transformation, 0.0f, true, 0, false };
     renderData.push_back(data);
+
+    if (sun->position().y > 0.0f) {
+        variant |= MODEL_VARIANT_DAY;
+
+        // Only models inside the shadow map can be shadowed
+        glm::vec4 corners[8];
+        boxCorners(model->boundingBox, sun->viewProjection(activeCamera->getPosition()) * transformation, corners);
+        bool left = true, right = true, below = true, above = true;
+        for (int i = 0; i < 8; ++i) {
+            left = left && corners[i].x < -corners[i].w;
+            right = right && corners[i].x > corners[i].w;
+            below = below && corners[i].y < -corners[i].w;
+            above = above && corners[i].y > corners[i].w;
+        }
+        if (!hasBounds || !(left || right || below || above)) {
+            variant |= MODEL_VARIANT_SHADOWS;
+        }
+    }
+
+    // Models entirely nearer than where the fog starts don't need it
+    glm::vec4 corners[8];
+    boxCorners(model->boundingBox, activeCamera->view() * transformation, corners);
+    bool fogged = !hasBounds;
+    glm::vec3 center(0.0f);
+    for (int i = 0; i < 8; ++i) {
+        fogged = fogged || glm::length(glm::vec3(corners[i])) > renderDistance - FOG_FADE;
+        center += glm::vec3(corners[i]) / 8.0f;
+    }
+    if (fogged) {
+        variant |= MODEL_VARIANT_FOG;
+    }
+    renderData.back().distance = glm::length(center);
+
+    // Normal mapping is chosen per shape
+    for (size_t i = 0; i < mesh->shapes.size(); ++i) {
+        ShapeDraw draw = { renderData.size() - 1, i, variant, renderData.back().distance };
+        if (mesh->shapes[i].normalMapId != -1) {
+            draw.variant |= MODEL_VARIANT_NORMAL_MAP;
+        }
+        if (mesh->shapes[i].transparent) {
+            transparentQueue.push_back(draw);
+        } else {
+            opaqueQueues[draw.variant].push_back(draw);
+        }
+    }
 }
 
 void Renderer::drawModel(const ModelData* model, glm::vec3 position, glm::vec3 scale,
@@ -137,6 +398,16 @@ void Renderer::drawModel(const ModelData* model, glm::vec3 position, glm::vec3 s
     drawModel(model, transformation);
 }
 
+size_t Renderer::addStaticGroup() {
+    staticGroups.push_back(StaticGroup());
+    return staticGroups.size() - 1;
+}
+
+void Renderer::setStaticInstances(size_t group, const std::vector<StaticInstance>& instances) {
+    staticGroups[group].instances = instances;
+    updateStaticGroup(staticGroups[group]);
+}
+
 void Renderer::addLight(glm::vec3 position) {
     lights.push_back(position);
 }
@@ -154,6 +425,20 @@ struct LightSorter {
     }
 };
 
+struct NearerShape {
+    template <typename ShapeDraw>
+    bool operator()(const ShapeDraw& d1, const ShapeDraw& d2) const {
+        return d1.distance < d2.distance;
+    }
+};
+
+struct FartherShape {
+    template <typename ShapeDraw>
+    bool operator()(const ShapeDraw& d1, const ShapeDraw& d2) const {
+        return d1.distance > d2.distance;
+    }
+};
+
 bool inFOV(glm::vec3 pt, glm::vec3 origin, glm::vec3 viewDirection) {
     if (glm::length(pt - origin) < 5.0f) {
         return true;
@@ -165,8 +450,33 @@ bool inFOV(glm::vec3 pt, glm::vec3 origin, glm::vec3 viewDirection) {
 void Renderer::renderScene() {
     const glm::mat4 cameraView = activeCamera->view();
     const glm::mat4 sunViewProj = sun->viewProjection(activeCamera->getPosition());
+    const glm::mat4 cameraProj = glm::perspective(DEG2RAD(PROJECTION_FOV), aspectRatio(), 0.1f, 200.0f);
     const glm::vec3 sunPosition = sun->position();
 
+    // Static instances the GPU culler doesn't have are drawn as any other model
+    for (size_t i = 0; i < staticGroups.size(); ++i) {
+        const StaticGroup& group = staticGroups[i];
+        for (size_t j = 0; j < group.drawn.size(); ++j) {
+            const StaticInstance& instance = group.instances[group.drawn[j]];
+            drawModel(instance.model, instance.transformation);
+        }
+    }
+
+    // Models are fully fogged a unit past the render distance, so farther instances are culled.
+    // Levels and impostors switch where lodDistance and impostorDistance put them.
+    const bool instanced = gpuCulling && gpuCuller->numInstances() > 0;
+    if (instanced) {
+        GpuCuller::Falloff falloff;
+        falloff.pixelsPerUnit = static_cast<float>(screenHeight) / (2.0f * tanf(DEG2RAD(PROJECTION_FOV) / 2.0f));
+        falloff.pixelError = LOD_PIXEL_ERROR;
+        falloff.hysteresis = LOD_HYSTERESIS;
+        falloff.fogStart = renderDistance - FOG_FADE;
+        falloff.fogLength = FOG_FADE + 1.0f;
+        falloff.impostorPixels = impostors ? IMPOSTOR_FRAME_SIZE * IMPOSTOR_PIXELS_PER_TEXEL : 0.0f;
+        gpuCuller->cull(cameraProj * cameraView, activeCamera->getPosition(), renderDistance + 1.0f, sunViewProj,
+            falloff);
+    }
+
     //
     // Render shadowmap
     //
@@ -181,12 +491,22 @@ void Renderer::renderScene() {
             const glm::mat4 depthMVP = sunViewProj * renderData[i].transformation;
             glUniformMatrix4fv(shader.uniform_depthMVP, 1, GL_FALSE, glm::value_ptr(depthMVP));
 
-            const ModelData* model = renderData[i].model;
+            const ModelData* model = renderData[i].shadowMesh;
             glBindVertexArray(model->vao);
             for (size_t i = 0; i < model->shapes.size(); ++i) {
                 glDrawElements(GL_TRIANGLES, model->shapes[i].numElements, GL_UNSIGNED_INT, (GLvoid*)model->shapes[i].elementOffset);
             }
         }
+
+        // Every shape of the instances inside the sun's view, one multi-draw per model
+        if (instanced) {
+            glUseProgram(instancedShadowMapProgram);
+            glUniformMatrix4fv(shader.uniform_instanced_depthVP, 1, GL_FALSE, glm::value_ptr(sunViewProj));
+            for (size_t batch = 0; batch < gpuBatchModels.size(); ++batch) {
+                glBindVertexArray(gpuBatchModels[batch]->vao);
+                gpuCuller->drawShadows(batch);
+            }
+        }
     }
 
     //
@@ -238,6 +558,9 @@ void Renderer::renderScene() {
     if (active_skybox != NULL) {
         glUseProgram(skyboxProgram);
 
+        // The skybox fades into the clear color through its alpha
+        glEnable(GL_BLEND);
+
         // set appropriate projection for skybox
         glm::mat4 rotate = cameraView * glm::translate(glm::mat4(1), activeCamera->getPosition());
         glm::mat4 proj = glm::perspective(DEG2RAD(FOV), aspectRatio(), 0.1f, 100.0f);
@@ -282,123 +605,716 @@ void Renderer::renderScene() {
     //
     // Render models
     //
-    glUseProgram(modelProgram);
-    glUniform1f(shader.uniform_renderDistance, renderDistance);
+    FrameUniforms frame;
+    frame.cameraView = cameraView;
+    frame.cameraProj = cameraProj;
+    frame.sunViewProj = sunViewProj;
+    frame.fogColor = fogColor;
 
-    // Bind shadowmap
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, shadowMapTexture);
-    glUniform1i(shader.uniform_shadowMap, /*GL_TEXTURE*/0);
+    // Sort the lights so that the nearest lights are more likely to be shown
+    LightSorter sorter = { activeCamera->getPosition(), activeCamera->getDirection() };
+    std::sort(lights.begin(), lights.end(), sorter);
+    for (size_t i = 0; i < lights.size() && frame.viewLights.size() < MAX_LIGHTS; ++i) {
+        if (inFOV(lights[i], activeCamera->getPosition(), activeCamera->getDirection())) {
+            frame.viewLights.push_back(glm::vec3(cameraView * glm::vec4(lights[i], 1.0f)));
+        }
+    }
+
+    // The horizon assumes everything stands on the ground below the camera
+    occluded = 0;
+    if (occlusionMode == OCCLUSION_HORIZON && activeCamera->getPosition().y > 0.0f) {
+        cullBehindHorizon(frame);
+    }
+    else if (occlusionMode == OCCLUSION_QUERIES) {
+        collectOcclusionQueries(frame);
+    }
+    else if (occlusionMode != OCCLUSION_OFF) {
+        cullOccluded(frame);
+    }
+
+    // Opaque shapes front to back, so hidden fragments fail the depth test before shading
+    glDisable(GL_BLEND);
+    for (int variant = 0; variant < NUM_MODEL_VARIANTS; ++variant) {
+        std::stable_sort(opaqueQueues[variant].begin(), opaqueQueues[variant].end(), NearerShape());
+    }
+
+    // With the pre-pass, the depth buffer holds the nearest opaque surface before anything is lit,
+    // and only fragments at exactly that depth are shaded
+    if (depthPrePass) {
+        glUseProgram(depthProgram);
+        glUniformMatrix4fv(shader.uniform_depth_v, 1, GL_FALSE, glm::value_ptr(frame.cameraView));
+        glUniformMatrix4fv(shader.uniform_depth_proj, 1, GL_FALSE, glm::value_ptr(frame.cameraProj));
+        glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+        for (int variant = 0; variant < NUM_MODEL_VARIANTS; ++variant) {
+            drawDepth(opaqueQueues[variant]);
+        }
+        glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+        glDepthFunc(GL_EQUAL);
+        glDepthMask(GL_FALSE);
+    }
+
+    // Collect the previous measurement once it is ready, and only start a new one after that
+    if (shadedSamplesPending) {
+        GLuint available = GL_FALSE;
+        glGetQueryObjectuiv(shadedSamplesQuery, GL_QUERY_RESULT_AVAILABLE, &available);
+        if (available) {
+            glGetQueryObjectuiv(shadedSamplesQuery, GL_QUERY_RESULT, &lastShadedSamples);
+            shadedSamplesPending = false;
+        }
+    }
+    const bool measure = !shadedSamplesPending;
+    if (measure) {
+        glBeginQuery(GL_SAMPLES_PASSED, shadedSamplesQuery);
+    }
+    for (int variant = 0; variant < NUM_MODEL_VARIANTS; ++variant) {
+        drawShapes(opaqueQueues[variant], frame, DRAW_VISIBLE);
+    }
+
+    if (depthPrePass) {
+        glDepthFunc(GL_LESS);
+        glDepthMask(GL_TRUE);
+    }
+
+    // The instances and impostors aren't in the pre-pass, so they are drawn with the usual depth test
+    if (instanced) {
+        drawInstanced(frame);
+    }
+    if (impostorAtlas != NULL) {
+        drawImpostors(frame);
+    }
+    if (measure) {
+        glEndQuery(GL_SAMPLES_PASSED);
+        shadedSamplesPending = true;
+    }
+
+    // Test the buildings against everything drawn so far, then draw the hidden ones only if the
+    // GPU found their bounds visible. The GPU waits for the results, the CPU never does.
+    if (occlusionMode == OCCLUSION_QUERIES) {
+        issueOcclusionQueries(frame);
+        for (int variant = 0; variant < NUM_MODEL_VARIANTS; ++variant) {
+            drawShapes(opaqueQueues[variant], frame, DRAW_QUERIED);
+        }
+    }
+
+    // Transparent shapes back to front over them, without writing depth so they don't hide each other
+    if (!transparentQueue.empty()) {
+        std::stable_sort(transparentQueue.begin(), transparentQueue.end(), FartherShape());
+        glEnable(GL_BLEND);
+        glDepthMask(GL_FALSE);
+        drawShapes(transparentQueue, frame, DRAW_VISIBLE | DRAW_QUERIED);
+        glDepthMask(GL_TRUE);
+    }
+}
+
+void Renderer::drawShapes(const std::vector<ShapeDraw>& draws, const FrameUniforms& frame, int set) {
+    const ModelProgram* program = NULL;
+    int currentVariant = -1;
+    size_t currentObject = renderData.size();
+    for (size_t i = 0; i < draws.size(); ++i) {
+        const RenderData& data = renderData[draws[i].object];
+        const bool queried = !data.visible && data.occlusionQuery != 0;
+        if (!(data.visible && (set & DRAW_VISIBLE)) && !(queried && (set & DRAW_QUERIED))) {
+            continue;
+        }
+        if (draws[i].variant != currentVariant) {
+            currentVariant = draws[i].variant;
+            currentObject = renderData.size();
+            program = &modelProgram(currentVariant);
+            glUseProgram(program->program);
+            setFrameUniforms(*program, frame);
+        }
+
+        // Shapes of an object are queued together, only change the object's transformations between objects
+        const ModelData* model = renderData[draws[i].object].mesh;
+        if (draws[i].object != currentObject) {
+            currentObject = draws[i].object;
+
+            const glm::mat4 m = renderData[currentObject].transformation;
+            const glm::mat4 depthBiasMVP = biasMatrix * frame.sunViewProj * m;
+            glUniformMatrix4fv(program->uniform_depthBiasMVP, 1, GL_FALSE, glm::value_ptr(depthBiasMVP));
+            glUniformMatrix4fv(program->uniform_m, 1, GL_FALSE, glm::value_ptr(m));
+            const glm::mat3 normalMatrix = glm::transpose(glm::inverse(glm::mat3(frame.cameraView * m)));
+            glUniformMatrix3fv(program->uniform_normalMatrix, 1, GL_FALSE, glm::value_ptr(normalMatrix));
+
+            glBindVertexArray(model->vao);
+        }
+
+        // Render the shape
+        const ModelData::Shape& shape = model->shapes[draws[i].shape];
+        setShapeUniforms(*program, model, draws[i].shape, currentVariant);
+
+        if (queried) {
+            glBeginConditionalRender(data.occlusionQuery, GL_QUERY_WAIT);
+        }
+        glDrawElements(GL_TRIANGLES, shape.numElements, GL_UNSIGNED_INT, (GLvoid*)shape.elementOffset);
+        if (queried) {
+            glEndConditionalRender();
+        }
+    }
+}
+
+void Renderer::setShapeUniforms(const ModelProgram& program, const ModelData* model, size_t shapeIndex, int variant) {
+    const ModelData::Shape& shape = model->shapes[shapeIndex];
+    const Material& mat = shape.material;
+    glUniform3fv(program.uniform_materialAmbient, 1, glm::value_ptr(mat.ambient));
+    glUniform3fv(program.uniform_materialDiffuse, 1, glm::value_ptr(mat.diffuse));
+    glUniform3fv(program.uniform_materialSpecular, 1, glm::value_ptr(mat.specular));
+    glUniform1f(program.uniform_materialShine, mat.shininess);
+    glUniform1f(program.uniform_materialOpacity, mat.dissolve);
 
-    // Change the active texture (used later)
     glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, shape.textureId);
 
-    // Add lights
-    glUniform3fv(shader.uniform_sunPos, 1, glm::value_ptr(glm::vec3(cameraView * glm::vec4(sunPosition, 1.0f))));
-    glUniform3fv(shader.uniform_sunAmbient, 1, glm::value_ptr(sun->ambient()));
-    glUniform3fv(shader.uniform_sunDiffuse, 1, glm::value_ptr(sun->diffuse()));
-    glUniform3fv(shader.uniform_fogColor, 1, glm::value_ptr(fogColor));
-    glUniform1i(shader.uniform_isDay, (GLboolean)(sunPosition.y > 0.0f));
+    if (variant & MODEL_VARIANT_NORMAL_MAP) {
+        glActiveTexture(GL_TEXTURE2);
+        glBindTexture(GL_TEXTURE_2D, shape.normalMapId);
+    }
+}
 
-    // Sort the lights so that the nearest lights are more likely to be shown
-    LightSorter sorter = { activeCamera->getPosition(), activeCamera->getDirection() };
-    std::sort(lights.begin(), lights.end(), sorter);
+size_t Renderer::gpuModel(const ModelData* model) {
+    std::map<const ModelData*, size_t>::iterator found = gpuModels.find(model);
+    if (found != gpuModels.end()) {
+        return found->second;
+    }
 
-    glUniform3fv(shader.uniform_lampLight.direction, 1, glm::value_ptr(glm::vec3(cameraView * glm::vec4(lampLight.direction, 0.0))));
-    glUniform1f(shader.uniform_lampLight.maxAngle, lampLight.maxAngle);
-    glUniform3fv(shader.uniform_lampLight.ambient, 1, glm::value_ptr(lampLight.ambient));
-    glUniform3fv(shader.uniform_lampLight.diffuse, 1, glm::value_ptr(lampLight.diffuse));
+    // Transparent shapes are sorted on the CPU, and models without bounds can't be culled
+    bool drawable = model->boundingBox.minVertex != model->boundingBox.maxVertex;
+    for (size_t i = 0; i <= model->lods.size(); ++i) {
+        const ModelData* mesh = i == 0 ? model : model->lods[i - 1].model;
+        for (size_t j = 0; mesh != NULL && j < mesh->shapes.size(); ++j) {
+            drawable = drawable && !mesh->shapes[j].transparent;
+        }
+    }
+    if (!drawable) {
+        gpuModels[model] = NOT_GPU_CULLED;
+        return NOT_GPU_CULLED;
+    }
 
-    size_t shader_i = 0;
-    size_t light_i = 0;
-    while (shader_i < MAX_LIGHTS) {
-        while (light_i < lights.size() && !inFOV(lights[light_i], activeCamera->getPosition(), activeCamera->getDirection())) {
-            light_i += 1;
+    // One level has to serve both the camera and the shadow map, so roofless levels are drawn with
+    // the level below them, as the shadow map draws them in selectLod
+    std::vector<GpuCuller::Level> levels;
+    for (size_t i = 0; i <= model->lods.size(); ++i) {
+        size_t drawn = i;
+        while (drawn > 0 && model->lods[drawn - 1].roofless) {
+            drawn -= 1;
         }
-        if (light_i >= lights.size()) {
-            break;
+        const ModelData* mesh = drawn == 0 ? model : model->lods[drawn - 1].model;
+        const GpuCuller::Level level = { mesh != NULL ? static_cast<GLuint>(gpuBatch(mesh)) : GpuCuller::NO_BATCH,
+            i == 0 ? 0.0f : model->lods[i - 1].error };
+        levels.push_back(level);
+    }
+
+    // Far instances cast shadows with the coarsest level that has a roof, as in drawModel
+    GpuCuller::Impostor impostor = { 0.0f, glm::mat4(1.0f), 0.0f, GpuCuller::NO_BATCH };
+    if (impostorAtlas != NULL && impostorAtlas->radius(model) > 0.0f) {
+        const ModelData* shadowMesh = model;
+        for (size_t i = model->lods.size(); i > 0; --i) {
+            if (model->lods[i - 1].model != NULL && !model->lods[i - 1].roofless) {
+                shadowMesh = model->lods[i - 1].model;
+                break;
+            }
         }
+        impostor.radius = impostorAtlas->radius(model);
+        impostor.sphere = impostorAtlas->sphere(model);
+        impostor.layer = impostorAtlas->layer(model);
+        impostor.shadowBatch = static_cast<GLuint>(gpuBatch(shadowMesh));
+    }
 
-        glUniform3fv(shader.uniform_lightPositions[shader_i], 1, glm::value_ptr(glm::vec3(cameraView * glm::vec4(lights[light_i], 1.0f))));
+    const size_t culled = gpuCuller->addModel(model->boundingBox, levels, impostor);
+    gpuModels[model] = culled;
+    return culled;
+}
 
-        light_i += 1;
-        shader_i += 1;
+size_t Renderer::gpuBatch(const ModelData* mesh) {
+    std::map<const ModelData*, size_t>::iterator found = gpuBatches.find(mesh);
+    if (found != gpuBatches.end()) {
+        return found->second;
     }
-    glUniform1i(shader.uniform_numLights, shader_i);
 
-    const glm::mat4 cameraProj = glm::perspective(DEG2RAD(60.0f), aspectRatio(), 0.1f, 200.0f);
-    glUniformMatrix4fv(shader.uniform_proj, 1, GL_FALSE, glm::value_ptr(cameraProj));
+    // The camera draws each shape with its own material, the shadow map draws them all at once.
+    // The meshes have no transparent shapes, see gpuModel.
+    std::vector<GpuCuller::DrawRange> ranges;
+    for (size_t i = 0; i < mesh->shapes.size(); ++i) {
+        const ModelData::Shape& shape = mesh->shapes[i];
+        const GpuCuller::DrawRange range = { static_cast<GLuint>(shape.elementOffset / sizeof(GLuint)), shape.numElements };
+        ranges.push_back(range);
+    }
+    const size_t batch = gpuCuller->addBatch(ranges, ranges);
+    gpuBatches[mesh] = batch;
+    gpuBatchModels.push_back(mesh);
+
+    if (instancedVaos.insert(mesh->vao).second) {
+        glBindVertexArray(mesh->vao);
+        gpuCuller->bindInstanceAttributes(ATTRIBUTE_INSTANCE_TRANSFORM);
+        glBindVertexArray(0);
+    }
+    return batch;
+}
 
-    for (size_t i = 0; i < renderData.size(); ++i) {
-        // Calculate shadowmap transformations
-        const glm::mat4 biasMatrix(
-            0.5, 0.0, 0.0, 0.0,
-            0.0, 0.5, 0.0, 0.0,
-            0.0, 0.0, 0.5, 0.0,
-            0.5, 0.5, 0.5, 1.0
-            );
-        const glm::mat4 depthMVP = sunViewProj * renderData[i].transformation;
-        const glm::mat4 depthBiasMVP = biasMatrix * depthMVP;
-        glUniformMatrix4fv(shader.uniform_depthBiasMVP, 1, GL_FALSE, glm::value_ptr(depthBiasMVP));
-
-        // Calculate model transformations
-        const glm::mat4 m = renderData[i].transformation;
-        glUniformMatrix4fv(shader.uniform_m, 1, GL_FALSE, glm::value_ptr(m));
-        const glm::mat4 v = cameraView; 
-        glUniformMatrix4fv(shader.uniform_v, 1, GL_FALSE, glm::value_ptr(v));
-        const glm::mat3 normalMatrix = glm::transpose(glm::inverse(glm::mat3(v * m)));
-        glUniformMatrix3fv(shader.uniform_normalMatrix, 1, GL_FALSE, glm::value_ptr(normalMatrix));
-
-        // Render the model
-        const ModelData* model = renderData[i].model;
+void Renderer::updateStaticGroup(StaticGroup& group) {
+    std::map<InstanceKey, size_t> culled;
+    group.drawn.clear();
+    for (size_t i = 0; i < group.instances.size(); ++i) {
+        const StaticInstance& instance = group.instances[i];
+        const size_t model = gpuCulling ? gpuModel(instance.model) : NOT_GPU_CULLED;
+        const InstanceKey key = { instance.model, glm::vec3(instance.transformation[3]) };
+        if (model == NOT_GPU_CULLED || culled.count(key) > 0) {
+            group.drawn.push_back(i);
+            continue;
+        }
+
+        // Instances the culler already has keep their slots, and so their levels
+        std::map<InstanceKey, size_t>::iterator found = group.culled.find(key);
+        if (found != group.culled.end()) {
+            culled.insert(*found);
+            group.culled.erase(found);
+        }
+        else {
+            culled[key] = gpuCuller->addInstance(model, instance.transformation);
+        }
+    }
+    for (std::map<InstanceKey, size_t>::iterator i = group.culled.begin(); i != group.culled.end(); ++i) {
+        gpuCuller->removeInstance(i->second);
+    }
+    group.culled.swap(culled);
+}
+
+void Renderer::resetGpuCuller() {
+    if (gpuCuller == NULL) {
+        return;
+    }
+    gpuCuller->clear();
+    gpuModels.clear();
+    gpuBatches.clear();
+    gpuBatchModels.clear();
+    for (size_t i = 0; i < staticGroups.size(); ++i) {
+        staticGroups[i].culled.clear();
+        updateStaticGroup(staticGroups[i]);
+    }
+}
+
+void Renderer::drawInstanced(const FrameUniforms& frame) {
+    // Instances anywhere may be fogged or shadowed
+    int baseVariant = MODEL_VARIANT_INSTANCED | MODEL_VARIANT_FOG;
+    if (sun->position().y > 0.0f) {
+        baseVariant |= MODEL_VARIANT_DAY | MODEL_VARIANT_SHADOWS;
+    }
+
+    const ModelProgram* program = NULL;
+    int currentVariant = -1;
+    for (size_t batch = 0; batch < gpuBatchModels.size(); ++batch) {
+        const ModelData* model = gpuBatchModels[batch];
         glBindVertexArray(model->vao);
+
+        // A camera range for each shape, in order
         for (size_t i = 0; i < model->shapes.size(); ++i) {
-            Material mat = model->shapes[i].material;
-            glUniform3fv(shader.uniform_materialAmbient, 1, glm::value_ptr(mat.ambient));
-            glUniform3fv(shader.uniform_materialDiffuse, 1, glm::value_ptr(mat.diffuse));
-            glUniform3fv(shader.uniform_materialSpecular, 1, glm::value_ptr(mat.specular));
-            glUniform1f(shader.uniform_materialShine, mat.shininess);
+            const ModelData::Shape& shape = model->shapes[i];
+            const int variant = baseVariant | (shape.normalMapId != -1 ? MODEL_VARIANT_NORMAL_MAP : 0);
+            if (variant != currentVariant) {
+                currentVariant = variant;
+                program = &modelProgram(currentVariant);
+                glUseProgram(program->program);
+                setFrameUniforms(*program, frame);
+            }
+            setShapeUniforms(*program, model, i, currentVariant);
+            gpuCuller->drawCamera(batch, i);
+        }
+    }
+}
 
-            glActiveTexture(GL_TEXTURE1);
-            glBindTexture(GL_TEXTURE_2D, model->shapes[i].textureId);
-            glUniform1i(shader.uniform_modelTexture, /*GL_TEXTURE*/1);
-
-            if (model->shapes[i].normalMapId != -1) {
-                glActiveTexture(GL_TEXTURE2);
-                glBindTexture(GL_TEXTURE_2D, model->shapes[i].normalMapId);
-                glUniform1i(shader.uniform_normalMap, /*GL_TEXTURE*/2);
-                glUniform1i(shader.uniform_bumpMapFlag, (GLboolean)model->shapes[i].normalMapId);
-                glUniform1i(shader.uniform_bumpMapFlag, 1);
+void Renderer::drawImpostors(const FrameUniforms& frame) {
+    for (size_t i = 0; i < renderData.size(); ++i) {
+        if (renderData[i].impostor && renderData[i].visible) {
+            impostorAtlas->addInstance(renderData[i].model, renderData[i].transformation);
+        }
+    }
+    const bool culled = impostors && gpuCulling && gpuCuller->numInstances() > 0;
+    if (impostorAtlas->numInstances() == 0 && !culled) {
+        return;
+    }
+
+    // Impostors are far away, so always fogged, and shadowed whenever the sun is up
+    int variant = MODEL_VARIANT_IMPOSTOR | MODEL_VARIANT_FOG;
+    if (sun->position().y > 0.0f) {
+        variant |= MODEL_VARIANT_DAY | MODEL_VARIANT_SHADOWS;
+    }
+    const ModelProgram& program = modelProgram(variant);
+    glUseProgram(program.program);
+    setFrameUniforms(program, frame);
+
+    const Material& mat = impostorAtlas->material();
+    glUniform3fv(program.uniform_materialAmbient, 1, glm::value_ptr(mat.ambient));
+    glUniform3fv(program.uniform_materialDiffuse, 1, glm::value_ptr(mat.diffuse));
+    glUniform3fv(program.uniform_materialSpecular, 1, glm::value_ptr(mat.specular));
+    glUniform1f(program.uniform_materialShine, mat.shininess);
+    glUniform1f(program.uniform_materialOpacity, mat.dissolve);
+    impostorAtlas->bindTextures(GL_TEXTURE1, GL_TEXTURE2);
+    impostorAtlas->draw();
+    if (culled) {
+        impostorAtlas->draw(*gpuCuller);
+    }
+}
+
+// Orders models by distance, for picking the nearest occluders
+struct NearerModel {
+    const std::vector<float>* distances;
+
+    bool operator()(size_t m1, size_t m2) const {
+        return (*distances)[m1] < (*distances)[m2];
+    }
+};
+
+void Renderer::cullOccluded(const FrameUniforms& frame) {
+    occlusionCuller->begin(frame.cameraProj * frame.cameraView);
+
+    // Only the nearest models hide much, and each occluder costs rasterising its faces
+    std::vector<size_t> occluding;
+    std::vector<float> distances(renderData.size());
+    for (size_t i = 0; i < renderData.size(); ++i) {
+        distances[i] = renderData[i].distance;
+        if (!renderData[i].model->occluders.empty()) {
+            occluding.push_back(i);
+        }
+    }
+    NearerModel nearer = { &distances };
+    const size_t numOccluding = std::min(occluding.size(), static_cast<size_t>(MAX_OCCLUDING_MODELS));
+    std::partial_sort(occluding.begin(), occluding.begin() + numOccluding, occluding.end(), nearer);
+    for (size_t i = 0; i < numOccluding; ++i) {
+        const RenderData& data = renderData[occluding[i]];
+        for (size_t j = 0; j < data.model->occluders.size(); ++j) {
+            occlusionCuller->addOccluder(data.model->occluders[j], data.transformation);
+        }
+    }
+
+    // Models without bounds can't be tested and are always drawn
+    std::vector<size_t> tested;
+    for (size_t i = 0; i < renderData.size(); ++i) {
+        const BoundingBox& bounds = renderData[i].model->boundingBox;
+        if (bounds.minVertex != bounds.maxVertex) {
+            occlusionCuller->addObject(bounds, renderData[i].transformation);
+            tested.push_back(i);
+        }
+    }
+    occlusionCuller->cull();
+    for (size_t i = 0; i < tested.size(); ++i) {
+        renderData[tested[i]].visible = occlusionCuller->isVisible(i);
+    }
+    occluded = occlusionCuller->numHidden();
+}
+
+void Renderer::cullBehindHorizon(const FrameUniforms& frame) {
+    horizonCuller->begin(frame.cameraProj * frame.cameraView);
+
+    // Occluding models come in the order they were drawn, which the city makes nearest first, so
+    // sorting them each frame isn't needed. The rest hide nothing and are tested once the horizon is
+    // complete.
+    for (int pass = 0; pass < 2; ++pass) {
+        for (size_t i = 0; i < renderData.size(); ++i) {
+            RenderData& data = renderData[i];
+            const BoundingBox& bounds = data.model->boundingBox;
+            if (data.model->occluders.empty() == (pass == 0) || bounds.minVertex == bounds.maxVertex) {
+                continue;
+            }
+            data.visible = horizonCuller->isVisible(bounds, data.transformation);
+            if (!data.visible) {
+                occluded += 1;
+                continue;
+            }
+            // A hidden model's occluders are below the horizon already
+            for (size_t j = 0; j < data.model->occluders.size(); ++j) {
+                horizonCuller->addOccluder(data.model->occluders[j], data.transformation);
+            }
+        }
+    }
+}
+
+void Renderer::collectOcclusionQueries(const FrameUniforms& frame) {
+    queryHits = 0;
+    queryMisses = 0;
+
+    const glm::mat4 viewProjection = frame.cameraProj * frame.cameraView;
+    for (size_t i = 0; i < renderData.size(); ++i) {
+        RenderData& data = renderData[i];
+        const BoundingBox& bounds = data.model->boundingBox;
+        if (data.impostor || data.model->occluders.empty() || bounds.minVertex == bounds.maxVertex) {
+            continue;
+        }
+
+        // Bounds crossing the near plane are clipped, and can be hidden while the camera is inside
+        // them, so those buildings are always drawn
+        glm::vec4 corners[8];
+        boxCorners(bounds, viewProjection * data.transformation, corners);
+        bool clipped = false;
+        for (int j = 0; j < 8; ++j) {
+            clipped = clipped || corners[j].z < -corners[j].w;
+        }
+        if (clipped) {
+            continue;
+        }
+
+        const InstanceKey key = { data.model, glm::vec3(data.transformation[3]) };
+        std::map<InstanceKey, OcclusionQuery>::iterator found = occlusionQueries.find(key);
+        if (found == occlusionQueries.end()) {
+            // New buildings are drawn until their first result arrives
+            OcclusionQuery query;
+            glGenQueries(OCCLUSION_QUERY_RING, query.queries);
+            query.next = 0;
+            query.pending = 0;
+            query.visible = true;
+            found = occlusionQueries.insert(std::make_pair(key, query)).first;
+        }
+
+        // Queries finish in the order they were issued, so reading stops at the first that hasn't
+        OcclusionQuery& query = found->second;
+        while (query.pending > 0) {
+            const GLuint oldest = query.queries[(query.next + OCCLUSION_QUERY_RING - query.pending) % OCCLUSION_QUERY_RING];
+            GLuint available = GL_FALSE;
+            glGetQueryObjectuiv(oldest, GL_QUERY_RESULT_AVAILABLE, &available);
+            if (!available) {
+                break;
+            }
+            GLuint passed = 0;
+            glGetQueryObjectuiv(oldest, GL_QUERY_RESULT, &passed);
+            query.pending -= 1;
+            query.visible = passed != 0;
+            if (query.visible) {
+                queryHits += 1;
             } else {
-                glUniform1i(shader.uniform_bumpMapFlag, 0);
+                queryMisses += 1;
             }
+        }
+        query.lastFrame = frameNumber;
+        query.object = i;
+
+        // Without a free query there's nothing to draw a hidden building conditionally on
+        const bool spare = query.pending < OCCLUSION_QUERY_RING;
+        data.visible = query.visible || !spare;
+        data.occlusionQuery = spare ? query.queries[query.next] : 0;
+        if (!data.visible) {
+            occluded += 1;
+        }
+    }
 
-            glDrawElements(GL_TRIANGLES, model->shapes[i].numElements, GL_UNSIGNED_INT, (GLvoid*)model->shapes[i].elementOffset);
+    // Buildings that are no longer drawn lose their queries
+    std::map<InstanceKey, OcclusionQuery>::iterator query = occlusionQueries.begin();
+    while (query != occlusionQueries.end()) {
+        if (query->second.lastFrame != frameNumber) {
+            glDeleteQueries(OCCLUSION_QUERY_RING, query->second.queries);
+            occlusionQueries.erase(query++);
+        } else {
+            ++query;
         }
     }
 }
 
+void Renderer::issueOcclusionQueries(const FrameUniforms& frame) {
+    glUseProgram(depthProgram);
+    glUniformMatrix4fv(shader.uniform_depth_v, 1, GL_FALSE, glm::value_ptr(frame.cameraView));
+    glUniformMatrix4fv(shader.uniform_depth_proj, 1, GL_FALSE, glm::value_ptr(frame.cameraProj));
+    glBindVertexArray(proxyVao);
+
+    // The bounds are pulled slightly towards the camera so a building drawn already doesn't hide
+    // its own bounds, and both sides are drawn in case the winding is flipped by a transformation
+    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+    glDepthMask(GL_FALSE);
+    glDepthFunc(GL_LEQUAL);
+    glDisable(GL_CULL_FACE);
+    glEnable(GL_POLYGON_OFFSET_FILL);
+    glPolygonOffset(-1.0f, -1.0f);
+
+    // Queries still pending from earlier frames are left to finish, each building is tested again
+    // with the next query of its ring
+    std::map<InstanceKey, OcclusionQuery>::iterator query;
+    for (query = occlusionQueries.begin(); query != occlusionQueries.end(); ++query) {
+        if (query->second.pending == OCCLUSION_QUERY_RING) {
+            continue;
+        }
+        const RenderData& data = renderData[query->second.object];
+        const BoundingBox& bounds = data.model->boundingBox;
+        const glm::mat4 m = data.transformation * glm::translate(glm::mat4(1.0f), bounds.minVertex) *
+            glm::scale(glm::mat4(1.0f), bounds.maxVertex - bounds.minVertex);
+        glUniformMatrix4fv(shader.uniform_depth_m, 1, GL_FALSE, glm::value_ptr(m));
+
+        glBeginQuery(occlusionQueryTarget, query->second.queries[query->second.next]);
+        glDrawElements(GL_TRIANGLES, sizeof(proxyIndices) / sizeof(proxyIndices[0]), GL_UNSIGNED_INT, NULL);
+        glEndQuery(occlusionQueryTarget);
+        query->second.next = (query->second.next + 1) % OCCLUSION_QUERY_RING;
+        query->second.pending += 1;
+    }
+
+    glDisable(GL_POLYGON_OFFSET_FILL);
+    glEnable(GL_CULL_FACE);
+    glDepthFunc(GL_LESS);
+    glDepthMask(GL_TRUE);
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+    glBindVertexArray(0);
+}
+
+void Renderer::releaseOcclusionQueries() {
+    std::map<InstanceKey, OcclusionQuery>::iterator query;
+    for (query = occlusionQueries.begin(); query != occlusionQueries.end(); ++query) {
+        glDeleteQueries(OCCLUSION_QUERY_RING, query->second.queries);
+    }
+    occlusionQueries.clear();
+}
+
+void Renderer::drawDepth(const std::vector<ShapeDraw>& draws) {
+    size_t currentObject = renderData.size();
+    for (size_t i = 0; i < draws.size(); ++i) {
+        if (!renderData[draws[i].object].visible) {
+            continue;
+        }
+        const ModelData* model = renderData[draws[i].object].mesh;
+        if (draws[i].object != currentObject) {
+            currentObject = draws[i].object;
+            glUniformMatrix4fv(shader.uniform_depth_m, 1, GL_FALSE, glm::value_ptr(renderData[currentObject].transformation));
+            glBindVertexArray(model->vao);
+        }
+
+        const ModelData::Shape& shape = model->shapes[draws[i].shape];
+        glDrawElements(GL_TRIANGLES, shape.numElements, GL_UNSIGNED_INT, (GLvoid*)(uintptr_t)shape.elementOffset);
+    }
+}
+
+const Renderer::ModelProgram& Renderer::modelProgram(int variant) {
+    ModelProgram& program = modelPrograms[variant];
+    if (program.program != 0) {
+        return program;
+    }
+
+    std::string defines;
+    if (variant & MODEL_VARIANT_DAY) {
+        defines += "#define DAY\n";
+    }
+    if (variant & MODEL_VARIANT_NORMAL_MAP) {
+        defines += "#define NORMAL_MAP\n";
+    }
+    if (variant & MODEL_VARIANT_SHADOWS) {
+        defines += "#define SHADOWS\n";
+    }
+    if (variant & MODEL_VARIANT_FOG) {
+        defines += "#define FOG\n";
+    }
+    if (variant & MODEL_VARIANT_INSTANCED) {
+        defines += "#define INSTANCED\n";
+    }
+    const bool impostor = (variant & MODEL_VARIANT_IMPOSTOR) != 0;
+    const ProgramSource source = { impostor ? IMPOSTOR_VERTEX_SHADER : modelVertexShader.c_str(),
+        impostor ? IMPOSTOR_FRAGMENT_SHADER : modelFragmentShader.c_str(), defines.c_str(), modelAttributes };
+    initPrograms(&source, &program.program, 1);
+    const GLuint id = program.program;
+
+    program.uniform_m = glGetUniformLocation(id, "m");
+    program.uniform_v = glGetUniformLocation(id, "v");
+    program.uniform_proj = glGetUniformLocation(id, "proj");
+    program.uniform_depthBiasMVP = glGetUniformLocation(id, "depthBiasMVP");
+    program.uniform_depthBiasVP = glGetUniformLocation(id, "depthBiasVP");
+    program.uniform_normalMatrix = glGetUniformLocation(id, "normalMatrix");
+
+    program.uniform_materialAmbient = glGetUniformLocation(id, "material.ambient");
+    program.uniform_materialDiffuse = glGetUniformLocation(id, "material.diffuse");
+    program.uniform_materialSpecular = glGetUniformLocation(id, "material.specular");
+    program.uniform_materialShine = glGetUniformLocation(id, "material.shine");
+    program.uniform_materialOpacity = glGetUniformLocation(id, "material.opacity");
+
+    program.uniform_sunPos = glGetUniformLocation(id, "sunPos");
+    program.uniform_sunAmbient = glGetUniformLocation(id, "sunAmbient");
+    program.uniform_sunDiffuse = glGetUniformLocation(id, "sunDiffuse");
+
+    program.uniform_normalMap = glGetUniformLocation(id, "normalMap");
+    program.uniform_modelTexture = glGetUniformLocation(id, "modelTexture");
+    program.uniform_shadowMap = glGetUniformLocation(id, "shadowMap");
+
+    program.uniform_fogColor = glGetUniformLocation(id, "fogColor");
+
+    program.uniform_renderDistance = glGetUniformLocation(id, "renderDistance");
+
+    // Configure lights uniform
+    program.uniform_numLights = glGetUniformLocation(id, "numLights");
+    program.uniform_lampLight.direction = glGetUniformLocation(id, "lampLight.direction");
+    program.uniform_lampLight.maxAngle = glGetUniformLocation(id, "lampLight.maxAngle");
+    program.uniform_lampLight.ambient = glGetUniformLocation(id, "lampLight.ambient");
+    program.uniform_lampLight.diffuse = glGetUniformLocation(id, "lampLight.diffuse");
+    for (int i = 0; i < MAX_LIGHTS; ++i) {
+        std::ostringstream light_ind;
+        light_ind << i;
+        const std::string shaderName = "lightPositions[" + light_ind.str() + "]";
+        program.uniform_lightPositions[i] = glGetUniformLocation(id, (shaderName).c_str());
+    }
+    return program;
+}
+
+void Renderer::setFrameUniforms(const ModelProgram& program, const FrameUniforms& frame) {
+    const glm::mat4& cameraView = frame.cameraView;
+    const std::vector<glm::vec3>& viewLights = frame.viewLights;
+    glUniform1f(program.uniform_renderDistance, renderDistance);
+
+    // Bind shadowmap, the model's texture and normal map are bound to textures 1 and 2
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, shadowMapTexture);
+    glUniform1i(program.uniform_shadowMap, /*GL_TEXTURE*/0);
+    glUniform1i(program.uniform_modelTexture, /*GL_TEXTURE*/1);
+    glUniform1i(program.uniform_normalMap, /*GL_TEXTURE*/2);
+
+    // Add lights
+    glUniform3fv(program.uniform_sunPos, 1, glm::value_ptr(glm::vec3(cameraView * glm::vec4(sun->position(), 1.0f))));
+    glUniform3fv(program.uniform_sunAmbient, 1, glm::value_ptr(sun->ambient()));
+    glUniform3fv(program.uniform_sunDiffuse, 1, glm::value_ptr(sun->diffuse()));
+    glUniform3fv(program.uniform_fogColor, 1, glm::value_ptr(frame.fogColor));
+
+    glUniform3fv(program.uniform_lampLight.direction, 1, glm::value_ptr(glm::vec3(cameraView * glm::vec4(lampLight.direction, 0.0))));
+    glUniform1f(program.uniform_lampLight.maxAngle, lampLight.maxAngle);
+    glUniform3fv(program.uniform_lampLight.ambient, 1, glm::value_ptr(lampLight.ambient));
+    glUniform3fv(program.uniform_lampLight.diffuse, 1, glm::value_ptr(lampLight.diffuse));
+    for (size_t i = 0; i < viewLights.size(); ++i) {
+        glUniform3fv(program.uniform_lightPositions[i], 1, glm::value_ptr(viewLights[i]));
+    }
+    glUniform1i(program.uniform_numLights, viewLights.size());
+
+    glUniformMatrix4fv(program.uniform_v, 1, GL_FALSE, glm::value_ptr(cameraView));
+    glUniformMatrix4fv(program.uniform_proj, 1, GL_FALSE, glm::value_ptr(frame.cameraProj));
+
+    // Instanced variants multiply in each instance's transformation themselves
+    const glm::mat4 depthBiasVP = biasMatrix * frame.sunViewProj;
+    glUniformMatrix4fv(program.uniform_depthBiasVP, 1, GL_FALSE, glm::value_ptr(depthBiasVP));
+}
+
+// Whether a position is within an object's bounds, or close to the ground
+static bool collides(const BoundingBox& bounds, const glm::mat4& m, glm::vec3 position) {
+    // put bounding box in position
+    glm::vec4 boundingBoxMax = m * glm::vec4(bounds.maxVertex, 1);
+    glm::vec4 boundingBoxMin = m * glm::vec4(bounds.minVertex, 1);
+
+    float boundingOffset = 0.3f;
+    //Check if within box
+    if (boundingBoxMax.x + boundingOffset > position.x
+        && boundingBoxMin.x - boundingOffset < position.x
+        && boundingBoxMax.y + boundingOffset > position.y
+        && boundingBoxMin.y - boundingOffset < position.y
+        && boundingBoxMax.z + boundingOffset > position.z
+        && boundingBoxMin.z - boundingOffset < position.z) {
+        return true;
+    }
+    else if (position.y < 0.0 + boundingOffset) { // Special case for the ground
+        return true;
+    }
+    return false;
+}
+
 bool Renderer::checkCollision(glm::vec3 position) {
     for (size_t i = 0; i < renderData.size(); i++) {
-        // Position of object
-        const glm::mat4 m = renderData[i].transformation;
-
-        // put bounding box in position
-        glm::vec4 boundingBoxMax = m * glm::vec4(renderData[i].model->boundingBox.maxVertex, 1);
-        glm::vec4 boundingBoxMin = m * glm::vec4(renderData[i].model->boundingBox.minVertex, 1);
-
-        float boundingOffset = 0.3f;
-        //Check if within box
-        if (boundingBoxMax.x + boundingOffset > position.x
-            && boundingBoxMin.x - boundingOffset < position.x
-            && boundingBoxMax.y + boundingOffset > position.y
-            && boundingBoxMin.y - boundingOffset < position.y
-            && boundingBoxMax.z + boundingOffset > position.z
-            && boundingBoxMin.z - boundingOffset < position.z) {
+        if (collides(renderData[i].model->boundingBox, renderData[i].transformation, position)) {
             return true;
         }
-        else if (position.y < 0.0 + boundingOffset) { // Special case for the ground
-            return true;
+    }
+
+    // The instances the GPU culler draws aren't in renderData
+    for (size_t i = 0; i < staticGroups.size(); ++i) {
+        const StaticGroup& group = staticGroups[i];
+        for (size_t j = 0; !group.culled.empty() && j < group.instances.size(); ++j) {
+            if (collides(group.instances[j].model->boundingBox, group.instances[j].transformation, position)) {
+                return true;
+            }
         }
     }
     return false;
@@ -409,9 +1325,105 @@ void Renderer::attachSkybox(Skybox* skybox) {
     active_skybox = skybox;
 }
 
+void Renderer::toggleDepthPrePass() {
+    depthPrePass = !depthPrePass;
+}
+
+bool Renderer::depthPrePassEnabled() const {
+    return depthPrePass;
+}
+
+GLuint Renderer::shadedSamples() const {
+    return lastShadedSamples;
+}
+
+void Renderer::nextOcclusionMode() {
+    if (occlusionMode == OCCLUSION_QUERIES) {
+        releaseOcclusionQueries();
+    }
+    occlusionMode = static_cast<OcclusionMode>((occlusionMode + 1) % NUM_OCCLUSION_MODES);
+}
+
+OcclusionMode Renderer::getOcclusionMode() const {
+    return occlusionMode;
+}
+
+size_t Renderer::numOccluded() const {
+    return occluded;
+}
+
+size_t Renderer::occlusionQueryHits() const {
+    return queryHits;
+}
+
+size_t Renderer::occlusionQueryMisses() const {
+    return queryMisses;
+}
+
+size_t Renderer::numSimplified() const {
+    return simplified;
+}
+
+size_t Renderer::numDropped() const {
+    return dropped;
+}
+
+void Renderer::toggleGpuCulling() {
+    gpuCulling = gpuCuller != NULL && !gpuCulling;
+    resetGpuCuller();
+}
+
+bool Renderer::gpuCullingEnabled() const {
+    return gpuCulling;
+}
+
+void Renderer::bakeImpostors(const std::vector<const ModelData*>& models) {
+    if (!ImpostorAtlas::supported()) {
+        return;
+    }
+    delete impostorAtlas;
+    impostorAtlas = new ImpostorAtlas(models);
+    impostors = true;
+
+    // The culler's models are added again with their impostors
+    resetGpuCuller();
+}
+
+void Renderer::toggleImpostors() {
+    impostors = impostorAtlas != NULL && !impostors;
+}
+
+bool Renderer::impostorsEnabled() const {
+    return impostors;
+}
+
+size_t Renderer::numImpostors() const {
+    return impostorAtlas != NULL ? impostorAtlas->numInstances() : 0;
+}
+
 void Renderer::clear() {
+    // Instances that weren't drawn last frame start from the full model again when they return
+    std::map<InstanceKey, LodState>::iterator state = lodStates.begin();
+    while (state != lodStates.end()) {
+        if (state->second.lastFrame != frameNumber) {
+            lodStates.erase(state++);
+        } else {
+            ++state;
+        }
+    }
+    frameNumber += 1;
+    simplified = 0;
+    dropped = 0;
+
     renderData.clear();
+    for (int i = 0; i < NUM_MODEL_VARIANTS; ++i) {
+        opaqueQueues[i].clear();
+    }
+    transparentQueue.clear();
     lights.clear();
+    if (impostorAtlas != NULL) {
+        impostorAtlas->begin();
+    }
 }
 
 float Renderer::aspectRatio() const {
@@ -7,12 +7,59 @@
 #include "Skybox.hpp"
 #include "ModelData.hpp"
 #include "glm/mat4x4.hpp"
+#include <map>
+#include <set>
+
+class OcclusionCuller;
+class HorizonCuller;
+class GpuCuller;
+class ImpostorAtlas;
 
 class ModelData;
 class Skybox;
 
 #define MAX_LIGHTS 30
 
+// A model is drawn with a simplified level of detail once the difference covers fewer pixels than this
+#define LOD_PIXEL_ERROR 2.0f
+// A model only switches to a coarser level this fraction past the switch distance, so models near
+// it don't switch back and forth as the camera moves
+#define LOD_HYSTERESIS 0.1f
+// A model is drawn as its impostor once each texel of the impostor's views covers fewer pixels than this
+#define IMPOSTOR_PIXELS_PER_TEXEL 2.0f
+
+// Occlusion queries kept in flight for each building, so a new one can be issued every frame while
+// the GPU runs this many frames behind
+#define OCCLUSION_QUERY_RING 3
+
+// Model shader variants, each combination is a separate program built the first time it is drawn
+// with. The shaders compile out everything a variant doesn't need.
+#define MODEL_VARIANT_DAY 1
+#define MODEL_VARIANT_NORMAL_MAP 2
+#define MODEL_VARIANT_SHADOWS 4
+#define MODEL_VARIANT_FOG 8
+#define MODEL_VARIANT_INSTANCED 16
+// Built from impostor.v.glsl and impostor.f.glsl instead of the model shaders
+#define MODEL_VARIANT_IMPOSTOR 32
+#define NUM_MODEL_VARIANTS 64
+
+// Attribute locations bound in every model program, so one vertex array works with all of them
+#define ATTRIBUTE_COORD 0
+#define ATTRIBUTE_NORMAL 1
+#define ATTRIBUTE_TEXCOORD 2
+#define ATTRIBUTE_TANGENT 3
+// A mat4 taking locations 4 to 7, the transformations of GPU culled instances
+#define ATTRIBUTE_INSTANCE_TRANSFORM 4
+
+// How models hidden behind buildings are found
+enum OcclusionMode {
+    OCCLUSION_OFF,
+    OCCLUSION_DEPTH_BUFFER, // The nearest occluders rasterised into a small depth buffer
+    OCCLUSION_HORIZON, // Every visible occluder raises a per column skyline, in the order drawn
+    OCCLUSION_QUERIES, // Building bounds tested on the GPU, hidden buildings drawn conditionally
+    NUM_OCCLUSION_MODES
+};
+
 struct LightSource {
     glm::vec3 direction;
     float maxAngle;
@@ -32,10 +79,14 @@ public:
     /// <param name="renderDistance">The distance to draw.</param>
     /// <param name="camera">The renderer's active camera.</param>
     /// <param name="sun">The sun used for lighting and shadows.</param>
-    /// <param name="modelProgram">The id of the model shader program.</param>
+    /// <param name="modelVertexShader">The model vertex shader's filename, variants are built from it.</param>
+    /// <param name="modelFragmentShader">The model fragment shader's filename.</param>
     /// <param name="shadowMapProgram">The id of the shadowMap shader program.</param>
+    /// <param name="instancedShadowMapProgram">The id of the shadowMap shader program for GPU culled instances.</param>
+    /// <param name="depthProgram">The id of the depth pre-pass shader program.</param>
     Renderer(GLsizei screenWidth, GLsizei screenHeight, float renderDistance, const Camera* camera, const Sun* sun,
-        GLuint modelProgram, GLuint shadowMapProgram, GLuint skyboxProgram);
+        const std::string& modelVertexShader, const std::string& modelFragmentShader, GLuint shadowMapProgram,
+        GLuint instancedShadowMapProgram, GLuint depthProgram, GLuint skyboxProgram);
 
     /// <summary>
     /// Renderer destructor, frees the buffers and textures allocated by the renderer.
@@ -51,7 +102,9 @@ public:
     void resize(GLsizei width, GLsizei height);
 
     /// <summary>
-    /// Draw a model with a specific transformation
+    /// Draw a model with a specific transformation. The shader variant of each of its shapes is
+    /// chosen here, from the time of day, the shape's textures and where the model is. Models with
+    /// occluders should be drawn nearest first, for the horizon to hide the most.
     /// </summary>
     ///
     /// <param name="model">The model to draw.</param>
@@ -71,6 +124,30 @@ public:
         glm::vec3 scale = glm::vec3(1),
         glm::vec3 rotation = glm::vec3(0));
 
+    /// <summary>
+    /// A model instance that stays in place from frame to frame.
+    /// </summary>
+    struct StaticInstance {
+        const ModelData* model;
+        glm::mat4 transformation;
+    };
+
+    /// <summary>
+    /// Add an empty group of static instances.
+    /// </summary>
+    ///
+    /// <returns>The group's index, for setStaticInstances.</returns>
+    size_t addStaticGroup();
+
+    /// <summary>
+    /// Replace the instances of a group, which are then drawn every frame until they are replaced,
+    /// so they only need to be set when they change. With GPU culling the culler keeps the instances
+    /// of models with bounds and without transparent shapes, and the CPU does nothing for them per
+    /// frame. The others are drawn with drawModel, in the group's order. Instances are identified by
+    /// their model and position, those in both groups keep their level of detail.
+    /// </summary>
+    void setStaticInstances(size_t group, const std::vector<StaticInstance>& instances);
+
     /// <summary>
     /// Adds a light to the scene
     /// </summary>
@@ -98,18 +175,128 @@ public:
     /// <param="skybox">The skybox to be rendered</param>
     void attachSkybox(Skybox* skybox);
 
+    /// <summary>
+    /// Turns the depth pre-pass on or off. When on, opaque shapes are first drawn to the depth
+    /// buffer only, and then shaded with an equal depth test so each visible pixel is lit once.
+    /// </summary>
+    void toggleDepthPrePass();
+
+    bool depthPrePassEnabled() const;
+
+    /// <summary>
+    /// The number of samples the opaque shading pass wrote in the most recently measured frame,
+    /// which is the number of fragments the model shaders lit. Measured with an occlusion query
+    /// that is read a frame or more later, so it never stalls rendering.
+    /// </summary>
+    GLuint shadedSamples() const;
+
+    /// <summary>
+    /// Cycles occlusion culling between off, the depth buffer, the horizon and GPU queries. The
+    /// horizon is only used while the camera is above the ground, the depth buffer is used otherwise.
+    /// </summary>
+    void nextOcclusionMode();
+
+    OcclusionMode getOcclusionMode() const;
+
+    /// <summary>
+    /// The number of models occlusion culling hid in the last frame, including those off the screen.
+    /// </summary>
+    size_t numOccluded() const;
+
+    /// <summary>
+    /// The number of building bounds the GPU occlusion queries found visible (hits) and hidden
+    /// (misses), counting the results that arrived in the last frame.
+    /// </summary>
+    size_t occlusionQueryHits() const;
+
+    size_t occlusionQueryMisses() const;
+
+    /// <summary>
+    /// The number of models drawn with a simplified level of detail in the current frame, and the
+    /// number left out as too small to see.
+    /// </summary>
+    size_t numSimplified() const;
+
+    size_t numDropped() const;
+
+    /// <summary>
+    /// Turns GPU culling on or off. When on, the static instances the culler can keep have their
+    /// level of detail or impostor chosen, and are culled against the camera, the render distance
+    /// and the sun, by a compute shader, and are drawn with indirect draws. Occlusion culling and the
+    /// depth pre-pass only apply to the other models. Does nothing if the context is older than OpenGL 4.3.
+    /// </summary>
+    void toggleGpuCulling();
+
+    bool gpuCullingEnabled() const;
+
+    /// <summary>
+    /// Renders the views of octahedral impostors of the models. Once an instance of one of them is
+    /// far enough away that each texel of its views covers fewer than IMPOSTOR_PIXELS_PER_TEXEL
+    /// pixels, it is drawn as a quad showing them, and every such instance is drawn in one instanced draw.
+    /// Far instances still cast shadows with their coarsest level with a roof. Does nothing if the
+    /// context is older than OpenGL 3.3.
+    /// </summary>
+    ///
+    /// <param name="models">The models, which should all share their first shape's material.</param>
+    void bakeImpostors(const std::vector<const ModelData*>& models);
+
+    /// <summary>
+    /// Turns drawing far models as impostors on or off, if they have been baked.
+    /// </summary>
+    void toggleImpostors();
+
+    bool impostorsEnabled() const;
+
+    /// <summary>
+    /// The number of instances drawn as impostors in the current frame, after occlusion culling.
+    /// </summary>
+    size_t numImpostors() const;
+
     struct ShaderInfo {
         GLint in_coord;
         GLint in_normal;
         GLint in_texcoord;
         GLint in_tangent;
 
+        GLint uniform_depthMVP;
+        GLint uniform_instanced_depthVP;
+
+        GLint uniform_depth_m;
+        GLint uniform_depth_v;
+        GLint uniform_depth_proj;
+
+        GLint in_sb_coord;
+        GLint in_sb_texcoord;
+
+        GLint uniform_sb_rotate;
+        GLint uniform_sb_proj;
+        GLint uniform_sb_day_texture;
+        GLint uniform_sb_sunset_texture;
+        GLint uniform_sb_night_texture;
+        GLint uniform_sb_sun_pos;
+    } shader;
+
+    GLsizei screenWidth;
+    GLsizei screenHeight;
+    float renderDistance;
+
+    /// <summary>
+    /// The camera to draw from.
+    /// </summary>
+    const Camera* activeCamera;
+
+    const Sun* sun;
+private:
+    // A model shader variant and its uniforms, program is 0 until the variant is first used
+    struct ModelProgram {
+        GLuint program;
+
         GLint uniform_m;
         GLint uniform_v;
         GLint uniform_proj;
         GLint uniform_depthBiasMVP;
+        GLint uniform_depthBiasVP;
         GLint uniform_normalMatrix;
-        GLint uniform_bumpMapFlag;
 
         GLint uniform_materialAmbient;
         GLint uniform_materialDiffuse;
@@ -120,27 +307,15 @@ public:
         GLint uniform_sunPos;
         GLint uniform_sunAmbient;
         GLint uniform_sunDiffuse;
-        GLint uniform_isDay;
 
         GLint uniform_normalMap;
         GLint uniform_modelTexture;
         GLint uniform_shadowMap;
-        GLint uniform_depthMVP;
 
         GLint uniform_fogColor;
 
         GLint uniform_renderDistance;
 
-        GLint in_sb_coord;
-        GLint in_sb_texcoord;
-
-        GLint uniform_sb_rotate;
-        GLint uniform_sb_proj;
-        GLint uniform_sb_day_texture;
-        GLint uniform_sb_sunset_texture;
-        GLint uniform_sb_night_texture;
-        GLint uniform_sb_sun_pos;
-
         GLint uniform_numLights;
         struct LightSource {
             GLint direction;
@@ -150,24 +325,92 @@ public:
         };
         LightSource uniform_lampLight;
         GLint uniform_lightPositions[MAX_LIGHTS];
-    } shader;
-
-    GLsizei screenWidth;
-    GLsizei screenHeight;
-    float renderDistance;
-
-    /// <summary>
-    /// The camera to draw from.
-    /// </summary>
-    const Camera* activeCamera;
+    };
 
-    const Sun* sun;
-private:
-    GLuint modelProgram;
-    GLuint nightProgram;
+    std::string modelVertexShader;
+    std::string modelFragmentShader;
+    ModelProgram modelPrograms[NUM_MODEL_VARIANTS];
     GLuint shadowMapProgram;
+    GLuint instancedShadowMapProgram;
+    GLuint depthProgram;
     GLuint skyboxProgram;
 
+    bool depthPrePass;
+    OcclusionMode occlusionMode;
+    OcclusionCuller* occlusionCuller;
+    HorizonCuller* horizonCuller;
+    size_t occluded;
+
+    // A model instance is identified across frames by its model and position
+    struct InstanceKey {
+        const ModelData* model;
+        glm::vec3 position;
+
+        bool operator<(const InstanceKey& other) const {
+            if (model != other.model) return model < other.model;
+            if (position.x != other.position.x) return position.x < other.position.x;
+            if (position.y != other.position.y) return position.y < other.position.y;
+            return position.z < other.position.z;
+        }
+    };
+
+    // A building's ring of queries, and the last result read from them. The pending queries are the
+    // ones before next, issued and not read yet, the oldest first.
+    struct OcclusionQuery {
+        GLuint queries[OCCLUSION_QUERY_RING];
+        unsigned int next;
+        unsigned int pending;
+        bool visible;
+        unsigned long lastFrame;
+        // Index into renderData in lastFrame
+        size_t object;
+    };
+
+    GLenum occlusionQueryTarget;
+    std::map<InstanceKey, OcclusionQuery> occlusionQueries;
+    unsigned long frameNumber;
+    size_t queryHits;
+    size_t queryMisses;
+    // A unit cube, scaled to a building's bounds to test them
+    GLuint proxyVao;
+    GLuint proxyBuffers[2];
+    // NULL if the context can't run it
+    GpuCuller* gpuCuller;
+    bool gpuCulling;
+    // The culler's model for each model with static instances, and its batch for each level's mesh
+    // and the mesh of each batch
+    std::map<const ModelData*, size_t> gpuModels;
+    std::map<const ModelData*, size_t> gpuBatches;
+    std::vector<const ModelData*> gpuBatchModels;
+    // Vertex arrays whose instance attributes read the culler's transformations
+    std::set<GLuint> instancedVaos;
+
+    struct StaticGroup {
+        std::vector<StaticInstance> instances;
+        // The instances drawModel draws every frame, all of them unless the culler has them
+        std::vector<size_t> drawn;
+        // The culler's instance of each one it has
+        std::map<InstanceKey, size_t> culled;
+    };
+    std::vector<StaticGroup> staticGroups;
+
+    // The level of detail an instance was last drawn with, 0 for the full model
+    struct LodState {
+        size_t level;
+        unsigned long lastFrame;
+    };
+    std::map<InstanceKey, LodState> lodStates;
+    size_t simplified;
+    size_t dropped;
+
+    // NULL until bakeImpostors
+    ImpostorAtlas* impostorAtlas;
+    bool impostors;
+
+    GLuint shadedSamplesQuery;
+    bool shadedSamplesPending;
+    GLuint lastShadedSamples;
+
     GLuint shadowMapFramebuffer;
     GLuint shadowMapTexture;
 
@@ -176,12 +419,53 @@ private:
     glm::vec3 lightPos;
 
     struct RenderData {
+        // The full model, whose bounds and occluders are used for culling
         const ModelData* model;
+        // The levels of detail drawn to the screen and to the shadow map
+        const ModelData* mesh;
+        const ModelData* shadowMesh;
         glm::mat4 transformation;
+        // Distance of the model's bounds from the camera
+        float distance;
+        // Cleared by occlusion culling, hidden objects still cast shadows
+        bool visible;
+        // With GPU queries, the query hidden buildings are drawn conditionally on, or 0
+        GLuint occlusionQuery;
+        // Drawn by the impostor atlas, mesh is NULL and only its shadow is drawn as a model
+        bool impostor;
     };
 
     std::vector<RenderData> renderData;
 
+    // A shape to draw, as indices into renderData and the model's shapes, with the variant it is
+    // drawn with and its object's distance from the camera
+    struct ShapeDraw {
+        size_t object;
+        size_t shape;
+        int variant;
+        float distance;
+    };
+
+    // Opaque shapes for each model variant, drawn front to back without blending. Transparent
+    // shapes are drawn after them, back to front with blending.
+    std::vector<ShapeDraw> opaqueQueues[NUM_MODEL_VARIANTS];
+    std::vector<ShapeDraw> transparentQueue;
+
+    // Which objects drawShapes draws, visible ones and hidden ones with an occlusion query
+    enum DrawSet {
+        DRAW_VISIBLE = 1,
+        DRAW_QUERIED = 2
+    };
+
+    // Values set on every model program used in a frame
+    struct FrameUniforms {
+        glm::mat4 cameraView;
+        glm::mat4 cameraProj;
+        glm::mat4 sunViewProj;
+        glm::vec4 fogColor;
+        std::vector<glm::vec3> viewLights;
+    };
+
     LightSource lampLight;
     std::vector<glm::vec3> lights;
 
@@ -189,4 +473,128 @@ private:
     /// Computes the current aspect ratio of the renderer's screen.
     /// </summary>
     float aspectRatio() const;
+
+    /// <summary>
+    /// The distance past which a difference from the full model of a size covers fewer than
+    /// LOD_PIXEL_ERROR pixels, taking the fog over it into account.
+    /// </summary>
+    ///
+    /// <param name="error">The size of the difference, in world units.</param>
+    float lodDistance(float error) const;
+
+    /// <summary>
+    /// The distance from the camera to the nearest point of a model's bounds.
+    /// </summary>
+    float boundsDistance(const ModelData* model, const glm::mat4& transformation) const;
+
+    /// <summary>
+    /// The largest scale of a transformation along its axes.
+    /// </summary>
+    static float largestScale(const glm::mat4& transformation);
+
+    /// <summary>
+    /// The distance past which a texel of a model's impostor views covers fewer than
+    /// IMPOSTOR_PIXELS_PER_TEXEL pixels, or a negative distance if it has no impostor.
+    /// </summary>
+    float impostorDistance(const ModelData* model, const glm::mat4& transformation) const;
+
+    /// <summary>
+    /// Picks the levels of detail of an instance of a model with simplified levels, from its
+    /// distance and the level it was drawn with last frame.
+    /// </summary>
+    ///
+    /// <param name="mesh">Set to the level to draw to the screen, NULL if the model is too small to see.</param>
+    /// <param name="shadowMesh">Set to the level to draw to the shadow map, which always has a roof.</param>
+    void selectLod(const ModelData* model, const glm::mat4& transformation, const ModelData*& mesh,
+        const ModelData*& shadowMesh);
+
+    /// <summary>
+    /// Gets a model shader variant, building it and looking up its uniforms the first time.
+    /// </summary>
+    ///
+    /// <param name="variant">A combination of the MODEL_VARIANT flags.</param>
+    const ModelProgram& modelProgram(int variant);
+
+    /// <summary>
+    /// Sets the uniforms which are the same for every model drawn this frame.
+    /// </summary>
+    void setFrameUniforms(const ModelProgram& program, const FrameUniforms& frame);
+
+    /// <summary>
+    /// Draws queued shapes in order, binding each variant's program as it is reached.
+    /// Objects with an occlusion query are drawn with conditional rendering on it, so the GPU skips
+    /// them if their bounds were hidden.
+    /// </summary>
+    ///
+    /// <param name="set">A combination of the DrawSet flags.</param>
+    void drawShapes(const std::vector<ShapeDraw>& draws, const FrameUniforms& frame, int set);
+
+    /// <summary>
+    /// Sets a model shape's material and binds its textures.
+    /// </summary>
+    void setShapeUniforms(const ModelProgram& program, const ModelData* model, size_t shape, int variant);
+
+    /// <summary>
+    /// Gets the GPU culler's model for a model, adding it and the batches of its levels the first
+    /// time. Returns NOT_GPU_CULLED if the culler can't draw the model.
+    /// </summary>
+    size_t gpuModel(const ModelData* model);
+
+    /// <summary>
+    /// Gets the GPU culler's batch for a mesh, adding it the first time.
+    /// </summary>
+    size_t gpuBatch(const ModelData* mesh);
+
+    /// <summary>
+    /// Gives the culler a group's instances it can draw and doesn't have, removes the ones no longer
+    /// in the group, and lists the rest to draw with drawModel.
+    /// </summary>
+    void updateStaticGroup(StaticGroup& group);
+
+    /// <summary>
+    /// Removes everything from the culler, and gives it the static instances again if GPU culling is on.
+    /// </summary>
+    void resetGpuCuller();
+
+    /// <summary>
+    /// Draws the opaque shapes of the GPU culled instances the camera can see.
+    /// </summary>
+    void drawInstanced(const FrameUniforms& frame);
+
+    /// <summary>
+    /// Draws the visible impostors in one instanced draw.
+    /// </summary>
+    void drawImpostors(const FrameUniforms& frame);
+
+    /// <summary>
+    /// Draws queued shapes to the depth buffer only, with the depth program.
+    /// </summary>
+    void drawDepth(const std::vector<ShapeDraw>& draws);
+
+    /// <summary>
+    /// Marks the objects hidden behind the nearest occluders as not visible.
+    /// </summary>
+    void cullOccluded(const FrameUniforms& frame);
+
+    /// <summary>
+    /// Marks the objects below the skyline of nearer buildings as not visible. Models with occluders
+    /// are taken in the order they were drawn, without sorting, and the others are tested against
+    /// the finished skyline.
+    /// </summary>
+    void cullBehindHorizon(const FrameUniforms& frame);
+
+    /// <summary>
+    /// Reads the building queries that have finished, oldest first and without waiting for the
+    /// others, and marks the buildings hidden by their last result as not visible. Visible buildings
+    /// are drawn as usual, hidden ones are drawn conditionally on the query issued this frame.
+    /// </summary>
+    void collectOcclusionQueries(const FrameUniforms& frame);
+
+    /// <summary>
+    /// Tests the bounds of every building against this frame's depth buffer, with the next query
+    /// of its ring. A building whose ring is still all pending isn't tested, and is drawn as visible.
+    /// </summary>
+    void issueOcclusionQueries(const FrameUniforms& frame);
+
+    void releaseOcclusionQueries();
 };
@@ -111,6 +111,7 @@
 #include "pvr_helper.h"
 #include "pkm_helper.h"
 
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -155,6 +156,11 @@ int query_DXT_capability( void );
 #define SOIL_RGBA_S3TC_DXT1		0x83F1
 #define SOIL_RGBA_S3TC_DXT3		0x83F2
 #define SOIL_RGBA_S3TC_DXT5		0x83F3
+/*	for using RGTC (BC4 / BC5) compression	*/
+static int has_RGTC_capability = SOIL_CAPABILITY_UNKNOWN;
+int query_RGTC_capability( void );
+#define SOIL_RED_RGTC1			0x8DBB
+#define SOIL_RG_RGTC2			0x8DBD
 typedef void (APIENTRY * P_SOIL_GLCOMPRESSEDTEXIMAGE2DPROC) (GLenum target, GLint level, GLenum internalformat, GLsizei width, GLsizei height, GLint border, GLsizei imageSize, const GLvoid * data);
 static P_SOIL_GLCOMPRESSEDTEXIMAGE2DPROC soilGlCompressedTexImage2D = NULL;
 
@@ -164,6 +170,30 @@ static P_SOIL_GLGENERATEMIPMAPPROC soilGlGenerateMipmap = NULL;
 static int has_gen_mipmap_capability = SOIL_CAPABILITY_UNKNOWN;
 static int query_gen_mipmap_capability( void );
 
+/*	for decoding straight into a pixel buffer object	*/
+#define SOIL_PIXEL_UNPACK_BUFFER	0x88EC
+#define SOIL_STREAM_DRAW			0x88E0
+#define SOIL_WRITE_ONLY				0x88B9
+typedef void (APIENTRY *P_SOIL_GLGENBUFFERSPROC)(GLsizei n, GLuint *buffers);
+typedef void (APIENTRY *P_SOIL_GLBINDBUFFERPROC)(GLenum target, GLuint buffer);
+typedef void (APIENTRY *P_SOIL_GLBUFFERDATAPROC)(GLenum target, ptrdiff_t size, const GLvoid *data, GLenum usage);
+typedef GLvoid* (APIENTRY *P_SOIL_GLMAPBUFFERPROC)(GLenum target, GLenum access);
+typedef GLboolean (APIENTRY *P_SOIL_GLUNMAPBUFFERPROC)(GLenum target);
+static P_SOIL_GLGENBUFFERSPROC soilGlGenBuffers = NULL;
+static P_SOIL_GLBINDBUFFERPROC soilGlBindBuffer = NULL;
+static P_SOIL_GLBUFFERDATAPROC soilGlBufferData = NULL;
+static P_SOIL_GLMAPBUFFERPROC soilGlMapBuffer = NULL;
+static P_SOIL_GLUNMAPBUFFERPROC soilGlUnmapBuffer = NULL;
+/*	the one buffer is orphaned and refilled for every upload	*/
+static GLuint soil_upload_PBO = 0;
+static int has_PBO_capability = SOIL_CAPABILITY_UNKNOWN;
+static int query_PBO_capability( void );
+
+/*	the texture size limits only need asking for once	*/
+static int max_texture_size = SOIL_CAPABILITY_UNKNOWN;
+static int max_cube_map_texture_size = SOIL_CAPABILITY_UNKNOWN;
+static int query_max_texture_size( unsigned int texture_check_size_enum );
+
 static int has_PVR_capability = SOIL_CAPABILITY_UNKNOWN;
 int query_PVR_capability( void );
 static int has_BGRA8888_capability = SOIL_CAPABILITY_UNKNOWN;
@@ -354,6 +384,160 @@ unsigned int
 		unsigned int texture_check_size_enum
 	);
 
+/*	Loading without any of SOIL's intermediate passes: the image is
+	decoded (already flipped, with the channels the user asked for)
+	straight into a mapped pixel buffer object, or into a single
+	buffer when PBOs aren't there, and uploaded from that.	*/
+typedef struct
+{
+	unsigned int flags;
+	int max_dimension;
+	int max_supported_size;
+	int channels;
+	int mapped;
+	unsigned char *pixels;
+} SOIL_direct_upload;
+
+/*	anything that needs resizing has to go the long way round	*/
+static int
+	SOIL_internal_direct_upload_fits
+	(
+		const SOIL_direct_upload *upload,
+		int width, int height
+	)
+{
+	return !( (width > upload->max_supported_size) ||
+		(height > upload->max_supported_size) ||
+		((upload->max_dimension > 0) &&
+			((width > upload->max_dimension) || (height > upload->max_dimension))) ||
+		((upload->flags & SOIL_FLAG_POWER_OF_TWO) &&
+			(!SOIL_IS_POW2( width ) || !SOIL_IS_POW2( height ))) );
+}
+
+static unsigned char*
+	SOIL_internal_direct_upload_output
+	(
+		void *user,
+		int width, int height, int channels
+	)
+{
+	SOIL_direct_upload *upload = (SOIL_direct_upload*)user;
+	if( !SOIL_internal_direct_upload_fits( upload, width, height ) )
+	{
+		return NULL;
+	}
+	upload->channels = channels;
+	if( query_PBO_capability() == SOIL_CAPABILITY_PRESENT )
+	{
+		soilGlBindBuffer( SOIL_PIXEL_UNPACK_BUFFER, soil_upload_PBO );
+		soilGlBufferData( SOIL_PIXEL_UNPACK_BUFFER, width*height*channels, NULL, SOIL_STREAM_DRAW );
+		upload->pixels = (unsigned char*)soilGlMapBuffer( SOIL_PIXEL_UNPACK_BUFFER, SOIL_WRITE_ONLY );
+		if( NULL != upload->pixels )
+		{
+			upload->mapped = 1;
+			return upload->pixels;
+		}
+		soilGlBindBuffer( SOIL_PIXEL_UNPACK_BUFFER, 0 );
+	}
+	upload->pixels = (unsigned char*)malloc( width*height*channels );
+	return upload->pixels;
+}
+
+static unsigned int
+	SOIL_internal_direct_upload
+	(
+		const char *filename,
+		const unsigned char *const buffer,
+		int buffer_length,
+		int force_channels,
+		unsigned int reuse_texture_ID,
+		unsigned int flags,
+		int max_dimension
+	)
+{
+	SOIL_direct_upload upload;
+	int width, height, channels, loaded;
+	unsigned int tex_id = 0;
+	/*	only flipping and the GL's own MIPmaps can be done on the way	*/
+	if( flags & (SOIL_FLAG_MULTIPLY_ALPHA | SOIL_FLAG_NTSC_SAFE_RGB | SOIL_FLAG_CoCg_Y |
+			SOIL_FLAG_COMPRESS_TO_DXT | SOIL_FLAG_COMPRESS_TO_RGTC | SOIL_FLAG_TEXTURE_RECTANGLE) )
+	{
+		return 0;
+	}
+	if( query_NPOT_capability() == SOIL_CAPABILITY_NONE )
+	{
+		flags |= SOIL_FLAG_POWER_OF_TWO;
+	}
+	if( (flags & SOIL_FLAG_MIPMAPS) &&
+		!( (flags & SOIL_FLAG_GL_MIPMAPS) &&
+		   (query_gen_mipmap_capability() == SOIL_CAPABILITY_PRESENT) &&
+		   (query_NPOT_capability() == SOIL_CAPABILITY_PRESENT) ) )
+	{
+		/*	SOIL's own MIPmaps need the pixels in memory	*/
+		return 0;
+	}
+	upload.flags = flags;
+	upload.max_dimension = max_dimension;
+	upload.max_supported_size = query_max_texture_size( GL_MAX_TEXTURE_SIZE );
+	upload.channels = 0;
+	upload.mapped = 0;
+	upload.pixels = NULL;
+	/*	check the size from the header first, so an image that can't
+		go this way isn't decoded twice	*/
+	if( NULL != filename )
+	{
+		loaded = stbi_info_max_dimension( filename, &width, &height, &channels, max_dimension );
+	} else
+	{
+		loaded = stbi_info_from_memory_max_dimension( buffer, buffer_length, &width, &height, &channels,
+				max_dimension );
+	}
+	if( !loaded || !SOIL_internal_direct_upload_fits( &upload, width, height ) )
+	{
+		return 0;
+	}
+	if( NULL != filename )
+	{
+		loaded = stbi_load_into( filename, &width, &height, &channels,
+				force_channels, max_dimension, flags & SOIL_FLAG_INVERT_Y,
+				SOIL_internal_direct_upload_output, &upload );
+	} else
+	{
+		loaded = stbi_load_from_memory_into( buffer, buffer_length, &width, &height, &channels,
+				force_channels, max_dimension, flags & SOIL_FLAG_INVERT_Y,
+				SOIL_internal_direct_upload_output, &upload );
+	}
+	if( upload.mapped )
+	{
+		/*	the pixels now live in the PBO, and GL reads them from offset 0	*/
+		if( !soilGlUnmapBuffer( SOIL_PIXEL_UNPACK_BUFFER ) )
+		{
+			loaded = 0;
+		}
+		if( loaded )
+		{
+			tex_id = SOIL_internal_create_OGL_texture(
+					NULL, &width, &height, upload.channels,
+					reuse_texture_ID, flags & ~SOIL_FLAG_INVERT_Y,
+					GL_TEXTURE_2D, GL_TEXTURE_2D,
+					GL_MAX_TEXTURE_SIZE );
+		}
+		soilGlBindBuffer( SOIL_PIXEL_UNPACK_BUFFER, 0 );
+	} else
+	{
+		if( loaded && (NULL != upload.pixels) )
+		{
+			tex_id = SOIL_internal_create_OGL_texture(
+					upload.pixels, &width, &height, upload.channels,
+					reuse_texture_ID, flags & ~SOIL_FLAG_INVERT_Y,
+					GL_TEXTURE_2D, GL_TEXTURE_2D,
+					GL_MAX_TEXTURE_SIZE );
+		}
+		SOIL_free_image_data( upload.pixels );
+	}
+	return tex_id;
+}
+
 /*	and the code magic begins here [8^)	*/
 unsigned int
 	SOIL_load_OGL_texture
@@ -363,6 +547,19 @@ unsigned int
 		unsigned int reuse_texture_ID,
 		unsigned int flags
 	)
+{
+	return SOIL_load_OGL_texture_max_dimension( filename, force_channels, reuse_texture_ID, flags, 0 );
+}
+
+unsigned int
+	SOIL_load_OGL_texture_max_dimension
+	(
+		const char *filename,
+		int force_channels,
+		unsigned int reuse_texture_ID,
+		unsigned int flags,
+		int max_dimension
+	)
 {
 	/*	variables	*/
 	unsigned char* img;
@@ -403,8 +600,16 @@ unsigned int
 		}
 	}
 
+	/*	decode straight into the upload buffer if nothing else needs doing	*/
+	tex_id = SOIL_internal_direct_upload( filename, NULL, 0,
+			force_channels, reuse_texture_ID, flags, max_dimension );
+	if( tex_id )
+	{
+		return tex_id;
+	}
+
 	/*	try to load the image	*/
-	img = SOIL_load_image( filename, &width, &height, &channels, force_channels );
+	img = SOIL_load_image_max_dimension( filename, &width, &height, &channels, force_channels, max_dimension );
 	/*	channels holds the original number of channels, which may have been forced	*/
 	if( (force_channels >= 1) && (force_channels <= 4) )
 	{
@@ -495,6 +700,21 @@ unsigned int
 		unsigned int reuse_texture_ID,
 		unsigned int flags
 	)
+{
+	return SOIL_load_OGL_texture_from_memory_max_dimension( buffer, buffer_length,
+			force_channels, reuse_texture_ID, flags, 0 );
+}
+
+unsigned int
+	SOIL_load_OGL_texture_from_memory_max_dimension
+	(
+		const unsigned char *const buffer,
+		int buffer_length,
+		int force_channels,
+		unsigned int reuse_texture_ID,
+		unsigned int flags,
+		int max_dimension
+	)
 {
 	/*	variables	*/
 	unsigned char* img;
@@ -541,11 +761,19 @@ unsigned int
 		}
 	}
 
+	/*	decode straight into the upload buffer if nothing else needs doing	*/
+	tex_id = SOIL_internal_direct_upload( NULL, buffer, buffer_length,
+			force_channels, reuse_texture_ID, flags, max_dimension );
+	if( tex_id )
+	{
+		return tex_id;
+	}
+
 	/*	try to load the image	*/
-	img = SOIL_load_image_from_memory(
+	img = SOIL_load_image_from_memory_max_dimension(
 					buffer, buffer_length,
 					&width, &height, &channels,
-					force_channels );
+					force_channels, max_dimension );
 	/*	channels holds the original number of channels, which may have been forced	*/
 	if( (force_channels >= 1) && (force_channels <= 4) )
 	{
@@ -1313,6 +1541,25 @@ void check_for_GL_errors( const char *calling_location )
 }
 #endif
 
+/*	compress an image into the block format picked as the internal format	*/
+static unsigned char* compress_image(const unsigned char *const img,
+		int width, int height, int channels,
+		unsigned int internal_texture_format,
+		int *out_size)
+{
+	switch( internal_texture_format )
+	{
+	case SOIL_RED_RGTC1:
+		return convert_image_to_BC4( img, width, height, channels, out_size );
+	case SOIL_RG_RGTC2:
+		return convert_image_to_BC5( img, width, height, channels, out_size );
+	case SOIL_RGB_S3TC_DXT1:
+		return convert_image_to_DXT1( img, width, height, channels, out_size );
+	default:
+		return convert_image_to_DXT5( img, width, height, channels, out_size );
+	}
+}
+
 static void createMipmaps(const unsigned char *const img,
 		int width, int height, int channels,
 		unsigned int flags,
@@ -1328,35 +1575,33 @@ static void createMipmaps(const unsigned char *const img,
 	else
 	{
 		int MIPlevel = 1;
-		int MIPwidth = (width+1) / 2;
-		int MIPheight = (height+1) / 2;
-		unsigned char *resampled = (unsigned char*)malloc( channels*MIPwidth*MIPheight );
-
-		while( ((1<<MIPlevel) <= width) || ((1<<MIPlevel) <= height) )
-		{
+		int MIPwidth = width > 1 ? width / 2 : 1;
+		int MIPheight = height > 1 ? height / 2 : 1;
+		/*	each level is a 2x2 reduction of the one before, ping-ponging
+			between two buffers, rather than an ever larger box filter of
+			the full size image	*/
+		const int level_size = channels*MIPwidth*MIPheight;
+		unsigned char *levels = (unsigned char*)malloc( 2*level_size );
+		const unsigned char *previous = img;
+		int previous_width = width, previous_height = height;
+
+		while( (NULL != levels) && (((1<<MIPlevel) <= width) || ((1<<MIPlevel) <= height)) )
+		{
+			unsigned char *resampled = levels + (MIPlevel & 1)*level_size;
 			/*	do this MIPmap level	*/
 			mipmap_image(
-					img, width, height, channels,
+					previous, previous_width, previous_height, channels,
 					resampled,
-					(1 << MIPlevel), (1 << MIPlevel) );
+					previous_width > 1 ? 2 : 1, previous_height > 1 ? 2 : 1 );
 
 			/*  upload the MIPmaps	*/
 			if( DXT_mode == SOIL_CAPABILITY_PRESENT )
 			{
-				/*	user wants me to do the DXT conversion!	*/
+				/*	user wants me to do the DXT or RGTC conversion!	*/
 				int DDS_size;
-				unsigned char *DDS_data = NULL;
-				if( (channels & 1) == 1 )
-				{
-					/*	RGB, use DXT1	*/
-					DDS_data = convert_image_to_DXT1(
-							resampled, MIPwidth, MIPheight, channels, &DDS_size );
-				} else
-				{
-					/*	RGBA, use DXT5	*/
-					DDS_data = convert_image_to_DXT5(
-							resampled, MIPwidth, MIPheight, channels, &DDS_size );
-				}
+				unsigned char *DDS_data = compress_image(
+						resampled, MIPwidth, MIPheight, channels,
+						internal_texture_format, &DDS_size );
 				if( DDS_data )
 				{
 					soilGlCompressedTexImage2D(
@@ -1384,12 +1629,15 @@ static void createMipmaps(const unsigned char *const img,
 				check_for_GL_errors( "glTexImage2D" );
 			}
 			/*	prep for the next level	*/
+			previous = resampled;
+			previous_width = MIPwidth;
+			previous_height = MIPheight;
 			++MIPlevel;
-			MIPwidth = (MIPwidth + 1) / 2;
-			MIPheight = (MIPheight + 1) / 2;
+			MIPwidth = MIPwidth > 1 ? MIPwidth / 2 : 1;
+			MIPheight = MIPheight > 1 ? MIPheight / 2 : 1;
 		}
 
-		SOIL_free_image_data( resampled );
+		SOIL_free_image_data( levels );
 	}
 }
 
@@ -1418,7 +1666,7 @@ unsigned int
 
 	/*	how large of a texture can this OpenGL implementation handle?	*/
 	/*	texture_check_size_enum will be GL_MAX_TEXTURE_SIZE or SOIL_MAX_CUBE_MAP_TEXTURE_SIZE	*/
-	glGetIntegerv( texture_check_size_enum, &max_supported_size );
+	max_supported_size = query_max_texture_size( texture_check_size_enum );
 
 	/*	If the user wants to use the texture rectangle I kill a few flags	*/
 	if( flags & SOIL_FLAG_TEXTURE_RECTANGLE )
@@ -1562,8 +1810,8 @@ unsigned int
 	/*	now, if it is too large...	*/
 	if( (iwidth > max_supported_size) || (iheight > max_supported_size) )
 	{
-		/*	I've already made it a power of two, so simply use the MIPmapping
-			code to reduce its size to the allowable maximum.	*/
+		/*	I've already made it a power of two, so a box filter
+			reduces it to the allowable maximum.	*/
 		unsigned char *resampled;
 		int reduce_block_x = 1, reduce_block_y = 1;
 		int new_width, new_height;
@@ -1579,8 +1827,8 @@ unsigned int
 		new_height = iheight / reduce_block_y;
 		resampled = (unsigned char*)malloc( channels*new_width*new_height );
 		/*	perform the actual reduction	*/
-		mipmap_image( NULL != img ? img : data, iwidth, iheight, channels,
-						resampled, reduce_block_x, reduce_block_y );
+		resample_image( NULL != img ? img : data, iwidth, iheight, channels,
+						resampled, new_width, new_height, SOIL_RESAMPLE_BOX );
 		/*	nuke the old guy, then point it at the new guy	*/
 		SOIL_free_image_data( img );
 		img = resampled;
@@ -1641,6 +1889,16 @@ unsigned int
 				}
 			}
 		}
+		/*	or as RGTC, which keeps only the first one or two channels?	*/
+		if( (flags & SOIL_FLAG_COMPRESS_TO_RGTC) && (DXT_mode != SOIL_CAPABILITY_PRESENT) )
+		{
+			DXT_mode = query_RGTC_capability();
+			if( DXT_mode == SOIL_CAPABILITY_PRESENT )
+			{
+				/*	1 channel = BC4, otherwise BC5	*/
+				internal_texture_format = (channels == 1) ? SOIL_RED_RGTC1 : SOIL_RG_RGTC2;
+			}
+		}
 		/*  bind an OpenGL texture ID	*/
 		glBindTexture( opengl_texture_type, tex_id );
 		check_for_GL_errors( "glBindTexture" );
@@ -1655,18 +1913,10 @@ unsigned int
 		/*  upload the main image	*/
 		if( DXT_mode == SOIL_CAPABILITY_PRESENT )
 		{
-			/*	user wants me to do the DXT conversion!	*/
+			/*	user wants me to do the DXT or RGTC conversion!	*/
 			int DDS_size;
-			unsigned char *DDS_data = NULL;
-			if( (channels & 1) == 1 )
-			{
-				/*	RGB, use DXT1	*/
-				DDS_data = convert_image_to_DXT1( NULL != img ? img : data, iwidth, iheight, channels, &DDS_size );
-			} else
-			{
-				/*	RGBA, use DXT5	*/
-				DDS_data = convert_image_to_DXT5( NULL != img ? img : data, iwidth, iheight, channels, &DDS_size );
-			}
+			unsigned char *DDS_data = compress_image( NULL != img ? img : data, iwidth, iheight, channels,
+					internal_texture_format, &DDS_size );
 			if( DDS_data )
 			{
 				soilGlCompressedTexImage2D(
@@ -1835,6 +2085,65 @@ unsigned char*
 	return result;
 }
 
+/*	halve anything still too big (other formats, or more than 1/8 needed)	*/
+static unsigned char*
+	SOIL_internal_reduce_image
+	(
+		unsigned char *img,
+		int *width, int *height, int channels,
+		int max_dimension
+	)
+{
+	while( (*width > max_dimension) || (*height > max_dimension) )
+	{
+		int new_width = *width > 1 ? *width / 2 : 1;
+		int new_height = *height > 1 ? *height / 2 : 1;
+		unsigned char *resampled = (unsigned char*)malloc( new_width*new_height*channels );
+		if( NULL == resampled )
+		{
+			break;
+		}
+		mipmap_image( img, *width, *height, channels,
+				resampled,
+				*width > 1 ? 2 : 1, *height > 1 ? 2 : 1 );
+		SOIL_free_image_data( img );
+		img = resampled;
+		*width = new_width;
+		*height = new_height;
+	}
+	return img;
+}
+
+unsigned char*
+	SOIL_load_image_max_dimension
+	(
+		const char *filename,
+		int *width, int *height, int *channels,
+		int force_channels,
+		int max_dimension
+	)
+{
+	unsigned char *result;
+	int data_channels;
+	if( max_dimension <= 0 )
+	{
+		return SOIL_load_image( filename, width, height, channels, force_channels );
+	}
+	/*	JPEGs are decoded straight to 1/2, 1/4 or 1/8 size,
+		so usually there is little or nothing left to do	*/
+	result = stbi_load_max_dimension( filename,
+			width, height, channels, force_channels, max_dimension );
+	if( result == NULL )
+	{
+		result_string_pointer = stbi_failure_reason();
+		return NULL;
+	}
+	data_channels = force_channels ? force_channels : *channels;
+	result = SOIL_internal_reduce_image( result, width, height, data_channels, max_dimension );
+	result_string_pointer = "Image loaded";
+	return result;
+}
+
 unsigned char*
 	SOIL_load_image_from_memory
 	(
@@ -1858,6 +2167,34 @@ unsigned char*
 	return result;
 }
 
+unsigned char*
+	SOIL_load_image_from_memory_max_dimension
+	(
+		const unsigned char *const buffer,
+		int buffer_length,
+		int *width, int *height, int *channels,
+		int force_channels,
+		int max_dimension
+	)
+{
+	unsigned char *result;
+	if( max_dimension <= 0 )
+	{
+		return SOIL_load_image_from_memory( buffer, buffer_length, width, height, channels, force_channels );
+	}
+	result = stbi_load_from_memory_max_dimension( buffer, buffer_length,
+			width, height, channels, force_channels, max_dimension );
+	if( result == NULL )
+	{
+		result_string_pointer = stbi_failure_reason();
+		return NULL;
+	}
+	result = SOIL_internal_reduce_image( result, width, height,
+			force_channels ? force_channels : *channels, max_dimension );
+	result_string_pointer = "Image loaded from memory";
+	return result;
+}
+
 int
 	SOIL_save_image
 	(
@@ -2865,6 +3202,41 @@ int query_DXT_capability( void )
 	return has_DXT_capability;
 }
 
+int query_RGTC_capability( void )
+{
+	/*	check for the capability	*/
+	if( has_RGTC_capability == SOIL_CAPABILITY_UNKNOWN )
+	{
+		/*	core since OpenGL 3.0, otherwise we need an extension	*/
+		const char *version = (const char *)glGetString( GL_VERSION );
+		if (	(NULL == version || atoi( version ) < 3) &&
+				0 == SOIL_GL_ExtensionSupported(
+					"GL_ARB_texture_compression_rgtc" ) &&
+				0 == SOIL_GL_ExtensionSupported(
+					"GL_EXT_texture_compression_rgtc" )
+			)
+		{
+			/*	not there, flag the failure	*/
+			has_RGTC_capability = SOIL_CAPABILITY_NONE;
+		} else
+		{
+			P_SOIL_GLCOMPRESSEDTEXIMAGE2DPROC ext_addr = get_glCompressedTexImage2D_addr();
+
+			/*	without the upload function the driver would have to compress it	*/
+			if( NULL == ext_addr )
+			{
+				has_RGTC_capability = SOIL_CAPABILITY_NONE;
+			} else
+			{
+				soilGlCompressedTexImage2D = ext_addr;
+				has_RGTC_capability = SOIL_CAPABILITY_PRESENT;
+			}
+		}
+	}
+	/*	let the user know if we can do RGTC or not	*/
+	return has_RGTC_capability;
+}
+
 int query_PVR_capability( void )
 {
 	/*	check for the capability	*/
@@ -2987,3 +3359,57 @@ int query_gen_mipmap_capability( void )
 
 	return has_gen_mipmap_capability;
 }
+
+int query_PBO_capability( void )
+{
+	/*	check for the capability	*/
+	if( has_PBO_capability == SOIL_CAPABILITY_UNKNOWN )
+	{
+		/*	not worth it on GLES, which only has the buffers from ES 3	*/
+		has_PBO_capability = SOIL_CAPABILITY_NONE;
+		#if !defined( SOIL_GLES1 ) && !defined( SOIL_GLES2 )
+		if( SOIL_GL_ExtensionSupported( "GL_ARB_pixel_buffer_object" ) ||
+			SOIL_GL_ExtensionSupported( "GL_EXT_pixel_buffer_object" ) )
+		{
+			soilGlGenBuffers = (P_SOIL_GLGENBUFFERSPROC)SOIL_GL_GetProcAddress( "glGenBuffers" );
+			soilGlBindBuffer = (P_SOIL_GLBINDBUFFERPROC)SOIL_GL_GetProcAddress( "glBindBuffer" );
+			soilGlBufferData = (P_SOIL_GLBUFFERDATAPROC)SOIL_GL_GetProcAddress( "glBufferData" );
+			soilGlMapBuffer = (P_SOIL_GLMAPBUFFERPROC)SOIL_GL_GetProcAddress( "glMapBuffer" );
+			soilGlUnmapBuffer = (P_SOIL_GLUNMAPBUFFERPROC)SOIL_GL_GetProcAddress( "glUnmapBuffer" );
+			if( (NULL != soilGlGenBuffers) && (NULL != soilGlBindBuffer) &&
+				(NULL != soilGlBufferData) && (NULL != soilGlMapBuffer) &&
+				(NULL != soilGlUnmapBuffer) )
+			{
+				soilGlGenBuffers( 1, &soil_upload_PBO );
+				if( soil_upload_PBO )
+				{
+					/*	it's there!	*/
+					has_PBO_capability = SOIL_CAPABILITY_PRESENT;
+				}
+			}
+		}
+		#endif
+	}
+	return has_PBO_capability;
+}
+
+int query_max_texture_size( unsigned int texture_check_size_enum )
+{
+	int *max_size = &max_texture_size;
+	if( texture_check_size_enum == SOIL_MAX_CUBE_MAP_TEXTURE_SIZE )
+	{
+		max_size = &max_cube_map_texture_size;
+	}
+	if( *max_size == SOIL_CAPABILITY_UNKNOWN )
+	{
+		GLint size = 0;
+		glGetIntegerv( texture_check_size_enum, &size );
+		/*	no context yet, so ask again next time	*/
+		if( size <= 0 )
+		{
+			return size;
+		}
+		*max_size = size;
+	}
+	return *max_size;
+}
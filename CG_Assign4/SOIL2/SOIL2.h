@@ -97,6 +97,7 @@ enum
 	SOIL_FLAG_CoCg_Y: Google YCoCg; RGB=>CoYCg, RGBA=>CoCgAY
 	SOIL_FLAG_TEXTURE_RECTANGE: uses ARB_texture_rectangle ; pixel indexed & no repeat or MIPmaps or cubemaps
 	SOIL_FLAG_PVR_LOAD_DIRECT: will load PVR files directly without _ANY_ additional processing ( if supported )
+	SOIL_FLAG_COMPRESS_TO_RGTC: if the card can display them, will convert 1 channel to BC4, and keep the first 2 channels of anything else as BC5 ( e.g. tangent space normal maps, whose Z is rebuilt when sampled )
 **/
 enum
 {
@@ -112,7 +113,8 @@ enum
 	SOIL_FLAG_TEXTURE_RECTANGLE = 512,
 	SOIL_FLAG_PVR_LOAD_DIRECT = 1024,
 	SOIL_FLAG_ETC1_LOAD_DIRECT = 2048,
-	SOIL_FLAG_GL_MIPMAPS = 4096
+	SOIL_FLAG_GL_MIPMAPS = 4096,
+	SOIL_FLAG_COMPRESS_TO_RGTC = 8192
 };
 
 /**
@@ -169,6 +171,28 @@ unsigned int
 		unsigned int flags
 	);
 
+/**
+	Loads an image from disk into an OpenGL texture, reduced so that
+	neither side is larger than max_dimension.  JPEGs are decoded
+	directly at the reduced size, which is much cheaper than loading
+	them at full size and downsampling.
+	\param filename the name of the file to upload as a texture
+	\param force_channels 0-image format, 1-luminous, 2-luminous/alpha, 3-RGB, 4-RGBA
+	\param reuse_texture_ID 0-generate a new texture ID, otherwise reuse the texture ID (overwriting the old texture)
+	\param flags can be any of SOIL_FLAG_POWER_OF_TWO | SOIL_FLAG_MIPMAPS | SOIL_FLAG_TEXTURE_REPEATS | SOIL_FLAG_MULTIPLY_ALPHA | SOIL_FLAG_INVERT_Y | SOIL_FLAG_COMPRESS_TO_DXT | SOIL_FLAG_DDS_LOAD_DIRECT
+	\param max_dimension the largest allowed width or height, 0 for no limit (DDS/PVR/ETC1 direct loads are not reduced)
+	\return 0-failed, otherwise returns the OpenGL texture handle
+**/
+unsigned int
+	SOIL_load_OGL_texture_max_dimension
+	(
+		const char *filename,
+		int force_channels,
+		unsigned int reuse_texture_ID,
+		unsigned int flags,
+		int max_dimension
+	);
+
 /**
 	Loads 6 images from disk into an OpenGL cubemap texture.
 	\param x_pos_file the name of the file to upload as the +x cube face
@@ -252,6 +276,29 @@ unsigned int
 		unsigned int flags
 	);
 
+/**
+	Loads an image from RAM into an OpenGL texture, reduced so that
+	neither side is larger than max_dimension, as with
+	SOIL_load_OGL_texture_max_dimension.
+	\param buffer the image data in RAM just as if it were still in a file
+	\param buffer_length the size of the buffer in bytes
+	\param force_channels 0-image format, 1-luminous, 2-luminous/alpha, 3-RGB, 4-RGBA
+	\param reuse_texture_ID 0-generate a new texture ID, otherwise reuse the texture ID (overwriting the old texture)
+	\param flags can be any of SOIL_FLAG_POWER_OF_TWO | SOIL_FLAG_MIPMAPS | SOIL_FLAG_TEXTURE_REPEATS | SOIL_FLAG_MULTIPLY_ALPHA | SOIL_FLAG_INVERT_Y | SOIL_FLAG_COMPRESS_TO_DXT | SOIL_FLAG_DDS_LOAD_DIRECT
+	\param max_dimension the largest allowed width or height, 0 for no limit (DDS/PVR/ETC1 direct loads are not reduced)
+	\return 0-failed, otherwise returns the OpenGL texture handle
+**/
+unsigned int
+	SOIL_load_OGL_texture_from_memory_max_dimension
+	(
+		const unsigned char *const buffer,
+		int buffer_length,
+		int force_channels,
+		unsigned int reuse_texture_ID,
+		unsigned int flags,
+		int max_dimension
+	);
+
 /**
 	Loads 6 images from memory into an OpenGL cubemap texture.
 	\param x_pos_buffer the image data in RAM to upload as the +x cube face
@@ -383,6 +430,21 @@ unsigned char*
 		int force_channels
 	);
 
+/**
+	Loads an image from disk into an array of unsigned chars,
+	reduced so that neither side is larger than max_dimension
+	(0 for no limit).  *width and *height return the reduced size.
+	\return 0 if failed, otherwise returns 1
+**/
+unsigned char*
+	SOIL_load_image_max_dimension
+	(
+		const char *filename,
+		int *width, int *height, int *channels,
+		int force_channels,
+		int max_dimension
+	);
+
 /**
 	Loads an image from memory into an array of unsigned chars.
 	Note that *channels return the original channel count of the
@@ -401,6 +463,22 @@ unsigned char*
 		int force_channels
 	);
 
+/**
+	Loads an image from memory into an array of unsigned chars,
+	reduced so that neither side is larger than max_dimension
+	(0 for no limit).  *width and *height return the reduced size.
+	\return 0 if failed, otherwise returns 1
+**/
+unsigned char*
+	SOIL_load_image_from_memory_max_dimension
+	(
+		const unsigned char *const buffer,
+		int buffer_length,
+		int *width, int *height, int *channels,
+		int force_channels,
+		int max_dimension
+	);
+
 /**
 	Saves an image from an array of unsigned chars (RGBA) to disk
 	\return 0 if failed, otherwise returns 1
@@ -8,11 +8,24 @@
 */
 
 #include "image_DXT.h"
+#include "image_parallel.h"
 #include <math.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 
+/*	SSE2 is always there on x64, and on x86 when the compiler targets it	*/
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+	#define IMAGE_DXT_SSE2
+	#include <emmintrin.h>
+#endif
+
+/*	each thread gets at least this many 4x4 blocks to compress	*/
+#define DXT_BLOCKS_PER_TASK	256
+
+/*	how many least squares passes the high quality encoders make	*/
+#define DXT_REFINE_ITERATIONS	3
+
 /*	set this =1 if you want to use the covarince matrix method...
 	which is better than my method of using standard deviations
 	overall, except on the infintesimal chance that the power
@@ -29,6 +42,15 @@ void compress_DDS_color_block(
 				int channels,
 				const unsigned char *const uncompressed,
 				unsigned char compressed[8] );
+/*
+	Same as compress_DDS_color_block, but refines the endpoints with
+	a least squares fit and picks each index by its actual error,
+	keeping whichever encoding comes out best.
+	(expects 4 channel blocks)
+*/
+void compress_DDS_color_block_HQ(
+				const unsigned char *const uncompressed,
+				unsigned char compressed[8] );
 /*
 	Takes a 4x4 block of pixels and compresses the alpha
 	component it into 8 bytes for use in DXT5 DDS files.
@@ -37,6 +59,17 @@ void compress_DDS_color_block(
 void compress_DDS_alpha_block(
 				const unsigned char *const uncompressed,
 				unsigned char compressed[8] );
+/*
+	Takes 16 single channel values and compresses them into
+	8 bytes, as used by the DXT5 alpha block and BC4 / BC5.
+*/
+void compress_BC4_block(
+				const unsigned char values[16],
+				int quality,
+				unsigned char compressed[8] );
+
+/*	the encoder convert_image_to_* will use	*/
+static int DXT_quality = DXT_QUALITY_FAST;
 
 /********* Actual Exposed Functions *********/
 int
@@ -98,180 +131,227 @@ int
 	return 1;
 }
 
-unsigned char* convert_image_to_DXT1(
-		const unsigned char *const uncompressed,
-		int width, int height, int channels,
-		int *out_size )
+
+void
+	set_DXT_quality
+	(
+		int quality
+	)
 {
+	DXT_quality = (quality == DXT_QUALITY_HIGH) ? DXT_QUALITY_HIGH : DXT_QUALITY_FAST;
+}
+
+int
+	get_DXT_quality
+	(
+		void
+	)
+{
+	return DXT_quality;
+}
+
+/*	The block formats convert_image_to_* can produce.  Every row of
+	blocks is independent, so they are compressed in parallel.	*/
+enum
+{
+	DXT_JOB_DXT1,
+	DXT_JOB_DXT5,
+	DXT_JOB_BC4,
+	DXT_JOB_BC5
+};
+
+typedef struct
+{
+	const unsigned char *uncompressed;
+	int width, height, channels;
+	int format, quality;
+	/*	the source channel for R,G,B,A of each block (-1 = 255)	*/
+	int source[4];
 	unsigned char *compressed;
-	int i, j, x, y;
-	unsigned char ublock[16*3];
-	unsigned char cblock[8];
-	int index = 0, chan_step = 1;
-	int block_count = 0;
-	/*	error check	*/
-	*out_size = 0;
-	if( (width < 1) || (height < 1) ||
-		(NULL == uncompressed) ||
-		(channels < 1) || (channels > 4) )
+} DXT_job;
+
+static void DXT_gather_block( const DXT_job *job, int i, int j, unsigned char ublock[16*4] )
+{
+	int x, y, c;
+	int idx = 0;
+	int mx = 4, my = 4;
+	if( j+4 >= job->height )
 	{
-		return NULL;
+		my = job->height - j;
 	}
-	/*	for channels == 1 or 2, I do not step forward for R,G,B values	*/
-	if( channels < 3 )
+	if( i+4 >= job->width )
 	{
-		chan_step = 0;
+		mx = job->width - i;
 	}
-	/*	get the RAM for the compressed image
-		(8 bytes per 4x4 pixel block)	*/
-	*out_size = ((width+3) >> 2) * ((height+3) >> 2) * 8;
-	compressed = (unsigned char*)malloc( *out_size );
-	/*	go through each block	*/
-	for( j = 0; j < height; j += 4 )
-	{
-		for( i = 0; i < width; i += 4 )
-		{
-			/*	copy this block into a new one	*/
-			int idx = 0;
-			int mx = 4, my = 4;
-			if( j+4 >= height )
+	for( y = 0; y < my; ++y )
+	{
+		const unsigned char *row = job->uncompressed + ((j+y)*job->width + i)*job->channels;
+		for( x = 0; x < mx; ++x )
+		{
+			for( c = 0; c < 4; ++c )
 			{
-				my = height - j;
+				ublock[idx++] = (job->source[c] < 0) ? 255 : row[x*job->channels+job->source[c]];
 			}
-			if( i+4 >= width )
+		}
+		/*	pad the block out with its first pixel	*/
+		for( x = mx; x < 4; ++x )
+		{
+			memcpy( ublock + idx, ublock, 4 );
+			idx += 4;
+		}
+	}
+	for( y = my; y < 4; ++y )
+	{
+		for( x = 0; x < 4; ++x )
+		{
+			memcpy( ublock + idx, ublock, 4 );
+			idx += 4;
+		}
+	}
+}
+
+static void DXT_block_channel( const unsigned char ublock[16*4], int c, unsigned char values[16] )
+{
+	int i;
+	for( i = 0; i < 16; ++i )
+	{
+		values[i] = ublock[i*4+c];
+	}
+}
+
+static void DXT_compress_block_rows( void *user_data, int first, int last )
+{
+	const DXT_job *job = (const DXT_job*)user_data;
+	int blocks_wide = (job->width + 3) >> 2;
+	int block_size = ((job->format == DXT_JOB_DXT1) || (job->format == DXT_JOB_BC4)) ? 8 : 16;
+	unsigned char ublock[16*4];
+	unsigned char values[16];
+	int row, col;
+	for( row = first; row < last; ++row )
+	{
+		unsigned char *out = job->compressed + row * blocks_wide * block_size;
+		for( col = 0; col < blocks_wide; ++col, out += block_size )
+		{
+			DXT_gather_block( job, col*4, row*4, ublock );
+			if( job->format == DXT_JOB_DXT5 )
 			{
-				mx = width - i;
+				/*	alpha comes first, then the color block	*/
+				DXT_block_channel( ublock, 3, values );
+				compress_BC4_block( values, job->quality, out );
 			}
-			for( y = 0; y < my; ++y )
+			if( (job->format == DXT_JOB_DXT1) || (job->format == DXT_JOB_DXT5) )
 			{
-				for( x = 0; x < mx; ++x )
+				unsigned char *color = out + block_size - 8;
+				if( job->quality == DXT_QUALITY_HIGH )
 				{
-					ublock[idx++] = uncompressed[(j+y)*width*channels+(i+x)*channels];
-					ublock[idx++] = uncompressed[(j+y)*width*channels+(i+x)*channels+chan_step];
-					ublock[idx++] = uncompressed[(j+y)*width*channels+(i+x)*channels+chan_step+chan_step];
-				}
-				for( x = mx; x < 4; ++x )
+					compress_DDS_color_block_HQ( ublock, color );
+				} else
 				{
-					ublock[idx++] = ublock[0];
-					ublock[idx++] = ublock[1];
-					ublock[idx++] = ublock[2];
+					compress_DDS_color_block( 4, ublock, color );
 				}
-			}
-			for( y = my; y < 4; ++y )
+			} else
 			{
-				for( x = 0; x < 4; ++x )
+				/*	BC4 is just the red channel, BC5 red then green	*/
+				DXT_block_channel( ublock, 0, values );
+				compress_BC4_block( values, job->quality, out );
+				if( job->format == DXT_JOB_BC5 )
 				{
-					ublock[idx++] = ublock[0];
-					ublock[idx++] = ublock[1];
-					ublock[idx++] = ublock[2];
+					DXT_block_channel( ublock, 1, values );
+					compress_BC4_block( values, job->quality, out + 8 );
 				}
 			}
-			/*	compress the block	*/
-			++block_count;
-			compress_DDS_color_block( 3, ublock, cblock );
-			/*	copy the data from the block into the main block	*/
-			for( x = 0; x < 8; ++x )
-			{
-				compressed[index++] = cblock[x];
-			}
 		}
 	}
-	return compressed;
 }
 
-unsigned char* convert_image_to_DXT5(
+static unsigned char* DXT_compress_image(
 		const unsigned char *const uncompressed,
 		int width, int height, int channels,
+		int format,
 		int *out_size )
 {
-	unsigned char *compressed;
-	int i, j, x, y;
-	unsigned char ublock[16*4];
-	unsigned char cblock[8];
-	int index = 0, chan_step = 1;
-	int block_count = 0, has_alpha;
+	DXT_job job;
+	int blocks_wide, blocks_high, rows_per_task;
 	/*	error check	*/
 	*out_size = 0;
 	if( (width < 1) || (height < 1) ||
 		(NULL == uncompressed) ||
-		(channels < 1) || ( channels > 4) )
+		(channels < 1) || (channels > 4) )
 	{
 		return NULL;
 	}
-	/*	for channels == 1 or 2, I do not step forward for R,G,B vales	*/
-	if( channels < 3 )
+	job.uncompressed = uncompressed;
+	job.width = width;
+	job.height = height;
+	job.channels = channels;
+	job.format = format;
+	job.quality = DXT_quality;
+	if( (format == DXT_JOB_DXT1) || (format == DXT_JOB_DXT5) )
+	{
+		/*	for channels == 1 or 2, I do not step forward for R,G,B values,
+			and # channels = 1 or 3 have no alpha, 2 & 4 do have alpha	*/
+		int chan_step = (channels < 3) ? 0 : 1;
+		job.source[0] = 0;
+		job.source[1] = chan_step;
+		job.source[2] = chan_step + chan_step;
+		job.source[3] = (channels & 1) ? -1 : channels - 1;
+	} else
 	{
-		chan_step = 0;
+		/*	the 1st channel, and the 2nd if there is one	*/
+		job.source[0] = 0;
+		job.source[1] = (channels > 1) ? 1 : 0;
+		job.source[2] = 0;
+		job.source[3] = -1;
 	}
-	/*	# channels = 1 or 3 have no alpha, 2 & 4 do have alpha	*/
-	has_alpha = 1 - (channels & 1);
 	/*	get the RAM for the compressed image
-		(16 bytes per 4x4 pixel block)	*/
-	*out_size = ((width+3) >> 2) * ((height+3) >> 2) * 16;
-	compressed = (unsigned char*)malloc( *out_size );
-	/*	go through each block	*/
-	for( j = 0; j < height; j += 4 )
-	{
-		for( i = 0; i < width; i += 4 )
-		{
-			/*	local variables, and my block counter	*/
-			int idx = 0;
-			int mx = 4, my = 4;
-			if( j+4 >= height )
-			{
-				my = height - j;
-			}
-			if( i+4 >= width )
-			{
-				mx = width - i;
-			}
-			for( y = 0; y < my; ++y )
-			{
-				for( x = 0; x < mx; ++x )
-				{
-					ublock[idx++] = uncompressed[(j+y)*width*channels+(i+x)*channels];
-					ublock[idx++] = uncompressed[(j+y)*width*channels+(i+x)*channels+chan_step];
-					ublock[idx++] = uncompressed[(j+y)*width*channels+(i+x)*channels+chan_step+chan_step];
-					ublock[idx++] =
-						has_alpha * uncompressed[(j+y)*width*channels+(i+x)*channels+channels-1]
-						+ (1-has_alpha)*255;
-				}
-				for( x = mx; x < 4; ++x )
-				{
-					ublock[idx++] = ublock[0];
-					ublock[idx++] = ublock[1];
-					ublock[idx++] = ublock[2];
-					ublock[idx++] = ublock[3];
-				}
-			}
-			for( y = my; y < 4; ++y )
-			{
-				for( x = 0; x < 4; ++x )
-				{
-					ublock[idx++] = ublock[0];
-					ublock[idx++] = ublock[1];
-					ublock[idx++] = ublock[2];
-					ublock[idx++] = ublock[3];
-				}
-			}
-			/*	now compress the alpha block	*/
-			compress_DDS_alpha_block( ublock, cblock );
-			/*	copy the data from the compressed alpha block into the main buffer	*/
-			for( x = 0; x < 8; ++x )
-			{
-				compressed[index++] = cblock[x];
-			}
-			/*	then compress the color block	*/
-			++block_count;
-			compress_DDS_color_block( 4, ublock, cblock );
-			/*	copy the data from the compressed color block into the main buffer	*/
-			for( x = 0; x < 8; ++x )
-			{
-				compressed[index++] = cblock[x];
-			}
-		}
+		(8 or 16 bytes per 4x4 pixel block)	*/
+	blocks_wide = (width+3) >> 2;
+	blocks_high = (height+3) >> 2;
+	*out_size = blocks_wide * blocks_high *
+		(((format == DXT_JOB_DXT1) || (format == DXT_JOB_BC4)) ? 8 : 16);
+	job.compressed = (unsigned char*)malloc( *out_size );
+	if( NULL == job.compressed )
+	{
+		*out_size = 0;
+		return NULL;
 	}
-	return compressed;
+	/*	and compress the rows of blocks across all the threads	*/
+	rows_per_task = DXT_BLOCKS_PER_TASK / blocks_wide;
+	image_parallel_for( blocks_high, (rows_per_task > 0) ? rows_per_task : 1,
+			DXT_compress_block_rows, &job );
+	return job.compressed;
+}
+
+unsigned char* convert_image_to_DXT1(
+		const unsigned char *const uncompressed,
+		int width, int height, int channels,
+		int *out_size )
+{
+	return DXT_compress_image( uncompressed, width, height, channels, DXT_JOB_DXT1, out_size );
+}
+
+unsigned char* convert_image_to_DXT5(
+		const unsigned char *const uncompressed,
+		int width, int height, int channels,
+		int *out_size )
+{
+	return DXT_compress_image( uncompressed, width, height, channels, DXT_JOB_DXT5, out_size );
+}
+
+unsigned char* convert_image_to_BC4(
+		const unsigned char *const uncompressed,
+		int width, int height, int channels,
+		int *out_size )
+{
+	return DXT_compress_image( uncompressed, width, height, channels, DXT_JOB_BC4, out_size );
+}
+
+unsigned char* convert_image_to_BC5(
+		const unsigned char *const uncompressed,
+		int width, int height, int channels,
+		int *out_size )
+{
+	return DXT_compress_image( uncompressed, width, height, channels, DXT_JOB_BC5, out_size );
 }
 
 /********* Helper Functions *********/
@@ -574,59 +654,460 @@ void
 	/*	done compressing to DXT1	*/
 }
 
+
 void
 	compress_DDS_alpha_block
 	(
 		const unsigned char *const uncompressed,
 		unsigned char compressed[8]
 	)
+{
+	unsigned char values[16];
+	int i;
+	for( i = 0; i < 16; ++i )
+	{
+		values[i] = uncompressed[i*4+3];
+	}
+	compress_BC4_block( values, DXT_QUALITY_FAST, compressed );
+}
+
+/********* High Quality Helpers *********/
+/*	Decodes the 4 colors of a block, in order along the line
+	from color 0 to color 1 (not in index order!)	*/
+static void DXT_color_palette( int enc_c0, int enc_c1, float palette[4][3] )
+{
+	int c0[3], c1[3];
+	int i, k;
+	rgb_888_from_565( enc_c0, &c0[0], &c0[1], &c0[2] );
+	rgb_888_from_565( enc_c1, &c1[0], &c1[1], &c1[2] );
+	for( k = 0; k < 4; ++k )
+	{
+		for( i = 0; i < 3; ++i )
+		{
+			palette[k][i] = ((3-k)*c0[i] + k*c1[i]) * (1.0f / 3.0f);
+		}
+	}
+}
+
+/*	Picks the closest palette color for every pixel, and returns
+	the summed squared error of the whole block.  On ties the
+	lower position wins, so a flat palette gives all zeros.	*/
+static float DXT_fit_color_indices(
+		float pixels[3][16],
+		float palette[4][3],
+		unsigned char positions[16] )
+{
+	int i, k;
+	float error = 0.0f;
+#ifdef IMAGE_DXT_SSE2
+	__m128 total = _mm_setzero_ps();
+	float sums[4];
+	int best_positions[4];
+	for( i = 0; i < 16; i += 4 )
+	{
+		__m128 r = _mm_loadu_ps( &pixels[0][i] );
+		__m128 g = _mm_loadu_ps( &pixels[1][i] );
+		__m128 b = _mm_loadu_ps( &pixels[2][i] );
+		__m128 best = _mm_set1_ps( 1e30f );
+		__m128i best_k = _mm_setzero_si128();
+		for( k = 0; k < 4; ++k )
+		{
+			__m128 dr = _mm_sub_ps( r, _mm_set1_ps( palette[k][0] ) );
+			__m128 dg = _mm_sub_ps( g, _mm_set1_ps( palette[k][1] ) );
+			__m128 db = _mm_sub_ps( b, _mm_set1_ps( palette[k][2] ) );
+			__m128 d = _mm_add_ps( _mm_add_ps( _mm_mul_ps( dr, dr ), _mm_mul_ps( dg, dg ) ), _mm_mul_ps( db, db ) );
+			__m128i closer = _mm_castps_si128( _mm_cmplt_ps( d, best ) );
+			best = _mm_min_ps( best, d );
+			best_k = _mm_or_si128( _mm_andnot_si128( closer, best_k ),
+					_mm_and_si128( closer, _mm_set1_epi32( k ) ) );
+		}
+		total = _mm_add_ps( total, best );
+		_mm_storeu_si128( (__m128i*)best_positions, best_k );
+		for( k = 0; k < 4; ++k )
+		{
+			positions[i+k] = (unsigned char)best_positions[k];
+		}
+	}
+	_mm_storeu_ps( sums, total );
+	error = (sums[0] + sums[1]) + (sums[2] + sums[3]);
+#else
+	for( i = 0; i < 16; ++i )
+	{
+		float best = 1e30f;
+		positions[i] = 0;
+		for( k = 0; k < 4; ++k )
+		{
+			float dr = pixels[0][i] - palette[k][0];
+			float dg = pixels[1][i] - palette[k][1];
+			float db = pixels[2][i] - palette[k][2];
+			float d = dr*dr + dg*dg + db*db;
+			if( d < best )
+			{
+				best = d;
+				positions[i] = (unsigned char)k;
+			}
+		}
+		error += best;
+	}
+#endif
+	return error;
+}
+
+/*	Solves for the pair of endpoints that best reproduce the pixels
+	with the current positions along the line (least squares).
+	\return 0 if the positions don't pin down 2 endpoints	*/
+static int DXT_refit_color_endpoints(
+		float pixels[3][16],
+		const unsigned char positions[16],
+		int *enc_c0, int *enc_c1 )
+{
+	/*	how much of color 0 is in each position	*/
+	const float weight[4] = { 1.0f, 2.0f / 3.0f, 1.0f / 3.0f, 0.0f };
+	float aa = 0.0f, bb = 0.0f, ab = 0.0f;
+	float ax[3] = { 0.0f, 0.0f, 0.0f };
+	float bx[3] = { 0.0f, 0.0f, 0.0f };
+	float det;
+	int c0[3], c1[3];
+	int i, j;
+	for( i = 0; i < 16; ++i )
+	{
+		float a = weight[positions[i]];
+		float b = 1.0f - a;
+		aa += a * a;
+		bb += b * b;
+		ab += a * b;
+		for( j = 0; j < 3; ++j )
+		{
+			ax[j] += a * pixels[j][i];
+			bx[j] += b * pixels[j][i];
+		}
+	}
+	det = aa * bb - ab * ab;
+	if( fabs( det ) < 1e-4f )
+	{
+		return 0;
+	}
+	det = 1.0f / det;
+	for( j = 0; j < 3; ++j )
+	{
+		c0[j] = (int)(0.5f + (ax[j] * bb - bx[j] * ab) * det);
+		c1[j] = (int)(0.5f + (bx[j] * aa - ax[j] * ab) * det);
+		c0[j] = (c0[j] < 0) ? 0 : ((c0[j] > 255) ? 255 : c0[j]);
+		c1[j] = (c1[j] < 0) ? 0 : ((c1[j] > 255) ? 255 : c1[j]);
+	}
+	/*	keep color 0 the larger, so the block stays in 4 color mode	*/
+	i = rgb_to_565( c0[0], c0[1], c0[2] );
+	j = rgb_to_565( c1[0], c1[1], c1[2] );
+	*enc_c0 = (i > j) ? i : j;
+	*enc_c1 = (i > j) ? j : i;
+	return 1;
+}
+
+void
+	compress_DDS_color_block_HQ
+	(
+		const unsigned char *const uncompressed,
+		unsigned char compressed[8]
+	)
+{
+	/*	variables	*/
+	int i, iteration;
+	int enc_c0, enc_c1, trial_c0, trial_c1;
+	float pixels[3][16];
+	float palette[4][3];
+	unsigned char positions[16], trial_positions[16];
+	float error, trial_error;
+	/*	stupid order	*/
+	const int swizzle4[] = { 0, 2, 3, 1 };
+	for( i = 0; i < 16; ++i )
+	{
+		pixels[0][i] = uncompressed[i*4+0];
+		pixels[1][i] = uncompressed[i*4+1];
+		pixels[2][i] = uncompressed[i*4+2];
+	}
+	/*	start from the same principal axis fit as the fast encoder	*/
+	LSE_master_colors_max_min( &enc_c0, &enc_c1, 4, uncompressed );
+	DXT_color_palette( enc_c0, enc_c1, palette );
+	error = DXT_fit_color_indices( pixels, palette, positions );
+	/*	then alternate between refitting the endpoints to the indices
+		and the indices to the endpoints, while the error drops	*/
+	for( iteration = 0; (iteration < DXT_REFINE_ITERATIONS) && (error > 0.0f); ++iteration )
+	{
+		if( !DXT_refit_color_endpoints( pixels, positions, &trial_c0, &trial_c1 ) ||
+			((trial_c0 == enc_c0) && (trial_c1 == enc_c1)) )
+		{
+			break;
+		}
+		DXT_color_palette( trial_c0, trial_c1, palette );
+		trial_error = DXT_fit_color_indices( pixels, palette, trial_positions );
+		if( trial_error >= error )
+		{
+			break;
+		}
+		error = trial_error;
+		enc_c0 = trial_c0;
+		enc_c1 = trial_c1;
+		memcpy( positions, trial_positions, 16 );
+	}
+	/*	store the 565 color 0 and color 1	*/
+	compressed[0] = (enc_c0 >> 0) & 255;
+	compressed[1] = (enc_c0 >> 8) & 255;
+	compressed[2] = (enc_c1 >> 0) & 255;
+	compressed[3] = (enc_c1 >> 8) & 255;
+	/*	and the indices, 2 bits each (all 0 when color 0 == color 1)	*/
+	compressed[4] = 0;
+	compressed[5] = 0;
+	compressed[6] = 0;
+	compressed[7] = 0;
+	for( i = 0; i < 16; ++i )
+	{
+		compressed[4 + (i >> 2)] |= swizzle4[ positions[i] ] << ((i & 3) * 2);
+	}
+}
+
+/*	Decodes the 8 values of an alpha / BC4 block, in index order	*/
+static void DXT_alpha_palette( int a0, int a1, int palette[8] )
+{
+	int i;
+	palette[0] = a0;
+	palette[1] = a1;
+	if( a0 > a1 )
+	{
+		/*	8 interpolated values	*/
+		for( i = 2; i < 8; ++i )
+		{
+			palette[i] = ((8-i)*a0 + (i-1)*a1 + 3) / 7;
+		}
+	} else
+	{
+		/*	6 interpolated values, plus 0 and 255	*/
+		for( i = 2; i < 6; ++i )
+		{
+			palette[i] = ((6-i)*a0 + (i-1)*a1 + 2) / 5;
+		}
+		palette[6] = 0;
+		palette[7] = 255;
+	}
+}
+
+/*	Picks the closest palette entry for each value, and returns
+	the summed squared error of the whole block	*/
+static int DXT_fit_alpha_indices(
+		const unsigned char values[16],
+		const int palette[8],
+		unsigned char indices[16] )
+{
+	int k;
+	int error = 0;
+#ifdef IMAGE_DXT_SSE2
+	/*	16 bit lanes, so all 16 values fit in 2 registers	*/
+	const __m128i zero = _mm_setzero_si128();
+	__m128i v = _mm_loadu_si128( (const __m128i*)values );
+	__m128i v_lo = _mm_unpacklo_epi8( v, zero );
+	__m128i v_hi = _mm_unpackhi_epi8( v, zero );
+	__m128i best_lo = _mm_set1_epi16( 0x7FFF );
+	__m128i best_hi = _mm_set1_epi16( 0x7FFF );
+	__m128i index_lo = zero, index_hi = zero;
+	__m128i sums;
+	int totals[4];
+	for( k = 0; k < 8; ++k )
+	{
+		__m128i p = _mm_set1_epi16( (short)palette[k] );
+		__m128i k16 = _mm_set1_epi16( (short)k );
+		__m128i d_lo = _mm_sub_epi16( v_lo, p );
+		__m128i d_hi = _mm_sub_epi16( v_hi, p );
+		__m128i closer_lo, closer_hi;
+		/*	|difference| orders the same as its square	*/
+		d_lo = _mm_max_epi16( d_lo, _mm_sub_epi16( zero, d_lo ) );
+		d_hi = _mm_max_epi16( d_hi, _mm_sub_epi16( zero, d_hi ) );
+		closer_lo = _mm_cmplt_epi16( d_lo, best_lo );
+		closer_hi = _mm_cmplt_epi16( d_hi, best_hi );
+		best_lo = _mm_min_epi16( best_lo, d_lo );
+		best_hi = _mm_min_epi16( best_hi, d_hi );
+		index_lo = _mm_or_si128( _mm_andnot_si128( closer_lo, index_lo ), _mm_and_si128( closer_lo, k16 ) );
+		index_hi = _mm_or_si128( _mm_andnot_si128( closer_hi, index_hi ), _mm_and_si128( closer_hi, k16 ) );
+	}
+	_mm_storeu_si128( (__m128i*)indices, _mm_packus_epi16( index_lo, index_hi ) );
+	sums = _mm_add_epi32( _mm_madd_epi16( best_lo, best_lo ), _mm_madd_epi16( best_hi, best_hi ) );
+	_mm_storeu_si128( (__m128i*)totals, sums );
+	error = totals[0] + totals[1] + totals[2] + totals[3];
+#else
+	int i;
+	for( i = 0; i < 16; ++i )
+	{
+		int best = 256;
+		indices[i] = 0;
+		for( k = 0; k < 8; ++k )
+		{
+			int d = abs( values[i] - palette[k] );
+			if( d < best )
+			{
+				best = d;
+				indices[i] = (unsigned char)k;
+			}
+		}
+		error += best * best;
+	}
+#endif
+	return error;
+}
+
+/*	Least squares fit of the 8 value mode endpoints (a0 > a1)
+	to the current indices.
+	\return 0 if the indices don't pin down 2 endpoints	*/
+static int DXT_refit_alpha_endpoints(
+		const unsigned char values[16],
+		const unsigned char indices[16],
+		int *a0, int *a1 )
+{
+	/*	how much of a0 is in each index	*/
+	const float weight[8] =
+	{
+		1.0f, 0.0f, 6.0f / 7.0f, 5.0f / 7.0f,
+		4.0f / 7.0f, 3.0f / 7.0f, 2.0f / 7.0f, 1.0f / 7.0f
+	};
+	float aa = 0.0f, bb = 0.0f, ab = 0.0f, ax = 0.0f, bx = 0.0f;
+	float det;
+	int i, e0, e1;
+	for( i = 0; i < 16; ++i )
+	{
+		float a = weight[indices[i]];
+		float b = 1.0f - a;
+		aa += a * a;
+		bb += b * b;
+		ab += a * b;
+		ax += a * values[i];
+		bx += b * values[i];
+	}
+	det = aa * bb - ab * ab;
+	if( fabs( det ) < 1e-4f )
+	{
+		return 0;
+	}
+	det = 1.0f / det;
+	e0 = (int)(0.5f + (ax * bb - bx * ab) * det);
+	e1 = (int)(0.5f + (bx * aa - ax * ab) * det);
+	e0 = (e0 < 0) ? 0 : ((e0 > 255) ? 255 : e0);
+	e1 = (e1 < 0) ? 0 : ((e1 > 255) ? 255 : e1);
+	*a0 = (e0 > e1) ? e0 : e1;
+	*a1 = (e0 > e1) ? e1 : e0;
+	return 1;
+}
+
+void
+	compress_BC4_block
+	(
+		const unsigned char values[16],
+		int quality,
+		unsigned char compressed[8]
+	)
 {
 	/*	variables	*/
 	int i;
 	int next_bit;
-	int a0, a1;
-	float scale_me;
+	int a0, a1, vmax, vmin;
+	unsigned char indices[16];
 	/*	stupid order	*/
-	int swizzle8[] = { 1, 7, 6, 5, 4, 3, 2, 0 };
-	/*	get the alpha limits (a0 > a1)	*/
-	a0 = a1 = uncompressed[3];
-	for( i = 4+3; i < 16*4; i += 4 )
+	const int swizzle8[] = { 1, 7, 6, 5, 4, 3, 2, 0 };
+	/*	get the limits (a0 > a1)	*/
+	vmax = vmin = values[0];
+	for( i = 1; i < 16; ++i )
 	{
-		if( uncompressed[i] > a0 )
+		if( values[i] > vmax )
 		{
-			a0 = uncompressed[i];
-		} else if( uncompressed[i] < a1 )
+			vmax = values[i];
+		} else if( values[i] < vmin )
 		{
-			a1 = uncompressed[i];
+			vmin = values[i];
+		}
+	}
+	a0 = vmax;
+	a1 = vmin;
+	if( quality == DXT_QUALITY_HIGH )
+	{
+		int palette[8];
+		unsigned char trial_indices[16];
+		int error, trial_error, trial_a0, trial_a1, iteration;
+		/*	8 value mode, nearest index instead of truncating	*/
+		DXT_alpha_palette( a0, a1, palette );
+		error = DXT_fit_alpha_indices( values, palette, indices );
+		for( iteration = 0; (iteration < DXT_REFINE_ITERATIONS) && (error > 0); ++iteration )
+		{
+			if( !DXT_refit_alpha_endpoints( values, indices, &trial_a0, &trial_a1 ) ||
+				(trial_a0 == trial_a1) ||
+				((trial_a0 == a0) && (trial_a1 == a1)) )
+			{
+				break;
+			}
+			DXT_alpha_palette( trial_a0, trial_a1, palette );
+			trial_error = DXT_fit_alpha_indices( values, palette, trial_indices );
+			if( trial_error >= error )
+			{
+				break;
+			}
+			error = trial_error;
+			a0 = trial_a0;
+			a1 = trial_a1;
+			memcpy( indices, trial_indices, 16 );
+		}
+		/*	blocks that hit 0 or 255 may do better in 6 value mode,
+			spanning just the values in between	*/
+		if( (error > 0) && ((vmin == 0) || (vmax == 255)) )
+		{
+			int lo = 255, hi = 0;
+			for( i = 0; i < 16; ++i )
+			{
+				if( (values[i] > 0) && (values[i] < 255) )
+				{
+					lo = (values[i] < lo) ? values[i] : lo;
+					hi = (values[i] > hi) ? values[i] : hi;
+				}
+			}
+			if( lo > hi )
+			{
+				lo = hi = 0;
+			}
+			DXT_alpha_palette( lo, hi, palette );
+			trial_error = DXT_fit_alpha_indices( values, palette, trial_indices );
+			if( trial_error < error )
+			{
+				a0 = lo;
+				a1 = hi;
+				memcpy( indices, trial_indices, 16 );
+			}
+		}
+	} else
+	{
+		/*	map each value straight onto the line between the limits	*/
+		float scale_me = (a0 > a1) ? 7.9999f / (a0 - a1) : 0.0f;
+		for( i = 0; i < 16; ++i )
+		{
+			/*	convert this value to a 3 bit number	*/
+			int value = (int)((values[i] - a1) * scale_me);
+			indices[i] = swizzle8[ value&7 ];
 		}
 	}
 	/*	store those limits, and zero the rest of the compressed dataset	*/
 	compressed[0] = a0;
 	compressed[1] = a1;
-	/*	zero out the compressed data	*/
 	compressed[2] = 0;
 	compressed[3] = 0;
 	compressed[4] = 0;
 	compressed[5] = 0;
 	compressed[6] = 0;
 	compressed[7] = 0;
-	/*	store the all of the alpha values	*/
+	/*	store the all of the 3 bit indices	*/
 	next_bit = 8*2;
-	scale_me = 7.9999f / (a0 - a1);
-	for( i = 3; i < 16*4; i += 4 )
+	for( i = 0; i < 16; ++i )
 	{
-		/*	convert this alpha value to a 3 bit number	*/
-		int svalue;
-		int value = (int)((uncompressed[i] - a1) * scale_me);
-		svalue = swizzle8[ value&7 ];
 		/*	OK, store this value, start with the 1st byte	*/
-		compressed[next_bit >> 3] |= svalue << (next_bit & 7);
+		compressed[next_bit >> 3] |= indices[i] << (next_bit & 7);
 		if( (next_bit & 7) > 5 )
 		{
 			/*	spans 2 bytes, fill in the start of the 2nd byte	*/
-			compressed[1 + (next_bit >> 3)] |= svalue >> (8 - (next_bit & 7) );
+			compressed[1 + (next_bit >> 3)] |= indices[i] >> (8 - (next_bit & 7) );
 		}
 		next_bit += 3;
 	}
-	/*	done compressing to DXT1	*/
+	/*	done compressing the block	*/
 }
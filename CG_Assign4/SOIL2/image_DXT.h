@@ -10,6 +10,10 @@
 #ifndef HEADER_IMAGE_DXT
 #define HEADER_IMAGE_DXT
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 /**
 	Converts an image from an array of unsigned chars (RGB or RGBA) to
 	DXT1 or DXT5, then saves the converted image to disk.
@@ -45,6 +49,62 @@ convert_image_to_DXT5
     int *out_size
 );
 
+/**
+	take an image and convert it to BC4 / ATI1 (the 1st channel only,
+	for height maps, masks, ...)
+**/
+unsigned char*
+convert_image_to_BC4
+(
+    const unsigned char *const uncompressed,
+    int width, int height, int channels,
+    int *out_size
+);
+
+/**
+	take an image and convert it to BC5 / ATI2 (the 1st two channels,
+	for normal maps, luminance + alpha, ...)
+**/
+unsigned char*
+convert_image_to_BC5
+(
+    const unsigned char *const uncompressed,
+    int width, int height, int channels,
+    int *out_size
+);
+
+/**
+	The block encoders the convert_image_to_* functions can use.
+	DXT_QUALITY_FAST fits each block to the ends of its principal axis.
+	DXT_QUALITY_HIGH also refines the endpoints with a least squares fit
+	and picks every index by its error against the decoded palette.
+	Either way the blocks are compressed across all of the CPUs.
+**/
+enum
+{
+	DXT_QUALITY_FAST = 0,
+	DXT_QUALITY_HIGH = 1
+};
+
+/**
+	Selects the block encoder, DXT_QUALITY_FAST by default.
+**/
+void
+set_DXT_quality
+(
+    int quality
+);
+
+/**
+	
+Return the current DXT quality
+**/
+int
+get_DXT_quality
+(
+    void
+);
+
 /**	A bunch of DirectDraw Surface structures and flags **/
 typedef struct
 {
@@ -120,4 +180,8 @@ DDS_header ;
 #define DDSCAPS2_CUBEMAP_NEGATIVEZ	0x00008000
 #define DDSCAPS2_VOLUME	0x00200000
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif /* HEADER_IMAGE_DXT	*/
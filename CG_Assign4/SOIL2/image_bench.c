@@ -0,0 +1,116 @@
+/*
+    Simple decode benchmark for the bundled stb_image.
+
+    Each file given on the command line is read into memory once and then
+    decoded repeatedly, first with the SIMD kernels disabled and then with
+    them enabled, so the two throughput figures can be compared directly.
+
+    usage: image_bench [-n iterations] files...
+*/
+
+#include "stb_image.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static unsigned char *read_file(const char *filename, int *len)
+{
+	FILE *f = fopen(filename, "rb");
+	unsigned char *buffer;
+	long size;
+
+	if (!f) return NULL;
+
+	fseek(f, 0, SEEK_END);
+	size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+
+	buffer = (unsigned char *) malloc(size);
+	if (buffer && fread(buffer, 1, size, f) != (size_t) size) {
+		free(buffer);
+		buffer = NULL;
+	}
+	fclose(f);
+
+	*len = (int) size;
+	return buffer;
+}
+
+/* decodes the buffer 'iterations' times, returns the elapsed seconds and the decoded size */
+static double time_decode(const unsigned char *buffer, int len, int iterations, double *out_bytes)
+{
+	clock_t start = clock();
+	int i, x, y, comp;
+
+	*out_bytes = 0.0;
+	for (i = 0; i < iterations; ++i) {
+		unsigned char *img = stbi_load_from_memory(buffer, len, &x, &y, &comp, 0);
+		if (!img) return -1.0;
+		*out_bytes += (double) x * y * comp;
+		stbi_image_free(img);
+	}
+
+	return (double) (clock() - start) / CLOCKS_PER_SEC;
+}
+
+int main(int argc, char **argv)
+{
+	int iterations = 5;
+	int first = 1;
+	int i;
+	double total_in = 0.0, total_out = 0.0, total_scalar = 0.0, total_simd = 0.0;
+
+	if (argc > 2 && strcmp(argv[1], "-n") == 0) {
+		iterations = atoi(argv[2]);
+		if (iterations < 1) iterations = 1;
+		first = 3;
+	}
+
+	if (first >= argc) {
+		fprintf(stderr, "usage: %s [-n iterations] files...\n", argv[0]);
+		return 1;
+	}
+
+	printf("%-48s %10s %12s %12s %8s\n", "file", "size (KB)", "scalar MB/s", "simd MB/s", "speedup");
+
+	for (i = first; i < argc; ++i) {
+		int len;
+		double out_bytes, scalar, simd;
+		unsigned char *buffer = read_file(argv[i], &len);
+
+		if (!buffer) {
+			fprintf(stderr, "failed to read %s\n", argv[i]);
+			continue;
+		}
+
+		stbi_set_simd(0);
+		scalar = time_decode(buffer, len, iterations, &out_bytes);
+		stbi_set_simd(1);
+		simd = time_decode(buffer, len, iterations, &out_bytes);
+		free(buffer);
+
+		if (scalar < 0.0 || simd < 0.0) {
+			fprintf(stderr, "failed to decode %s: %s\n", argv[i], stbi_failure_reason());
+			continue;
+		}
+
+		/* throughput is measured in decoded megabytes per second */
+		printf("%-48s %10d %12.1f %12.1f %7.2fx\n", argv[i], len / 1024,
+			out_bytes / (scalar * 1048576.0), out_bytes / (simd * 1048576.0), scalar / simd);
+
+		total_in += (double) len * iterations;
+		total_out += out_bytes;
+		total_scalar += scalar;
+		total_simd += simd;
+	}
+
+	if (total_scalar > 0.0 && total_simd > 0.0) {
+		printf("%-48s %10d %12.1f %12.1f %7.2fx\n", "total", (int) (total_in / iterations / 1024),
+			total_out / (total_scalar * 1048576.0), total_out / (total_simd * 1048576.0),
+			total_scalar / total_simd);
+	}
+
+	return 0;
+}
@@ -7,10 +7,115 @@
 */
 
 #include "image_helper.h"
+#include "image_parallel.h"
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 
-/*	Upscaling the image uses simple bilinear interpolation	*/
+/*	SSE2 is always there on x64, and on x86 when the compiler targets it	*/
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+	#define IMAGE_HELPER_SSE2
+	#include <emmintrin.h>
+#endif
+
+/*	the threaded kernels hand each thread at least this many output pixels	*/
+#define IMAGE_HELPER_PIXELS_PER_TASK (64*1024)
+
+unsigned char clamp_byte( int x );
+
+static int rows_per_task( int row_width )
+{
+	int rows = IMAGE_HELPER_PIXELS_PER_TASK / (row_width > 0 ? row_width : 1);
+	return rows > 0 ? rows : 1;
+}
+
+/*	Upscaling the image uses simple bilinear interpolation,
+	in 8-bit fixed point: rows are blended vertically first
+	(the contiguous, vectorised part), then horizontally	*/
+typedef struct
+{
+	const unsigned char *orig;
+	int width, height, channels;
+	unsigned char *resampled;
+	int resampled_width, resampled_height;
+	const int *x_index;		/*	left source pixel for each output column	*/
+	const int *x_weight;	/*	weight of the right source pixel, 0-256	*/
+	int num_tasks;			/*	the rows are split into this many contiguous tasks	*/
+	unsigned short *blend;	/*	one vertically blended source row per task	*/
+} up_scale_job;
+
+static void up_scale_rows( const up_scale_job *job, int first, int last, unsigned short *blend )
+{
+	const int channels = job->channels;
+	const int row_size = job->width * channels;
+	const float dy = (job->height - 1.0f) / (job->resampled_height - 1.0f);
+	int x, y, c;
+	for( y = first; y < last; ++y )
+	{
+		/*	find the base y index and fractional offset from that	*/
+		float sampley = y * dy;
+		int inty = (int)sampley;
+		int wy, i = 0;
+		const unsigned char *row0, *row1;
+		unsigned char *out = job->resampled + y * job->resampled_width * channels;
+		if( inty > job->height - 2 ) { inty = job->height - 2; }
+		if( inty < 0 ) { inty = 0; }
+		wy = (int)((sampley - inty) * 256.0f + 0.5f);
+		row0 = job->orig + inty * row_size;
+		row1 = (job->height > 1) ? row0 + row_size : row0;
+		/*	vertical blend, row0*(256-wy) + row1*wy fits in 16 bits	*/
+#ifdef IMAGE_HELPER_SSE2
+		{
+			const __m128i zero = _mm_setzero_si128();
+			const __m128i w0 = _mm_set1_epi16( (short)(256 - wy) );
+			const __m128i w1 = _mm_set1_epi16( (short)wy );
+			for( ; i + 16 <= row_size; i += 16 )
+			{
+				__m128i a = _mm_loadu_si128( (const __m128i*)(row0 + i) );
+				__m128i b = _mm_loadu_si128( (const __m128i*)(row1 + i) );
+				__m128i lo = _mm_add_epi16(
+						_mm_mullo_epi16( _mm_unpacklo_epi8( a, zero ), w0 ),
+						_mm_mullo_epi16( _mm_unpacklo_epi8( b, zero ), w1 ) );
+				__m128i hi = _mm_add_epi16(
+						_mm_mullo_epi16( _mm_unpackhi_epi8( a, zero ), w0 ),
+						_mm_mullo_epi16( _mm_unpackhi_epi8( b, zero ), w1 ) );
+				_mm_storeu_si128( (__m128i*)(blend + i), lo );
+				_mm_storeu_si128( (__m128i*)(blend + i + 8), hi );
+			}
+		}
+#endif
+		for( ; i < row_size; ++i )
+		{
+			blend[i] = (unsigned short)(row0[i] * (256 - wy) + row1[i] * wy);
+		}
+		/*	horizontal blend of the two neighbouring pixels	*/
+		for( x = 0; x < job->resampled_width; ++x )
+		{
+			const unsigned short *left = blend + job->x_index[x] * channels;
+			const unsigned short *right = (job->width > 1) ? left + channels : left;
+			const unsigned int wx = job->x_weight[x];
+			for( c = 0; c < channels; ++c )
+			{
+				*out++ = (unsigned char)((left[c] * (256 - wx) + right[c] * wx + 32768) >> 16);
+			}
+		}
+	}
+}
+
+static void up_scale_tasks( void *user_data, int first, int last )
+{
+	const up_scale_job *job = (const up_scale_job*)user_data;
+	const int row_size = job->width * job->channels;
+	int t;
+	for( t = first; t < last; ++t )
+	{
+		up_scale_rows( job,
+				(int)((long long)job->resampled_height * t / job->num_tasks),
+				(int)((long long)job->resampled_height * (t+1) / job->num_tasks),
+				job->blend + (size_t)t * row_size );
+	}
+}
+
 int
 	up_scale_image
 	(
@@ -20,8 +125,10 @@ int
 		int resampled_width, int resampled_height
 	)
 {
-	float dx, dy;
-	int x, y, c;
+	float dx;
+	int x;
+	int *x_table;
+	up_scale_job job;
 
     /* error(s) check	*/
     if ( 	(width < 1) || (height < 1) ||
@@ -33,54 +140,183 @@ int
         return 0;
     }
     /*
-		for each given pixel in the new map, find the exact location
+		for each given column in the new map, find the exact location
 		from the original map which would contribute to this guy
 	*/
+	x_table = (int*)malloc( 2 * resampled_width * sizeof(int) );
+	if( NULL == x_table )
+	{
+		return 0;
+	}
     dx = (width - 1.0f) / (resampled_width - 1.0f);
-    dy = (height - 1.0f) / (resampled_height - 1.0f);
-    for ( y = 0; y < resampled_height; ++y )
-    {
-    	/* find the base y index and fractional offset from that	*/
-    	float sampley = y * dy;
-    	int inty = (int)sampley;
-    	/*	if( inty < 0 ) { inty = 0; } else	*/
-		if( inty > height - 2 ) { inty = height - 2; }
-		sampley -= inty;
-        for ( x = 0; x < resampled_width; ++x )
-        {
-			float samplex = x * dx;
-			int intx = (int)samplex;
-			int base_index;
-			/* find the base x index and fractional offset from that	*/
-			/*	if( intx < 0 ) { intx = 0; } else	*/
-			if( intx > width - 2 ) { intx = width - 2; }
-			samplex -= intx;
-			/*	base index into the original image	*/
-			base_index = (inty * width + intx) * channels;
-            for ( c = 0; c < channels; ++c )
-            {
-            	/*	do the sampling	*/
-				float value = 0.5f;
-				value += orig[base_index]
-							*(1.0f-samplex)*(1.0f-sampley);
-				value += orig[base_index+channels]
-							*(samplex)*(1.0f-sampley);
-				value += orig[base_index+width*channels]
-							*(1.0f-samplex)*(sampley);
-				value += orig[base_index+width*channels+channels]
-							*(samplex)*(sampley);
-				/*	move to the next channel	*/
-				++base_index;
-            	/*	save the new value	*/
-            	resampled[y*resampled_width*channels+x*channels+c] =
-						(unsigned char)(value);
-            }
-        }
-    }
+	for( x = 0; x < resampled_width; ++x )
+	{
+		float samplex = x * dx;
+		int intx = (int)samplex;
+		if( intx > width - 2 ) { intx = width - 2; }
+		if( intx < 0 ) { intx = 0; }
+		x_table[x] = intx;
+		x_table[resampled_width + x] = (int)((samplex - intx) * 256.0f + 0.5f);
+	}
+	job.orig = orig;
+	job.width = width;
+	job.height = height;
+	job.channels = channels;
+	job.resampled = resampled;
+	job.resampled_width = resampled_width;
+	job.resampled_height = resampled_height;
+	job.x_index = x_table;
+	job.x_weight = x_table + resampled_width;
+	/*	one task per thread, each with its own blend row	*/
+	job.num_tasks = resampled_height / rows_per_task( resampled_width );
+	if( job.num_tasks > image_parallel_thread_count() )
+	{
+		job.num_tasks = image_parallel_thread_count();
+	}
+	if( job.num_tasks < 1 )
+	{
+		job.num_tasks = 1;
+	}
+	job.blend = (unsigned short*)malloc( (size_t)job.num_tasks * width * channels * sizeof(unsigned short) );
+	if( NULL == job.blend )
+	{
+		free( x_table );
+		return 0;
+	}
+	image_parallel_for( job.num_tasks, 1, up_scale_tasks, &job );
+	free( job.blend );
+	free( x_table );
     /*	done	*/
     return 1;
 }
 
+/*	The common MIPmap case: every output pixel is the
+	rounded average of a 2x2 block	*/
+typedef struct
+{
+	const unsigned char *orig;
+	int width, channels;
+	unsigned char *resampled;
+	int mip_width;
+} mipmap_2x2_job;
+
+#ifdef IMAGE_HELPER_SSE2
+/*	returns how many output pixels of the row were done	*/
+static int mipmap_row_2x2_sse2( const unsigned char *row0, const unsigned char *row1,
+		unsigned char *out, int mip_width, int channels )
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i two = _mm_set1_epi16( 2 );
+	int i = 0;
+	if( channels == 1 )
+	{
+		/*	even and odd bytes are the two pixels of each pair	*/
+		const __m128i mask = _mm_set1_epi16( 0x00ff );
+		for( ; i + 16 <= mip_width; i += 16 )
+		{
+			__m128i a0 = _mm_loadu_si128( (const __m128i*)(row0 + 2*i) );
+			__m128i a1 = _mm_loadu_si128( (const __m128i*)(row0 + 2*i + 16) );
+			__m128i b0 = _mm_loadu_si128( (const __m128i*)(row1 + 2*i) );
+			__m128i b1 = _mm_loadu_si128( (const __m128i*)(row1 + 2*i + 16) );
+			__m128i s0 = _mm_add_epi16(
+					_mm_add_epi16( _mm_and_si128( a0, mask ), _mm_srli_epi16( a0, 8 ) ),
+					_mm_add_epi16( _mm_and_si128( b0, mask ), _mm_srli_epi16( b0, 8 ) ) );
+			__m128i s1 = _mm_add_epi16(
+					_mm_add_epi16( _mm_and_si128( a1, mask ), _mm_srli_epi16( a1, 8 ) ),
+					_mm_add_epi16( _mm_and_si128( b1, mask ), _mm_srli_epi16( b1, 8 ) ) );
+			s0 = _mm_srli_epi16( _mm_add_epi16( s0, two ), 2 );
+			s1 = _mm_srli_epi16( _mm_add_epi16( s1, two ), 2 );
+			_mm_storeu_si128( (__m128i*)(out + i), _mm_packus_epi16( s0, s1 ) );
+		}
+	} else if( channels == 2 )
+	{
+		/*	a widened pixel is 32 bits, so split even and odd pixels with 32-bit shuffles	*/
+		for( ; i + 8 <= mip_width; i += 8 )
+		{
+			__m128i s[2];
+			int k;
+			for( k = 0; k < 2; ++k )
+			{
+				__m128i a = _mm_loadu_si128( (const __m128i*)(row0 + 4*i + 16*k) );
+				__m128i b = _mm_loadu_si128( (const __m128i*)(row1 + 4*i + 16*k) );
+				__m128 lo = _mm_castsi128_ps( _mm_add_epi16( _mm_unpacklo_epi8( a, zero ), _mm_unpacklo_epi8( b, zero ) ) );
+				__m128 hi = _mm_castsi128_ps( _mm_add_epi16( _mm_unpackhi_epi8( a, zero ), _mm_unpackhi_epi8( b, zero ) ) );
+				s[k] = _mm_add_epi16(
+						_mm_castps_si128( _mm_shuffle_ps( lo, hi, _MM_SHUFFLE(2,0,2,0) ) ),
+						_mm_castps_si128( _mm_shuffle_ps( lo, hi, _MM_SHUFFLE(3,1,3,1) ) ) );
+				s[k] = _mm_srli_epi16( _mm_add_epi16( s[k], two ), 2 );
+			}
+			_mm_storeu_si128( (__m128i*)(out + 2*i), _mm_packus_epi16( s[0], s[1] ) );
+		}
+	} else if( channels == 3 )
+	{
+		/*	two output pixels per step; the 8 byte store spills 2 bytes
+			into the next pixel, so stop while that is still in this row	*/
+		const __m128i three = _mm_set_epi32( 0, 0, 0xffff, -1 );
+		for( ; i + 3 <= mip_width; i += 2 )
+		{
+			__m128i a = _mm_loadu_si128( (const __m128i*)(row0 + 6*i) );
+			__m128i b = _mm_loadu_si128( (const __m128i*)(row1 + 6*i) );
+			__m128i p = _mm_add_epi16( _mm_unpacklo_epi8( a, zero ), _mm_unpacklo_epi8( b, zero ) );
+			__m128i q = _mm_add_epi16(
+					_mm_unpacklo_epi8( _mm_srli_si128( a, 6 ), zero ),
+					_mm_unpacklo_epi8( _mm_srli_si128( b, 6 ), zero ) );
+			p = _mm_add_epi16( p, _mm_srli_si128( p, 6 ) );
+			q = _mm_add_epi16( q, _mm_srli_si128( q, 6 ) );
+			p = _mm_or_si128( _mm_and_si128( p, three ), _mm_slli_si128( q, 6 ) );
+			p = _mm_srli_epi16( _mm_add_epi16( p, two ), 2 );
+			_mm_storel_epi64( (__m128i*)(out + 3*i), _mm_packus_epi16( p, p ) );
+		}
+	} else if( channels == 4 )
+	{
+		/*	a widened pixel is 64 bits, so split even and odd pixels with 64-bit unpacks	*/
+		for( ; i + 4 <= mip_width; i += 4 )
+		{
+			__m128i s[2];
+			int k;
+			for( k = 0; k < 2; ++k )
+			{
+				__m128i a = _mm_loadu_si128( (const __m128i*)(row0 + 8*i + 16*k) );
+				__m128i b = _mm_loadu_si128( (const __m128i*)(row1 + 8*i + 16*k) );
+				__m128i lo = _mm_add_epi16( _mm_unpacklo_epi8( a, zero ), _mm_unpacklo_epi8( b, zero ) );
+				__m128i hi = _mm_add_epi16( _mm_unpackhi_epi8( a, zero ), _mm_unpackhi_epi8( b, zero ) );
+				s[k] = _mm_add_epi16( _mm_unpacklo_epi64( lo, hi ), _mm_unpackhi_epi64( lo, hi ) );
+				s[k] = _mm_srli_epi16( _mm_add_epi16( s[k], two ), 2 );
+			}
+			_mm_storeu_si128( (__m128i*)(out + 4*i), _mm_packus_epi16( s[0], s[1] ) );
+		}
+	}
+	return i;
+}
+#endif
+
+static void mipmap_rows_2x2( void *user_data, int first, int last )
+{
+	const mipmap_2x2_job *job = (const mipmap_2x2_job*)user_data;
+	const int channels = job->channels;
+	int i, j, c;
+	for( j = first; j < last; ++j )
+	{
+		const unsigned char *row0 = job->orig + (2*j) * job->width * channels;
+		const unsigned char *row1 = row0 + job->width * channels;
+		unsigned char *out = job->resampled + j * job->mip_width * channels;
+		i = 0;
+#ifdef IMAGE_HELPER_SSE2
+		i = mipmap_row_2x2_sse2( row0, row1, out, job->mip_width, channels );
+#endif
+		for( ; i < job->mip_width; ++i )
+		{
+			const unsigned char *p = row0 + 2*i*channels;
+			const unsigned char *q = row1 + 2*i*channels;
+			for( c = 0; c < channels; ++c )
+			{
+				out[i*channels + c] = (unsigned char)
+						((p[c] + p[c + channels] + q[c] + q[c + channels] + 2) >> 2);
+			}
+		}
+	}
+}
+
 int
 	mipmap_image
 	(
@@ -102,6 +338,18 @@ int
 		/*	nothing to do	*/
 		return 0;
 	}
+	/*	the 2x2 reduction gets its own vectorised, threaded kernel	*/
+	if( (block_size_x == 2) && (block_size_y == 2) && (width >= 2) && (height >= 2) )
+	{
+		mipmap_2x2_job job;
+		job.orig = orig;
+		job.width = width;
+		job.channels = channels;
+		job.resampled = resampled;
+		job.mip_width = width / 2;
+		image_parallel_for( height / 2, rows_per_task( job.mip_width ), mipmap_rows_2x2, &job );
+		return 1;
+	}
 	mip_width = width / block_size_x;
 	mip_height = height / block_size_y;
 	if( mip_width < 1 )
@@ -151,6 +399,236 @@ int
 	return 1;
 }
 
+/*	General resampling is separable: each axis gets a table of
+	source samples and 14-bit fixed point weights per output
+	sample.  The horizontal pass writes 16-bit intermediates
+	(6 fractional bits, with headroom for Lanczos overshoot),
+	the vertical pass then works on whole contiguous rows.	*/
+typedef struct
+{
+	int taps;		/*	source samples per output sample	*/
+	int *index;		/*	[output][tap] source sample, clamped to the edges	*/
+	short *weight;	/*	[output][tap] weight, 1.0 = 1 << 14	*/
+} resample_axis;
+
+typedef struct
+{
+	const unsigned char *orig;
+	int width, channels;
+	unsigned char *resampled;
+	int resampled_width;
+	short *tmp;
+	resample_axis horizontal, vertical;
+} resample_job;
+
+static float resample_support( int filter )
+{
+	switch( filter )
+	{
+	case SOIL_RESAMPLE_BOX:			return 0.5f;
+	case SOIL_RESAMPLE_LANCZOS3:	return 3.0f;
+	default:						return 1.0f;
+	}
+}
+
+static float resample_filter( int filter, float x )
+{
+	const float pi = 3.14159265358979f;
+	x = fabsf( x );
+	switch( filter )
+	{
+	case SOIL_RESAMPLE_BOX:
+		return x < 0.5f ? 1.0f : 0.0f;
+	case SOIL_RESAMPLE_LANCZOS3:
+		if( x < 1e-5f ) return 1.0f;
+		if( x >= 3.0f ) return 0.0f;
+		return 3.0f * sinf( pi * x ) * sinf( pi * x / 3.0f ) / (pi * pi * x * x);
+	default:
+		return x < 1.0f ? 1.0f - x : 0.0f;
+	}
+}
+
+static int build_resample_axis( resample_axis *axis, int in_size, int out_size, int filter )
+{
+	const float scale = (float)in_size / (float)out_size;
+	/*	when shrinking, widen the filter to cover every source sample	*/
+	const float filter_scale = scale > 1.0f ? scale : 1.0f;
+	const float radius = resample_support( filter ) * filter_scale;
+	float *fw;
+	int o, t;
+	axis->taps = (int)ceilf( 2.0f * radius ) + 1;
+	axis->index = (int*)malloc( out_size * axis->taps * sizeof(int) );
+	axis->weight = (short*)malloc( out_size * axis->taps * sizeof(short) );
+	fw = (float*)malloc( axis->taps * sizeof(float) );
+	if( (NULL == axis->index) || (NULL == axis->weight) || (NULL == fw) )
+	{
+		free( fw );
+		return 0;
+	}
+	for( o = 0; o < out_size; ++o )
+	{
+		const float center = (o + 0.5f) * scale - 0.5f;
+		const int first = (int)ceilf( center - radius );
+		int *index = axis->index + o * axis->taps;
+		short *weight = axis->weight + o * axis->taps;
+		float total = 0.0f;
+		int sum = 0, largest = 0;
+		for( t = 0; t < axis->taps; ++t )
+		{
+			int src = first + t;
+			fw[t] = resample_filter( filter, (src - center) / filter_scale );
+			total += fw[t];
+			index[t] = src < 0 ? 0 : (src >= in_size ? in_size - 1 : src);
+		}
+		if( total <= 0.0f )
+		{
+			/*	nothing in range, fall back to the nearest sample	*/
+			int src = (int)(center + 0.5f);
+			for( t = 0; t < axis->taps; ++t )
+			{
+				fw[t] = 0.0f;
+			}
+			fw[0] = total = 1.0f;
+			index[0] = src < 0 ? 0 : (src >= in_size ? in_size - 1 : src);
+		}
+		/*	normalise, and make the rounded weights sum to exactly 1.0	*/
+		for( t = 0; t < axis->taps; ++t )
+		{
+			weight[t] = (short)floorf( fw[t] / total * 16384.0f + 0.5f );
+			sum += weight[t];
+			if( weight[t] > weight[largest] )
+			{
+				largest = t;
+			}
+		}
+		weight[largest] += (short)(16384 - sum);
+	}
+	free( fw );
+	return 1;
+}
+
+static void resample_rows_horizontal( void *user_data, int first, int last )
+{
+	const resample_job *job = (const resample_job*)user_data;
+	const int channels = job->channels;
+	const int taps = job->horizontal.taps;
+	int x, y, c, t;
+	for( y = first; y < last; ++y )
+	{
+		const unsigned char *src = job->orig + y * job->width * channels;
+		short *dst = job->tmp + y * job->resampled_width * channels;
+		for( x = 0; x < job->resampled_width; ++x )
+		{
+			const int *index = job->horizontal.index + x * taps;
+			const short *weight = job->horizontal.weight + x * taps;
+			for( c = 0; c < channels; ++c )
+			{
+				int sum = 1 << 7;
+				for( t = 0; t < taps; ++t )
+				{
+					sum += weight[t] * src[index[t] * channels + c];
+				}
+				*dst++ = (short)(sum >> 8);
+			}
+		}
+	}
+}
+
+static void resample_rows_vertical( void *user_data, int first, int last )
+{
+	const resample_job *job = (const resample_job*)user_data;
+	const int row_size = job->resampled_width * job->channels;
+	const int taps = job->vertical.taps;
+	int i, y, t;
+	for( y = first; y < last; ++y )
+	{
+		const int *index = job->vertical.index + y * taps;
+		const short *weight = job->vertical.weight + y * taps;
+		unsigned char *out = job->resampled + y * row_size;
+		i = 0;
+#ifdef IMAGE_HELPER_SSE2
+		{
+			const __m128i zero = _mm_setzero_si128();
+			const __m128i round = _mm_set1_epi32( 1 << 19 );
+			for( ; i + 8 <= row_size; i += 8 )
+			{
+				__m128i lo = round, hi = round;
+				/*	two source rows per multiply-add	*/
+				for( t = 0; t < taps; t += 2 )
+				{
+					__m128i a = _mm_loadu_si128( (const __m128i*)(job->tmp + index[t] * row_size + i) );
+					__m128i b = zero;
+					int w = (unsigned short)weight[t];
+					if( t + 1 < taps )
+					{
+						b = _mm_loadu_si128( (const __m128i*)(job->tmp + index[t+1] * row_size + i) );
+						w |= (int)weight[t+1] << 16;
+					}
+					lo = _mm_add_epi32( lo, _mm_madd_epi16( _mm_unpacklo_epi16( a, b ), _mm_set1_epi32( w ) ) );
+					hi = _mm_add_epi32( hi, _mm_madd_epi16( _mm_unpackhi_epi16( a, b ), _mm_set1_epi32( w ) ) );
+				}
+				lo = _mm_srai_epi32( lo, 20 );
+				hi = _mm_srai_epi32( hi, 20 );
+				_mm_storel_epi64( (__m128i*)(out + i), _mm_packus_epi16( _mm_packs_epi32( lo, hi ), zero ) );
+			}
+		}
+#endif
+		for( ; i < row_size; ++i )
+		{
+			int sum = 1 << 19;
+			for( t = 0; t < taps; ++t )
+			{
+				sum += weight[t] * job->tmp[index[t] * row_size + i];
+			}
+			out[i] = clamp_byte( sum >> 20 );
+		}
+	}
+}
+
+int
+	resample_image
+	(
+		const unsigned char* const orig,
+		int width, int height, int channels,
+		unsigned char* resampled,
+		int resampled_width, int resampled_height,
+		int filter
+	)
+{
+	resample_job job;
+	int result = 0;
+	/*	error check	*/
+	if( (width < 1) || (height < 1) ||
+		(resampled_width < 1) || (resampled_height < 1) ||
+		(channels < 1) || (orig == NULL) ||
+		(resampled == NULL) )
+	{
+		/*	nothing to do	*/
+		return 0;
+	}
+	memset( &job, 0, sizeof(job) );
+	job.orig = orig;
+	job.width = width;
+	job.channels = channels;
+	job.resampled = resampled;
+	job.resampled_width = resampled_width;
+	job.tmp = (short*)malloc( height * resampled_width * channels * sizeof(short) );
+	if( (NULL != job.tmp) &&
+		build_resample_axis( &job.horizontal, width, resampled_width, filter ) &&
+		build_resample_axis( &job.vertical, height, resampled_height, filter ) )
+	{
+		image_parallel_for( height, rows_per_task( resampled_width ), resample_rows_horizontal, &job );
+		image_parallel_for( resampled_height, rows_per_task( resampled_width ), resample_rows_vertical, &job );
+		result = 1;
+	}
+	free( job.horizontal.index );
+	free( job.horizontal.weight );
+	free( job.vertical.index );
+	free( job.vertical.weight );
+	free( job.tmp );
+	return result;
+}
+
 int
 	scale_image_RGB_to_NTSC_safe
 	(
@@ -43,6 +43,36 @@ int
 		int block_size_x, int block_size_y
 	);
 
+/**
+	Filters for resample_image.
+	SOIL_RESAMPLE_BOX averages the covered source pixels,
+	SOIL_RESAMPLE_TRIANGLE is bilinear (tent) filtering and
+	SOIL_RESAMPLE_LANCZOS3 is the sharpest, at the cost of
+	more taps and a little ringing.
+**/
+enum
+{
+	SOIL_RESAMPLE_BOX = 0,
+	SOIL_RESAMPLE_TRIANGLE = 1,
+	SOIL_RESAMPLE_LANCZOS3 = 2
+};
+
+/**
+	This function resamples an image to any size with the
+	given filter (usually to shrink it).  The passes are
+	vectorised and large images are split across threads.
+	\return 0 if failed, otherwise returns 1
+**/
+int
+	resample_image
+	(
+		const unsigned char* const orig,
+		int width, int height, int channels,
+		unsigned char* resampled,
+		int resampled_width, int resampled_height,
+		int filter
+	);
+
 /**
 	This function takes the RGB components of the image
 	and scales each channel from [0,255] to [16,235].
@@ -0,0 +1,156 @@
+/*
+    Parallel helper functions
+
+    MIT license
+*/
+
+#include "image_parallel.h"
+
+#ifdef _WIN32
+	#define WIN32_LEAN_AND_MEAN
+	#include <windows.h>
+#else
+	#include <pthread.h>
+	#include <unistd.h>
+#endif
+
+#define IMAGE_PARALLEL_MAX_THREADS 64
+
+typedef struct
+{
+	image_parallel_func func;
+	void *user_data;
+	int first, last;
+} image_parallel_task;
+
+static int image_parallel_threads = 0;
+
+int
+	image_parallel_thread_count
+	(
+		void
+	)
+{
+	if( image_parallel_threads < 1 )
+	{
+		int cpus;
+#ifdef _WIN32
+		SYSTEM_INFO info;
+		GetSystemInfo( &info );
+		cpus = (int)info.dwNumberOfProcessors;
+#else
+		cpus = (int)sysconf( _SC_NPROCESSORS_ONLN );
+#endif
+		if( cpus < 1 )
+		{
+			cpus = 1;
+		}
+		if( cpus > IMAGE_PARALLEL_MAX_THREADS )
+		{
+			cpus = IMAGE_PARALLEL_MAX_THREADS;
+		}
+		image_parallel_threads = cpus;
+	}
+	return image_parallel_threads;
+}
+
+void
+	image_parallel_set_thread_count
+	(
+		int thread_count
+	)
+{
+	if( thread_count > IMAGE_PARALLEL_MAX_THREADS )
+	{
+		thread_count = IMAGE_PARALLEL_MAX_THREADS;
+	}
+	image_parallel_threads = thread_count;
+}
+
+#ifdef _WIN32
+static DWORD WINAPI image_parallel_thread( LPVOID param )
+{
+	image_parallel_task *task = (image_parallel_task*)param;
+	task->func( task->user_data, task->first, task->last );
+	return 0;
+}
+#else
+static void* image_parallel_thread( void *param )
+{
+	image_parallel_task *task = (image_parallel_task*)param;
+	task->func( task->user_data, task->first, task->last );
+	return NULL;
+}
+#endif
+
+void
+	image_parallel_for
+	(
+		int count, int min_per_task,
+		image_parallel_func func, void *user_data
+	)
+{
+	image_parallel_task tasks[IMAGE_PARALLEL_MAX_THREADS];
+#ifdef _WIN32
+	HANDLE threads[IMAGE_PARALLEL_MAX_THREADS];
+#else
+	pthread_t threads[IMAGE_PARALLEL_MAX_THREADS];
+#endif
+	int started[IMAGE_PARALLEL_MAX_THREADS];
+	int num_tasks, i;
+
+	if( count <= 0 )
+	{
+		return;
+	}
+	if( min_per_task < 1 )
+	{
+		min_per_task = 1;
+	}
+	/*	don't bother with threads for tiny jobs	*/
+	num_tasks = image_parallel_thread_count();
+	if( num_tasks > count / min_per_task )
+	{
+		num_tasks = count / min_per_task;
+	}
+	if( num_tasks <= 1 )
+	{
+		func( user_data, 0, count );
+		return;
+	}
+	/*	contiguous ranges, the first (count % num_tasks) get one extra item	*/
+	for( i = 0; i < num_tasks; ++i )
+	{
+		tasks[i].func = func;
+		tasks[i].user_data = user_data;
+		tasks[i].first = (int)((long long)count * i / num_tasks);
+		tasks[i].last = (int)((long long)count * (i+1) / num_tasks);
+	}
+	/*	farm out all but the first range; if a thread can't be
+		started, that range is just run here instead	*/
+	for( i = 1; i < num_tasks; ++i )
+	{
+#ifdef _WIN32
+		threads[i] = CreateThread( NULL, 0, image_parallel_thread, &tasks[i], 0, NULL );
+		started[i] = (NULL != threads[i]);
+#else
+		started[i] = (0 == pthread_create( &threads[i], NULL, image_parallel_thread, &tasks[i] ));
+#endif
+	}
+	func( user_data, tasks[0].first, tasks[0].last );
+	for( i = 1; i < num_tasks; ++i )
+	{
+		if( started[i] )
+		{
+#ifdef _WIN32
+			WaitForSingleObject( threads[i], INFINITE );
+			CloseHandle( threads[i] );
+#else
+			pthread_join( threads[i], NULL );
+#endif
+		} else
+		{
+			func( user_data, tasks[i].first, tasks[i].last );
+		}
+	}
+}
@@ -0,0 +1,59 @@
+/*
+    Parallel helper functions
+
+    Splits image work (rows, blocks, ...) across the available CPUs.
+    Uses Win32 threads on Windows and pthreads everywhere else.
+
+    MIT license
+*/
+
+#ifndef HEADER_IMAGE_PARALLEL
+#define HEADER_IMAGE_PARALLEL
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+	Called for each contiguous range [first,last) of the work.
+**/
+typedef void (*image_parallel_func)( void *user_data, int first, int last );
+
+/**
+	The number of threads image_parallel_for will use, at least 1.
+	Defaults to the number of online CPUs.
+**/
+int
+	image_parallel_thread_count
+	(
+		void
+	);
+
+/**
+	Overrides the thread count, 1 turns threading off
+	and 0 goes back to the number of online CPUs.
+**/
+void
+	image_parallel_set_thread_count
+	(
+		int thread_count
+	);
+
+/**
+	Splits [0,count) into one contiguous range per thread and
+	runs func on each, returning when they are all done.  Small
+	jobs (fewer than 2*min_per_task items) run on the calling
+	thread, as does the first range of every job.
+**/
+void
+	image_parallel_for
+	(
+		int count, int min_per_task,
+		image_parallel_func func, void *user_data
+	);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* HEADER_IMAGE_PARALLEL	*/
@@ -114,6 +114,98 @@ typedef unsigned char validate_uint32[sizeof(uint32)==4 ? 1 : -1];
    #define stbi_lrot(x,y)  (((x) << (y)) | ((x) >> (32 - (y))))
 #endif
 
+///////////////////////////////////////////////
+//
+//  runtime SIMD kernel selection
+//
+//  the JPEG IDCT, upsampling and colour conversion have SSE2 (and for the
+//  colour conversion AVX2) versions on x86; everything else, including
+//  ARM, keeps using the portable scalar code. define STBI_NO_SIMD to
+//  compile the kernels out entirely.
+
+#if !defined(STBI_NO_SIMD) && !defined(STBI_SIMD) && \
+    (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+   #define STBI_SSE2
+   #include <emmintrin.h>
+   #if defined(_MSC_VER) && _MSC_VER >= 1700
+      #define STBI_AVX2
+      #include <intrin.h>
+      #include <immintrin.h>
+      #define STBI_AVX2_TARGET
+   #elif defined(__GNUC__) && ((__GNUC__ > 4) || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9) || defined(__clang__))
+      #define STBI_AVX2
+      #include <cpuid.h>
+      #include <immintrin.h>
+      #define STBI_AVX2_TARGET __attribute__((target("avx2")))
+   #endif
+#endif
+
+enum
+{
+   STBI_CPU_SSE2 = 1,
+   STBI_CPU_AVX2 = 2
+};
+
+// -1 until the first decode queries the cpu
+static int stbi_cpu_features = -1;
+static int stbi_simd_enabled = 1;
+
+void stbi_set_simd(int flag_true_if_should_use_simd)
+{
+   stbi_simd_enabled = flag_true_if_should_use_simd;
+}
+
+#ifdef STBI_AVX2
+static void stbi_cpuid(int leaf, int regs[4])
+{
+   #ifdef _MSC_VER
+   __cpuidex(regs, leaf, 0);
+   #else
+   unsigned int a=0,b=0,c=0,d=0;
+   __cpuid_count(leaf, 0, a, b, c, d);
+   regs[0] = (int) a; regs[1] = (int) b; regs[2] = (int) c; regs[3] = (int) d;
+   #endif
+}
+
+// AVX2 needs both the cpu flag and the OS saving the ymm registers
+static int stbi_cpu_has_avx2(void)
+{
+   int regs[4];
+   unsigned int xcr0_lo;
+   stbi_cpuid(0, regs);
+   if (regs[0] < 7) return 0;
+   stbi_cpuid(1, regs);
+   if (!(regs[2] & (1 << 27))) return 0; // OSXSAVE
+   #ifdef _MSC_VER
+   xcr0_lo = (unsigned int) _xgetbv(0);
+   #else
+   {
+      unsigned int xcr0_hi;
+      __asm__ __volatile__ ("xgetbv" : "=a" (xcr0_lo), "=d" (xcr0_hi) : "c" (0));
+   }
+   #endif
+   if ((xcr0_lo & 6) != 6) return 0;
+   stbi_cpuid(7, regs);
+   return (regs[1] >> 5) & 1;
+}
+#endif
+
+static int stbi_cpu(void)
+{
+   if (stbi_cpu_features < 0) {
+      int features = 0;
+      #ifdef STBI_SSE2
+      // every cpu able to run code compiled with SSE2 enabled has SSE2
+      features |= STBI_CPU_SSE2;
+      #endif
+      #ifdef STBI_AVX2
+      if (stbi_cpu_has_avx2()) features |= STBI_CPU_AVX2;
+      #endif
+      stbi_cpu_features = features;
+   }
+   return stbi_simd_enabled ? stbi_cpu_features : 0;
+}
+
 ///////////////////////////////////////////////
 //
 //  stbi struct and start_xxx functions
@@ -128,6 +220,12 @@ typedef struct
    stbi_io_callbacks io;
    void *io_user_data;
 
+   int jpeg_max_dimension; // 0 for full size, see stbi_load_max_dimension
+
+   stbi_output_func output; // NULL to allocate the result, see stbi_load_into
+   void *output_user;
+   int flip_vertically;
+
    int read_from_callbacks;
    int buflen;
    uint8 buffer_start[128];
@@ -143,6 +241,9 @@ static void refill_buffer(stbi *s);
 static void start_mem(stbi *s, uint8 const *buffer, int len)
 {
    s->io.read = NULL;
+   s->jpeg_max_dimension = 0;
+   s->output = NULL;
+   s->flip_vertically = 0;
    s->read_from_callbacks = 0;
    s->img_buffer = s->img_buffer_original = (uint8 *) buffer;
    s->img_buffer_end = (uint8 *) buffer+len;
@@ -153,6 +254,9 @@ static void start_callbacks(stbi *s, stbi_io_callbacks *c, void *user)
 {
    s->io = *c;
    s->io_user_data = user;
+   s->jpeg_max_dimension = 0;
+   s->output = NULL;
+   s->flip_vertically = 0;
    s->buflen = sizeof(s->buffer_start);
    s->read_from_callbacks = 1;
    s->img_buffer_original = s->buffer_start;
@@ -341,6 +445,83 @@ unsigned char *stbi_load_from_callbacks(stbi_io_callbacks const *clbk, void *use
    return stbi_load_main(&s,x,y,comp,req_comp);
 }
 
+unsigned char *stbi_load_from_memory_max_dimension(stbi_uc const *buffer, int len, int *x, int *y, int *comp, int req_comp, int max_dimension)
+{
+   stbi s;
+   start_mem(&s,buffer,len);
+   s.jpeg_max_dimension = max_dimension;
+   return stbi_load_main(&s,x,y,comp,req_comp);
+}
+
+#ifndef STBI_NO_STDIO
+unsigned char *stbi_load_max_dimension(char const *filename, int *x, int *y, int *comp, int req_comp, int max_dimension)
+{
+   FILE *f = fopen(filename, "rb");
+   unsigned char *result;
+   stbi s;
+   if (!f) return epuc("can't fopen", "Unable to open file");
+   start_file(&s,f);
+   s.jpeg_max_dimension = max_dimension;
+   result = stbi_load_main(&s,x,y,comp,req_comp);
+   fclose(f);
+   return result;
+}
+#endif
+
+static int stbi_load_into_main(stbi *s, int *x, int *y, int *comp, int req_comp)
+{
+   uint8 *data, *output;
+   int n, j, stride;
+
+   // jpegs write their rows directly into the output
+   if (stbi_jpeg_test(s))
+      return stbi_jpeg_load(s,x,y,comp,req_comp) != NULL;
+
+   // everything else is decoded as usual, then copied across in the right row order
+   data = stbi_load_main(s,x,y,comp,req_comp);
+   if (data == NULL) return 0;
+   n = req_comp ? req_comp : *comp;
+   output = s->output(s->output_user, *x, *y, n);
+   if (output == NULL) {
+      stbi_image_free(data);
+      return e("output refused", "Output buffer not available");
+   }
+   stride = n * *x;
+   for (j=0; j < *y; ++j)
+      memcpy(output + stride * (s->flip_vertically ? *y-1 - j : j), data + stride * j, stride);
+   stbi_image_free(data);
+   return 1;
+}
+
+int stbi_load_from_memory_into(stbi_uc const *buffer, int len, int *x, int *y, int *comp, int req_comp, int max_dimension, int flip_vertically, stbi_output_func output, void *user)
+{
+   stbi s;
+   start_mem(&s,buffer,len);
+   s.jpeg_max_dimension = max_dimension;
+   s.output = output;
+   s.output_user = user;
+   s.flip_vertically = flip_vertically;
+   return stbi_load_into_main(&s,x,y,comp,req_comp);
+}
+
+#ifndef STBI_NO_STDIO
+int stbi_load_into(char const *filename, int *x, int *y, int *comp, int req_comp, int max_dimension, int flip_vertically, stbi_output_func output, void *user)
+{
+   FILE *f = fopen(filename, "rb");
+   int result;
+   stbi s;
+   if (!f) return e("can't fopen", "Unable to open file");
+   start_file(&s,f);
+   s.jpeg_max_dimension = max_dimension;
+   s.output = output;
+   s.output_user = user;
+   s.flip_vertically = flip_vertically;
+   result = stbi_load_into_main(&s,x,y,comp,req_comp);
+   fclose(f);
+   return result;
+}
+#endif
+
 #ifndef STBI_NO_HDR
 
 float *stbi_loadf_main(stbi *s, int *x, int *y, int *comp, int req_comp)
@@ -753,6 +934,9 @@ typedef struct
 
    int scan_n, order[4];
    int restart_interval, todo;
+
+   int scale_shift; // log2 of the DCT-domain downscale, 0..3
+   int coef_limit;  // last zigzag index the (possibly reduced) IDCT needs
 } jpeg;
 
 static int build_huffman(huffman *h, int *count)
@@ -911,6 +1095,14 @@ static uint8 dezigzag[64+15] =
 };
 
 // decode one 64-entry block--
+// discard n bits of the entropy stream without decoding them
+stbi_inline static void skip_bits(jpeg *j, int n)
+{
+   if (j->code_bits < n) grow_buffer_unsafe(j);
+   j->code_buffer <<= n;
+   j->code_bits -= n;
+}
+
 static int decode_block(jpeg *j, short data[64], huffman *hdc, huffman *hac, int b)
 {
    int diff,dc,k;
@@ -938,8 +1130,14 @@ static int decode_block(jpeg *j, short data[64], huffman *hdc, huffman *hac, int
          k += 16;
       } else {
          k += r;
-         // decode into unzigzag'd location
-         data[dezigzag[k++]] = (short) extend_receive(j,s);
+         // decode into unzigzag'd location, or just step over coefficients
+         // that a scaled decode's reduced IDCT will never look at
+         if (k <= j->coef_limit)
+            data[dezigzag[k++]] = (short) extend_receive(j,s);
+         else {
+            skip_bits(j,s);
+            ++k;
+         }
       }
    } while (k < 64);
    return 1;
@@ -1065,6 +1263,269 @@ static void idct_block(uint8 *out, int out_stride, short data[64], stbi_dequanti
    }
 }
 
+#ifdef STBI_SSE2
+// sse2 version of idct_block, producing the same output: both passes
+// work on all eight columns (rows) at once, with a transpose in between.
+// the even/odd rotations from IDCT_1D are folded into pmaddwd pairs.
+static void idct_block_sse2(uint8 *out, int out_stride, short data[64], stbi_dequantize_t *dequantize)
+{
+   __m128i row0, row1, row2, row3, row4, row5, row6, row7;
+   __m128i tmp;
+
+   // dot product constant: even elems=x, odd elems=y
+   #define dct_const(x,y)  _mm_setr_epi16((x),(y),(x),(y),(x),(y),(x),(y))
+
+   // out(0) = c0[even]*x + c0[odd]*y   (c0, x, y 16-bit, out 32-bit)
+   // out(1) = c1[even]*x + c1[odd]*y
+   #define dct_rot(out0,out1, x,y,c0,c1) \
+      __m128i c0##lo = _mm_unpacklo_epi16((x),(y)); \
+      __m128i c0##hi = _mm_unpackhi_epi16((x),(y)); \
+      __m128i out0##_l = _mm_madd_epi16(c0##lo, c0); \
+      __m128i out0##_h = _mm_madd_epi16(c0##hi, c0); \
+      __m128i out1##_l = _mm_madd_epi16(c0##lo, c1); \
+      __m128i out1##_h = _mm_madd_epi16(c0##hi, c1)
+
+   // out = in << 12  (in 16-bit, out 32-bit)
+   #define dct_widen(out, in) \
+      __m128i out##_l = _mm_srai_epi32(_mm_unpacklo_epi16(_mm_setzero_si128(), (in)), 4); \
+      __m128i out##_h = _mm_srai_epi32(_mm_unpackhi_epi16(_mm_setzero_si128(), (in)), 4)
+
+   #define dct_wadd(out, a, b) \
+      __m128i out##_l = _mm_add_epi32(a##_l, b##_l); \
+      __m128i out##_h = _mm_add_epi32(a##_h, b##_h)
+
+   #define dct_wsub(out, a, b) \
+      __m128i out##_l = _mm_sub_epi32(a##_l, b##_l); \
+      __m128i out##_h = _mm_sub_epi32(a##_h, b##_h)
+
+   // butterfly a/b, add bias, then shift by "s" and pack
+   #define dct_bfly32o(out0, out1, a,b,bias,s) \
+      { \
+         __m128i abiased_l = _mm_add_epi32(a##_l, bias); \
+         __m128i abiased_h = _mm_add_epi32(a##_h, bias); \
+         dct_wadd(sum, abiased, b); \
+         dct_wsub(dif, abiased, b); \
+         out0 = _mm_packs_epi32(_mm_srai_epi32(sum_l, s), _mm_srai_epi32(sum_h, s)); \
+         out1 = _mm_packs_epi32(_mm_srai_epi32(dif_l, s), _mm_srai_epi32(dif_h, s)); \
+      }
+
+   // 8-bit interleave step (for transposes)
+   #define dct_interleave8(a, b) \
+      tmp = a; \
+      a = _mm_unpacklo_epi8(a, b); \
+      b = _mm_unpackhi_epi8(tmp, b)
+
+   // 16-bit interleave step (for transposes)
+   #define dct_interleave16(a, b) \
+      tmp = a; \
+      a = _mm_unpacklo_epi16(a, b); \
+      b = _mm_unpackhi_epi16(tmp, b)
+
+   #define dct_pass(bias,shift) \
+      { \
+         /* even part */ \
+         dct_rot(t2e,t3e, row2,row6, rot0_0,rot0_1); \
+         __m128i sum04 = _mm_add_epi16(row0, row4); \
+         __m128i dif04 = _mm_sub_epi16(row0, row4); \
+         dct_widen(t0e, sum04); \
+         dct_widen(t1e, dif04); \
+         dct_wadd(x0, t0e, t3e); \
+         dct_wsub(x3, t0e, t3e); \
+         dct_wadd(x1, t1e, t2e); \
+         dct_wsub(x2, t1e, t2e); \
+         /* odd part */ \
+         dct_rot(y0o,y2o, row7,row3, rot2_0,rot2_1); \
+         dct_rot(y1o,y3o, row5,row1, rot3_0,rot3_1); \
+         __m128i sum17 = _mm_add_epi16(row1, row7); \
+         __m128i sum35 = _mm_add_epi16(row3, row5); \
+         dct_rot(y4o,y5o, sum17,sum35, rot1_0,rot1_1); \
+         dct_wadd(x4, y0o, y4o); \
+         dct_wadd(x5, y1o, y5o); \
+         dct_wadd(x6, y2o, y5o); \
+         dct_wadd(x7, y3o, y4o); \
+         dct_bfly32o(row0,row7, x0,x7,bias,shift); \
+         dct_bfly32o(row1,row6, x1,x6,bias,shift); \
+         dct_bfly32o(row2,row5, x2,x5,bias,shift); \
+         dct_bfly32o(row3,row4, x3,x4,bias,shift); \
+      }
+
+   __m128i rot0_0 = dct_const(f2f(0.5411961f), f2f(0.5411961f) + f2f(-1.847759065f));
+   __m128i rot0_1 = dct_const(f2f(0.5411961f) + f2f( 0.765366865f), f2f(0.5411961f));
+   __m128i rot1_0 = dct_const(f2f(1.175875602f) + f2f(-0.899976223f), f2f(1.175875602f));
+   __m128i rot1_1 = dct_const(f2f(1.175875602f), f2f(1.175875602f) + f2f(-2.562915447f));
+   __m128i rot2_0 = dct_const(f2f(-1.961570560f) + f2f( 0.298631336f), f2f(-1.961570560f));
+   __m128i rot2_1 = dct_const(f2f(-1.961570560f), f2f(-1.961570560f) + f2f( 3.072711026f));
+   __m128i rot3_0 = dct_const(f2f(-0.390180644f) + f2f( 2.053119869f), f2f(-0.390180644f));
+   __m128i rot3_1 = dct_const(f2f(-0.390180644f), f2f(-0.390180644f) + f2f( 1.501321110f));
+
+   // rounding biases in column/row passes, see idct_block for explanation.
+   __m128i bias_0 = _mm_set1_epi32(512);
+   __m128i bias_1 = _mm_set1_epi32(65536 + (128<<17));
+   __m128i zero = _mm_setzero_si128();
+
+   // load and dequantize
+   #define dct_load(row, r) \
+      row = _mm_mullo_epi16(_mm_loadu_si128((const __m128i *) (data + (r)*8)), \
+                            _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *) (dequantize + (r)*8)), zero))
+   dct_load(row0, 0);
+   dct_load(row1, 1);
+   dct_load(row2, 2);
+   dct_load(row3, 3);
+   dct_load(row4, 4);
+   dct_load(row5, 5);
+   dct_load(row6, 6);
+   dct_load(row7, 7);
+
+   // column pass
+   dct_pass(bias_0, 10);
+
+   {
+      // 16bit 8x8 transpose pass 1
+      dct_interleave16(row0, row4);
+      dct_interleave16(row1, row5);
+      dct_interleave16(row2, row6);
+      dct_interleave16(row3, row7);
+
+      // transpose pass 2
+      dct_interleave16(row0, row2);
+      dct_interleave16(row1, row3);
+      dct_interleave16(row4, row6);
+      dct_interleave16(row5, row7);
+
+      // transpose pass 3
+      dct_interleave16(row0, row1);
+      dct_interleave16(row2, row3);
+      dct_interleave16(row4, row5);
+      dct_interleave16(row6, row7);
+   }
+
+   // row pass
+   dct_pass(bias_1, 17);
+
+   {
+      // pack
+      __m128i p0 = _mm_packus_epi16(row0, row1); // a0a1a2a3...a7b0b1b2b3...b7
+      __m128i p1 = _mm_packus_epi16(row2, row3);
+      __m128i p2 = _mm_packus_epi16(row4, row5);
+      __m128i p3 = _mm_packus_epi16(row6, row7);
+
+      // 8bit 8x8 transpose pass 1
+      dct_interleave8(p0, p2); // a0e0a1e1...
+      dct_interleave8(p1, p3); // c0g0c1g1...
+
+      // transpose pass 2
+      dct_interleave8(p0, p1); // a0c0e0g0...
+      dct_interleave8(p2, p3); // b0d0f0h0...
+
+      // transpose pass 3
+      dct_interleave8(p0, p2); // a0b0c0d0...
+      dct_interleave8(p1, p3); // a4b4c4d4...
+
+      // store
+      _mm_storel_epi64((__m128i *) out, p0); out += out_stride;
+      _mm_storel_epi64((__m128i *) out, _mm_shuffle_epi32(p0, 0x4e)); out += out_stride;
+      _mm_storel_epi64((__m128i *) out, p2); out += out_stride;
+      _mm_storel_epi64((__m128i *) out, _mm_shuffle_epi32(p2, 0x4e)); out += out_stride;
+      _mm_storel_epi64((__m128i *) out, p1); out += out_stride;
+      _mm_storel_epi64((__m128i *) out, _mm_shuffle_epi32(p1, 0x4e)); out += out_stride;
+      _mm_storel_epi64((__m128i *) out, p3); out += out_stride;
+      _mm_storel_epi64((__m128i *) out, _mm_shuffle_epi32(p3, 0x4e));
+   }
+
+   #undef dct_const
+   #undef dct_rot
+   #undef dct_widen
+   #undef dct_wadd
+   #undef dct_wsub
+   #undef dct_bfly32o
+   #undef dct_interleave8
+   #undef dct_interleave16
+   #undef dct_pass
+   #undef dct_load
+}
+#endif // STBI_SSE2
+
+#ifndef STBI_SIMD
+// reduced-size IDCTs for scaled decoding: an NxN inverse DCT of the lowest
+// NxN coefficients gives the block downsampled by 8/N directly, so we never
+// reconstruct the pixels we're about to throw away. the constants already
+// include the 1/2 (and 1/sqrt(2) for DC) normalization of the 8-point IDCT
+#define IDCT_4(s0,s1,s2,s3) \
+   e0 = ((s0) + (s2)) * f2f(0.35355339f); \
+   e1 = ((s0) - (s2)) * f2f(0.35355339f); \
+   o0 = (s1) * f2f(0.46193977f) + (s3) * f2f(0.19134172f); \
+   o1 = (s1) * f2f(0.19134172f) - (s3) * f2f(0.46193977f);
+
+static void idct_block_4x4(uint8 *out, int out_stride, short data[64], stbi_dequantize_t *dequantize)
+{
+   int i,val[16],*v=val;
+   int e0,e1,o0,o1;
+   stbi_dequantize_t *dq = dequantize;
+   short *d = data;
+
+   // columns, keeping 2 extra bits of precision like idct_block
+   for (i=0; i < 4; ++i,++d,++dq,++v) {
+      if (d[8]==0 && d[16]==0 && d[24]==0) {
+         int dcterm = (d[0]*dq[0] * f2f(0.35355339f) + 512) >> 10;
+         v[0] = v[4] = v[8] = v[12] = dcterm;
+      } else {
+         IDCT_4(d[ 0]*dq[ 0],d[ 8]*dq[ 8],d[16]*dq[16],d[24]*dq[24])
+         e0 += 512; e1 += 512;
+         v[ 0] = (e0+o0) >> 10;
+         v[ 4] = (e1+o1) >> 10;
+         v[ 8] = (e1-o1) >> 10;
+         v[12] = (e0-o0) >> 10;
+      }
+   }
+
+   // rows, then drop the extra precision and level shift back to unsigned
+   for (i=0, v=val; i < 4; ++i, v+=4, out+=out_stride) {
+      IDCT_4(v[0],v[1],v[2],v[3])
+      e0 += (1 << 13) + (128 << 14);
+      e1 += (1 << 13) + (128 << 14);
+      out[0] = clamp((e0+o0) >> 14);
+      out[1] = clamp((e1+o1) >> 14);
+      out[2] = clamp((e1-o1) >> 14);
+      out[3] = clamp((e0-o0) >> 14);
+   }
+}
+
+static void idct_block_2x2(uint8 *out, int out_stride, short data[64], stbi_dequantize_t *dequantize)
+{
+   int i,val[4];
+   for (i=0; i < 2; ++i) {
+      int p0 = data[i]*dequantize[i], p1 = data[8+i]*dequantize[8+i];
+      val[i]   = ((p0+p1) * f2f(0.35355339f) + 512) >> 10;
+      val[2+i] = ((p0-p1) * f2f(0.35355339f) + 512) >> 10;
+   }
+   for (i=0; i < 2; ++i, out+=out_stride) {
+      int p0 = val[i*2], p1 = val[i*2+1];
+      out[0] = clamp(((p0+p1) * f2f(0.35355339f) + (1 << 13) + (128 << 14)) >> 14);
+      out[1] = clamp(((p0-p1) * f2f(0.35355339f) + (1 << 13) + (128 << 14)) >> 14);
+   }
+}
+
+// at 1/8 scale each block is just its DC term, which is the block average
+static void idct_block_1x1(uint8 *out, int out_stride, short data[64], stbi_dequantize_t *dequantize)
+{
+   out[0] = clamp(((data[0] * dequantize[0] + 4) >> 3) + 128);
+}
+
+typedef void (*idct_block_func)(uint8 *out, int out_stride, short data[64], stbi_dequantize_t *dequantize);
+
+// 'shift' is the log2 of the downscale factor, 0 for a full size decode
+static idct_block_func select_idct_block(int shift)
+{
+   if (shift == 1) return idct_block_4x4;
+   if (shift == 2) return idct_block_2x2;
+   if (shift == 3) return idct_block_1x1;
+   #ifdef STBI_SSE2
+   if (stbi_cpu() & STBI_CPU_SSE2) return idct_block_sse2;
+   #endif
+   return idct_block;
+}
+#endif
+
 #ifdef STBI_SIMD
 static stbi_idct_8x8 stbi_idct_installed = idct_block;
 
@@ -1109,6 +1570,11 @@ static void reset(jpeg *j)
 
 static int parse_entropy_coded_data(jpeg *z)
 {
+   // output block size, smaller than 8 when decoding at a reduced scale
+   int bs = 8 >> z->scale_shift;
+   #ifndef STBI_SIMD
+   idct_block_func idct = select_idct_block(z->scale_shift);
+   #endif
    reset(z);
    if (z->scan_n == 1) {
       int i,j;
@@ -1129,7 +1595,7 @@ static int parse_entropy_coded_data(jpeg *z)
             #ifdef STBI_SIMD
             stbi_idct_installed(z->img_comp[n].data+z->img_comp[n].w2*j*8+i*8, z->img_comp[n].w2, data, z->dequant2[z->img_comp[n].tq]);
             #else
-            idct_block(z->img_comp[n].data+z->img_comp[n].w2*j*8+i*8, z->img_comp[n].w2, data, z->dequant[z->img_comp[n].tq]);
+            idct(z->img_comp[n].data+z->img_comp[n].w2*j*bs+i*bs, z->img_comp[n].w2, data, z->dequant[z->img_comp[n].tq]);
             #endif
             // every data block is an MCU, so countdown the restart interval
             if (--z->todo <= 0) {
@@ -1153,13 +1619,13 @@ static int parse_entropy_coded_data(jpeg *z)
                // by the basic H and V specified for the component
                for (y=0; y < z->img_comp[n].v; ++y) {
                   for (x=0; x < z->img_comp[n].h; ++x) {
-                     int x2 = (i*z->img_comp[n].h + x)*8;
-                     int y2 = (j*z->img_comp[n].v + y)*8;
+                     int x2 = (i*z->img_comp[n].h + x)*bs;
+                     int y2 = (j*z->img_comp[n].v + y)*bs;
                      if (!decode_block(z, data, z->huff_dc+z->img_comp[n].hd, z->huff_ac+z->img_comp[n].ha, n)) return 0;
                      #ifdef STBI_SIMD
                      stbi_idct_installed(z->img_comp[n].data+z->img_comp[n].w2*y2+x2, z->img_comp[n].w2, data, z->dequant2[z->img_comp[n].tq]);
                      #else
-                     idct_block(z->img_comp[n].data+z->img_comp[n].w2*y2+x2, z->img_comp[n].w2, data, z->dequant[z->img_comp[n].tq]);
+                     idct(z->img_comp[n].data+z->img_comp[n].w2*y2+x2, z->img_comp[n].w2, data, z->dequant[z->img_comp[n].tq]);
                      #endif
                   }
                }
@@ -1273,6 +1739,22 @@ static int process_scan_header(jpeg *z)
    return 1;
 }
 
+// pick the smallest 1/2, 1/4 or 1/8 scale that still keeps the larger
+// side at or above the requested maximum dimension; the caller can
+// finish the reduction from there
+static int jpeg_scale_shift(stbi *s)
+{
+   int shift = 0;
+   #ifndef STBI_SIMD
+   if (s->jpeg_max_dimension > 0) {
+      uint32 larger = s->img_x > s->img_y ? s->img_x : s->img_y;
+      while (shift < 3 && (larger >> (shift+1)) >= (uint32) s->jpeg_max_dimension)
+         ++shift;
+   }
+   #endif
+   return shift;
+}
+
 static int process_frame_header(jpeg *z, int scan)
 {
    stbi *s = z->s;
@@ -1319,6 +1801,10 @@ static int process_frame_header(jpeg *z, int scan)
    z->img_mcu_x = (s->img_x + z->img_mcu_w-1) / z->img_mcu_w;
    z->img_mcu_y = (s->img_y + z->img_mcu_h-1) / z->img_mcu_h;
 
+   z->scale_shift = jpeg_scale_shift(s);
+   // zigzag positions of the bottom right coefficient of the 8x8, 4x4, 2x2 and 1x1 corners
+   z->coef_limit = z->scale_shift == 0 ? 63 : z->scale_shift == 1 ? 24 : z->scale_shift == 2 ? 4 : 0;
+
    for (i=0; i < s->img_n; ++i) {
       // number of effective pixels (e.g. for non-interleaved MCU)
       z->img_comp[i].x = (s->img_x * z->img_comp[i].h + h_max-1) / h_max;
@@ -1327,8 +1813,8 @@ static int process_frame_header(jpeg *z, int scan)
       // the bogus oversized data from using interleaved MCUs and their
       // big blocks (e.g. a 16x16 iMCU on an image of width 33); we won't
       // discard the extra data until colorspace conversion
-      z->img_comp[i].w2 = z->img_mcu_x * z->img_comp[i].h * 8;
-      z->img_comp[i].h2 = z->img_mcu_y * z->img_comp[i].v * 8;
+      z->img_comp[i].w2 = (z->img_mcu_x * z->img_comp[i].h * 8) >> z->scale_shift;
+      z->img_comp[i].h2 = (z->img_mcu_y * z->img_comp[i].v * 8) >> z->scale_shift;
       z->img_comp[i].raw_data = malloc(z->img_comp[i].w2 * z->img_comp[i].h2+15);
       if (z->img_comp[i].raw_data == NULL) {
          for(--i; i >= 0; --i) {
@@ -1484,6 +1970,98 @@ static uint8 *resample_row_hv_2(uint8 *out, uint8 *in_near, uint8 *in_far, int w
    return out;
 }
 
+#ifdef STBI_SSE2
+// same filter as resample_row_hv_2, 8 input pixels at a time
+static uint8 *resample_row_hv_2_sse2(uint8 *out, uint8 *in_near, uint8 *in_far, int w, int hs)
+{
+   int i=0,t0,t1;
+   if (w == 1) {
+      out[0] = out[1] = div4(3*in_near[0] + in_far[0] + 2);
+      return out;
+   }
+
+   t1 = 3*in_near[0] + in_far[0];
+   // the last input pixel is left to the scalar tail, which handles the
+   // filter boundary
+   for (; i < ((w-1) & ~7); i += 8) {
+      // vertical pass: 3*near + far = 4*near + (far - near)
+      __m128i zero  = _mm_setzero_si128();
+      __m128i farb  = _mm_loadl_epi64((__m128i *) (in_far + i));
+      __m128i nearb = _mm_loadl_epi64((__m128i *) (in_near + i));
+      __m128i farw  = _mm_unpacklo_epi8(farb, zero);
+      __m128i nearw = _mm_unpacklo_epi8(nearb, zero);
+      __m128i diff  = _mm_sub_epi16(farw, nearw);
+      __m128i nears = _mm_slli_epi16(nearw, 2);
+      __m128i curr  = _mm_add_epi16(nears, diff);
+
+      // horizontal pass on the current row shifted one pixel either way;
+      // "prev" takes its first value from the previous block (t1) and
+      // "next" its last value from the following block
+      __m128i prv0 = _mm_slli_si128(curr, 2);
+      __m128i nxt0 = _mm_srli_si128(curr, 2);
+      __m128i prev = _mm_insert_epi16(prv0, t1, 0);
+      __m128i next = _mm_insert_epi16(nxt0, 3*in_near[i+8] + in_far[i+8], 7);
+
+      // even pixels = 3*cur + prev = cur*4 + (prev - cur)
+      // odd  pixels = 3*cur + next = cur*4 + (next - cur)
+      __m128i bias = _mm_set1_epi16(8);
+      __m128i curs = _mm_slli_epi16(curr, 2);
+      __m128i prvd = _mm_sub_epi16(prev, curr);
+      __m128i nxtd = _mm_sub_epi16(next, curr);
+      __m128i curb = _mm_add_epi16(curs, bias);
+      __m128i even = _mm_add_epi16(prvd, curb);
+      __m128i odd  = _mm_add_epi16(nxtd, curb);
+
+      // interleave even and odd pixels, then undo scaling
+      __m128i int0 = _mm_unpacklo_epi16(even, odd);
+      __m128i int1 = _mm_unpackhi_epi16(even, odd);
+      __m128i de0  = _mm_srli_epi16(int0, 4);
+      __m128i de1  = _mm_srli_epi16(int1, 4);
+
+      _mm_storeu_si128((__m128i *) (out + i*2), _mm_packus_epi16(de0, de1));
+
+      t1 = 3*in_near[i+7] + in_far[i+7];
+   }
+
+   t0 = t1;
+   t1 = 3*in_near[i] + in_far[i];
+   out[i*2] = div16(3*t1 + t0 + 8);
+
+   for (++i; i < w; ++i) {
+      t0 = t1;
+      t1 = 3*in_near[i]+in_far[i];
+      out[i*2-1] = div16(3*t0 + t1 + 8);
+      out[i*2  ] = div16(3*t1 + t0 + 8);
+   }
+   out[w*2-1] = div4(t1+2);
+
+   STBI_NOTUSED(hs);
+
+   return out;
+}
+
+// same filter as resample_row_v_2, 16 pixels at a time
+static uint8 *resample_row_v_2_sse2(uint8 *out, uint8 *in_near, uint8 *in_far, int w, int hs)
+{
+   int i = 0;
+   __m128i zero = _mm_setzero_si128();
+   __m128i bias = _mm_set1_epi16(2);
+   STBI_NOTUSED(hs);
+   for (; i+15 < w; i += 16) {
+      __m128i nearb = _mm_loadu_si128((__m128i *) (in_near + i));
+      __m128i farb  = _mm_loadu_si128((__m128i *) (in_far + i));
+      __m128i nl = _mm_unpacklo_epi8(nearb, zero), nh = _mm_unpackhi_epi8(nearb, zero);
+      __m128i fl = _mm_unpacklo_epi8(farb, zero),  fh = _mm_unpackhi_epi8(farb, zero);
+      __m128i lo = _mm_add_epi16(_mm_add_epi16(_mm_add_epi16(nl, nl), nl), _mm_add_epi16(fl, bias));
+      __m128i hi = _mm_add_epi16(_mm_add_epi16(_mm_add_epi16(nh, nh), nh), _mm_add_epi16(fh, bias));
+      _mm_storeu_si128((__m128i *) (out + i), _mm_packus_epi16(_mm_srli_epi16(lo, 2), _mm_srli_epi16(hi, 2)));
+   }
+   for (; i < w; ++i)
+      out[i] = div4(3*in_near[i] + in_far[i] + 2);
+   return out;
+}
+#endif // STBI_SSE2
+
 static uint8 *resample_row_generic(uint8 *out, uint8 *in_near, uint8 *in_far, int w, int hs)
 {
    // resample with nearest-neighbor
@@ -1519,11 +2097,171 @@ static void YCbCr_to_RGB_row(uint8 *out, const uint8 *y, const uint8 *pcb, const
       out[0] = (uint8)r;
       out[1] = (uint8)g;
       out[2] = (uint8)b;
-      out[3] = 255;
+      if (step == 4) out[3] = 255; // rows can be stored bottom-up, so don't touch the next one
       out += step;
    }
 }
 
+#ifdef STBI_SSE2
+// the vector colour converters work in 16-bit lanes with 4 fractional
+// bits: y is scaled by 16 and the chroma constants are 4.12 fixed point
+// applied with a high multiply against (c-128)<<8. results can differ from
+// YCbCr_to_RGB_row by at most one.
+#define YCBCR_CONST(x) ((short) ((x)*4096.0f+0.5f))
+
+// pack 'count' (<= 16) RGBX pixels from 'src' into 3 byte pixels
+stbi_inline static uint8 *rgbx_to_rgb(uint8 *out, const uint8 *src, int count)
+{
+   int i;
+   for (i=0; i < count; ++i, src += 4, out += 3) {
+      out[0] = src[0];
+      out[1] = src[1];
+      out[2] = src[2];
+   }
+   return out;
+}
+
+static void YCbCr_to_RGB_row_sse2(uint8 *out, const uint8 *y, const uint8 *pcb, const uint8 *pcr, int count, int step)
+{
+   int i = 0;
+   __m128i signflip  = _mm_set1_epi8(-0x80);
+   __m128i cr_const0 = _mm_set1_epi16( YCBCR_CONST(1.40200f));
+   __m128i cr_const1 = _mm_set1_epi16(-YCBCR_CONST(0.71414f));
+   __m128i cb_const0 = _mm_set1_epi16(-YCBCR_CONST(0.34414f));
+   __m128i cb_const1 = _mm_set1_epi16( YCBCR_CONST(1.77200f));
+   __m128i y_bias = _mm_set1_epi8((char) (unsigned char) 128);
+   __m128i xw = _mm_set1_epi16(255); // alpha channel
+   __m128i rgbx[2];
+
+   for (; i+7 < count; i += 8) {
+      __m128i y_bytes = _mm_loadl_epi64((__m128i *) (y+i));
+      __m128i cr_bytes = _mm_loadl_epi64((__m128i *) (pcr+i));
+      __m128i cb_bytes = _mm_loadl_epi64((__m128i *) (pcb+i));
+      __m128i cr_biased = _mm_xor_si128(cr_bytes, signflip); // -128
+      __m128i cb_biased = _mm_xor_si128(cb_bytes, signflip); // -128
+
+      // unpack to short (and left-shift cr, cb by 8)
+      __m128i yw  = _mm_unpacklo_epi8(y_bias, y_bytes);
+      __m128i crw = _mm_unpacklo_epi8(_mm_setzero_si128(), cr_biased);
+      __m128i cbw = _mm_unpacklo_epi8(_mm_setzero_si128(), cb_biased);
+
+      // color transform
+      __m128i yws = _mm_srli_epi16(yw, 4);
+      __m128i cr0 = _mm_mulhi_epi16(cr_const0, crw);
+      __m128i cb0 = _mm_mulhi_epi16(cb_const0, cbw);
+      __m128i cb1 = _mm_mulhi_epi16(cbw, cb_const1);
+      __m128i cr1 = _mm_mulhi_epi16(crw, cr_const1);
+      __m128i rws = _mm_add_epi16(cr0, yws);
+      __m128i gwt = _mm_add_epi16(cb0, yws);
+      __m128i bws = _mm_add_epi16(yws, cb1);
+      __m128i gws = _mm_add_epi16(gwt, cr1);
+
+      // descale
+      __m128i rw = _mm_srai_epi16(rws, 4);
+      __m128i bw = _mm_srai_epi16(bws, 4);
+      __m128i gw = _mm_srai_epi16(gws, 4);
+
+      // back to byte, set up for transpose
+      __m128i brb = _mm_packus_epi16(rw, bw);
+      __m128i gxb = _mm_packus_epi16(gw, xw);
+
+      // transpose to interleave channels
+      __m128i t0 = _mm_unpacklo_epi8(brb, gxb);
+      __m128i t1 = _mm_unpackhi_epi8(brb, gxb);
+      __m128i o0 = _mm_unpacklo_epi16(t0, t1);
+      __m128i o1 = _mm_unpackhi_epi16(t0, t1);
+
+      if (step == 4) {
+         _mm_storeu_si128((__m128i *) (out + 0), o0);
+         _mm_storeu_si128((__m128i *) (out + 16), o1);
+         out += 32;
+      } else {
+         rgbx[0] = o0;
+         rgbx[1] = o1;
+         out = rgbx_to_rgb(out, (uint8 *) rgbx, 8);
+      }
+   }
+
+   YCbCr_to_RGB_row(out, y+i, pcb+i, pcr+i, count-i, step);
+}
+#endif // STBI_SSE2
+
+#ifdef STBI_AVX2
+// 16 pixel version of YCbCr_to_RGB_row_sse2
+STBI_AVX2_TARGET
+static void YCbCr_to_RGB_row_avx2(uint8 *out, const uint8 *y, const uint8 *pcb, const uint8 *pcr, int count, int step)
+{
+   int i = 0;
+   __m256i cr_const0 = _mm256_set1_epi16( YCBCR_CONST(1.40200f));
+   __m256i cr_const1 = _mm256_set1_epi16(-YCBCR_CONST(0.71414f));
+   __m256i cb_const0 = _mm256_set1_epi16(-YCBCR_CONST(0.34414f));
+   __m256i cb_const1 = _mm256_set1_epi16( YCBCR_CONST(1.77200f));
+   __m256i y_bias = _mm256_set1_epi16(128);
+   __m256i c_bias = _mm256_set1_epi16(128);
+   __m256i xw = _mm256_set1_epi16(255); // alpha channel
+   __m256i rgbx[2];
+
+   for (; i+15 < count; i += 16) {
+      __m256i yb  = _mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i *) (y+i)));
+      __m256i crb = _mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i *) (pcr+i)));
+      __m256i cbb = _mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i *) (pcb+i)));
+
+      // (y<<8)+128 and (c-128)<<8, as in the sse2 version
+      __m256i yw  = _mm256_or_si256(_mm256_slli_epi16(yb, 8), y_bias);
+      __m256i crw = _mm256_slli_epi16(_mm256_sub_epi16(crb, c_bias), 8);
+      __m256i cbw = _mm256_slli_epi16(_mm256_sub_epi16(cbb, c_bias), 8);
+
+      __m256i yws = _mm256_srli_epi16(yw, 4);
+      __m256i rws = _mm256_add_epi16(_mm256_mulhi_epi16(cr_const0, crw), yws);
+      __m256i gws = _mm256_add_epi16(_mm256_add_epi16(_mm256_mulhi_epi16(cb_const0, cbw), yws),
+                                     _mm256_mulhi_epi16(crw, cr_const1));
+      __m256i bws = _mm256_add_epi16(yws, _mm256_mulhi_epi16(cbw, cb_const1));
+
+      __m256i rw = _mm256_srai_epi16(rws, 4);
+      __m256i gw = _mm256_srai_epi16(gws, 4);
+      __m256i bw = _mm256_srai_epi16(bws, 4);
+
+      // the packs and unpacks work per 128-bit lane, so o0 holds pixels
+      // 0-3 and 8-11, o1 pixels 4-7 and 12-15
+      __m256i brb = _mm256_packus_epi16(rw, bw);
+      __m256i gxb = _mm256_packus_epi16(gw, xw);
+      __m256i t0 = _mm256_unpacklo_epi8(brb, gxb);
+      __m256i t1 = _mm256_unpackhi_epi8(brb, gxb);
+      __m256i o0 = _mm256_unpacklo_epi16(t0, t1);
+      __m256i o1 = _mm256_unpackhi_epi16(t0, t1);
+      __m256i p0 = _mm256_permute2x128_si256(o0, o1, 0x20);
+      __m256i p1 = _mm256_permute2x128_si256(o0, o1, 0x31);
+
+      if (step == 4) {
+         _mm256_storeu_si256((__m256i *) (out + 0), p0);
+         _mm256_storeu_si256((__m256i *) (out + 32), p1);
+         out += 64;
+      } else {
+         _mm256_storeu_si256(&rgbx[0], p0);
+         _mm256_storeu_si256(&rgbx[1], p1);
+         out = rgbx_to_rgb(out, (uint8 *) rgbx, 16);
+      }
+   }
+
+   YCbCr_to_RGB_row(out, y+i, pcb+i, pcr+i, count-i, step);
+}
+#endif // STBI_AVX2
+
+#ifndef STBI_SIMD
+typedef void (*YCbCr_to_RGB_func)(uint8 *out, const uint8 *y, const uint8 *pcb, const uint8 *pcr, int count, int step);
+
+static YCbCr_to_RGB_func select_YCbCr_to_RGB(void)
+{
+   #ifdef STBI_AVX2
+   if (stbi_cpu() & STBI_CPU_AVX2) return YCbCr_to_RGB_row_avx2;
+   #endif
+   #ifdef STBI_SSE2
+   if (stbi_cpu() & STBI_CPU_SSE2) return YCbCr_to_RGB_row_sse2;
+   #endif
+   return YCbCr_to_RGB_row;
+}
+#endif
+
 #ifdef STBI_SIMD
 static stbi_YCbCr_to_RGB_run stbi_YCbCr_installed = YCbCr_to_RGB_row;
 
@@ -1570,6 +2308,18 @@ static uint8 *load_jpeg_image(jpeg *z, int *out_x, int *out_y, int *comp, int re
    // load a jpeg image from whichever source
    if (!decode_jpeg_image(z)) { cleanup_jpeg(z); return NULL; }
 
+   // the entropy decode works in full size block units; from here on
+   // everything is in the reduced output size
+   if (z->scale_shift) {
+      int round = (1 << z->scale_shift) - 1;
+      z->s->img_x = (z->s->img_x + round) >> z->scale_shift;
+      z->s->img_y = (z->s->img_y + round) >> z->scale_shift;
+      for (n=0; n < z->s->img_n; ++n) {
+         z->img_comp[n].x = (z->img_comp[n].x + round) >> z->scale_shift;
+         z->img_comp[n].y = (z->img_comp[n].y + round) >> z->scale_shift;
+      }
+   }
+
    // determine actual number of components to generate
    n = req_comp ? req_comp : z->s->img_n;
 
@@ -1584,6 +2334,9 @@ static uint8 *load_jpeg_image(jpeg *z, int *out_x, int *out_y, int *comp, int re
       uint i,j;
       uint8 *output;
       uint8 *coutput[4];
+      #ifndef STBI_SIMD
+      YCbCr_to_RGB_func YCbCr_to_RGB = select_YCbCr_to_RGB();
+      #endif
 
       stbi_resample res_comp[4];
 
@@ -1607,15 +2360,28 @@ static uint8 *load_jpeg_image(jpeg *z, int *out_x, int *out_y, int *comp, int re
          else if (r->hs == 2 && r->vs == 1) r->resample = resample_row_h_2;
          else if (r->hs == 2 && r->vs == 2) r->resample = resample_row_hv_2;
          else                               r->resample = resample_row_generic;
+
+         #ifdef STBI_SSE2
+         if (stbi_cpu() & STBI_CPU_SSE2) {
+            if      (r->resample == resample_row_hv_2) r->resample = resample_row_hv_2_sse2;
+            else if (r->resample == resample_row_v_2)  r->resample = resample_row_v_2_sse2;
+         }
+         #endif
       }
 
       // can't error after this so, this is safe
-      output = (uint8 *) malloc(n * z->s->img_x * z->s->img_y + 1);
-      if (!output) { cleanup_jpeg(z); return epuc("outofmem", "Out of memory"); }
+      if (z->s->output) {
+         // color convert straight into the caller's memory
+         output = z->s->output(z->s->output_user, z->s->img_x, z->s->img_y, n);
+         if (!output) { cleanup_jpeg(z); return epuc("output refused", "Output buffer not available"); }
+      } else {
+         output = (uint8 *) malloc(n * z->s->img_x * z->s->img_y + 1);
+         if (!output) { cleanup_jpeg(z); return epuc("outofmem", "Out of memory"); }
+      }
 
       // now go ahead and resample
       for (j=0; j < z->s->img_y; ++j) {
-         uint8 *out = output + n * z->s->img_x * j;
+         uint8 *out = output + n * z->s->img_x * (z->s->flip_vertically ? z->s->img_y-1 - j : j);
          for (k=0; k < decode_n; ++k) {
             stbi_resample *r = &res_comp[k];
             int y_bot = r->ystep >= (r->vs >> 1);
@@ -1636,12 +2402,12 @@ static uint8 *load_jpeg_image(jpeg *z, int *out_x, int *out_y, int *comp, int re
                #ifdef STBI_SIMD
                stbi_YCbCr_installed(out, y, coutput[1], coutput[2], z->s.img_x, n);
                #else
-               YCbCr_to_RGB_row(out, y, coutput[1], coutput[2], z->s->img_x, n);
+               YCbCr_to_RGB(out, y, coutput[1], coutput[2], z->s->img_x, n);
                #endif
             } else
                for (i=0; i < z->s->img_x; ++i) {
                   out[0] = out[1] = out[2] = y[i];
-                  out[3] = 255; // not used if n==3
+                  if (n == 4) out[3] = 255;
                   out += n;
                }
          } else {
@@ -1702,16 +2468,19 @@ static int stbi_jpeg_info(stbi *s, int *x, int *y, int *comp)
 //      - all output is written to a single output buffer (can malloc/realloc)
 //    performance
 //      - fast huffman
+//      - two literals per lookup for the literal/length code
+//      - 8 bytes at a time back-reference copies
 
 // fast-way is faster to check than jpeg huffman, but slow way is slower
-#define ZFAST_BITS  9 // accelerate all cases in default tables
+#define ZFAST_BITS  10 // accelerate all cases in default tables
 #define ZFAST_MASK  ((1 << ZFAST_BITS) - 1)
 
 // zlib-style huffman encoding
 // (jpegs packs from left, zlib from right, so can't share code)
 typedef struct
 {
-   uint16 fast[1 << ZFAST_BITS];
+   uint16 fast[1 << ZFAST_BITS];  // (code length << 9) | symbol, 0 if not resolved by the fast table
+   uint32 fast2[1 << ZFAST_BITS]; // literal pairs, see zbuild_literal_pairs
    uint16 firstcode[16];
    int maxcode[17];
    uint16 firstsymbol[16];
@@ -1743,7 +2512,7 @@ static int zbuild_huffman(zhuffman *z, uint8 *sizelist, int num)
 
    // DEFLATE spec for generating codes
    memset(sizes, 0, sizeof(sizes));
-   memset(z->fast, 255, sizeof(z->fast));
+   memset(z->fast, 0, sizeof(z->fast));
    for (i=0; i < num; ++i) 
       ++sizes[sizelist[i]];
    sizes[0] = 0;
@@ -1771,7 +2540,7 @@ static int zbuild_huffman(zhuffman *z, uint8 *sizelist, int num)
          if (s <= ZFAST_BITS) {
             int k = bit_reverse(next_code[s],s);
             while (k < (1 << ZFAST_BITS)) {
-               z->fast[k] = (uint16) c;
+               z->fast[k] = (uint16) ((s << 9) | i);
                k += (1 << s);
             }
          }
@@ -1781,6 +2550,28 @@ static int zbuild_huffman(zhuffman *z, uint8 *sizelist, int num)
    return 1;
 }
 
+// literal runs dominate filtered image data, so for the literal/length code
+// we also build a table that resolves up to two short literals with a single
+// lookup: bits 0-7 first literal, 8-15 second literal, 16-23 total code
+// length, bit 24 set if there is a second literal. 0 means the next symbol
+// isn't a literal the fast table can resolve, so take the normal path
+static void zbuild_literal_pairs(zhuffman *z)
+{
+   int i;
+   for (i=0; i < (1 << ZFAST_BITS); ++i) {
+      int b = z->fast[i], b2, s, s2;
+      z->fast2[i] = 0;
+      if (!b || (b & 511) >= 256) continue;
+      s = b >> 9;
+      z->fast2[i] = (b & 255) | (s << 16);
+      // the second code is only valid if it fits in the bits left in the index
+      b2 = z->fast[i >> s];
+      s2 = b2 >> 9;
+      if (b2 && (b2 & 511) < 256 && s + s2 <= ZFAST_BITS)
+         z->fast2[i] = (b & 255) | ((b2 & 255) << 8) | ((s + s2) << 16) | (1 << 24);
+   }
+}
+
 // zlib-from-memory implementation for PNG reading
 //    because PNG allows splitting the zlib stream arbitrarily,
 //    and it's annoying structurally to have PNG call ZLIB call PNG,
@@ -1809,6 +2600,14 @@ stbi_inline static int zget8(zbuf *z)
 
 static void fill_bits(zbuf *z)
 {
+   // at most 4 bytes are needed, so skip the end check when they're there
+   if (z->zbuffer_end - z->zbuffer >= 4) {
+      do {
+         z->code_buffer |= (uint32) *z->zbuffer++ << z->num_bits;
+         z->num_bits += 8;
+      } while (z->num_bits <= 24);
+      return;
+   }
    do {
       assert(z->code_buffer < (1U << z->num_bits));
       z->code_buffer |= zget8(z) << z->num_bits;
@@ -1831,11 +2630,11 @@ stbi_inline static int zhuffman_decode(zbuf *a, zhuffman *z)
    int b,s,k;
    if (a->num_bits < 16) fill_bits(a);
    b = z->fast[a->code_buffer & ZFAST_MASK];
-   if (b < 0xffff) {
-      s = z->size[b];
+   if (b) {
+      s = b >> 9;
       a->code_buffer >>= s;
       a->num_bits -= s;
-      return z->value[b];
+      return b & 511;
    }
 
    // not resolved by fast table, so compute it the slow way
@@ -1887,13 +2686,29 @@ static int dist_extra[32] =
 static int parse_huffman_block(zbuf *a)
 {
    for(;;) {
-      int z = zhuffman_decode(a, &a->z_length);
+      int z;
+      uint32 pair;
+      if (a->num_bits < 16) fill_bits(a);
+      pair = a->z_length.fast2[a->code_buffer & ZFAST_MASK];
+      if (pair && a->zout + 2 <= a->zout_end) {
+         // one or two literals; always store both, the second is
+         // overwritten by the next symbol if it wasn't real
+         int s = (pair >> 16) & 255;
+         a->code_buffer >>= s;
+         a->num_bits -= s;
+         a->zout[0] = (char) pair;
+         a->zout[1] = (char) (pair >> 8);
+         a->zout += 1 + (pair >> 24);
+         continue;
+      }
+      z = zhuffman_decode(a, &a->z_length);
       if (z < 256) {
          if (z < 0) return e("bad huffman code","Corrupt PNG"); // error in huffman codes
          if (a->zout >= a->zout_end) if (!expand(a, 1)) return 0;
          *a->zout++ = (char) z;
       } else {
          uint8 *p;
+         char *zout;
          int len,dist;
          if (z == 256) return 1;
          z -= 257;
@@ -1905,9 +2720,24 @@ static int parse_huffman_block(zbuf *a)
          if (dist_extra[z]) dist += zreceive(a, dist_extra[z]);
          if (a->zout - a->zout_start < dist) return e("bad dist","Corrupt PNG");
          if (a->zout + len > a->zout_end) if (!expand(a, len)) return 0;
-         p = (uint8 *) (a->zout - dist);
-         while (len--)
-            *a->zout++ = *p++;
+         zout = a->zout;
+         p = (uint8 *) (zout - dist);
+         a->zout += len;
+         if (dist == 1) {
+            // run of a single byte
+            memset(zout, *p, len);
+         } else if (dist >= 8 && a->zout + 8 <= a->zout_end) {
+            // 8 byte chunks never overlap their source; the last one may
+            // spill up to 7 bytes past the match, which later output replaces
+            do {
+               memcpy(zout, p, 8);
+               zout += 8;
+               p += 8;
+            } while (zout < a->zout);
+         } else {
+            while (len--)
+               *zout++ = *p++;
+         }
       }
    }
 }
@@ -1955,6 +2785,7 @@ static int compute_huffman_codes(zbuf *a)
    if (n != hlit+hdist) return e("bad codelengths","Corrupt PNG");
    if (!zbuild_huffman(&a->z_length, lencodes, hlit)) return 0;
    if (!zbuild_huffman(&a->z_distance, lencodes+hlit, hdist)) return 0;
+   zbuild_literal_pairs(&a->z_length);
    return 1;
 }
 
@@ -2034,6 +2865,7 @@ static int parse_zlib(zbuf *a, int parse_header)
             if (!default_distance[31]) init_defaults();
             if (!zbuild_huffman(&a->z_length  , default_length  , 288)) return 0;
             if (!zbuild_huffman(&a->z_distance, default_distance,  32)) return 0;
+            zbuild_literal_pairs(&a->z_length);
          } else {
             if (!compute_huffman_codes(a)) return 0;
          }
@@ -2194,6 +3026,75 @@ static int paeth(int a, int b, int c)
    return c;
 }
 
+#ifdef STBI_SSE2
+stbi_inline static __m128i png_load_pixel(uint8 const *p, int n)
+{
+   uint32 v = n == 4 ? p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32) p[3] << 24)
+                     : p[0] | (p[1] << 8) | (p[2] << 16);
+   return _mm_cvtsi32_si128((int) v);
+}
+
+stbi_inline static void png_store_pixel(uint8 *p, __m128i v, int n)
+{
+   uint32 k = (uint32) _mm_cvtsi128_si32(v);
+   p[0] = (uint8) k;
+   p[1] = (uint8) (k >> 8);
+   p[2] = (uint8) (k >> 16);
+   if (n == 4) p[3] = (uint8) (k >> 24);
+}
+
+// unfilter a whole row of 3 or 4 byte pixels. the scalar path runs paeth
+// and avg a byte at a time with unpredictable branches; here each pixel is
+// one set of 16-bit lanes and the predictor choice is branch-free. a NULL
+// prior means the first row, where the row above reads as zeros
+static void unfilter_row_sse2(uint8 *cur, uint8 const *prior, uint8 const *raw, int filter, uint32 x, int n)
+{
+   __m128i zero = _mm_setzero_si128();
+   __m128i a = zero, c = zero; // left and upper left neighbours
+   uint32 i, bytes = x*n;
+
+   if (filter == F_none || (filter == F_up && !prior)) {
+      memcpy(cur, raw, bytes);
+      return;
+   }
+   if (filter == F_up) {
+      for (i=0; i+16 <= bytes; i += 16)
+         _mm_storeu_si128((__m128i *) (cur+i), _mm_add_epi8(_mm_loadu_si128((__m128i const *) (raw+i)),
+                                                             _mm_loadu_si128((__m128i const *) (prior+i))));
+      for (; i < bytes; ++i)
+         cur[i] = raw[i] + prior[i];
+      return;
+   }
+
+   // sub, avg and paeth depend on the pixel to the left, so go a pixel at a time
+   for (i=0; i < x; ++i, cur += n, raw += n) {
+      __m128i b = prior ? _mm_unpacklo_epi8(png_load_pixel(prior + i*n, n), zero) : zero;
+      __m128i pred, out;
+      if (filter == F_sub)
+         pred = a;
+      else if (filter == F_avg)
+         pred = _mm_srli_epi16(_mm_add_epi16(a, b), 1);
+      else {
+         __m128i pa = _mm_sub_epi16(b, c);              // p-a = b-c
+         __m128i pb = _mm_sub_epi16(a, c);              // p-b = a-c
+         __m128i pc = _mm_add_epi16(pa, pb);            // p-c = a+b-2c
+         __m128i not_a, c_over_b;
+         pa = _mm_max_epi16(pa, _mm_sub_epi16(zero, pa));
+         pb = _mm_max_epi16(pb, _mm_sub_epi16(zero, pb));
+         pc = _mm_max_epi16(pc, _mm_sub_epi16(zero, pc));
+         not_a    = _mm_or_si128(_mm_cmpgt_epi16(pa, pb), _mm_cmpgt_epi16(pa, pc));
+         c_over_b = _mm_cmpgt_epi16(pb, pc);
+         pred = _mm_or_si128(_mm_and_si128(c_over_b, c), _mm_andnot_si128(c_over_b, b));
+         pred = _mm_or_si128(_mm_and_si128(not_a, pred), _mm_andnot_si128(not_a, a));
+      }
+      out = _mm_add_epi8(png_load_pixel(raw, n), _mm_packus_epi16(pred, pred));
+      png_store_pixel(cur, out, n);
+      a = _mm_unpacklo_epi8(out, zero);
+      c = b;
+   }
+}
+#endif // STBI_SSE2
+
 // create the png data from post-deflated data
 static int create_png_image_raw(png *a, uint8 *raw, uint32 raw_len, int out_n, uint32 x, uint32 y)
 {
@@ -2201,6 +3102,9 @@ static int create_png_image_raw(png *a, uint8 *raw, uint32 raw_len, int out_n, u
    uint32 i,j,stride = x*out_n;
    int k;
    int img_n = s->img_n; // copy it into a local for later
+   #ifdef STBI_SSE2
+   int simd = img_n == out_n && (img_n == 3 || img_n == 4) && (stbi_cpu() & STBI_CPU_SSE2);
+   #endif
    assert(out_n == s->img_n || out_n == s->img_n+1);
    if (stbi_png_partial) y = 1;
    a->out = (uint8 *) malloc(x * y * out_n);
@@ -2217,6 +3121,13 @@ static int create_png_image_raw(png *a, uint8 *raw, uint32 raw_len, int out_n, u
       uint8 *prior = cur - stride;
       int filter = *raw++;
       if (filter > 4) return e("invalid filter","Corrupt PNG");
+      #ifdef STBI_SSE2
+      if (simd) {
+         unfilter_row_sse2(cur, j ? prior : NULL, raw, filter, x, img_n);
+         raw += stride;
+         continue;
+      }
+      #endif
       // if first row, use special filter that doesn't sample previous row
       if (j == 0) filter = first_row_filter[filter];
       // handle first pixel explicitly
@@ -4351,6 +5262,44 @@ int stbi_info_from_file(FILE *f, int *x, int *y, int *comp)
 }
 #endif // !STBI_NO_STDIO
 
+// the size a reduced size load will produce, for a jpeg the header is enough
+static int stbi_info_max_dimension_main(stbi *s, int *x, int *y, int *comp)
+{
+   jpeg j;
+   j.s = s;
+   if (stbi_jpeg_info_raw(&j, x, y, comp)) {
+      int shift = jpeg_scale_shift(s);
+      int round = (1 << shift) - 1;
+      *x = (*x + round) >> shift;
+      *y = (*y + round) >> shift;
+      return 1;
+   }
+   return stbi_info_main(s,x,y,comp);
+}
+
+int stbi_info_from_memory_max_dimension(stbi_uc const *buffer, int len, int *x, int *y, int *comp, int max_dimension)
+{
+   stbi s;
+   start_mem(&s,buffer,len);
+   s.jpeg_max_dimension = max_dimension;
+   return stbi_info_max_dimension_main(&s,x,y,comp);
+}
+
+#ifndef STBI_NO_STDIO
+int stbi_info_max_dimension(char const *filename, int *x, int *y, int *comp, int max_dimension)
+{
+   FILE *f = fopen(filename, "rb");
+   int result;
+   stbi s;
+   if (!f) return e("can't fopen", "Unable to open file");
+   start_file(&s,f);
+   s.jpeg_max_dimension = max_dimension;
+   result = stbi_info_max_dimension_main(&s,x,y,comp);
+   fclose(f);
+   return result;
+}
+#endif
+
 int stbi_info_from_memory(stbi_uc const *buffer, int len, int *x, int *y, int *comp)
 {
    stbi s;
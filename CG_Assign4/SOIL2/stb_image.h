@@ -174,6 +174,31 @@ typedef struct
 
 extern stbi_uc *stbi_load_from_callbacks  (stbi_io_callbacks const *clbk, void *user, int *x, int *y, int *comp, int req_comp);
 
+// reduced size loads: JPEGs are decoded directly at 1/2, 1/4 or 1/8 scale, picking
+// the smallest scale whose larger side is still >= max_dimension, so the result
+// may still need a final reduction. other formats are always loaded at full size,
+// so check the returned x and y. a max_dimension <= 0 means full size
+extern stbi_uc *stbi_load_from_memory_max_dimension(stbi_uc const *buffer, int len, int *x, int *y, int *comp, int req_comp, int max_dimension);
+
+#ifndef STBI_NO_STDIO
+extern stbi_uc *stbi_load_max_dimension(char const *filename, int *x, int *y, int *comp, int req_comp, int max_dimension);
+#endif
+
+// loads into memory supplied by the caller (e.g. a mapped pixel buffer object)
+// instead of a buffer stbi allocates. 'output' is called once the final size is
+// known and returns where the x*y*n bytes should go (n is req_comp, or comp when
+// req_comp is 0), or NULL to cancel the load. with flip_vertically the rows are
+// stored bottom-up, as OpenGL expects. JPEGs are color converted straight into
+// the output; other formats are copied there after decoding. max_dimension
+// works as in stbi_load_max_dimension. returns 1 on success, 0 on failure
+typedef stbi_uc *(*stbi_output_func)(void *user, int x, int y, int n);
+
+extern int stbi_load_from_memory_into(stbi_uc const *buffer, int len, int *x, int *y, int *comp, int req_comp, int max_dimension, int flip_vertically, stbi_output_func output, void *user);
+
+#ifndef STBI_NO_STDIO
+extern int stbi_load_into(char const *filename, int *x, int *y, int *comp, int req_comp, int max_dimension, int flip_vertically, stbi_output_func output, void *user);
+#endif
+
 #ifndef STBI_NO_HDR
    extern float *stbi_loadf_from_memory(stbi_uc const *buffer, int len, int *x, int *y, int *comp, int req_comp);
 
@@ -216,6 +241,14 @@ extern int      stbi_info_from_file  (FILE *f,                  int *x, int *y,
 
 #endif
 
+// the dimensions a load with max_dimension (see stbi_load_max_dimension) will
+// produce, without decoding the image
+extern int      stbi_info_from_memory_max_dimension(stbi_uc const *buffer, int len, int *x, int *y, int *comp, int max_dimension);
+
+#ifndef STBI_NO_STDIO
+extern int      stbi_info_max_dimension(char const *filename, int *x, int *y, int *comp, int max_dimension);
+#endif
+
 
 
 // for image formats that explicitly notate that they have premultiplied alpha,
@@ -227,6 +260,10 @@ extern void stbi_set_unpremultiply_on_load(int flag_true_if_should_unpremultiply
 // or just pass them through "as-is"
 extern void stbi_convert_iphone_png_to_rgb(int flag_true_if_should_convert);
 
+// the JPEG decoder picks SSE2/AVX2 kernels at runtime when the cpu has them;
+// pass 0 to force the portable scalar code (e.g. to compare the two)
+extern void stbi_set_simd(int flag_true_if_should_use_simd);
+
 
 // ZLIB client - used by PNG, available for other purposes
 
@@ -0,0 +1,164 @@
+//! Writes a chain of simplified levels of a model
+//
+// usage: simplify_mesh [-l levels] [-r ratio] model.obj output
+//
+// Each level keeps a fraction of the triangles of the one before it, simplified with MeshSimplifier
+// so texture seams and material boundaries stay where they are. The levels are written to
+// output_lod1.obj, output_lod2.obj and so on, sharing the materials in output.mtl. Texture names
+// are copied as they are, so write the levels next to the model. The triangle count and the
+// largest distance from the full model's surface are printed for each level, and written at the
+// top of its file.
+#include "MeshSimplifier.hpp"
+#include "ObjLoader.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#define DEFAULT_LEVELS 4
+#define DEFAULT_RATIO 0.5f
+
+// The part of a path after the last separator
+static std::string baseName(const std::string& path) {
+    const size_t separator = path.find_last_of("/\\");
+    return separator == std::string::npos ? path : path.substr(separator + 1);
+}
+
+static bool writeMaterials(const std::string& filename, const RawModelData& data) {
+    FILE* out = fopen(filename.c_str(), "w");
+    if (out == NULL) {
+        return false;
+    }
+    fprintf(out, "# simplify_mesh materials\n");
+    for (size_t i = 0; i < data.shapes.size(); ++i) {
+        const Material& material = data.shapes[i].material;
+        fprintf(out, "\nnewmtl material_%u\n", (unsigned int)i);
+        fprintf(out, "Ka %f %f %f\n", material.ambient.x, material.ambient.y, material.ambient.z);
+        fprintf(out, "Kd %f %f %f\n", material.diffuse.x, material.diffuse.y, material.diffuse.z);
+        fprintf(out, "Ks %f %f %f\n", material.specular.x, material.specular.y, material.specular.z);
+        fprintf(out, "Ns %f\n", material.shininess);
+        fprintf(out, "d %f\n", material.dissolve);
+        if (!data.shapes[i].textureName.empty()) {
+            fprintf(out, "map_Kd %s\n", data.shapes[i].textureName.c_str());
+        }
+    }
+    return fclose(out) == 0;
+}
+
+// Each of the level's shapes is matched to its material by texture and material, as shapes with no
+// triangles left are dropped
+static size_t findMaterial(const RawModelData& full, const RawModelData::Shape& shape) {
+    for (size_t i = 0; i < full.shapes.size(); ++i) {
+        if (full.shapes[i].textureName == shape.textureName &&
+                memcmp(&full.shapes[i].material, &shape.material, sizeof(Material)) == 0) {
+            return i;
+        }
+    }
+    return 0;
+}
+
+static bool writeLevel(const std::string& filename, const std::string& materials, const RawModelData& full,
+        const RawModelData& level, float error) {
+    FILE* out = fopen(filename.c_str(), "w");
+    if (out == NULL) {
+        return false;
+    }
+
+    size_t numTriangles = 0;
+    for (size_t i = 0; i < level.shapes.size(); ++i) {
+        numTriangles += level.shapes[i].indices.size() / 3;
+    }
+    fprintf(out, "# simplify_mesh level, %u triangles, error %f\n", (unsigned int)numTriangles, error);
+    fprintf(out, "mtllib %s\n", materials.c_str());
+
+    size_t firstVertex = 1;
+    size_t firstTexCoord = 1;
+    for (size_t i = 0; i < level.shapes.size(); ++i) {
+        const RawModelData::Shape& shape = level.shapes[i];
+        fprintf(out, "g shape_%u\n", (unsigned int)i);
+        fprintf(out, "usemtl material_%u\n", (unsigned int)findMaterial(full, shape));
+        for (size_t j = 0; j < shape.vertices.size(); ++j) {
+            fprintf(out, "v %f %f %f\n", shape.vertices[j].x, shape.vertices[j].y, shape.vertices[j].z);
+        }
+        for (size_t j = 0; j < shape.texCoords.size(); ++j) {
+            fprintf(out, "vt %f %f\n", shape.texCoords[j].x, shape.texCoords[j].y);
+        }
+        for (size_t j = 0; j + 2 < shape.indices.size(); j += 3) {
+            fprintf(out, "f");
+            for (int k = 0; k < 3; ++k) {
+                if (shape.texCoords.empty()) {
+                    fprintf(out, " %u", (unsigned int)(firstVertex + shape.indices[j + k]));
+                }
+                else {
+                    fprintf(out, " %u/%u", (unsigned int)(firstVertex + shape.indices[j + k]),
+                        (unsigned int)(firstTexCoord + shape.indices[j + k]));
+                }
+            }
+            fprintf(out, "\n");
+        }
+        firstVertex += shape.vertices.size();
+        firstTexCoord += shape.texCoords.size();
+    }
+    return fclose(out) == 0;
+}
+
+int main(int argc, char** argv) {
+    int levels = DEFAULT_LEVELS;
+    float ratio = DEFAULT_RATIO;
+    int arg = 1;
+    for (; arg + 1 < argc && argv[arg][0] == '-'; arg += 2) {
+        if (strcmp(argv[arg], "-l") == 0) {
+            levels = atoi(argv[arg + 1]);
+        }
+        else if (strcmp(argv[arg], "-r") == 0) {
+            ratio = (float)atof(argv[arg + 1]);
+        }
+        else {
+            break;
+        }
+    }
+    if (argc - arg != 2 || levels < 1 || ratio <= 0.0f || ratio >= 1.0f) {
+        fprintf(stderr, "usage: %s [-l levels] [-r ratio] model.obj output\n", argv[0]);
+        return 1;
+    }
+    const std::string filename = argv[arg];
+    const std::string output = argv[arg + 1];
+
+    const size_t separator = filename.find_last_of("/\\");
+    const std::string mtlBasePath = separator == std::string::npos ? "" : filename.substr(0, separator + 1);
+    RawModelData full;
+    const std::string err = loadObj(full, filename, mtlBasePath);
+    if (!err.empty()) {
+        fprintf(stderr, "Unable to load %s: %s\n", filename.c_str(), err.c_str());
+        return 1;
+    }
+
+    const std::string materials = output + ".mtl";
+    if (!writeMaterials(materials, full)) {
+        fprintf(stderr, "Unable to write %s\n", materials.c_str());
+        return 1;
+    }
+
+    MeshSimplifier simplifier(full);
+    printf("%-8s%12s%14s\n", "level", "triangles", "error");
+    printf("%-8d%12u%14f\n", 0, (unsigned int)simplifier.numTriangles(), 0.0f);
+    for (int level = 1; level <= levels; ++level) {
+        const size_t target = (size_t)(simplifier.numTriangles() * ratio);
+        const size_t before = simplifier.numTriangles();
+        const RawModelData data = simplifier.simplify(target);
+        if (simplifier.numTriangles() == before) {
+            printf("No more edges can be collapsed\n");
+            break;
+        }
+        const float error = surfaceDistance(full, data);
+
+        char suffix[32];
+        sprintf(suffix, "_lod%d.obj", level);
+        const std::string levelFilename = output + suffix;
+        if (!writeLevel(levelFilename, baseName(materials), full, data, error)) {
+            fprintf(stderr, "Unable to write %s\n", levelFilename.c_str());
+            return 1;
+        }
+        printf("%-8d%12u%14f\n", level, (unsigned int)simplifier.numTriangles(), error);
+    }
+    return 0;
+}
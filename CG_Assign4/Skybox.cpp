@@ -1,5 +1,5 @@
 #include "Skybox.hpp"
-#include "SOIL2/SOIL2.h"
+#include "AssetManager.hpp"
 #include <iostream>
 #include <vector>
 #include <string>
@@ -75,6 +75,7 @@ Skybox::Skybox(const Renderer* renderer, std::vector<std::string> day_files, std
         2, 1, 0, 0, 3, 2
     };
 
+    int maxDimension = AssetManager::getMaxTextureDimension();
 
     //
     // Load data into GPU buffers and initialize appropriate GLSL variables
@@ -96,15 +97,12 @@ Skybox::Skybox(const Renderer* renderer, std::vector<std::string> day_files, std
         glEnableVertexAttribArray(renderer->shader.in_sb_texcoord);
         glVertexAttribPointer(renderer->shader.in_sb_texcoord, 2, GL_FLOAT, GL_FALSE, 0, NULL);
 
-        //Load textures using SOIL
-        walls[i].day_textureId = SOIL_load_OGL_texture(day_files[i].c_str(), SOIL_LOAD_AUTO,
-            SOIL_CREATE_NEW_ID, SOIL_FLAG_INVERT_Y | SOIL_FLAG_TEXTURE_REPEATS);
+        //Load textures using SOIL, at the same quality as the other assets
+        walls[i].day_textureId = AssetManager::createTexture(day_files[i], maxDimension);
 
-        walls[i].night_textureId = SOIL_load_OGL_texture(night_files[i].c_str(), SOIL_LOAD_AUTO,
-            SOIL_CREATE_NEW_ID, SOIL_FLAG_INVERT_Y | SOIL_FLAG_TEXTURE_REPEATS);
+        walls[i].night_textureId = AssetManager::createTexture(night_files[i], maxDimension);
 
-        walls[i].sunset_textureId = SOIL_load_OGL_texture(sunset_files[i].c_str(), SOIL_LOAD_AUTO,
-            SOIL_CREATE_NEW_ID, SOIL_FLAG_INVERT_Y | SOIL_FLAG_TEXTURE_REPEATS);
+        walls[i].sunset_textureId = AssetManager::createTexture(sunset_files[i], maxDimension);
 
         // Load indices into buffer
         glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, walls[i].buffers[2]);
@@ -30,11 +30,24 @@ RawModelData genTerrainModel(const std::string& terrainTexture, const std::strin
     return data;
 }
 
+RawModelData Terrain::tileModel(TileType type) {
+    switch (type) {
+    case H: return genTerrainModel(HORIZONTAL_TEXTURE, HORIZONTAL_NORMAL_TEXTURE);
+    case V: return genTerrainModel(VERTICAL_TEXTURE, VERTICAL_NORMAL_TEXTURE);
+    case I: return genTerrainModel(INTERSECTION_TEXTURE, INTERSECTION_NORMAL_TEXTURE);
+    default: return genTerrainModel(BUILDING_GROUND_TEXTURE, BUILDING_GROUND_NORMAL_TEXTURE);
+    }
+}
+
 Terrain::Terrain(Renderer* renderer) {
-    horizontalRoad = new ModelData(genTerrainModel(HORIZONTAL_TEXTURE, HORIZONTAL_NORMAL_TEXTURE), renderer);
-    verticalRoad = new ModelData(genTerrainModel(VERTICAL_TEXTURE, VERTICAL_NORMAL_TEXTURE), renderer);
-    intersection = new ModelData(genTerrainModel(INTERSECTION_TEXTURE, INTERSECTION_NORMAL_TEXTURE), renderer);
-    building = new ModelData(genTerrainModel(BUILDING_GROUND_TEXTURE, BUILDING_GROUND_NORMAL_TEXTURE), renderer);
+    horizontalRoad = new ModelData(tileModel(H), renderer);
+    verticalRoad = new ModelData(tileModel(V), renderer);
+    intersection = new ModelData(tileModel(I), renderer);
+    building = new ModelData(tileModel(B), renderer);
+    staticGroup = renderer->addStaticGroup();
+    drawn = false;
+    drawnSize = 0;
+    drawnProxies = 0;
 }
 
 void Terrain::draw(Renderer* renderer, City* city, glm::vec3 cameraPosition, int size) const {
@@ -53,34 +66,45 @@ void Terrain::draw(Renderer* renderer, City* city, glm::vec3 cameraPosition, int
     if (cameraPosition.x == 0) centerSquare.x = 0.0;
     if (cameraPosition.z == 0) centerSquare.z = 0.0;
 
+    if (drawn && centerSquare == drawnCenter && size == drawnSize && city->proxiesVersion() == drawnProxies) {
+        return;
+    }
+    drawn = true;
+    drawnCenter = centerSquare;
+    drawnSize = size;
+    drawnProxies = city->proxiesVersion();
+
     // Draw center square and surrounding squares
+    const glm::vec3 scale = glm::vec3(terrainSizeX, 1, terrainSizeZ);
+    std::vector<Renderer::StaticInstance> tiles;
     for (int i = -size; i < size + 1; i++) {
         for (int j = -size; j < size + 1; j++) {
             glm::vec3 square = centerSquare;
             square.x = centerSquare.x + terrainSizeX * 2 * j;
             square.z = centerSquare.z + terrainSizeZ * 2 * i;
+            if (city->drawnByProxy(square)) {
+                continue;
+            }
+            const ModelData* model = NULL;
             switch (city->tileForPosition(square)) {
             case B: // Building case
-            {
-                renderer->drawModel(building, square, glm::vec3(terrainSizeX, 1, terrainSizeZ));
-            }
+                model = building;
                 break;
             case V: // Vertical road segment
-            {
-                renderer->drawModel(verticalRoad, square, glm::vec3(terrainSizeX, 1, terrainSizeZ));
-            }
+                model = verticalRoad;
                 break;
             case H: // Horizontal road segment
-            {
-                renderer->drawModel(horizontalRoad, square, glm::vec3(terrainSizeX, 1, terrainSizeZ));
-            }
+                model = horizontalRoad;
                 break;
             case I: // Intersection
-            {
-                renderer->drawModel(intersection, square, glm::vec3(terrainSizeX, 1, terrainSizeZ));
-            }
+                model = intersection;
                 break;
             }
+            if (model != NULL) {
+                const Renderer::StaticInstance tile = { model, glm::scale(glm::translate(glm::mat4(1.0f), square), scale) };
+                tiles.push_back(tile);
+            }
         }
     }
+    renderer->setStaticInstances(staticGroup, tiles);
 }
@@ -18,13 +18,27 @@ public:
     Terrain(Renderer* renderer);
 
     /// <summary>
-    /// Draws a grid of terrain models corresponding to the city grid
+    /// Draws a grid of terrain models corresponding to the city grid. The tiles are static
+    /// instances of the renderer the terrain was created with, only set again when the camera moves
+    /// to another tile or the city's proxies change.
     /// </summary>
     void draw(Renderer* renderer, City* city, glm::vec3 cameraPosition, int size) const;
+
+    /// <summary>
+    /// The model of a tile type, a square from -1 to 1 drawn with a scale of half a tile
+    /// </summary>
+    static RawModelData tileModel(TileType type);
 private:
     ModelData* horizontalRoad;
     ModelData* verticalRoad;
     ModelData* intersection;
     ModelData* building;
 
+    // The renderer's group of static instances the tiles are set in
+    size_t staticGroup;
+    // Where the tiles were last set from, they are set on the first draw
+    mutable bool drawn;
+    mutable glm::vec3 drawnCenter;
+    mutable int drawnSize;
+    mutable unsigned long drawnProxies;
 };
\ No newline at end of file
@@ -0,0 +1,191 @@
+#version 430
+
+// Culls model instances on the GPU, see GpuCuller.hpp. Each instance chooses its level of detail,
+// or its impostor, and each one that passes a test is appended to its batch's range of the culled
+// transformations, and every draw command of the batch gets one more instance.
+layout(local_size_x = 64) in;
+
+const uint NO_BATCH = 0xffffffffu;
+const uint NO_MODEL = 0xffffffffu;
+
+struct Instance {
+    mat4 transformation;
+    uint model;
+    uint level;
+    uint padding[2];
+};
+
+struct Model {
+    vec4 minVertex;
+    vec4 maxVertex;
+    mat4 impostorSphere;
+    uint firstLevel;
+    uint numLevels;
+    float impostorRadius;
+    float impostorLayer;
+    uint impostorShadowBatch;
+    uint padding[3];
+};
+
+struct Level {
+    uint batch;
+    float error;
+};
+
+struct Batch {
+    uint firstCameraCommand;
+    uint numCameraCommands;
+    uint firstShadowCommand;
+    uint numShadowCommands;
+    uint cameraBase;
+    uint shadowBase;
+    uint cameraCount;
+    uint shadowCount;
+};
+
+// Laid out as glDrawElementsIndirect reads it. The last command is read by glDrawArraysIndirect,
+// with the number of impostors as its instanceCount.
+struct DrawCommand {
+    uint count;
+    uint instanceCount;
+    uint firstIndex;
+    uint baseVertex;
+    uint baseInstance;
+};
+
+layout(std430, binding = 0) buffer Instances {
+    Instance instances[];
+};
+
+layout(std430, binding = 1) readonly buffer Models {
+    Model models[];
+};
+
+layout(std430, binding = 2) readonly buffer Levels {
+    Level levels[];
+};
+
+layout(std430, binding = 3) buffer Batches {
+    Batch batches[];
+};
+
+layout(std430, binding = 4) buffer Commands {
+    DrawCommand commands[];
+};
+
+layout(std430, binding = 5) writeonly buffer Culled {
+    mat4 culled[];
+};
+
+// The transformation of each impostor's sphere and its layer, as ImpostorAtlas lays them out
+layout(std430, binding = 6) writeonly buffer Impostors {
+    float impostors[];
+};
+
+uniform uint numInstances;
+uniform vec4 cameraPlanes[6];
+uniform vec4 shadowPlanes[6];
+uniform vec3 cameraPosition;
+uniform float maxDistance;
+
+// See GpuCuller::Falloff
+uniform float pixelsPerUnit;
+uniform float pixelError;
+uniform float hysteresis;
+uniform float fogStart;
+uniform float fogLength;
+uniform float impostorPixels;
+
+// Whether a box is at least partly on the inner side of every plane
+bool insidePlanes(vec4 planes[6], vec3 center, vec3 extent) {
+    for (int i = 0; i < 6; ++i) {
+        // The corner farthest along the plane's normal
+        if (dot(planes[i].xyz, center) + dot(abs(planes[i].xyz), extent) + planes[i].w < 0.0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// The distance past which an error is too small to see, as Renderer::lodDistance
+float lodDistance(float error) {
+    float pixels = error * pixelsPerUnit;
+    float clear = pixels / pixelError;
+    if (clear <= fogStart) {
+        return clear;
+    }
+    return pixels * (fogStart + fogLength) / (pixelError * fogLength + pixels);
+}
+
+void main() {
+    uint index = gl_GlobalInvocationID.x;
+    if (index >= numInstances || instances[index].model == NO_MODEL) {
+        return;
+    }
+    mat4 m = instances[index].transformation;
+    Model model = models[instances[index].model];
+
+    // World space box around the transformed bounds
+    vec3 center = 0.5 * (model.minVertex.xyz + model.maxVertex.xyz);
+    vec3 extent = 0.5 * (model.maxVertex.xyz - model.minVertex.xyz);
+    vec3 worldCenter = vec3(m * vec4(center, 1.0));
+    vec3 worldExtent = abs(m[0].xyz) * extent.x + abs(m[1].xyz) * extent.y + abs(m[2].xyz) * extent.z;
+
+    // The nearest point of the bounds, and the largest scale, give the largest error on screen
+    vec3 nearest = clamp(cameraPosition, worldCenter - worldExtent, worldCenter + worldExtent);
+    float cameraDistance = distance(nearest, cameraPosition);
+    float scale = max(max(length(m[0].xyz), length(m[1].xyz)), length(m[2].xyz));
+
+    // Level i is used past the switch distance of level i's error, as Renderer::selectLod
+    uint level = instances[index].level;
+    while (level + 1u < model.numLevels &&
+            cameraDistance > lodDistance(levels[model.firstLevel + level + 1u].error * scale) * (1.0 + hysteresis)) {
+        level += 1u;
+    }
+    while (level > 0u && cameraDistance < lodDistance(levels[model.firstLevel + level].error * scale)) {
+        level -= 1u;
+    }
+    instances[index].level = level;
+
+    // Past its impostor's switch distance, as Renderer::impostorDistance, the camera sees the
+    // impostor and the sun a level with a roof
+    uint cameraBatch = levels[model.firstLevel + level].batch;
+    uint shadowBatch = cameraBatch;
+    bool impostor = false;
+    if (impostorPixels > 0.0 && model.impostorRadius > 0.0) {
+        float switchDistance = 2.0 * model.impostorRadius * scale * pixelsPerUnit / impostorPixels;
+        if (cameraDistance > switchDistance) {
+            impostor = true;
+            cameraBatch = NO_BATCH;
+            shadowBatch = model.impostorShadowBatch;
+        }
+    }
+
+    if (cameraDistance <= maxDistance && insidePlanes(cameraPlanes, worldCenter, worldExtent)) {
+        if (cameraBatch != NO_BATCH) {
+            uint slot = atomicAdd(batches[cameraBatch].cameraCount, 1u);
+            culled[batches[cameraBatch].cameraBase + slot] = m;
+            for (uint i = 0u; i < batches[cameraBatch].numCameraCommands; ++i) {
+                atomicAdd(commands[batches[cameraBatch].firstCameraCommand + i].instanceCount, 1u);
+            }
+        }
+        else if (impostor) {
+            uint slot = atomicAdd(commands[commands.length() - 1].instanceCount, 1u);
+            mat4 sphere = m * model.impostorSphere;
+            for (int column = 0; column < 4; ++column) {
+                for (int row = 0; row < 4; ++row) {
+                    impostors[slot * 17u + uint(column * 4 + row)] = sphere[column][row];
+                }
+            }
+            impostors[slot * 17u + 16u] = model.impostorLayer;
+        }
+    }
+
+    if (shadowBatch != NO_BATCH && insidePlanes(shadowPlanes, worldCenter, worldExtent)) {
+        uint slot = atomicAdd(batches[shadowBatch].shadowCount, 1u);
+        culled[batches[shadowBatch].shadowBase + slot] = m;
+        for (uint i = 0u; i < batches[shadowBatch].numShadowCommands; ++i) {
+            atomicAdd(commands[batches[shadowBatch].firstShadowCommand + i].instanceCount, 1u);
+        }
+    }
+}
@@ -0,0 +1,13 @@
+#version 150
+
+// Depth pre-pass, gl_Position has to be computed exactly as in vshader.glsl for the GL_EQUAL test
+in vec3 v_coord;
+invariant gl_Position;
+
+uniform mat4 m, v;
+uniform mat4 proj;
+
+void main() {
+    vec4 pos = v * m * vec4(v_coord, 1.0);
+    gl_Position = proj * pos;
+}
@@ -1,28 +1,34 @@
 #version 150
 
+// Variants are selected with DAY, NORMAL_MAP, SHADOWS and FOG, see Renderer.hpp
+#ifdef SHADOWS
 in vec4 shadowCoord;
+#endif
 in vec3 position;
 in vec3 normal;
 in vec2 texcoord;
+#ifdef NORMAL_MAP
 in mat3 localSurface2World;
+#endif
 
 out vec4 out_color;
 
+#ifdef NORMAL_MAP
 uniform sampler2D normalMap;
+#endif
 uniform sampler2D modelTexture;
+#ifdef SHADOWS
 uniform sampler2DShadow shadowMap;
+#endif
 
 uniform mat4 v;
 uniform mat3 normalMatrix;
-uniform bool bumpMapFlag;
 
 in vec3 sunDir;
 uniform vec3 sunAmbient;
 uniform vec3 sunDiffuse;
 uniform vec3 sun_position;
 
-uniform bool isDay;
-
 uniform int numLights;
 struct LightSource {
     vec3 direction;
@@ -42,16 +48,20 @@ struct Material {
 };
 uniform Material material;
 
+#ifdef SHADOWS
 vec2 poissonDisk[4] = vec2[] ( 
     vec2(-0.94201624, -0.39906216), 
     vec2(0.94558609, -0.76890725), 
     vec2(-0.094184101, -0.92938870), 
     vec2(0.34495938, 0.29387760)
 );
+#endif
 
+#ifdef FOG
 uniform float renderDistance;
 uniform vec4 fogColor;
 float fogFade = 10.0;
+#endif
 
 vec3 minAmbient = vec3(0.2, 0.2, 0.2);
 
@@ -81,16 +91,16 @@ vec3 computeDiffuse(vec4 lightVector, LightSource light) {
     float cosTheta = 0.0;
 
     // Bump map
-    if (bumpMapFlag) {
-        vec4 encodedNormal = texture(normalMap, texcoord);
-        vec3 localCoords = 2.0 * encodedNormal.rgb - vec3(1.0);
-        vec3 normalDirection = normalize(localSurface2World * localCoords);
+#ifdef NORMAL_MAP
+    // Normal maps only keep X and Y, see AssetManager::loadNormalMap
+    vec2 encodedNormal = 2.0 * texture(normalMap, texcoord).rg - vec2(1.0);
+    vec3 localCoords = vec3(encodedNormal, sqrt(max(0.0, 1.0 - dot(encodedNormal, encodedNormal))));
+    vec3 normalDirection = normalize(localSurface2World * localCoords);
 
-        cosTheta = max(0.0, dot(normalDirection, lightDir));
-    } 
-    else {
-        cosTheta = clamp(dot(normal, lightDir), 0.0, 1.0);
-    }
+    cosTheta = max(0.0, dot(normalDirection, lightDir));
+#else
+    cosTheta = clamp(dot(normal, lightDir), 0.0, 1.0);
+#endif
 
     vec3 diffuse = light.diffuse * material.diffuse * pow(cosTheta, 3.0) * fadeFactor;
     return diffuse / (1.0 + 0.1 * distance * distance);
@@ -100,7 +110,8 @@ vec3 computeDiffuse(vec4 lightVector, LightSource light) {
 void main(void) {
     vec4 color;
     // Day lighting
-    if (isDay) { 
+#ifdef DAY
+    {
         LightSource sunLightSource;
         sunLightSource.direction = vec3(0, 0, 0);
         sunLightSource.maxAngle = 0.0;
@@ -110,19 +121,22 @@ void main(void) {
         vec4 diffuse = vec4(computeDiffuse(vec4(sunDir, 0.0), sunLightSource), 1.0);
 
         // Shadows
+        float visibility = 1.0;
+#ifdef SHADOWS
         float bias = 0.005;
         bias = clamp(bias, 0, 0.01);
-        float visibility = 1.0;
         for (int i = 0; i < 4; ++i) {
             visibility -= 0.2 * (1.0 - texture(shadowMap, vec3(shadowCoord.xy + poissonDisk[i] / 8000.0,
                 (shadowCoord.z - bias) / shadowCoord.w)));
          }
+#endif
 
         color = visibility * diffuse * vec4(sunDiffuse, 1.0);
         color.a = 1.0;
     }
     // Night lighting
-    else {
+#else
+    {
         vec3 totalLight = vec3(0.0, 0.0, 0.0);
         for (int i = 0; i < numLights; ++i) {
             totalLight += computeDiffuse(vec4(lightPositions[i], 1.0), lampLight);
@@ -131,13 +145,21 @@ void main(void) {
         color = vec4(totalLight, 1.0);
         color.a = 1.0;
     }
+#endif
 
     vec3 ambientLevel = max(sunAmbient, minAmbient);
     color += vec4(material.ambient * ambientLevel, 1.0);
 
     vec4 texcolor = texture(modelTexture, texcoord);
 
+#ifdef FOG
     float fogStart = renderDistance - fogFade;
     float fogFactor = min(max(length(position) - fogStart, 0) / (1.0 + fogFade), 1);
     out_color = (1 - fogFactor) * texcolor * color + fogFactor * fogColor; 
+#else
+    out_color = texcolor * color;
+#endif
+
+    // Blending is only on for transparent shapes, which are sorted and drawn last
+    out_color.a = texcolor.a * material.opacity;
 }
@@ -0,0 +1,187 @@
+#version 150
+
+// Lights the impostor's views like fshader.glsl lights the model. Variants are selected with DAY,
+// SHADOWS and FOG, see Renderer.hpp.
+#ifdef SHADOWS
+in vec4 shadowCoord;
+flat in vec4 shadowOffset;
+#endif
+in vec3 position;
+flat in vec3 viewOffset;
+flat in mat3 normalMatrix;
+flat in float layer;
+
+flat in ivec2 frame0;
+flat in ivec2 frame1;
+flat in ivec2 frame2;
+flat in vec3 weights;
+in vec2 frameCoord0;
+in vec2 frameCoord1;
+in vec2 frameCoord2;
+
+out vec4 out_color;
+
+// The views' colour and coverage, and their model space normal and depth
+uniform sampler2DArray modelTexture;
+uniform sampler2DArray normalMap;
+#ifdef SHADOWS
+uniform sampler2DShadow shadowMap;
+#endif
+
+// Must match IMPOSTOR_FRAMES and IMPOSTOR_FRAME_SIZE in ImpostorAtlas.hpp
+const float frames = 8.0;
+const float frameSize = 64.0;
+
+uniform mat4 proj;
+
+uniform vec3 sunPos;
+uniform vec3 sunAmbient;
+uniform vec3 sunDiffuse;
+
+uniform int numLights;
+struct LightSource {
+    vec3 direction;
+    float maxAngle;
+    vec3 ambient;
+    vec3 diffuse;
+};
+uniform LightSource lampLight;
+uniform vec3 lightPositions[30];
+
+struct Material {
+    vec3 ambient;
+    vec3 diffuse;
+    vec3 specular;
+    float shine;
+    float opacity;
+};
+uniform Material material;
+
+#ifdef SHADOWS
+vec2 poissonDisk[4] = vec2[] (
+    vec2(-0.94201624, -0.39906216),
+    vec2(0.94558609, -0.76890725),
+    vec2(-0.094184101, -0.92938870),
+    vec2(0.34495938, 0.29387760)
+);
+#endif
+
+#ifdef FOG
+uniform float renderDistance;
+uniform vec4 fogColor;
+float fogFade = 10.0;
+#endif
+
+vec3 minAmbient = vec3(0.2, 0.2, 0.2);
+
+// The surface's view space position and normal, set from the views before lighting
+vec3 surface;
+vec3 normal;
+
+vec3 computeDiffuse(vec4 lightVector, LightSource light) {
+    float distance;
+    vec3 lightDir;
+    if (lightVector.w > 0.0) {
+        vec3 lightToPosition = surface - vec3(lightVector);
+        distance = length(lightToPosition);
+        lightDir = lightToPosition / distance;
+    }
+    else {
+        distance = 0.0;
+        lightDir = normalize(vec3(lightVector));
+    }
+
+    float fadeFactor = 1.0;
+    if (lightVector.w > 0.0) {
+        float theta = acos(dot(lightDir, light.direction));
+        if (theta > light.maxAngle) {
+            return vec3(0, 0, 0);
+        }
+        fadeFactor = 1.0 - pow(theta / light.maxAngle, 5);
+    }
+
+    float cosTheta = clamp(dot(normal, lightDir), 0.0, 1.0);
+    vec3 diffuse = light.diffuse * material.diffuse * pow(cosTheta, 3.0) * fadeFactor;
+    return diffuse / (1.0 + 0.1 * distance * distance);
+}
+
+// Samples a view, staying half a texel inside it so its neighbours don't bleed in
+vec4 sampleView(sampler2DArray views, ivec2 frame, vec2 frameCoord) {
+    vec2 inside = clamp(frameCoord, 0.5 / frameSize, 1.0 - 0.5 / frameSize);
+    return texture(views, vec3((vec2(frame) + inside) / frames, layer));
+}
+
+void main(void) {
+    // Both arrays are multiplied by the coverage, so blending and dividing by it weighs each view
+    // by how much of the model it saw
+    vec4 colour = weights.x * sampleView(modelTexture, frame0, frameCoord0) +
+        weights.y * sampleView(modelTexture, frame1, frameCoord1) +
+        weights.z * sampleView(modelTexture, frame2, frameCoord2);
+    if (colour.a < 0.5) {
+        discard;
+    }
+    vec4 normalDepth = (weights.x * sampleView(normalMap, frame0, frameCoord0) +
+        weights.y * sampleView(normalMap, frame1, frameCoord1) +
+        weights.z * sampleView(normalMap, frame2, frameCoord2)) / colour.a;
+    normal = normalize(normalMatrix * (normalDepth.xyz * 2.0 - 1.0));
+
+    // The views' depth moves the point off the quad, towards the camera
+    float depth = normalDepth.w * 2.0 - 1.0;
+    surface = position + viewOffset * depth;
+    vec4 clip = proj * vec4(surface, 1.0);
+    gl_FragDepth = clip.z / clip.w * 0.5 + 0.5;
+
+    vec4 color;
+    // Day lighting
+#ifdef DAY
+    {
+        LightSource sunLightSource;
+        sunLightSource.direction = vec3(0, 0, 0);
+        sunLightSource.maxAngle = 0.0;
+        sunLightSource.ambient = sunAmbient;
+        sunLightSource.diffuse = sunDiffuse;
+
+        vec3 sunDir = -normalize(sunPos - surface);
+        vec4 diffuse = vec4(computeDiffuse(vec4(sunDir, 0.0), sunLightSource), 1.0);
+
+        // Shadows
+        float visibility = 1.0;
+#ifdef SHADOWS
+        vec4 surfaceShadowCoord = shadowCoord + shadowOffset * depth;
+        float bias = 0.005;
+        for (int i = 0; i < 4; ++i) {
+            visibility -= 0.2 * (1.0 - texture(shadowMap, vec3(surfaceShadowCoord.xy + poissonDisk[i] / 8000.0,
+                (surfaceShadowCoord.z - bias) / surfaceShadowCoord.w)));
+        }
+#endif
+
+        color = visibility * diffuse * vec4(sunDiffuse, 1.0);
+        color.a = 1.0;
+    }
+    // Night lighting
+#else
+    {
+        vec3 totalLight = vec3(0.0, 0.0, 0.0);
+        for (int i = 0; i < numLights; ++i) {
+            totalLight += computeDiffuse(vec4(lightPositions[i], 1.0), lampLight);
+        }
+
+        color = vec4(totalLight, 1.0);
+        color.a = 1.0;
+    }
+#endif
+
+    vec3 ambientLevel = max(sunAmbient, minAmbient);
+    color += vec4(material.ambient * ambientLevel, 1.0);
+
+    vec4 texcolor = vec4(colour.rgb / colour.a, 1.0);
+
+#ifdef FOG
+    float fogStart = renderDistance - fogFade;
+    float fogFactor = min(max(length(surface) - fogStart, 0) / (1.0 + fogFade), 1);
+    out_color = (1 - fogFactor) * texcolor * color + fogFactor * fogColor;
+#else
+    out_color = texcolor * color;
+#endif
+    out_color.a = 1.0;
+}
@@ -0,0 +1,115 @@
+#version 150
+
+// Far instances as camera facing quads over their bounding spheres, textured with the three views
+// of their ImpostorAtlas nearest the direction to the camera. Variants are selected with DAY,
+// SHADOWS and FOG, see Renderer.hpp.
+
+// A corner of the quad, in the camera's right and up
+in vec2 v_coord;
+// Transforms a unit sphere onto the instance's bounding sphere
+in mat4 m_instance;
+// The instance's layer of the atlas, at the texture coordinate's location as there are no vertices
+in float v_texcoord;
+
+// Must match IMPOSTOR_FRAMES in ImpostorAtlas.hpp
+const int frames = 8;
+
+#ifdef SHADOWS
+out vec4 shadowCoord;
+flat out vec4 shadowOffset;
+#endif
+out vec3 position;
+// The view space offset of a unit of depth towards the camera
+flat out vec3 viewOffset;
+flat out mat3 normalMatrix;
+flat out float layer;
+
+// The three views blended, their weights and where the ray through the quad's point hits each
+flat out ivec2 frame0;
+flat out ivec2 frame1;
+flat out ivec2 frame2;
+flat out vec3 weights;
+out vec2 frameCoord0;
+out vec2 frameCoord1;
+out vec2 frameCoord2;
+
+uniform mat4 v;
+uniform mat4 proj;
+uniform mat4 depthBiasVP;
+
+// Must match frameDirection in ImpostorAtlas.cpp
+vec3 frameDirection(ivec2 frame) {
+    vec2 grid = vec2(frame) / float(frames - 1) * 2.0 - 1.0;
+    float a = (grid.x + grid.y) / 2.0;
+    float b = (grid.x - grid.y) / 2.0;
+    return normalize(vec3(a, 1.0 - abs(a) - abs(b), b));
+}
+
+// Must match frameBasis in ImpostorAtlas.cpp
+void frameBasis(vec3 direction, out vec3 right, out vec3 up) {
+    right = abs(direction.y) > 0.999 ? vec3(1, 0, 0) : normalize(cross(vec3(0, 1, 0), direction));
+    up = cross(direction, right);
+}
+
+// Where a ray from the camera through a point of the quad crosses a view's plane, in the view's
+// texture coordinates
+vec2 frameCoord(ivec2 frame, vec3 camera, vec3 corner) {
+    vec3 direction = frameDirection(frame);
+    vec3 right, up;
+    frameBasis(direction, right, up);
+    vec3 ray = corner - camera;
+    vec3 hit = camera - ray * dot(camera, direction) / dot(ray, direction);
+    return vec2(dot(hit, right), dot(hit, up)) * 0.5 + 0.5;
+}
+
+void main() {
+    mat4 m = m_instance;
+    mat4 mv = v * m;
+    layer = v_texcoord;
+
+    // Everything is worked out around the unit sphere, where the views were taken
+    vec3 camera = vec3(inverse(mv) * vec4(0, 0, 0, 1));
+    float distance = max(length(camera), 1.001);
+    vec3 toCamera = camera / length(camera);
+
+    // The grid cell of the direction, from below the ground the side views are used
+    vec3 direction = normalize(vec3(toCamera.x, max(toCamera.y, 0.0), toCamera.z) + vec3(0, 0.0001, 0));
+    float s = abs(direction.x) + abs(direction.y) + abs(direction.z);
+    vec2 octahedron = vec2(direction.x + direction.z, direction.x - direction.z) / s;
+    vec2 grid = (octahedron * 0.5 + 0.5) * float(frames - 1);
+    vec2 cell = min(floor(grid), vec2(frames - 2));
+    vec2 f = grid - cell;
+    ivec2 base = ivec2(cell);
+    if (f.x + f.y < 1.0) {
+        frame0 = base;
+        frame1 = base + ivec2(1, 0);
+        frame2 = base + ivec2(0, 1);
+        weights = vec3(1.0 - f.x - f.y, f.x, f.y);
+    }
+    else {
+        frame0 = base + ivec2(1, 1);
+        frame1 = base + ivec2(0, 1);
+        frame2 = base + ivec2(1, 0);
+        weights = vec3(f.x + f.y - 1.0, 1.0 - f.x, 1.0 - f.y);
+    }
+
+    // The quad through the centre covering the sphere's outline
+    vec3 right, up;
+    frameBasis(toCamera, right, up);
+    vec3 corner = (right * v_coord.x + up * v_coord.y) * distance / sqrt(distance * distance - 1.0);
+
+    frameCoord0 = frameCoord(frame0, camera, corner);
+    frameCoord1 = frameCoord(frame1, camera, corner);
+    frameCoord2 = frameCoord(frame2, camera, corner);
+
+    vec4 pos = mv * vec4(corner, 1.0);
+    gl_Position = proj * pos;
+    position = vec3(pos);
+    viewOffset = mat3(mv) * toCamera;
+    normalMatrix = transpose(inverse(mat3(mv)));
+
+#ifdef SHADOWS
+    shadowCoord = depthBiasVP * m * vec4(corner, 1.0);
+    shadowOffset = depthBiasVP * m * vec4(toCamera, 0.0);
+#endif
+}
@@ -0,0 +1,18 @@
+#version 150
+
+in vec3 normal;
+in vec2 texcoord;
+in float depth;
+
+out vec4 out_color;
+
+uniform sampler2D modelTexture;
+
+void main() {
+    // The alpha is the coverage in the colour pass, the texels the model misses are cleared to 0
+#ifdef NORMAL_DEPTH
+    out_color = vec4(normalize(normal) * 0.5 + 0.5, depth * 0.5 + 0.5);
+#else
+    out_color = vec4(texture(modelTexture, texcoord).rgb, 1.0);
+#endif
+}
@@ -0,0 +1,25 @@
+#version 150
+
+// Renders a model into one view of its impostor, see ImpostorAtlas. NORMAL_DEPTH selects the
+// normal and depth pass instead of the colour pass.
+in vec3 v_coord;
+in vec3 v_normal;
+in vec2 v_texcoord;
+
+out vec3 normal;
+out vec2 texcoord;
+out float depth;
+
+// The view's orthographic projection of the model's bounding sphere
+uniform mat4 viewProj;
+// The direction from the model to the view, and the model's bounding sphere
+uniform vec3 viewDirection;
+uniform vec3 center;
+uniform float radius;
+
+void main() {
+    gl_Position = viewProj * vec4(v_coord, 1.0);
+    normal = v_normal;
+    texcoord = v_texcoord;
+    depth = dot(v_coord - center, viewDirection) / radius;
+}
@@ -1,8 +1,19 @@
 #version 150
 
 in vec3 v_position;
+
+#ifdef INSTANCED
+// The model's transformation comes from the GPU culler's instances
+in mat4 m_instance;
+uniform mat4 depthVP;
+#else
 uniform mat4 depthMVP;
+#endif
 
 void main() {
+#ifdef INSTANCED
+	gl_Position = depthVP * m_instance * vec4(v_position, 1);
+#else
 	gl_Position = depthMVP * vec4(v_position, 1);
+#endif
 }
@@ -5,31 +5,55 @@ in vec3 v_normal;
 in vec2 v_texcoord;
 in vec3 v_tangent;
 
+// Must match depth.v.glsl, so the depth pre-pass writes exactly the depths tested here
+invariant gl_Position;
+
+// Variants are selected with DAY, NORMAL_MAP, SHADOWS, FOG and INSTANCED, see Renderer.hpp
+#ifdef SHADOWS
 out vec4 shadowCoord;
+#endif
 out vec3 normal;
 out vec3 sunDir;
 out vec2 texcoord;
 out vec3 position;
+#ifdef NORMAL_MAP
 out mat3 localSurface2World;
+#endif
 
-uniform mat4 m, v;
-uniform mat4 proj;
+#ifdef INSTANCED
+// The model's transformation comes from the GPU culler's instances
+in mat4 m_instance;
+uniform mat4 depthBiasVP;
+#else
+uniform mat4 m;
 uniform mat4 depthBiasMVP;
 uniform mat3 normalMatrix;
+#endif
+uniform mat4 v;
+uniform mat4 proj;
 uniform vec3 sunPos;
 
 void main() {
+#ifdef INSTANCED
+    mat4 m = m_instance;
+    mat4 depthBiasMVP = depthBiasVP * m;
+    mat3 normalMatrix = transpose(inverse(mat3(v * m)));
+#endif
     vec4 pos = v * m * vec4(v_coord, 1.0);
     gl_Position = proj * pos;
     position = vec3(pos);
 
+#ifdef SHADOWS
     shadowCoord = depthBiasMVP * vec4(v_coord, 1.0);
+#endif
     normal = normalize(normalMatrix * v_normal);
     sunDir = -normalize(sunPos - vec3(pos));
     texcoord = v_texcoord;
 
+#ifdef NORMAL_MAP
     // mapping from local surface coordinates to world coordinates
   	localSurface2World[0] = normalize(vec3(m * vec4(v_tangent, 0.0)));
   	localSurface2World[2] = normalize(normalMatrix * v_normal);
   	localSurface2World[1] = normalize(cross(localSurface2World[2], localSurface2World[0]));
+#endif
 }